@@ -0,0 +1,74 @@
+#ifndef CACHESTATS_H
+#define CACHESTATS_H
+
+#include <stdint.h>
+#include "counters.h"
+
+/* Last slot of the histogram: chains of this length or longer. */
+#define CACHE_PROBES_HISTOGRAM_SIZE 16
+
+typedef struct {
+  uint64_t hits;
+  uint64_t misses;
+
+  /* Lookups which found the entry, but expired (also counted as misses). */
+  uint64_t expired;
+
+  uint64_t inserts;
+  uint64_t updates;
+
+  /* Live entries removed to make room for new entries. */
+  uint64_t evictions;
+
+  /* Entries released (expired or evicted). */
+  uint64_t frees;
+
+  uint64_t entries;
+  uint64_t bytes;
+
+  /* Number of entries visited per lookup / insert. */
+  uint64_t probes[CACHE_PROBES_HISTOGRAM_SIZE];
+} cache_stats_t;
+
+/* The counters are updated with the helpers of counters.h (relaxed atomic
+ * stores), so that another thread can take a snapshot of the statistics
+ * of a cache without stopping its owner.
+ */
+static inline void cache_stats_add(uint64_t* counter, uint64_t n)
+{
+  counter_add(counter, n);
+}
+
+static inline void cache_stats_sub(uint64_t* counter, uint64_t n)
+{
+  counter_sub(counter, n);
+}
+
+static inline void cache_stats_inc(uint64_t* counter)
+{
+  counter_inc(counter);
+}
+
+static inline void cache_stats_probes(cache_stats_t* stats, unsigned probes)
+{
+  cache_stats_inc(&stats->probes[(probes < CACHE_PROBES_HISTOGRAM_SIZE) ?
+                                 probes :
+                                 CACHE_PROBES_HISTOGRAM_SIZE - 1]);
+}
+
+static inline void cache_stats_snapshot(const cache_stats_t* stats,
+                                        cache_stats_t* snapshot)
+{
+  counters_snapshot(stats, snapshot, sizeof(cache_stats_t));
+}
+
+/* Adds the counters of 'stats' to 'total' (e.g. to aggregate the snapshots
+ * of several threads).
+ */
+static inline void cache_stats_merge(cache_stats_t* total,
+                                     const cache_stats_t* stats)
+{
+  counters_merge(total, stats, sizeof(cache_stats_t));
+}
+
+#endif /* CACHESTATS_H */
@@ -0,0 +1,61 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Statistics counters (uint64_t).
+ * The counters are only modified by the thread owning them (or holding the
+ * lock of their owner), they are written with relaxed atomic stores (plain
+ * stores on the usual architectures) so that another thread can take a
+ * snapshot without stopping the owner.
+ */
+
+static inline void counter_add(uint64_t* counter, uint64_t n)
+{
+  __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+static inline void counter_sub(uint64_t* counter, uint64_t n)
+{
+  __atomic_store_n(counter, *counter - n, __ATOMIC_RELAXED);
+}
+
+static inline void counter_inc(uint64_t* counter)
+{
+  counter_add(counter, 1);
+}
+
+/* Copies the counters of 'counters' (a structure of 'size' bytes made only
+ * of uint64_t) to 'snapshot' with relaxed atomic loads.
+ */
+static inline void counters_snapshot(const void* counters,
+                                     void* snapshot,
+                                     size_t size)
+{
+  const uint64_t* src = (const uint64_t*) counters;
+  uint64_t* dest = (uint64_t*) snapshot;
+  size_t i;
+
+  for (i = 0; i < size / sizeof(uint64_t); i++) {
+    dest[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+  }
+}
+
+/* Adds the counters of 'counters' to 'total' (e.g. to aggregate the
+ * snapshots of several threads).
+ */
+static inline void counters_merge(void* total,
+                                  const void* counters,
+                                  size_t size)
+{
+  const uint64_t* src = (const uint64_t*) counters;
+  uint64_t* dest = (uint64_t*) total;
+  size_t i;
+
+  for (i = 0; i < size / sizeof(uint64_t); i++) {
+    dest[i] += src[i];
+  }
+}
+
+#endif /* COUNTERS_H */
@@ -0,0 +1,189 @@
+#include <stdlib.h>
+#include <string.h>
+#include "delegation.h"
+#include "hash.h"
+
+static const uint32_t initval = 0x5eed5eed;
+
+static delegation_t* find_delegation(const delegations_t* delegations,
+                                     const char* zone,
+                                     size_t zonelen);
+
+int delegations_create(delegations_t* delegations, unsigned size)
+{
+  unsigned i;
+
+  if (size == 0) {
+    return -1;
+  }
+
+  memset(delegations, 0, sizeof(delegations_t));
+
+  delegations->size = size;
+  delegations->nbuckets = size;
+
+  if (((delegations->entries = (delegation_t*)
+                               malloc(size * sizeof(delegation_t))) != NULL) &&
+      ((delegations->buckets = (node_t*)
+                               malloc(delegations->nbuckets *
+                                      sizeof(node_t))) != NULL)) {
+    for (i = 0; i < delegations->nbuckets; i++) {
+      delegations->buckets[i].prev = &delegations->buckets[i];
+      delegations->buckets[i].next = &delegations->buckets[i];
+    }
+
+    return 0;
+  }
+
+  delegations_destroy(delegations);
+
+  return -1;
+}
+
+void delegations_destroy(delegations_t* delegations)
+{
+  if (delegations->buckets) {
+    free(delegations->buckets);
+    delegations->buckets = NULL;
+  }
+
+  if (delegations->entries) {
+    free(delegations->entries);
+    delegations->entries = NULL;
+  }
+}
+
+int delegations_add_root(delegations_t* delegations,
+                         const struct sockaddr* addr,
+                         socklen_t addrlen)
+{
+  delegation_t* root;
+
+  root = &delegations->root;
+
+  if ((root->naddrs < DELEGATION_MAX_ADDRESSES) &&
+      (((addr->sa_family == AF_INET) &&
+        (addrlen >= sizeof(struct sockaddr_in))) ||
+       ((addr->sa_family == AF_INET6) &&
+        (addrlen >= sizeof(struct sockaddr_in6))))) {
+    memcpy(&root->addrs[root->naddrs],
+           addr,
+           delegation_addrlen((const delegation_address_t*) addr));
+
+    root->naddrs++;
+
+    return 0;
+  }
+
+  return -1;
+}
+
+int delegations_add(delegations_t* delegations,
+                    const char* zone,
+                    size_t zonelen,
+                    const delegation_address_t* addrs,
+                    unsigned naddrs,
+                    time_t expiration_time)
+{
+  delegation_t* delegation;
+  node_t* header;
+
+  if ((zonelen == 0) ||
+      (zonelen > HOSTNAME_MAX_LEN) ||
+      (naddrs == 0) ||
+      (naddrs > DELEGATION_MAX_ADDRESSES)) {
+    return -1;
+  }
+
+  /* If the zone is not in the cache yet, take the next entry (the oldest
+   * one when the cache is full).
+   */
+  if ((delegation = find_delegation(delegations, zone, zonelen)) == NULL) {
+    delegation = &delegations->entries[delegations->next];
+
+    if (delegations->used == delegations->size) {
+      node_unlink(&delegation->node);
+    } else {
+      delegations->used++;
+    }
+
+    delegations->next = (delegations->next + 1) % delegations->size;
+
+    memcpy(delegation->zone, zone, zonelen);
+    delegation->zone[zonelen] = 0;
+    delegation->zonelen = zonelen;
+
+    header = &delegations->buckets[hash(zone,
+                                        zonelen,
+                                        initval,
+                                        delegations->nbuckets)];
+
+    delegation->node.next = header->next;
+    delegation->node.prev = header;
+
+    header->next->prev = &delegation->node;
+    header->next = &delegation->node;
+  }
+
+  memcpy(delegation->addrs, addrs, naddrs * sizeof(delegation_address_t));
+  delegation->naddrs = naddrs;
+
+  delegation->expiration_time = expiration_time;
+
+  return 0;
+}
+
+const delegation_t* delegations_find(const delegations_t* delegations,
+                                     const char* name,
+                                     size_t namelen,
+                                     time_t now)
+{
+  const delegation_t* delegation;
+  const char* end;
+
+  end = name + namelen;
+
+  /* Try with the name and with each of its parents. */
+  while (name < end) {
+    if (((delegation = find_delegation(delegations,
+                                       name,
+                                       end - name)) != NULL) &&
+        (delegation->expiration_time > now)) {
+      return delegation;
+    }
+
+    if ((name = (const char*) memchr(name, '.', end - name)) == NULL) {
+      break;
+    }
+
+    name++;
+  }
+
+  return &delegations->root;
+}
+
+delegation_t* find_delegation(const delegations_t* delegations,
+                              const char* zone,
+                              size_t zonelen)
+{
+  const node_t* header;
+  delegation_t* delegation;
+
+  header = &delegations->buckets[hash(zone,
+                                      zonelen,
+                                      initval,
+                                      delegations->nbuckets)];
+
+  delegation = (delegation_t*) header->next;
+
+  while (&delegation->node != header) {
+    if ((delegation->zonelen == zonelen) &&
+        (memcmp(delegation->zone, zone, zonelen) == 0)) {
+      return delegation;
+    }
+
+    delegation = (delegation_t*) delegation->node.next;
+  }
+
+  return NULL;
+}
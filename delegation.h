@@ -0,0 +1,92 @@
+#ifndef DELEGATION_H
+#define DELEGATION_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "dns.h"
+#include "node.h"
+
+/* Cache of delegations used by the iterative resolution: the addresses of
+ * the nameservers of each zone cut. The closest enclosing cut of a name is
+ * found by looking up its suffixes, from the longest one down to the root,
+ * whose servers (root hints) don't expire.
+ * The entries are preallocated; when the cache is full, the oldest entry is
+ * replaced.
+ */
+
+/* Maximum number of addresses per zone cut. */
+#define DELEGATION_MAX_ADDRESSES 16
+
+/* Maximum time a delegation is cached [s]. */
+#define DELEGATION_MAX_TTL       (24 * 60 * 60)
+
+typedef union {
+  struct sockaddr sa;
+  struct sockaddr_in sin;
+  struct sockaddr_in6 sin6;
+} delegation_address_t;
+
+typedef struct {
+  /* Entries with the same hash (must be the first field). */
+  node_t node;
+
+  /* Zone cut (lowercase, "" for the root). */
+  char zone[HOSTNAME_MAX_LEN + 1];
+  size_t zonelen;
+
+  delegation_address_t addrs[DELEGATION_MAX_ADDRESSES];
+  unsigned naddrs;
+
+  time_t expiration_time;
+} delegation_t;
+
+typedef struct {
+  /* Root servers. */
+  delegation_t root;
+
+  delegation_t* entries;
+  unsigned size;
+
+  /* Number of entries used and next entry to be used (the entries are
+   * reused in order).
+   */
+  unsigned used;
+  unsigned next;
+
+  node_t* buckets;
+  unsigned nbuckets;
+} delegations_t;
+
+int delegations_create(delegations_t* delegations, unsigned size);
+void delegations_destroy(delegations_t* delegations);
+
+/* Adds a root server (up to DELEGATION_MAX_ADDRESSES). */
+int delegations_add_root(delegations_t* delegations,
+                         const struct sockaddr* addr,
+                         socklen_t addrlen);
+
+/* Adds or replaces the delegation of 'zone' (lowercase). */
+int delegations_add(delegations_t* delegations,
+                    const char* zone,
+                    size_t zonelen,
+                    const delegation_address_t* addrs,
+                    unsigned naddrs,
+                    time_t expiration_time);
+
+/* Returns the closest enclosing zone cut of 'name' (lowercase) which has
+ * not expired: the root if there is none.
+ */
+const delegation_t* delegations_find(const delegations_t* delegations,
+                                     const char* name,
+                                     size_t namelen,
+                                     time_t now);
+
+static inline socklen_t delegation_addrlen(const delegation_address_t* addr)
+{
+  return (addr->sa.sa_family == AF_INET) ? sizeof(struct sockaddr_in) :
+                                           sizeof(struct sockaddr_in6);
+}
+
+#endif /* DELEGATION_H */
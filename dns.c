@@ -2,9 +2,29 @@
 #include <string.h>
 #include "dns.h"
 #include "macros.h"
+#include "ctype.h"
+#include "trace.h"
 
 #define MAX_POINTERS 10
 
+/* Maximum number of labels of a name. */
+#define MAX_LABELS   ((HOSTNAME_MAX_LEN + 1) / 2)
+
+/* Maximum offset which can be pointed to. */
+#define MAX_OFFSET   0x3fff
+
+static int process_response(const void* buf,
+                            size_t len,
+                            uint16_t* id,
+                            dns_question_t* questions,
+                            size_t* nquestions,
+                            rr_t* answers,
+                            size_t* nanswers,
+                            rr_t* authorities,
+                            size_t* nauthorities,
+                            rr_t* additionals,
+                            size_t* nadditionals);
+
 static int build_cname(const char* name, size_t namelen, void* buf);
 static const uint8_t* process_questions(const uint8_t* buf,
                                         const uint8_t* end,
@@ -36,6 +56,22 @@ static const uint8_t* parse_domain_name(const uint8_t* buf,
 
 static const uint8_t* skip_domain_name(const uint8_t* buf, const uint8_t* end);
 
+static int write_name(dns_response_t* response,
+                      const char* name,
+                      size_t namelen,
+                      size_t* pos);
+
+static int suffix_equal(const uint8_t* buf,
+                        uint16_t offset,
+                        const char* name,
+                        const size_t* labels,
+                        const size_t* lengths,
+                        unsigned first,
+                        unsigned nlabels);
+
+static void write16(uint8_t* p, uint16_t n);
+static void write32(uint8_t* p, uint32_t n);
+
 int dns_build_request(uint16_t id,
                       dns_qtype_t qtype,
                       dns_qclass_t qclass,
@@ -109,81 +145,407 @@ int dns_process_response(const void* buf,
                          size_t* nanswers,
                          rr_t* authorities,
                          size_t* nauthorities)
+{
+  int ret;
+
+  TRACE2(process_response_entry, buf, len);
+
+  ret = process_response(buf,
+                         len,
+                         id,
+                         questions,
+                         nquestions,
+                         answers,
+                         nanswers,
+                         authorities,
+                         nauthorities,
+                         NULL,
+                         NULL);
+
+  TRACE3(process_response_return,
+         ret,
+         (len >= 4) ? (((const uint8_t*) buf)[3] & 0x0f) : -1,
+         ((ret == 0) && (nanswers)) ? *nanswers : 0);
+
+  return ret;
+}
+
+int dns_process_sections(const void* buf,
+                         size_t len,
+                         rr_t* answers,
+                         size_t* nanswers,
+                         rr_t* authorities,
+                         size_t* nauthorities,
+                         rr_t* additionals,
+                         size_t* nadditionals)
+{
+  return process_response(buf,
+                          len,
+                          NULL,
+                          NULL,
+                          NULL,
+                          answers,
+                          nanswers,
+                          authorities,
+                          nauthorities,
+                          additionals,
+                          nadditionals);
+}
+
+int dns_process_header(const void* buf,
+                       size_t len,
+                       dns_header_t* header,
+                       dns_question_t* question)
 {
   const uint8_t* b;
-  const uint8_t* end;
-  uint16_t qdcount;
-  uint16_t ancount;
-  uint16_t nscount;
-  uint16_t count;
 
-  if ((len >= 12) && (len <= MAX_DNS_MESSAGE_SIZE)) {
+  if ((len >= 12) && (len <= MAX_DNS_TCP_MESSAGE_SIZE)) {
     b = (const uint8_t*) buf;
 
-    if (id) {
-      /* Save ID. */
-      *id = (b[0] << 8) | b[1];
+    header->id = (b[0] << 8) | b[1];
+    header->flags = (b[2] << 8) | b[3];
+    header->qdcount = (b[4] << 8) | b[5];
+    header->ancount = (b[6] << 8) | b[7];
+    header->nscount = (b[8] << 8) | b[9];
+    header->arcount = (b[10] << 8) | b[11];
+
+    if (!question) {
+      return 0;
     }
 
-    /* If it is a response... */
-    if (b[2] & 0x80) {
-      /* If the message was not truncated... */
-      if ((b[2] & 0x02) == 0) {
-        /* If the response code is 0... */
-        if ((b[3] & 0x0f) == 0) {
-          /* Get the number of questions. */
-          qdcount = (b[4] << 8) | b[5];
+    /* Process first question. */
+    if ((header->qdcount > 0) &&
+        (process_questions(b, b + len, b + 12, 1, question, NULL) != NULL)) {
+      return 0;
+    }
+  }
 
-          /* Get the number of answers. */
-          ancount = (b[6] << 8) | b[7];
+  return -1;
+}
 
-          /* Get the number of authorities. */
-          nscount = (b[8] << 8) | b[9];
+int dns_parse_query(const void* buf, size_t len, dns_query_t* query)
+{
+  const uint8_t* b;
+  const uint8_t* p;
+  const uint8_t* name;
+  const uint8_t* end;
+  uint8_t* key;
+  uint32_t h;
+  unsigned count;
+  unsigned i;
+  uint16_t rdlength;
+  uint8_t c;
+  uint8_t l;
 
-          end = b + len;
+  b = (const uint8_t*) buf;
 
-          count = questions ? MIN(qdcount, *nquestions) : 0;
+  if ((len < 12) || (b[2] & (DNS_FLAG_QR >> 8))) {
+    return -1;
+  }
 
-          /* Process questions. */
-          if ((b = process_questions(buf,
-                                     end,
-                                     b + 12,
-                                     count,
-                                     questions,
-                                     nquestions)) != NULL) {
-            /* Skip not processed questions. */
-            if ((b = skip_questions(b, end, qdcount - count)) != NULL) {
-              count = answers ? MIN(ancount, *nanswers) : 0;
+  query->id = (b[0] << 8) | b[1];
+  query->flags = (b[2] << 8) | b[3];
 
-              /* Process answers. */
-              if ((b = process_resource_records(buf,
-                                                end,
-                                                b,
-                                                count,
-                                                answers,
-                                                nanswers)) != NULL) {
-                /* Skip not processed answers. */
-                if ((b = skip_resource_records(b,
-                                               end,
-                                               ancount - count)) != NULL) {
-                  count = authorities ? MIN(nscount, *nauthorities) : 0;
+  if (DNS_OPCODE(query->flags) != 0) {
+    return DNS_RCODE_NOTIMP;
+  }
 
-                  /* Process authorities. */
-                  if ((b = process_resource_records(buf,
-                                                    end,
-                                                    b,
-                                                    count,
-                                                    authorities,
-                                                    nauthorities)) != NULL) {
-                    return 0;
-                  }
-                }
-              }
-            }
+  /* A single question, no answers nor authority records. */
+  if ((b[4] != 0) || (b[5] != 1) ||
+      (b[6] != 0) || (b[7] != 0) ||
+      (b[8] != 0) || (b[9] != 0)) {
+    return DNS_RCODE_FORMERR;
+  }
+
+  /* Name: lowercase copy and hash in the same pass (no compression). */
+  end = b + len;
+  p = b + 12;
+  key = query->key;
+  h = 2166136261u;
+
+  do {
+    if ((p >= end) ||
+        ((l = *p) > DNS_LABEL_MAX_LEN) ||
+        (p + 1 + l > end) ||
+        ((key - query->key) + 1 + l > HOSTNAME_MAX_LEN)) {
+      return DNS_RCODE_FORMERR;
+    }
+
+    *key++ = l;
+    h = (h ^ l) * 16777619u;
+
+    for (i = 1; i <= l; i++) {
+      c = to_lower(p[i]);
+
+      *key++ = c;
+      h = (h ^ c) * 16777619u;
+    }
+
+    p += 1 + l;
+  } while (l != 0);
+
+  /* Type and class. */
+  if (p + 4 > end) {
+    return DNS_RCODE_FORMERR;
+  }
+
+  for (i = 0; i < 4; i++) {
+    *key++ = p[i];
+    h = (h ^ p[i]) * 16777619u;
+  }
+
+  query->qtype = (p[0] << 8) | p[1];
+  query->qclass = (p[2] << 8) | p[3];
+
+  query->keylen = key - query->key;
+  query->hash = h;
+
+  p += 4;
+
+  /* Additional records: OPT (at most one). */
+  query->opt = 0;
+  query->udp_size = 0;
+  query->edns_flags = 0;
+
+  count = (b[10] << 8) | b[11];
+
+  for (i = 0; i < count; i++) {
+    name = p;
+
+    if (((p = skip_domain_name(p, end)) == NULL) || (p + 10 > end)) {
+      return DNS_RCODE_FORMERR;
+    }
+
+    rdlength = (p[8] << 8) | p[9];
+
+    if (p + 10 + rdlength > end) {
+      return DNS_RCODE_FORMERR;
+    }
+
+    if (((p[0] << 8) | p[1]) == DNS_QTYPE_OPT) {
+      /* Root name. */
+      if ((query->opt != 0) || (*name != 0)) {
+        return DNS_RCODE_FORMERR;
+      }
+
+      query->opt = name - b;
+      query->udp_size = (p[2] << 8) | p[3];
+      query->edns_flags = (p[6] << 8) | p[7];
+    }
+
+    p += 10 + rdlength;
+  }
+
+  return DNS_RCODE_NOERROR;
+}
+
+int dns_query_name(const dns_query_t* query, char* name, size_t* namelen)
+{
+  /* The root is not a valid name for the resolver. */
+  if ((*namelen = dns_name_to_text(query->key, name)) == 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+size_t dns_name_to_text(const uint8_t* wire, char* name)
+{
+  size_t len;
+
+  len = 0;
+
+  while (*wire != 0) {
+    if (len > 0) {
+      name[len++] = '.';
+    }
+
+    memcpy(name + len, wire + 1, *wire);
+    len += *wire;
+
+    wire += 1 + *wire;
+  }
+
+  name[len] = 0;
+
+  return len;
+}
+
+int dns_response_init(dns_response_t* response,
+                      void* buf,
+                      size_t size,
+                      uint16_t id,
+                      uint16_t flags,
+                      const dns_question_t* question)
+{
+  uint8_t* b;
+  size_t pos;
+
+  if ((size < 12) || (size > MAX_DNS_TCP_MESSAGE_SIZE)) {
+    return -1;
+  }
+
+  response->buf = (uint8_t*) buf;
+  response->size = size;
+  response->len = 12;
+  response->section = DNS_SECTION_ANSWER;
+
+  memset(response->names, 0, sizeof(response->names));
+  response->nnames = 0;
+
+  b = response->buf;
+
+  write16(b, id);
+  write16(b + 2, flags);
+
+  /* QDCOUNT, ANCOUNT, NSCOUNT and ARCOUNT. */
+  memset(b + 4, 0, 8);
+
+  if (question) {
+    pos = 12;
+
+    if ((write_name(response, question->name, question->namelen, &pos) < 0) ||
+        (pos + 4 > size)) {
+      return -1;
+    }
+
+    write16(b + pos, question->qtype);
+    write16(b + pos + 2, question->qclass);
+
+    response->len = pos + 4;
+
+    /* QDCOUNT. */
+    b[5] = 1;
+  }
+
+  return 0;
+}
+
+int dns_response_add(dns_response_t* response,
+                     dns_section_t section,
+                     const rr_t* rr)
+{
+  dns_compression_entry_t names[DNS_COMPRESSION_ENTRIES];
+  unsigned nnames;
+  uint8_t* b;
+  uint8_t* count;
+  size_t pos;
+  size_t rdata;
+
+  if (section < response->section) {
+    return -1;
+  }
+
+  /* The names added by a record which doesn't fit are forgotten. */
+  memcpy(names, response->names, sizeof(names));
+  nnames = response->nnames;
+
+  b = response->buf;
+  pos = response->len;
+
+  /* NAME, TYPE, CLASS, TTL and RDLENGTH. */
+  if ((write_name(response, rr->name, rr->namelen, &pos) == 0) &&
+      (pos + 10 <= response->size)) {
+    write16(b + pos, rr->type);
+    write16(b + pos + 2, rr->class);
+    write32(b + pos + 4, rr->ttl);
+
+    pos += 10;
+    rdata = pos;
+
+    switch (rr->type) {
+      case DNS_QTYPE_A:
+        if (pos + 4 <= response->size) {
+          memcpy(b + pos, &rr->addr4, 4);
+          pos += 4;
+        } else {
+          pos = 0;
+        }
+
+        break;
+      case DNS_QTYPE_AAAA:
+        if (pos + 16 <= response->size) {
+          memcpy(b + pos, &rr->addr6, 16);
+          pos += 16;
+        } else {
+          pos = 0;
+        }
+
+        break;
+      case DNS_QTYPE_CNAME:
+      case DNS_QTYPE_NS:
+      case DNS_QTYPE_PTR:
+        if (write_name(response, rr->cname.name, rr->cname.namelen, &pos) < 0) {
+          pos = 0;
+        }
+
+        break;
+      case DNS_QTYPE_MX:
+        if (pos + 2 <= response->size) {
+          write16(b + pos, rr->mx.preference);
+          pos += 2;
+
+          if (write_name(response,
+                         rr->mx.exchange,
+                         rr->mx.exchangelen,
+                         &pos) < 0) {
+            pos = 0;
           }
+        } else {
+          pos = 0;
         }
-      }
+
+        break;
+      case DNS_QTYPE_SOA:
+        if ((write_name(response,
+                        rr->soa.nameserver,
+                        rr->soa.nameserverlen,
+                        &pos) == 0) &&
+            (write_name(response,
+                        rr->soa.mailbox,
+                        rr->soa.mailboxlen,
+                        &pos) == 0) &&
+            (pos + 20 <= response->size)) {
+          write32(b + pos, rr->soa.serial);
+          write32(b + pos + 4, rr->soa.refresh);
+          write32(b + pos + 8, rr->soa.retry);
+          write32(b + pos + 12, rr->soa.expire);
+          write32(b + pos + 16, rr->soa.minimum_ttl);
+
+          pos += 20;
+        } else {
+          pos = 0;
+        }
+
+        break;
+      default:
+        /* Unsupported type. */
+        memcpy(response->names, names, sizeof(names));
+        response->nnames = nnames;
+
+        return -1;
     }
+
+    if (pos != 0) {
+      /* RDLENGTH. */
+      write16(b + rdata - 2, pos - rdata);
+
+      /* ANCOUNT, NSCOUNT or ARCOUNT. */
+      count = b + 6 + (section * 2);
+      write16(count, ((count[0] << 8) | count[1]) + 1);
+
+      response->len = pos;
+      response->section = section;
+
+      return 0;
+    }
+  }
+
+  memcpy(response->names, names, sizeof(names));
+  response->nnames = nnames;
+
+  if (section != DNS_SECTION_ADDITIONAL) {
+    b[2] |= (DNS_FLAG_TC >> 8);
   }
 
   return -1;
@@ -257,6 +619,119 @@ const char* dns_qclass_to_string(dns_qclass_t qclass)
   }
 }
 
+int process_response(const void* buf,
+                     size_t len,
+                     uint16_t* id,
+                     dns_question_t* questions,
+                     size_t* nquestions,
+                     rr_t* answers,
+                     size_t* nanswers,
+                     rr_t* authorities,
+                     size_t* nauthorities,
+                     rr_t* additionals,
+                     size_t* nadditionals)
+{
+  const uint8_t* b;
+  const uint8_t* end;
+  uint16_t qdcount;
+  uint16_t ancount;
+  uint16_t nscount;
+  uint16_t arcount;
+  uint16_t count;
+
+  if ((len >= 12) && (len <= MAX_DNS_TCP_MESSAGE_SIZE)) {
+    b = (const uint8_t*) buf;
+
+    if (id) {
+      /* Save ID. */
+      *id = (b[0] << 8) | b[1];
+    }
+
+    /* If it is a response... */
+    if (b[2] & 0x80) {
+      /* If the message was not truncated... */
+      if ((b[2] & 0x02) == 0) {
+        /* If the response code is 0... */
+        if ((b[3] & 0x0f) == 0) {
+          /* Get the number of questions. */
+          qdcount = (b[4] << 8) | b[5];
+
+          /* Get the number of answers. */
+          ancount = (b[6] << 8) | b[7];
+
+          /* Get the number of authorities. */
+          nscount = (b[8] << 8) | b[9];
+
+          /* Get the number of additional records. */
+          arcount = (b[10] << 8) | b[11];
+
+          end = b + len;
+
+          count = questions ? MIN(qdcount, *nquestions) : 0;
+
+          /* Process questions. */
+          if ((b = process_questions(buf,
+                                     end,
+                                     b + 12,
+                                     count,
+                                     questions,
+                                     nquestions)) != NULL) {
+            /* Skip not processed questions. */
+            if ((b = skip_questions(b, end, qdcount - count)) != NULL) {
+              count = answers ? MIN(ancount, *nanswers) : 0;
+
+              /* Process answers. */
+              if ((b = process_resource_records(buf,
+                                                end,
+                                                b,
+                                                count,
+                                                answers,
+                                                nanswers)) != NULL) {
+                /* Skip not processed answers. */
+                if ((b = skip_resource_records(b,
+                                               end,
+                                               ancount - count)) != NULL) {
+                  count = authorities ? MIN(nscount, *nauthorities) : 0;
+
+                  /* Process authorities. */
+                  if ((b = process_resource_records(buf,
+                                                    end,
+                                                    b,
+                                                    count,
+                                                    authorities,
+                                                    nauthorities)) != NULL) {
+                    if (!additionals) {
+                      return 0;
+                    }
+
+                    /* Skip not processed authorities and process
+                     * additional records.
+                     */
+                    if (((b = skip_resource_records(b,
+                                                    end,
+                                                    nscount - count)) !=
+                         NULL) &&
+                        (process_resource_records(buf,
+                                                  end,
+                                                  b,
+                                                  MIN(arcount, *nadditionals),
+                                                  additionals,
+                                                  nadditionals) != NULL)) {
+                      return 0;
+                    }
+                  }
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  return -1;
+}
+
 int build_cname(const char* name, size_t namelen, void* buf)
 {
   const char* end;
@@ -429,6 +904,8 @@ const uint8_t* process_resource_records(const uint8_t* buf,
 
                 break;
               case DNS_QTYPE_CNAME: /* Canonical name. */
+              case DNS_QTYPE_NS: /* Nameserver. */
+              case DNS_QTYPE_PTR: /* Domain name pointer. */
                 if (parse_domain_name(buf,
                                       end,
                                       pos + 10,
@@ -663,3 +1140,207 @@ const uint8_t* skip_domain_name(const uint8_t* buf, const uint8_t* end)
 
   return NULL;
 }
+
+int write_name(dns_response_t* response,
+               const char* name,
+               size_t namelen,
+               size_t* pos)
+{
+  size_t labels[MAX_LABELS];
+  size_t lengths[MAX_LABELS];
+  uint32_t hashes[MAX_LABELS];
+  dns_compression_entry_t* entry;
+  unsigned nlabels;
+  unsigned first;
+  unsigned idx;
+  unsigned i;
+  uint32_t h;
+  size_t start;
+  size_t p;
+  size_t j;
+
+  if (namelen > HOSTNAME_MAX_LEN) {
+    return -1;
+  }
+
+  /* Root. */
+  if (namelen == 0) {
+    if (*pos + 1 > response->size) {
+      return -1;
+    }
+
+    response->buf[(*pos)++] = 0;
+
+    return 0;
+  }
+
+  /* Split the name in labels. */
+  nlabels = 0;
+  start = 0;
+
+  for (j = 0; j <= namelen; j++) {
+    if ((j == namelen) || (name[j] == '.')) {
+      if ((j == start) ||
+          (j - start > DNS_LABEL_MAX_LEN) ||
+          (nlabels == MAX_LABELS)) {
+        return -1;
+      }
+
+      labels[nlabels] = start;
+      lengths[nlabels++] = j - start;
+
+      start = j + 1;
+    }
+  }
+
+  /* Hash of each suffix (FNV-1a of the lowercase labels, from the last
+   * one).
+   */
+  h = 2166136261u;
+
+  for (i = nlabels; i > 0; i--) {
+    h = (h ^ (uint8_t) lengths[i - 1]) * 16777619u;
+
+    for (j = 0; j < lengths[i - 1]; j++) {
+      h = (h ^ to_lower((uint8_t) name[labels[i - 1] + j])) * 16777619u;
+    }
+
+    hashes[i - 1] = h;
+  }
+
+  /* Longest suffix already written. */
+  for (first = 0; first < nlabels; first++) {
+    idx = hashes[first] & (DNS_COMPRESSION_ENTRIES - 1);
+
+    while ((entry = &response->names[idx])->offset != 0) {
+      if ((entry->hash == hashes[first]) &&
+          (suffix_equal(response->buf,
+                        entry->offset,
+                        name,
+                        labels,
+                        lengths,
+                        first,
+                        nlabels))) {
+        break;
+      }
+
+      idx = (idx + 1) & (DNS_COMPRESSION_ENTRIES - 1);
+    }
+
+    if (entry->offset != 0) {
+      break;
+    }
+  }
+
+  /* Labels before the suffix and pointer (or null label). */
+  p = *pos;
+
+  for (i = 0; i < first; i++) {
+    if (p + 1 + lengths[i] > response->size) {
+      return -1;
+    }
+
+    /* Remember the new suffix (while there is room in the table). */
+    if ((p <= MAX_OFFSET) &&
+        (response->nnames < DNS_COMPRESSION_ENTRIES - 1)) {
+      idx = hashes[i] & (DNS_COMPRESSION_ENTRIES - 1);
+
+      while (response->names[idx].offset != 0) {
+        idx = (idx + 1) & (DNS_COMPRESSION_ENTRIES - 1);
+      }
+
+      response->names[idx].hash = hashes[i];
+      response->names[idx].offset = p;
+      response->nnames++;
+    }
+
+    response->buf[p] = (uint8_t) lengths[i];
+    memcpy(response->buf + p + 1, name + labels[i], lengths[i]);
+
+    p += 1 + lengths[i];
+  }
+
+  if (first < nlabels) {
+    if (p + 2 > response->size) {
+      return -1;
+    }
+
+    write16(response->buf + p, 0xc000 | entry->offset);
+    p += 2;
+  } else {
+    if (p + 1 > response->size) {
+      return -1;
+    }
+
+    response->buf[p++] = 0;
+  }
+
+  *pos = p;
+
+  return 0;
+}
+
+int suffix_equal(const uint8_t* buf,
+                 uint16_t offset,
+                 const char* name,
+                 const size_t* labels,
+                 const size_t* lengths,
+                 unsigned first,
+                 unsigned nlabels)
+{
+  const uint8_t* p;
+  unsigned npointers;
+  unsigned i;
+  size_t j;
+
+  p = buf + offset;
+  npointers = 0;
+
+  for (i = first; i < nlabels; i++) {
+    /* The names written by the encoder are well-formed. */
+    while ((*p & 0xc0) == 0xc0) {
+      if (++npointers > MAX_POINTERS) {
+        return 0;
+      }
+
+      p = buf + (((p[0] & 0x3f) << 8) | p[1]);
+    }
+
+    if (*p != lengths[i]) {
+      return 0;
+    }
+
+    for (j = 0; j < lengths[i]; j++) {
+      if (to_lower(p[1 + j]) != to_lower((uint8_t) name[labels[i] + j])) {
+        return 0;
+      }
+    }
+
+    p += 1 + lengths[i];
+  }
+
+  /* The suffix must end there too. */
+  while ((*p & 0xc0) == 0xc0) {
+    if (++npointers > MAX_POINTERS) {
+      return 0;
+    }
+
+    p = buf + (((p[0] & 0x3f) << 8) | p[1]);
+  }
+
+  return (*p == 0);
+}
+
+void write16(uint8_t* p, uint16_t n)
+{
+  p[0] = (n >> 8) & 0xff;
+  p[1] = n & 0xff;
+}
+
+void write32(uint8_t* p, uint32_t n)
+{
+  p[0] = (n >> 24) & 0xff;
+  p[1] = (n >> 16) & 0xff;
+  p[2] = (n >> 8) & 0xff;
+  p[3] = n & 0xff;
+}
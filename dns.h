@@ -8,6 +8,9 @@
 #define DNS_LABEL_MAX_LEN    63
 #define MAX_DNS_MESSAGE_SIZE 512
 
+/* Messages sent over TCP are preceded by their length (2 bytes). */
+#define MAX_DNS_TCP_MESSAGE_SIZE 65535
+
 typedef enum {
   DNS_QTYPE_A     = 1,
   DNS_QTYPE_NS    = 2,
@@ -26,6 +29,7 @@ typedef enum {
   DNS_QTYPE_MX    = 15,
   DNS_QTYPE_TXT   = 16,
   DNS_QTYPE_AAAA  = 28,
+  DNS_QTYPE_OPT   = 41,
   DNS_QTYPE_AXFR  = 252,
   DNS_QTYPE_MAILB = 253,
   DNS_QTYPE_MAILA = 254,
@@ -40,6 +44,35 @@ typedef enum {
   DNS_QCLASS_ANY = 255
 } dns_qclass_t;
 
+typedef enum {
+  DNS_RCODE_NOERROR  = 0,
+  DNS_RCODE_FORMERR  = 1,
+  DNS_RCODE_SERVFAIL = 2,
+  DNS_RCODE_NXDOMAIN = 3,
+  DNS_RCODE_NOTIMP   = 4,
+  DNS_RCODE_REFUSED  = 5
+} dns_rcode_t;
+
+/* Header flags. */
+#define DNS_FLAG_QR          0x8000 /* Response. */
+#define DNS_FLAG_AA          0x0400 /* Authoritative answer. */
+#define DNS_FLAG_TC          0x0200 /* Truncated. */
+#define DNS_FLAG_RD          0x0100 /* Recursion desired. */
+#define DNS_FLAG_RA          0x0080 /* Recursion available. */
+
+#define DNS_OPCODE(flags)    (((flags) >> 11) & 0x0f)
+#define DNS_RCODE(flags)     ((flags) & 0x0f)
+
+typedef struct {
+  uint16_t id;
+  uint16_t flags;
+
+  uint16_t qdcount;
+  uint16_t ancount;
+  uint16_t nscount;
+  uint16_t arcount;
+} dns_header_t;
+
 typedef struct {
   char name[HOSTNAME_MAX_LEN + 1];
   size_t namelen;
@@ -86,7 +119,7 @@ typedef struct {
   union {
     struct in_addr addr4;
     struct in6_addr addr6;
-    cname_rdata_t cname;
+    cname_rdata_t cname; /* CNAME, NS and PTR. */
     mx_rdata_t mx;
     soa_rdata_t soa;
   };
@@ -94,6 +127,60 @@ typedef struct {
   size_t rdlength;
 } rr_t;
 
+/* Maximum length of a question in wire format (name, type and class). */
+#define DNS_MAX_QUESTION_LEN (HOSTNAME_MAX_LEN + 2 + 4)
+
+/* Query parsed by dns_parse_query(). */
+typedef struct {
+  uint16_t id;
+  uint16_t flags;
+
+  /* Question in wire format with the name in lowercase (lookup key) and
+   * its hash (dns_key_hash()).
+   */
+  uint8_t key[DNS_MAX_QUESTION_LEN];
+  size_t keylen;
+  uint32_t hash;
+
+  uint16_t qtype;
+  uint16_t qclass;
+
+  /* Offset of the OPT record (0: none), UDP payload size and flags (DO)
+   * of the client.
+   */
+  size_t opt;
+  uint16_t udp_size;
+  uint16_t edns_flags;
+} dns_query_t;
+
+typedef enum {
+  DNS_SECTION_ANSWER,
+  DNS_SECTION_AUTHORITY,
+  DNS_SECTION_ADDITIONAL
+} dns_section_t;
+
+/* Number of name suffixes remembered for compression. */
+#define DNS_COMPRESSION_ENTRIES 64 /* Power of 2. */
+
+typedef struct {
+  uint32_t hash; /* Of the (lowercase) suffix. */
+  uint16_t offset; /* 0: free. */
+} dns_compression_entry_t;
+
+/* Response being built. */
+typedef struct {
+  uint8_t* buf;
+  size_t size;
+  size_t len;
+
+  /* Current section (the records are added section by section). */
+  dns_section_t section;
+
+  /* Offsets of the names (and of their suffixes) already written. */
+  dns_compression_entry_t names[DNS_COMPRESSION_ENTRIES];
+  unsigned nnames;
+} dns_response_t;
+
 int dns_build_request(uint16_t id,
                       dns_qtype_t qtype,
                       dns_qclass_t qclass,
@@ -112,6 +199,88 @@ int dns_process_response(const void* buf,
                          rr_t* authorities,
                          size_t* nauthorities);
 
+/* Same as dns_process_response(), but it also parses the additional
+ * section (e.g. the addresses of the nameservers of a referral).
+ */
+int dns_process_sections(const void* buf,
+                         size_t len,
+                         rr_t* answers,
+                         size_t* nanswers,
+                         rr_t* authorities,
+                         size_t* nauthorities,
+                         rr_t* additionals,
+                         size_t* nadditionals);
+
+/* Parses the header and (if 'question' is not NULL) the first question of
+ * a DNS message, whatever its flags and response code.
+ * The messages can be up to MAX_DNS_TCP_MESSAGE_SIZE bytes long (also for
+ * dns_process_response()).
+ */
+int dns_process_header(const void* buf,
+                       size_t len,
+                       dns_header_t* header,
+                       dns_question_t* question);
+
+/* Parses a query received by a server in a single pass over the message:
+ * header, single question (the key is built while the name is validated)
+ * and OPT record. Returns -1 if the message is not a query (too short or
+ * QR set), DNS_RCODE_NOERROR if the query is valid, or the response code
+ * to send otherwise (DNS_RCODE_NOTIMP: opcode other than QUERY,
+ * DNS_RCODE_FORMERR: malformed query); 'id' and 'flags' are set in every
+ * case but the first one.
+ */
+int dns_parse_query(const void* buf, size_t len, dns_query_t* query);
+
+/* Hash of a lookup key (FNV-1a). */
+static inline uint32_t dns_key_hash(const uint8_t* key, size_t len)
+{
+  uint32_t h;
+  size_t i;
+
+  h = 2166136261u;
+
+  for (i = 0; i < len; i++) {
+    h = (h ^ key[i]) * 16777619u;
+  }
+
+  return h;
+}
+
+/* Name of the question of a parsed query in text format (lowercase). */
+int dns_query_name(const dns_query_t* query, char* name, size_t* namelen);
+
+/* Converts an uncompressed (and valid) name from wire format to text
+ * format ("" for the root); returns its length.
+ */
+size_t dns_name_to_text(const uint8_t* wire, char* name);
+
+/* Starts a response to 'question' in 'buf' ('size' bytes, at most
+ * MAX_DNS_TCP_MESSAGE_SIZE; names beyond the first 16384 bytes are not
+ * pointed to) with the header flags 'flags'.
+ */
+int dns_response_init(dns_response_t* response,
+                      void* buf,
+                      size_t size,
+                      uint16_t id,
+                      uint16_t flags,
+                      const dns_question_t* question);
+
+/* Adds a resource record (A, AAAA, CNAME, NS and PTR (rdata in 'cname'),
+ * MX or SOA) to 'section', compressing the names against the ones already
+ * written. Fails if the record doesn't fit (the response is left
+ * untouched and, unless 'section' is the additional section, marked as
+ * truncated) or if 'section' precedes the current one.
+ */
+int dns_response_add(dns_response_t* response,
+                     dns_section_t section,
+                     const rr_t* rr);
+
+/* Length of the response. */
+static inline size_t dns_response_length(const dns_response_t* response)
+{
+  return response->len;
+}
+
 const char* dns_qtype_to_string(dns_qtype_t qtype);
 const char* dns_qclass_to_string(dns_qclass_t qclass);
 
@@ -0,0 +1,1708 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include "dns.h"
+#include "dnscache.h"
+#include "shmcache.h"
+#include "hash.h"
+#include "histogram.h"
+#include "random.h"
+#include "macros.h"
+
+/* Microbenchmarks of the response parser, the request builder, the hash
+ * function and the DNS cache.
+ * The inputs (host names and responses) are generated from a fixed seed
+ * (-s), so that two builds can be compared with the same corpus; each
+ * benchmark is run several times (-r) and the fastest run is reported.
+ *
+ * With -W, the cache is measured under a concurrent workload instead: each
+ * thread draws names from a Zipf (or uniform) distribution, optionally
+ * mixed with a scan over names which are never repeated, reads them
+ * (inserting them when they are missing, as the resolver does) or writes
+ * them, with a TTL per name. The time is simulated: the run spans -D
+ * seconds, so that the entries expire.
+ */
+
+#define DEFAULT_ENTRIES    100000
+#define DEFAULT_ITERATIONS 200000
+#define DEFAULT_RUNS       5
+#define DEFAULT_SEED       1
+
+/* Number of responses of each kind. */
+#define CORPUS_SIZE        256
+
+/* Records of the large RRsets. */
+#define RRSET_SIZE         20
+
+#define MAX_RECORDS        32
+
+#define CACHE_TTL          3600 /* [s] */
+
+/* Workload (-W). */
+#define DEFAULT_EXPONENT   0.99
+#define DEFAULT_WRITES     5 /* [%] */
+#define DEFAULT_MIN_TTL    60 /* [s] */
+#define DEFAULT_MAX_TTL    3600 /* [s] */
+#define DEFAULT_OPERATIONS 1000000
+#define DEFAULT_DURATION   3600 /* [s] */
+
+/* Interval between two removals of the expired entries [s]. */
+#define EXPIRE_INTERVAL    60
+
+/* One operation out of LATENCY_SAMPLING is timed. */
+#define LATENCY_SAMPLING   8
+
+/* The cycles are read from the time-stamp counter (reference cycles). */
+#if defined(__x86_64__) || defined(__i386__)
+  #define HAVE_CYCLES 1
+#else
+  #define HAVE_CYCLES 0
+#endif
+
+typedef enum {
+  RESPONSE_ADDRESS,  /* A records of the name of the question. */
+  RESPONSE_CNAME,    /* Chain of CNAME records and A records. */
+  RESPONSE_RRSET,    /* Large RRset with NS records in the authority. */
+  RESPONSE_NODATA,   /* SOA record in the authority. */
+  RESPONSE_MIXED     /* All the kinds, interleaved. */
+} response_kind_t;
+
+#define NUMBER_RESPONSE_KINDS RESPONSE_MIXED
+
+typedef enum {
+  DISTRIBUTION_UNIFORM,
+  DISTRIBUTION_ZIPF
+} distribution_t;
+
+typedef enum {
+  BACKEND_DNSCACHE, /* A dnscache shared by the threads (with a mutex). */
+  BACKEND_PRIVATE,  /* A dnscache per thread (as the workers). */
+  BACKEND_SHMCACHE  /* A shmcache (a mutex per stripe of buckets). */
+} backend_t;
+
+typedef struct {
+  uint8_t data[MAX_DNS_MESSAGE_SIZE];
+  size_t len;
+} message_t;
+
+/* Host names (text format, NUL-terminated, one after the other). */
+typedef struct {
+  char* data;
+  uint32_t* offsets;
+  uint8_t* lengths;
+  unsigned count;
+} names_t;
+
+typedef struct {
+  /* Configuration. */
+  unsigned entries;
+  unsigned nbuckets;
+  unsigned iterations;
+  unsigned runs;
+  uint64_t seed;
+
+  /* Names in the cache and names which are not. */
+  names_t names;
+  names_t missing;
+
+  /* Random order of the lookups. */
+  uint32_t* order;
+
+  message_t responses[NUMBER_RESPONSE_KINDS][CORPUS_SIZE];
+
+  dnscaches_t caches;
+  int cache_created;
+  int cache_filled;
+
+  uint64_t sink;
+
+  /* Workload (-W). */
+  distribution_t distribution;
+  double exponent;
+  unsigned scan_percent;
+  unsigned write_percent;
+  unsigned min_ttl;
+  unsigned max_ttl;
+  unsigned nthreads;
+  unsigned operations; /* Per thread. */
+  unsigned duration; /* [s] */
+  unsigned capacity; /* Of the shmcache. */
+  backend_t backend;
+
+  /* Cumulative distribution of the ranks (Zipf). */
+  double* cdf;
+
+  pthread_mutex_t mutex;
+
+  /* The threads wait until 'start' is set (1: run, -1: abort). */
+  pthread_mutex_t start_mutex;
+  pthread_cond_t start_cond;
+  int start;
+
+  shmcaches_t shmcaches;
+  int shmcache_created;
+} bench_t;
+
+/* Thread of the workload. */
+typedef struct {
+  bench_t* bench;
+  unsigned index;
+  pthread_t thread;
+  uint64_t state;
+
+  /* BACKEND_PRIVATE. */
+  dnscaches_t caches;
+  int cache_created;
+
+  /* BACKEND_SHMCACHE: copy of the handle (with its own statistics). */
+  shmcaches_t shmcaches;
+
+  uint64_t reads;
+  uint64_t hits;
+  uint64_t fills; /* Names inserted after a miss. */
+  uint64_t writes;
+
+  histogram_t read_latency;
+  histogram_t write_latency;
+
+  int error;
+} worker_t;
+
+typedef struct {
+  const char* name;
+
+  /* Prepares the state (not measured), optional. */
+  int (*setup)(bench_t* bench);
+
+  /* Runs the benchmark, returns the number of operations. */
+  int (*run)(bench_t* bench, uint64_t* ops);
+} benchmark_t;
+
+static int setup_empty_cache(bench_t* bench);
+static int setup_full_cache(bench_t* bench);
+
+static int run_parse_address(bench_t* bench, uint64_t* ops);
+static int run_parse_cname(bench_t* bench, uint64_t* ops);
+static int run_parse_rrset(bench_t* bench, uint64_t* ops);
+static int run_parse_nodata(bench_t* bench, uint64_t* ops);
+static int run_parse_mixed(bench_t* bench, uint64_t* ops);
+static int run_build_request(bench_t* bench, uint64_t* ops);
+static int run_hash(bench_t* bench, uint64_t* ops);
+static int run_cache_insert(bench_t* bench, uint64_t* ops);
+static int run_cache_update(bench_t* bench, uint64_t* ops);
+static int run_cache_hit(bench_t* bench, uint64_t* ops);
+static int run_cache_miss(bench_t* bench, uint64_t* ops);
+
+static const benchmark_t benchmarks[] = {
+  {"dns_process_response/address", NULL, run_parse_address},
+  {"dns_process_response/cname", NULL, run_parse_cname},
+  {"dns_process_response/rrset", NULL, run_parse_rrset},
+  {"dns_process_response/nodata", NULL, run_parse_nodata},
+  {"dns_process_response/mixed", NULL, run_parse_mixed},
+  {"dns_build_request", NULL, run_build_request},
+  {"hash", NULL, run_hash},
+  {"dnscache/insert", setup_empty_cache, run_cache_insert},
+  {"dnscache/update", setup_full_cache, run_cache_update},
+  {"dnscache/hit", setup_full_cache, run_cache_hit},
+  {"dnscache/miss", setup_full_cache, run_cache_miss}
+};
+
+static void usage(const char* program);
+static int bench_create(bench_t* bench);
+static void bench_destroy(bench_t* bench);
+static int run_benchmark(bench_t* bench, const benchmark_t* benchmark);
+static int parse_responses(bench_t* bench,
+                           response_kind_t kind,
+                           uint64_t* ops);
+
+static int generate_names(names_t* names,
+                          unsigned count,
+                          const char* tld,
+                          uint64_t* state);
+
+static int generate_response(message_t* msg,
+                             response_kind_t kind,
+                             const char* name,
+                             size_t namelen,
+                             uint64_t* state);
+
+static int add_record(dns_response_t* response,
+                      dns_section_t section,
+                      const char* name,
+                      dns_qtype_t type,
+                      const char* target,
+                      uint32_t value);
+
+
+static int parse_workload_option(bench_t* bench, int opt, const char* arg);
+static int run_workload(bench_t* bench);
+static int create_zipf(bench_t* bench);
+static void* workload_thread(void* arg);
+static int workload_get(worker_t* worker,
+                        const char* name,
+                        size_t namelen,
+                        time_t now);
+
+static int workload_add(worker_t* worker,
+                        const char* name,
+                        size_t namelen,
+                        uint32_t n,
+                        time_t now);
+
+static void workload_remove_expired(worker_t* worker, time_t now);
+static void start_workload(bench_t* bench, int start);
+static void print_workload(const bench_t* bench,
+                           const worker_t* workers,
+                           uint64_t ns);
+
+static void print_latency(const char* operation,
+                          const histogram_t* histogram);
+
+
+static inline const char* get_name(const names_t* names,
+                                   unsigned i,
+                                   size_t* len)
+{
+  *len = names->lengths[i];
+  return names->data + names->offsets[i];
+}
+
+static inline uint64_t read_cycles(void)
+{
+#if HAVE_CYCLES
+  return __builtin_ia32_rdtsc();
+#else
+  return 0;
+#endif
+}
+
+static inline uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+int main(int argc, char** argv)
+{
+  const char* filter;
+  bench_t* bench;
+  unsigned i;
+  int workload;
+  int opt;
+  int ret;
+
+  if ((bench = (bench_t*) calloc(1, sizeof(bench_t))) == NULL) {
+    fprintf(stderr, "Error allocating memory.\n");
+    return -1;
+  }
+
+  bench->entries = DEFAULT_ENTRIES;
+  bench->iterations = DEFAULT_ITERATIONS;
+  bench->runs = DEFAULT_RUNS;
+  bench->seed = DEFAULT_SEED;
+
+  bench->distribution = DISTRIBUTION_ZIPF;
+  bench->exponent = DEFAULT_EXPONENT;
+  bench->write_percent = DEFAULT_WRITES;
+  bench->min_ttl = DEFAULT_MIN_TTL;
+  bench->max_ttl = DEFAULT_MAX_TTL;
+  bench->nthreads = 1;
+  bench->operations = DEFAULT_OPERATIONS;
+  bench->duration = DEFAULT_DURATION;
+  bench->backend = BACKEND_DNSCACHE;
+
+  filter = NULL;
+  workload = 0;
+
+  while ((opt = getopt(argc,
+                       argv,
+                       "n:b:i:r:s:f:Wd:a:S:w:t:j:o:D:c:B:")) != -1) {
+    switch (opt) {
+      case 'n':
+        bench->entries = atoi(optarg);
+        break;
+      case 'b':
+        bench->nbuckets = atoi(optarg);
+        break;
+      case 'i':
+        bench->iterations = atoi(optarg);
+        break;
+      case 'r':
+        bench->runs = atoi(optarg);
+        break;
+      case 's':
+        bench->seed = strtoull(optarg, NULL, 10);
+        break;
+      case 'f':
+        filter = optarg;
+        break;
+      case 'W':
+        workload = 1;
+        break;
+      case '?':
+        usage(argv[0]);
+        free(bench);
+        return -1;
+      default:
+        if (parse_workload_option(bench, opt, optarg) < 0) {
+          usage(argv[0]);
+          free(bench);
+          return -1;
+        }
+    }
+  }
+
+  if ((optind != argc) ||
+      (bench->entries < CORPUS_SIZE) ||
+      (bench->iterations == 0) ||
+      (bench->runs == 0) ||
+      (bench->scan_percent > 100) ||
+      (bench->write_percent > 100) ||
+      (bench->min_ttl == 0) ||
+      (bench->max_ttl < bench->min_ttl) ||
+      (bench->nthreads == 0) ||
+      (bench->operations == 0) ||
+      (bench->duration == 0)) {
+    usage(argv[0]);
+    free(bench);
+    return -1;
+  }
+
+  /* By default, one bucket per entry. */
+  if (bench->nbuckets == 0) {
+    bench->nbuckets = bench->entries;
+  }
+
+  /* By default, the shmcache can hold all the names. */
+  if (bench->capacity == 0) {
+    bench->capacity = bench->entries;
+  }
+
+  if (bench_create(bench) < 0) {
+    bench_destroy(bench);
+    free(bench);
+    return -1;
+  }
+
+  if (workload) {
+    ret = run_workload(bench);
+
+    bench_destroy(bench);
+    free(bench);
+
+    return ret;
+  }
+
+  printf("Entries: %u, buckets: %u, iterations: %u, runs: %u, seed: %llu.\n",
+         bench->entries,
+         bench->nbuckets,
+         bench->iterations,
+         bench->runs,
+         (unsigned long long) bench->seed);
+
+  printf("%-30s %10s %10s %14s %10s\n",
+         "Benchmark",
+         "ops",
+         "ns/op",
+         "ops/s",
+         "cycles/op");
+
+  ret = 0;
+
+  for (i = 0; i < ARRAY_SIZE(benchmarks); i++) {
+    if ((!filter) || (strstr(benchmarks[i].name, filter))) {
+      if (run_benchmark(bench, &benchmarks[i]) < 0) {
+        fprintf(stderr, "Error running '%s'.\n", benchmarks[i].name);
+
+        ret = -1;
+        break;
+      }
+    }
+  }
+
+  bench_destroy(bench);
+  free(bench);
+
+  return ret;
+}
+
+void usage(const char* program)
+{
+  printf("Usage: %s [-n <entries>] [-b <buckets>] [-i <iterations>] "
+         "[-r <runs>] [-s <seed>] [-f <filter>]\n",
+         program);
+
+  printf("  -n <entries>: number of host names in the cache (default: %u, "
+         "minimum: %u).\n",
+         DEFAULT_ENTRIES,
+         CORPUS_SIZE);
+
+  printf("  -b <buckets>: number of buckets of the cache (default: one per "
+         "entry).\n");
+
+  printf("  -i <iterations>: operations per run (default: %u).\n",
+         DEFAULT_ITERATIONS);
+
+  printf("  -r <runs>: runs per benchmark, the fastest one is reported "
+         "(default: %u).\n",
+         DEFAULT_RUNS);
+
+  printf("  -s <seed>: seed of the generated names and responses (default: "
+         "%u).\n",
+         DEFAULT_SEED);
+
+  printf("  -f <filter>: only run the benchmarks whose name contains "
+         "<filter>.\n");
+
+  printf("\n  -W: run a concurrent workload against the cache (-n: number of "
+         "names).\n");
+
+  printf("  -d <distribution>: distribution of the names, 'zipf' "
+         "(default) or 'uniform'.\n");
+
+  printf("  -a <exponent>: exponent of the Zipf distribution (default: "
+         "%.2f).\n",
+         DEFAULT_EXPONENT);
+
+  printf("  -S <percentage>: operations on names scanned once (default: "
+         "0).\n");
+
+  printf("  -w <percentage>: writes (default: %u), the other operations are "
+         "reads.\n",
+         DEFAULT_WRITES);
+
+  printf("  -t <ttl>[:<max-ttl>]: TTL of the names, uniformly distributed "
+         "(default: %u:%u).\n",
+         DEFAULT_MIN_TTL,
+         DEFAULT_MAX_TTL);
+
+  printf("  -j <threads>: number of threads (default: 1).\n");
+
+  printf("  -o <operations>: operations per thread (default: %u).\n",
+         DEFAULT_OPERATIONS);
+
+  printf("  -D <seconds>: simulated duration of the run (default: %u).\n",
+         DEFAULT_DURATION);
+
+  printf("  -B <backend>: 'dnscache' (shared, default), 'private' (a "
+         "dnscache per thread) or 'shmcache'.\n");
+
+  printf("  -c <entries>: capacity of the shmcache (default: -n).\n");
+}
+
+int bench_create(bench_t* bench)
+{
+  uint64_t state;
+  size_t len;
+  const char* name;
+  unsigned i;
+  unsigned j;
+  uint32_t tmp;
+  int kind;
+
+  state = bench->seed;
+
+  if ((generate_names(&bench->names, bench->entries, "com", &state) < 0) ||
+      (generate_names(&bench->missing, bench->entries, "net", &state) < 0) ||
+      ((bench->order = (uint32_t*) malloc(bench->entries *
+                                          sizeof(uint32_t))) == NULL)) {
+    fprintf(stderr, "Error allocating memory.\n");
+    return -1;
+  }
+
+  /* Shuffle the order of the lookups (Fisher-Yates). */
+  for (i = 0; i < bench->entries; i++) {
+    bench->order[i] = i;
+  }
+
+  for (i = bench->entries - 1; i > 0; i--) {
+    j = next_random(&state) % (i + 1);
+
+    tmp = bench->order[i];
+    bench->order[i] = bench->order[j];
+    bench->order[j] = tmp;
+  }
+
+  /* Build the responses to the first names. */
+  for (kind = 0; kind < NUMBER_RESPONSE_KINDS; kind++) {
+    for (i = 0; i < CORPUS_SIZE; i++) {
+      name = get_name(&bench->names, i, &len);
+
+      if (generate_response(&bench->responses[kind][i],
+                            (response_kind_t) kind,
+                            name,
+                            len,
+                            &state) < 0) {
+        fprintf(stderr, "Error building response for '%s'.\n", name);
+        return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+void bench_destroy(bench_t* bench)
+{
+  if (bench->cache_created) {
+    dnscaches_destroy(&bench->caches);
+    bench->cache_created = 0;
+  }
+
+  if (bench->shmcache_created) {
+    shmcaches_detach(&bench->shmcaches);
+    bench->shmcache_created = 0;
+  }
+
+  free(bench->cdf);
+
+  free(bench->order);
+
+  free(bench->names.data);
+  free(bench->names.offsets);
+  free(bench->names.lengths);
+
+  free(bench->missing.data);
+  free(bench->missing.offsets);
+  free(bench->missing.lengths);
+}
+
+int run_benchmark(bench_t* bench, const benchmark_t* benchmark)
+{
+  uint64_t best_ns;
+  uint64_t best_cycles;
+  uint64_t start_ns;
+  uint64_t start_cycles;
+  uint64_t ns;
+  uint64_t cycles;
+  uint64_t ops;
+  unsigned i;
+
+  best_ns = UINT64_MAX;
+  best_cycles = 0;
+  ops = 0;
+
+  for (i = 0; i < bench->runs; i++) {
+    if ((benchmark->setup) && (benchmark->setup(bench) < 0)) {
+      return -1;
+    }
+
+    start_ns = now_ns();
+    start_cycles = read_cycles();
+
+    if (benchmark->run(bench, &ops) < 0) {
+      return -1;
+    }
+
+    cycles = read_cycles() - start_cycles;
+    ns = now_ns() - start_ns;
+
+    if (ns < best_ns) {
+      best_ns = ns;
+      best_cycles = cycles;
+    }
+  }
+
+  if (best_ns == 0) {
+    best_ns = 1;
+  }
+
+  printf("%-30s %10llu %10.1f %14.0f ",
+         benchmark->name,
+         (unsigned long long) ops,
+         (double) best_ns / ops,
+         ops * 1e9 / best_ns);
+
+  if (HAVE_CYCLES) {
+    printf("%10.1f\n", (double) best_cycles / ops);
+  } else {
+    printf("%10s\n", "-");
+  }
+
+  return 0;
+}
+
+int setup_empty_cache(bench_t* bench)
+{
+  if (bench->cache_created) {
+    dnscaches_destroy(&bench->caches);
+    bench->cache_created = 0;
+  }
+
+  if (dnscaches_create(&bench->caches, bench->nbuckets) < 0) {
+    return -1;
+  }
+
+  bench->cache_created = 1;
+  bench->cache_filled = 0;
+
+  return 0;
+}
+
+int setup_full_cache(bench_t* bench)
+{
+  uint64_t ops;
+
+  if (bench->cache_filled) {
+    return 0;
+  }
+
+  return ((setup_empty_cache(bench) == 0) &&
+          (run_cache_insert(bench, &ops) == 0)) ? 0 : -1;
+}
+
+int run_parse_address(bench_t* bench, uint64_t* ops)
+{
+  return parse_responses(bench, RESPONSE_ADDRESS, ops);
+}
+
+int run_parse_cname(bench_t* bench, uint64_t* ops)
+{
+  return parse_responses(bench, RESPONSE_CNAME, ops);
+}
+
+int run_parse_rrset(bench_t* bench, uint64_t* ops)
+{
+  return parse_responses(bench, RESPONSE_RRSET, ops);
+}
+
+int run_parse_nodata(bench_t* bench, uint64_t* ops)
+{
+  return parse_responses(bench, RESPONSE_NODATA, ops);
+}
+
+int run_parse_mixed(bench_t* bench, uint64_t* ops)
+{
+  return parse_responses(bench, RESPONSE_MIXED, ops);
+}
+
+int run_build_request(bench_t* bench, uint64_t* ops)
+{
+  uint8_t buf[MAX_DNS_MESSAGE_SIZE];
+  const char* name;
+  size_t namelen;
+  size_t len;
+  unsigned i;
+
+  for (i = 0; i < bench->iterations; i++) {
+    name = get_name(&bench->names, i % bench->entries, &namelen);
+
+    if (dns_build_request(i,
+                          DNS_QTYPE_A,
+                          DNS_QCLASS_IN,
+                          name,
+                          namelen,
+                          buf,
+                          &len) < 0) {
+      return -1;
+    }
+
+    bench->sink += len;
+  }
+
+  *ops = bench->iterations;
+
+  return 0;
+}
+
+int run_hash(bench_t* bench, uint64_t* ops)
+{
+  const char* name;
+  size_t namelen;
+  unsigned i;
+
+  for (i = 0; i < bench->iterations; i++) {
+    name = get_name(&bench->names, i % bench->entries, &namelen);
+
+    bench->sink += hash(name, namelen, 0xdeaddead, bench->nbuckets);
+  }
+
+  *ops = bench->iterations;
+
+  return 0;
+}
+
+int run_cache_insert(bench_t* bench, uint64_t* ops)
+{
+  struct in_addr addr;
+  const char* name;
+  size_t namelen;
+  unsigned i;
+
+  for (i = 0; i < bench->entries; i++) {
+    name = get_name(&bench->names, i, &namelen);
+    addr.s_addr = htonl(i + 1);
+
+    if (dnscaches_add_ipv4(&bench->caches,
+                           name,
+                           namelen,
+                           &addr,
+                           CACHE_TTL,
+                           0) < 0) {
+      return -1;
+    }
+  }
+
+  bench->cache_filled = 1;
+
+  *ops = bench->entries;
+
+  return 0;
+}
+
+int run_cache_update(bench_t* bench, uint64_t* ops)
+{
+  struct in_addr addr;
+  const char* name;
+  size_t namelen;
+  unsigned i;
+  uint32_t n;
+
+  for (i = 0; i < bench->iterations; i++) {
+    n = bench->order[i % bench->entries];
+    name = get_name(&bench->names, n, &namelen);
+    addr.s_addr = htonl(n + 1);
+
+    if (dnscaches_add_ipv4(&bench->caches,
+                           name,
+                           namelen,
+                           &addr,
+                           CACHE_TTL,
+                           0) < 0) {
+      return -1;
+    }
+  }
+
+  *ops = bench->iterations;
+
+  return 0;
+}
+
+int run_cache_hit(bench_t* bench, uint64_t* ops)
+{
+  struct in_addr addr;
+  const char* name;
+  size_t namelen;
+  unsigned i;
+
+  for (i = 0; i < bench->iterations; i++) {
+    name = get_name(&bench->names,
+                    bench->order[i % bench->entries],
+                    &namelen);
+
+    if (dnscaches_get_ipv4(&bench->caches, name, namelen, 0, &addr) < 0) {
+      return -1;
+    }
+
+    bench->sink += addr.s_addr;
+  }
+
+  *ops = bench->iterations;
+
+  return 0;
+}
+
+int run_cache_miss(bench_t* bench, uint64_t* ops)
+{
+  struct in_addr addr;
+  const char* name;
+  size_t namelen;
+  unsigned i;
+
+  for (i = 0; i < bench->iterations; i++) {
+    name = get_name(&bench->missing,
+                    bench->order[i % bench->entries],
+                    &namelen);
+
+    if (dnscaches_get_ipv4(&bench->caches, name, namelen, 0, &addr) == 0) {
+      return -1;
+    }
+  }
+
+  *ops = bench->iterations;
+
+  return 0;
+}
+
+int parse_responses(bench_t* bench, response_kind_t kind, uint64_t* ops)
+{
+  dns_question_t questions[1];
+  rr_t answers[MAX_RECORDS];
+  rr_t authorities[MAX_RECORDS];
+  const message_t* msg;
+  size_t nquestions;
+  size_t nanswers;
+  size_t nauthorities;
+  uint16_t id;
+  unsigned i;
+
+  for (i = 0; i < bench->iterations; i++) {
+    if (kind == RESPONSE_MIXED) {
+      msg = &bench->responses[i % NUMBER_RESPONSE_KINDS]
+                             [(i / NUMBER_RESPONSE_KINDS) % CORPUS_SIZE];
+    } else {
+      msg = &bench->responses[kind][i % CORPUS_SIZE];
+    }
+
+    nquestions = ARRAY_SIZE(questions);
+    nanswers = ARRAY_SIZE(answers);
+    nauthorities = ARRAY_SIZE(authorities);
+
+    if (dns_process_response(msg->data,
+                             msg->len,
+                             &id,
+                             questions,
+                             &nquestions,
+                             answers,
+                             &nanswers,
+                             authorities,
+                             &nauthorities) < 0) {
+      return -1;
+    }
+
+    bench->sink += id + nanswers + nauthorities;
+  }
+
+  *ops = bench->iterations;
+
+  return 0;
+}
+
+int generate_names(names_t* names,
+                   unsigned count,
+                   const char* tld,
+                   uint64_t* state)
+{
+  static const char letters[] = "abcdefghijklmnopqrstuvwxyz";
+  char* p;
+  unsigned nlabels;
+  unsigned labellen;
+  unsigned i;
+  unsigned j;
+  unsigned k;
+
+  /* At most 3 labels of 12 characters, the index and the TLD. */
+  if (((names->data = (char*) malloc(count * 64)) == NULL) ||
+      ((names->offsets = (uint32_t*) malloc(count *
+                                            sizeof(uint32_t))) == NULL) ||
+      ((names->lengths = (uint8_t*) malloc(count)) == NULL)) {
+    return -1;
+  }
+
+  p = names->data;
+
+  for (i = 0; i < count; i++) {
+    names->offsets[i] = p - names->data;
+
+    /* e.g. "www.qfxzkd123.com": a label with the index (so that the names
+     * are unique) preceded by up to two labels.
+     */
+    nlabels = 1 + next_random(state) % 3;
+
+    for (j = 0; j < nlabels; j++) {
+      labellen = 2 + next_random(state) % 11;
+
+      for (k = 0; k < labellen; k++) {
+        *p++ = letters[next_random(state) % (sizeof(letters) - 1)];
+      }
+
+      if (j + 1 < nlabels) {
+        *p++ = '.';
+      }
+    }
+
+    p += sprintf(p, "%u.%s", i, tld);
+
+    names->lengths[i] = p - (names->data + names->offsets[i]);
+
+    /* Keep the terminating NUL. */
+    p++;
+  }
+
+  names->count = count;
+
+  return 0;
+}
+
+int generate_response(message_t* msg,
+                      response_kind_t kind,
+                      const char* name,
+                      size_t namelen,
+                      uint64_t* state)
+{
+  dns_response_t response;
+  dns_question_t question;
+  char owner[HOSTNAME_MAX_LEN + 1];
+  char target[HOSTNAME_MAX_LEN + 1];
+  const char* zone;
+  uint32_t value;
+  unsigned count;
+  unsigned i;
+
+  memcpy(question.name, name, namelen);
+  question.name[namelen] = 0;
+  question.namelen = namelen;
+  question.qtype = (kind == RESPONSE_NODATA) ? DNS_QTYPE_AAAA : DNS_QTYPE_A;
+  question.qclass = DNS_QCLASS_IN;
+
+  if (dns_response_init(&response,
+                        msg->data,
+                        sizeof(msg->data),
+                        next_random(state),
+                        DNS_FLAG_QR | DNS_FLAG_RD | DNS_FLAG_RA,
+                        &question) < 0) {
+    return -1;
+  }
+
+  /* Zone of the name (without its first label). */
+  zone = (const char*) memchr(name, '.', namelen) + 1;
+
+  value = next_random(state);
+
+  switch (kind) {
+    case RESPONSE_ADDRESS:
+      count = 1 + next_random(state) % 2;
+
+      for (i = 0; i < count; i++) {
+        if (add_record(&response,
+                       DNS_SECTION_ANSWER,
+                       name,
+                       DNS_QTYPE_A,
+                       NULL,
+                       value + i) < 0) {
+          return -1;
+        }
+      }
+
+      break;
+    case RESPONSE_CNAME:
+      /* name CNAME e0.<zone>.cdn.net CNAME e1.<zone>.cdn.net ... A A
+       * (the targets are compressed against the previous ones).
+       */
+      snprintf(owner, sizeof(owner), "%s", name);
+
+      count = 1 + next_random(state) % 3;
+
+      for (i = 0; i < count; i++) {
+        snprintf(target, sizeof(target), "e%u.%s.cdn.net", i, zone);
+
+        if (add_record(&response,
+                       DNS_SECTION_ANSWER,
+                       owner,
+                       DNS_QTYPE_CNAME,
+                       target,
+                       0) < 0) {
+          return -1;
+        }
+
+        memcpy(owner, target, sizeof(owner));
+      }
+
+      for (i = 0; i < 2; i++) {
+        if (add_record(&response,
+                       DNS_SECTION_ANSWER,
+                       owner,
+                       DNS_QTYPE_A,
+                       NULL,
+                       value + i) < 0) {
+          return -1;
+        }
+      }
+
+      break;
+    case RESPONSE_RRSET:
+      for (i = 0; i < RRSET_SIZE; i++) {
+        if (add_record(&response,
+                       DNS_SECTION_ANSWER,
+                       name,
+                       DNS_QTYPE_A,
+                       NULL,
+                       value + i) < 0) {
+          return -1;
+        }
+      }
+
+      for (i = 0; i < 2; i++) {
+        snprintf(target, sizeof(target), "ns%u.%s", i + 1, zone);
+
+        if (add_record(&response,
+                       DNS_SECTION_AUTHORITY,
+                       zone,
+                       DNS_QTYPE_NS,
+                       target,
+                       0) < 0) {
+          return -1;
+        }
+      }
+
+      break;
+    case RESPONSE_NODATA:
+      snprintf(target, sizeof(target), "ns1.%s", zone);
+
+      if (add_record(&response,
+                     DNS_SECTION_AUTHORITY,
+                     zone,
+                     DNS_QTYPE_SOA,
+                     target,
+                     value) < 0) {
+        return -1;
+      }
+
+      break;
+    default:
+      return -1;
+  }
+
+  msg->len = dns_response_length(&response);
+
+  return 0;
+}
+
+int add_record(dns_response_t* response,
+               dns_section_t section,
+               const char* name,
+               dns_qtype_t type,
+               const char* target,
+               uint32_t value)
+{
+  rr_t rr;
+
+  memset(&rr, 0, sizeof(rr_t));
+
+  rr.namelen = snprintf(rr.name, sizeof(rr.name), "%s", name);
+  rr.type = type;
+  rr.class = DNS_QCLASS_IN;
+  rr.ttl = 300;
+
+  switch (type) {
+    case DNS_QTYPE_A:
+      rr.addr4.s_addr = htonl(value);
+      break;
+    case DNS_QTYPE_CNAME:
+    case DNS_QTYPE_NS:
+      rr.cname.namelen = snprintf(rr.cname.name,
+                                  sizeof(rr.cname.name),
+                                  "%s",
+                                  target);
+
+      break;
+    case DNS_QTYPE_SOA:
+      rr.soa.nameserverlen = snprintf(rr.soa.nameserver,
+                                      sizeof(rr.soa.nameserver),
+                                      "%s",
+                                      target);
+
+      rr.soa.mailboxlen = snprintf(rr.soa.mailbox,
+                                   sizeof(rr.soa.mailbox),
+                                   "hostmaster.%s",
+                                   strchr(target, '.') + 1);
+
+      rr.soa.serial = value;
+      rr.soa.refresh = 7200;
+      rr.soa.retry = 3600;
+      rr.soa.expire = 1209600;
+      rr.soa.minimum_ttl = 300;
+
+      break;
+    default:
+      return -1;
+  }
+
+  return dns_response_add(response, section, &rr);
+}
+
+int parse_workload_option(bench_t* bench, int opt, const char* arg)
+{
+  char* end;
+
+  switch (opt) {
+    case 'd':
+      if (strcmp(arg, "zipf") == 0) {
+        bench->distribution = DISTRIBUTION_ZIPF;
+      } else if (strcmp(arg, "uniform") == 0) {
+        bench->distribution = DISTRIBUTION_UNIFORM;
+      } else {
+        return -1;
+      }
+
+      return 0;
+    case 'a':
+      return ((bench->exponent = atof(arg)) > 0) ? 0 : -1;
+    case 'S':
+      bench->scan_percent = atoi(arg);
+      return 0;
+    case 'w':
+      bench->write_percent = atoi(arg);
+      return 0;
+    case 't':
+      bench->min_ttl = strtoul(arg, &end, 10);
+
+      if (*end == ':') {
+        bench->max_ttl = strtoul(end + 1, &end, 10);
+      } else {
+        bench->max_ttl = bench->min_ttl;
+      }
+
+      return (*end == 0) ? 0 : -1;
+    case 'j':
+      bench->nthreads = atoi(arg);
+      return 0;
+    case 'o':
+      bench->operations = atoi(arg);
+      return 0;
+    case 'D':
+      bench->duration = atoi(arg);
+      return 0;
+    case 'c':
+      bench->capacity = atoi(arg);
+      return 0;
+    case 'B':
+      if (strcmp(arg, "dnscache") == 0) {
+        bench->backend = BACKEND_DNSCACHE;
+      } else if (strcmp(arg, "private") == 0) {
+        bench->backend = BACKEND_PRIVATE;
+      } else if (strcmp(arg, "shmcache") == 0) {
+        bench->backend = BACKEND_SHMCACHE;
+      } else {
+        return -1;
+      }
+
+      return 0;
+    default:
+      return -1;
+  }
+}
+
+int run_workload(bench_t* bench)
+{
+  worker_t* workers;
+  worker_t* worker;
+  uint64_t start;
+  uint64_t end;
+  unsigned nstarted;
+  unsigned i;
+  int ret;
+
+  if ((bench->distribution == DISTRIBUTION_ZIPF) && (create_zipf(bench) < 0)) {
+    fprintf(stderr, "Error allocating memory.\n");
+    return -1;
+  }
+
+  if ((workers = (worker_t*) calloc(bench->nthreads,
+                                    sizeof(worker_t))) == NULL) {
+    fprintf(stderr, "Error allocating memory.\n");
+    return -1;
+  }
+
+  /* Create the cache(s). */
+  ret = 0;
+
+  switch (bench->backend) {
+    case BACKEND_DNSCACHE:
+      if ((ret = dnscaches_create(&bench->caches, bench->nbuckets)) == 0) {
+        bench->cache_created = 1;
+      }
+
+      break;
+    case BACKEND_PRIVATE:
+      for (i = 0; (i < bench->nthreads) && (ret == 0); i++) {
+        if ((ret = dnscaches_create(&workers[i].caches,
+                                    bench->nbuckets)) == 0) {
+          workers[i].cache_created = 1;
+        }
+      }
+
+      break;
+    case BACKEND_SHMCACHE:
+      if ((ret = shmcaches_create(&bench->shmcaches,
+                                  NULL,
+                                  bench->nbuckets,
+                                  bench->capacity)) == 0) {
+        bench->shmcache_created = 1;
+      }
+
+      break;
+  }
+
+  nstarted = 0;
+
+  if (ret == 0) {
+    pthread_mutex_init(&bench->mutex, NULL);
+    pthread_mutex_init(&bench->start_mutex, NULL);
+    pthread_cond_init(&bench->start_cond, NULL);
+
+    for (i = 0; i < bench->nthreads; i++) {
+      worker = &workers[i];
+
+      worker->bench = bench;
+      worker->index = i;
+      worker->state = bench->seed + i + 1;
+
+      if (bench->backend == BACKEND_SHMCACHE) {
+        worker->shmcaches = bench->shmcaches;
+        memset(&worker->shmcaches.stats, 0, sizeof(cache_stats_t));
+      }
+
+      if (pthread_create(&worker->thread,
+                         NULL,
+                         workload_thread,
+                         worker) != 0) {
+        break;
+      }
+
+      nstarted++;
+    }
+
+    if (nstarted == bench->nthreads) {
+      /* Start all the threads at the same time. */
+      start = now_ns();
+
+      start_workload(bench, 1);
+
+      for (i = 0; i < nstarted; i++) {
+        pthread_join(workers[i].thread, NULL);
+
+        if (workers[i].error) {
+          ret = -1;
+        }
+      }
+
+      end = now_ns();
+
+      if (ret == 0) {
+        print_workload(bench, workers, end - start);
+      } else {
+        fprintf(stderr, "Error adding to the cache.\n");
+      }
+    } else {
+      fprintf(stderr, "Error creating threads.\n");
+
+      start_workload(bench, -1);
+
+      for (i = 0; i < nstarted; i++) {
+        pthread_join(workers[i].thread, NULL);
+      }
+
+      ret = -1;
+    }
+
+    pthread_cond_destroy(&bench->start_cond);
+    pthread_mutex_destroy(&bench->start_mutex);
+    pthread_mutex_destroy(&bench->mutex);
+  } else {
+    fprintf(stderr, "Error creating the cache.\n");
+  }
+
+  for (i = 0; i < bench->nthreads; i++) {
+    if (workers[i].cache_created) {
+      dnscaches_destroy(&workers[i].caches);
+    }
+  }
+
+  free(workers);
+
+  return ret;
+}
+
+int create_zipf(bench_t* bench)
+{
+  double sum;
+  unsigned i;
+
+  if ((bench->cdf = (double*) malloc(bench->entries *
+                                     sizeof(double))) == NULL) {
+    return -1;
+  }
+
+  /* Probability of the rank k: 1 / k^s (normalized). */
+  sum = 0;
+
+  for (i = 0; i < bench->entries; i++) {
+    sum += 1.0 / pow(i + 1, bench->exponent);
+    bench->cdf[i] = sum;
+  }
+
+  for (i = 0; i < bench->entries; i++) {
+    bench->cdf[i] /= sum;
+  }
+
+  return 0;
+}
+
+void* workload_thread(void* arg)
+{
+  worker_t* worker;
+  bench_t* bench;
+  const char* name;
+  size_t namelen;
+  uint64_t start;
+  uint64_t scan;
+  uint64_t r;
+  double u;
+  time_t now;
+  time_t sweep;
+  uint32_t low;
+  uint32_t high;
+  uint32_t mid;
+  uint32_t n;
+  unsigned i;
+  int ret;
+
+  worker = (worker_t*) arg;
+  bench = worker->bench;
+
+  /* Each thread scans from a different position. */
+  scan = ((uint64_t) worker->index * bench->entries) / bench->nthreads;
+
+  sweep = 0;
+
+  pthread_mutex_lock(&bench->start_mutex);
+
+  while (bench->start == 0) {
+    pthread_cond_wait(&bench->start_cond, &bench->start_mutex);
+  }
+
+  pthread_mutex_unlock(&bench->start_mutex);
+
+  if (bench->start < 0) {
+    return NULL;
+  }
+
+  for (i = 0; i < bench->operations; i++) {
+    now = ((uint64_t) i * bench->duration) / bench->operations;
+
+    if (now >= sweep + EXPIRE_INTERVAL) {
+      workload_remove_expired(worker, now);
+      sweep = now;
+    }
+
+    r = next_random(&worker->state);
+
+    /* Choose the name. */
+    if ((r % 100) < bench->scan_percent) {
+      n = scan++ % bench->entries;
+      name = get_name(&bench->missing, n, &namelen);
+    } else {
+      if (bench->distribution == DISTRIBUTION_ZIPF) {
+        /* First rank whose cumulative probability is above u. */
+        u = random_unit(&worker->state);
+
+        low = 0;
+        high = bench->entries - 1;
+
+        while (low < high) {
+          mid = low + (high - low) / 2;
+
+          if (bench->cdf[mid] > u) {
+            high = mid;
+          } else {
+            low = mid + 1;
+          }
+        }
+
+        n = low;
+      } else {
+        n = next_random(&worker->state) % bench->entries;
+      }
+
+      name = get_name(&bench->names, n, &namelen);
+    }
+
+    start = ((i % LATENCY_SAMPLING) == 0) ? now_ns() : 0;
+
+    if (((r / 100) % 100) < bench->write_percent) {
+      worker->writes++;
+
+      ret = workload_add(worker, name, namelen, n, now);
+
+      if (start) {
+        histogram_add(&worker->write_latency, now_ns() - start);
+      }
+    } else {
+      worker->reads++;
+
+      if (workload_get(worker, name, namelen, now) == 0) {
+        worker->hits++;
+
+        if (start) {
+          histogram_add(&worker->read_latency, now_ns() - start);
+        }
+
+        ret = 0;
+      } else {
+        if (start) {
+          histogram_add(&worker->read_latency, now_ns() - start);
+        }
+
+        /* Insert the name, as the resolver does with the response. */
+        worker->fills++;
+
+        ret = workload_add(worker, name, namelen, n, now);
+      }
+    }
+
+    if (ret < 0) {
+      worker->error = 1;
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+int workload_get(worker_t* worker,
+                 const char* name,
+                 size_t namelen,
+                 time_t now)
+{
+  bench_t* bench;
+  struct in_addr addr;
+  int ret;
+
+  bench = worker->bench;
+
+  switch (bench->backend) {
+    case BACKEND_DNSCACHE:
+      pthread_mutex_lock(&bench->mutex);
+      ret = dnscaches_get_ipv4(&bench->caches, name, namelen, now, &addr);
+      pthread_mutex_unlock(&bench->mutex);
+
+      return ret;
+    case BACKEND_PRIVATE:
+      return dnscaches_get_ipv4(&worker->caches, name, namelen, now, &addr);
+    case BACKEND_SHMCACHE:
+      return shmcaches_get_ipv4(&worker->shmcaches,
+                                name,
+                                namelen,
+                                now,
+                                &addr);
+
+    default:
+      return -1;
+  }
+}
+
+int workload_add(worker_t* worker,
+                 const char* name,
+                 size_t namelen,
+                 uint32_t n,
+                 time_t now)
+{
+  bench_t* bench;
+  struct in_addr addr;
+  time_t expiration;
+  int ret;
+
+  bench = worker->bench;
+
+  /* The TTL of each name doesn't change. */
+  expiration = now +
+               bench->min_ttl +
+               ((n * 2654435761u) % (bench->max_ttl - bench->min_ttl + 1));
+
+  addr.s_addr = htonl(n + 1);
+
+  switch (bench->backend) {
+    case BACKEND_DNSCACHE:
+      pthread_mutex_lock(&bench->mutex);
+
+      ret = dnscaches_add_ipv4(&bench->caches,
+                               name,
+                               namelen,
+                               &addr,
+                               expiration,
+                               now);
+
+      pthread_mutex_unlock(&bench->mutex);
+
+      return ret;
+    case BACKEND_PRIVATE:
+      return dnscaches_add_ipv4(&worker->caches,
+                                name,
+                                namelen,
+                                &addr,
+                                expiration,
+                                now);
+
+    case BACKEND_SHMCACHE:
+      return shmcaches_add_ipv4(&worker->shmcaches,
+                                name,
+                                namelen,
+                                &addr,
+                                expiration,
+                                now);
+
+    default:
+      return -1;
+  }
+}
+
+void workload_remove_expired(worker_t* worker, time_t now)
+{
+  bench_t* bench;
+
+  bench = worker->bench;
+
+  /* The shared caches are swept by the first thread. */
+  switch (bench->backend) {
+    case BACKEND_DNSCACHE:
+      if (worker->index == 0) {
+        pthread_mutex_lock(&bench->mutex);
+        dnscaches_remove_expired(&bench->caches, now);
+        pthread_mutex_unlock(&bench->mutex);
+      }
+
+      break;
+    case BACKEND_PRIVATE:
+      dnscaches_remove_expired(&worker->caches, now);
+      break;
+    case BACKEND_SHMCACHE:
+      if (worker->index == 0) {
+        shmcaches_remove_expired(&worker->shmcaches, now);
+      }
+
+      break;
+  }
+}
+
+void start_workload(bench_t* bench, int start)
+{
+  pthread_mutex_lock(&bench->start_mutex);
+
+  bench->start = start;
+  pthread_cond_broadcast(&bench->start_cond);
+
+  pthread_mutex_unlock(&bench->start_mutex);
+}
+
+void print_workload(const bench_t* bench,
+                    const worker_t* workers,
+                    uint64_t ns)
+{
+  static const char* backends[] = {"dnscache", "private", "shmcache"};
+  histogram_t* reads;
+  histogram_t* writes;
+  cache_stats_t ipv4;
+  cache_stats_t ipv6;
+  uint64_t operations;
+  uint64_t nreads;
+  uint64_t hits;
+  uint64_t fills;
+  uint64_t nwrites;
+  uint64_t entries;
+  uint64_t bytes;
+  unsigned i;
+
+  if (bench->distribution == DISTRIBUTION_ZIPF) {
+    printf("Workload: %u names, Zipf (exponent %.2f)",
+           bench->entries,
+           bench->exponent);
+  } else {
+    printf("Workload: %u names, uniform", bench->entries);
+  }
+
+  printf(", %u%% scans, %u%% writes, TTL %u-%u s over %u s, %u thread(s), "
+         "backend %s, %u buckets.\n",
+         bench->scan_percent,
+         bench->write_percent,
+         bench->min_ttl,
+         bench->max_ttl,
+         bench->duration,
+         bench->nthreads,
+         backends[bench->backend],
+         bench->nbuckets);
+
+  /* Merge the counters of the threads. */
+  if (((reads = (histogram_t*) calloc(1, sizeof(histogram_t))) == NULL) ||
+      ((writes = (histogram_t*) calloc(1, sizeof(histogram_t))) == NULL)) {
+    free(reads);
+    return;
+  }
+
+  nreads = 0;
+  hits = 0;
+  fills = 0;
+  nwrites = 0;
+
+  entries = 0;
+  bytes = 0;
+
+  for (i = 0; i < bench->nthreads; i++) {
+    nreads += workers[i].reads;
+    hits += workers[i].hits;
+    fills += workers[i].fills;
+    nwrites += workers[i].writes;
+
+    histogram_merge(reads, &workers[i].read_latency);
+    histogram_merge(writes, &workers[i].write_latency);
+
+    if (bench->backend == BACKEND_PRIVATE) {
+      dnscaches_get_stats(&workers[i].caches, &ipv4, &ipv6);
+
+      entries += ipv4.entries;
+      bytes += ipv4.bytes;
+    }
+  }
+
+  if (bench->backend == BACKEND_DNSCACHE) {
+    dnscaches_get_stats(&bench->caches, &ipv4, &ipv6);
+
+    entries = ipv4.entries;
+    bytes = ipv4.bytes;
+  } else if (bench->backend == BACKEND_SHMCACHE) {
+    shmcaches_get_stats(&bench->shmcaches, &ipv4);
+
+    /* The segment is preallocated. */
+    entries = ipv4.entries;
+    bytes = bench->shmcaches.size;
+  }
+
+  operations = (uint64_t) bench->nthreads * bench->operations;
+
+  printf("  Operations: %llu in %.3f s (%.0f ops/s)\n",
+         (unsigned long long) operations,
+         ns / 1e9,
+         operations * 1e9 / ns);
+
+  printf("  Reads: %llu, hit rate: %.2f%% (inserted after a miss: %llu)\n",
+         (unsigned long long) nreads,
+         (nreads > 0) ? (100.0 * hits) / nreads : 0.0,
+         (unsigned long long) fills);
+
+  printf("  Writes: %llu\n", (unsigned long long) nwrites);
+
+  printf("  Entries: %llu, memory: %llu bytes (%.1f bytes per entry)\n",
+         (unsigned long long) entries,
+         (unsigned long long) bytes,
+         (entries > 0) ? (double) bytes / entries : 0.0);
+
+  print_latency("read", reads);
+  print_latency("write", writes);
+
+  free(reads);
+  free(writes);
+}
+
+void print_latency(const char* operation, const histogram_t* histogram)
+{
+  if (histogram->count > 0) {
+    printf("  Latency of a %s [ns] (1 out of %u): p50 %llu, p90 %llu, "
+           "p99 %llu, p99.9 %llu, max %llu\n",
+           operation,
+           LATENCY_SAMPLING,
+           (unsigned long long) histogram_percentile(histogram, 50),
+           (unsigned long long) histogram_percentile(histogram, 90),
+           (unsigned long long) histogram_percentile(histogram, 99),
+           (unsigned long long) histogram_percentile(histogram, 99.9),
+           (unsigned long long) histogram->max);
+  }
+}
@@ -5,6 +5,7 @@
 #include "dnscache.h"
 #include "dns.h"
 #include "hash.h"
+#include "trace.h"
 
 static const uint32_t initval = 0xdeaddead;
 
@@ -36,7 +37,8 @@ static int dnscache_get(dnscache_t* cache,
                         size_t hostlen,
                         time_t now,
                         void* addr,
-                        socklen_t addrlen);
+                        socklen_t addrlen,
+                        time_t* expiration_time);
 
 static void dnscache_remove_expired(dnscache_t* cache, time_t now);
 
@@ -55,6 +57,23 @@ static inline void touch_cache_entry(node_t* header, cache_entry_t* entry)
   cache_entry_push_front(header, entry);
 }
 
+static inline size_t cache_entry_size(size_t hostlen)
+{
+  return offsetof(cache_entry_t, host) + hostlen + 1;
+}
+
+static inline void free_cache_entry(dnscache_t* cache, cache_entry_t* entry)
+{
+  TRACE2(cache_evict, entry->host, entry->hostlen);
+
+  cache_stats_inc(&cache->stats.frees);
+  cache_stats_sub(&cache->stats.entries, 1);
+  cache_stats_sub(&cache->stats.bytes, cache_entry_size(entry->hostlen));
+
+  node_unlink((node_t*) entry);
+  free(entry);
+}
+
 int dnscaches_create(dnscaches_t* caches, unsigned nbuckets)
 {
   if (dnscache_create(&caches->ipv4, nbuckets) == 0) {
@@ -112,7 +131,7 @@ int dnscaches_get_ipv4(dnscaches_t* caches,
                        time_t now,
                        struct in_addr* addr)
 {
-  return dnscache_get(&caches->ipv4, host, hostlen, now, addr, 4);
+  return dnscache_get(&caches->ipv4, host, hostlen, now, addr, 4, NULL);
 }
 
 int dnscaches_get_ipv6(dnscaches_t* caches,
@@ -121,7 +140,39 @@ int dnscaches_get_ipv6(dnscaches_t* caches,
                        time_t now,
                        struct in6_addr* addr)
 {
-  return dnscache_get(&caches->ipv6, host, hostlen, now, addr, 16);
+  return dnscache_get(&caches->ipv6, host, hostlen, now, addr, 16, NULL);
+}
+
+int dnscaches_lookup_ipv4(dnscaches_t* caches,
+                          const char* host,
+                          size_t hostlen,
+                          time_t now,
+                          struct in_addr* addr,
+                          time_t* expiration_time)
+{
+  return dnscache_get(&caches->ipv4,
+                      host,
+                      hostlen,
+                      now,
+                      addr,
+                      4,
+                      expiration_time);
+}
+
+int dnscaches_lookup_ipv6(dnscaches_t* caches,
+                          const char* host,
+                          size_t hostlen,
+                          time_t now,
+                          struct in6_addr* addr,
+                          time_t* expiration_time)
+{
+  return dnscache_get(&caches->ipv6,
+                      host,
+                      hostlen,
+                      now,
+                      addr,
+                      16,
+                      expiration_time);
 }
 
 void dnscaches_remove_expired(dnscaches_t* caches, time_t now)
@@ -130,6 +181,14 @@ void dnscaches_remove_expired(dnscaches_t* caches, time_t now)
   dnscache_remove_expired(&caches->ipv6, now);
 }
 
+void dnscaches_get_stats(const dnscaches_t* caches,
+                         cache_stats_t* ipv4,
+                         cache_stats_t* ipv6)
+{
+  cache_stats_snapshot(&caches->ipv4.stats, ipv4);
+  cache_stats_snapshot(&caches->ipv6.stats, ipv6);
+}
+
 int dnscache_create(dnscache_t* cache, unsigned nbuckets)
 {
   unsigned i;
@@ -142,6 +201,9 @@ int dnscache_create(dnscache_t* cache, unsigned nbuckets)
 
     cache->nbuckets = nbuckets;
 
+    memset(&cache->stats, 0, sizeof(cache_stats_t));
+    cache->stats.bytes = nbuckets * sizeof(node_t);
+
     return 0;
   }
 
@@ -173,12 +235,16 @@ int dnscache_add(dnscache_t* cache,
   node_t* header;
   cache_entry_t* entry;
   cache_entry_t* next;
+  unsigned probes;
 
   if (hostlen <= HOSTNAME_MAX_LEN) {
     header = &cache->buckets[hash(host, hostlen, initval, cache->nbuckets)];
     entry = (cache_entry_t*) header->next;
+    probes = 0;
 
     while (entry != (cache_entry_t*) header) {
+      probes++;
+
       /* Same host?
        * (The caller is responsible for always using the same case, either
        *  lowercase or uppercase).
@@ -189,6 +255,9 @@ int dnscache_add(dnscache_t* cache,
 
         touch_cache_entry(header, entry);
 
+        cache_stats_inc(&cache->stats.updates);
+        cache_stats_probes(&cache->stats, probes);
+
         return 0;
       }
 
@@ -196,16 +265,16 @@ int dnscache_add(dnscache_t* cache,
 
       /* If the entry has expired... */
       if (now > entry->expiration_time) {
-        node_unlink((node_t*) entry);
-        free(entry);
+        free_cache_entry(cache, entry);
       }
 
       entry = next;
     }
 
+    cache_stats_probes(&cache->stats, probes);
+
     /* Create new entry. */
-    if ((entry = (cache_entry_t*) malloc(offsetof(cache_entry_t, host) +
-                                         hostlen + 1)) != NULL) {
+    if ((entry = (cache_entry_t*) malloc(cache_entry_size(hostlen))) != NULL) {
       memcpy(entry->addr, addr, addrlen);
 
       entry->expiration_time = expiration_time;
@@ -217,6 +286,10 @@ int dnscache_add(dnscache_t* cache,
 
       cache_entry_push_front(header, entry);
 
+      cache_stats_inc(&cache->stats.inserts);
+      cache_stats_inc(&cache->stats.entries);
+      cache_stats_add(&cache->stats.bytes, cache_entry_size(hostlen));
+
       return 0;
     }
   }
@@ -229,34 +302,53 @@ int dnscache_get(dnscache_t* cache,
                  size_t hostlen,
                  time_t now,
                  void* addr,
-                 socklen_t addrlen)
+                 socklen_t addrlen,
+                 time_t* expiration_time)
 {
   node_t* header;
   cache_entry_t* entry;
   cache_entry_t* next;
+  unsigned probes;
 
   if (hostlen <= HOSTNAME_MAX_LEN) {
     header = &cache->buckets[hash(host, hostlen, initval, cache->nbuckets)];
     entry = (cache_entry_t*) header->next;
+    probes = 0;
 
     while (entry != (cache_entry_t*) header) {
+      probes++;
+
       /* Same host?
        * (The caller is responsible for always using the same case, either
        *  lowercase or uppercase).
        */
       if ((hostlen == entry->hostlen) &&
           (memcmp(host, entry->host, hostlen) == 0)) {
+        cache_stats_probes(&cache->stats, probes);
+
         /* If the entry has not expired... */
         if (now <= entry->expiration_time) {
           /* Save address. */
           memcpy(addr, entry->addr, addrlen);
 
+          if (expiration_time) {
+            *expiration_time = entry->expiration_time;
+          }
+
           touch_cache_entry(header, entry);
 
+          cache_stats_inc(&cache->stats.hits);
+
+          TRACE2(cache_hit, host, hostlen);
+
           return 0;
         } else {
-          node_unlink((node_t*) entry);
-          free(entry);
+          free_cache_entry(cache, entry);
+
+          cache_stats_inc(&cache->stats.expired);
+          cache_stats_inc(&cache->stats.misses);
+
+          TRACE2(cache_expired, host, hostlen);
 
           return -1;
         }
@@ -265,15 +357,20 @@ int dnscache_get(dnscache_t* cache,
 
         /* If the entry has expired... */
         if (now > entry->expiration_time) {
-          node_unlink((node_t*) entry);
-          free(entry);
+          free_cache_entry(cache, entry);
         }
 
         entry = next;
       }
     }
+
+    cache_stats_probes(&cache->stats, probes);
   }
 
+  cache_stats_inc(&cache->stats.misses);
+
+  TRACE2(cache_miss, host, hostlen);
+
   return -1;
 }
 
@@ -293,8 +390,7 @@ void dnscache_remove_expired(dnscache_t* cache, time_t now)
 
       /* If the entry has expired... */
       if (now > entry->expiration_time) {
-        node_unlink((node_t*) entry);
-        free(entry);
+        free_cache_entry(cache, entry);
       }
 
       entry = next;
@@ -4,10 +4,13 @@
 #include <time.h>
 #include <netinet/in.h>
 #include "node.h"
+#include "cachestats.h"
 
 typedef struct {
   node_t* buckets;
   unsigned nbuckets;
+
+  cache_stats_t stats;
 } dnscache_t;
 
 typedef struct {
@@ -44,6 +47,30 @@ int dnscaches_get_ipv6(dnscaches_t* caches,
                        time_t now,
                        struct in6_addr* addr);
 
+/* Same as dnscaches_get_ipv4() / dnscaches_get_ipv6(), but they also
+ * return the expiration time of the entry.
+ */
+int dnscaches_lookup_ipv4(dnscaches_t* caches,
+                          const char* host,
+                          size_t hostlen,
+                          time_t now,
+                          struct in_addr* addr,
+                          time_t* expiration_time);
+
+int dnscaches_lookup_ipv6(dnscaches_t* caches,
+                          const char* host,
+                          size_t hostlen,
+                          time_t now,
+                          struct in6_addr* addr,
+                          time_t* expiration_time);
+
 void dnscaches_remove_expired(dnscaches_t* caches, time_t now);
 
+/* Takes a snapshot of the statistics of the caches (it can be called from
+ * a thread other than the one using the caches).
+ */
+void dnscaches_get_stats(const dnscaches_t* caches,
+                         cache_stats_t* ipv4,
+                         cache_stats_t* ipv6);
+
 #endif /* DNSCACHE_H */
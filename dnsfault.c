@@ -0,0 +1,1042 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
+#include "dns.h"
+#include "zone.h"
+#include "socket.h"
+#include "timers.h"
+#include "random.h"
+#include "macros.h"
+
+/* Stand-in DNS server for testing resolvers under faults: it answers the
+ * queries received over UDP and TCP from a zone (-z) or, without zone,
+ * with a canned address for every name (A 192.0.2.1, AAAA 2001:db8::1),
+ * and injects packet loss, latency, truncation, SERVFAIL and duplicated or
+ * reordered replies with the configured probabilities.
+ * The faults are drawn from a seeded generator (-s), so that a run can be
+ * repeated; the replies wait in a timer heap until their delay expires.
+ */
+
+#define DEFAULT_MAX_REPLIES     4096
+#define DEFAULT_MAX_CONNECTIONS 64
+#define DEFAULT_REORDER_DELAY   10 /* [ms] */
+#define DEFAULT_SEED            1
+#define MAX_LATENCY             60000 /* [ms] */
+#define CANNED_TTL              300 /* [s] */
+#define BATCH_SIZE              32
+#define MAX_EVENTS              64
+
+/* Data of the epoll events (the connections follow). */
+#define EVENT_UDP               0
+#define EVENT_LISTENER          1
+#define EVENT_CONNECTIONS       2
+
+typedef enum {
+  LATENCY_NONE,
+  LATENCY_FIXED,       /* fixed:<ms> */
+  LATENCY_UNIFORM,     /* uniform:<min>:<max> */
+  LATENCY_EXPONENTIAL, /* exp:<mean> */
+  LATENCY_PARETO       /* pareto:<min>:<alpha> (heavy tail) */
+} latency_distribution_t;
+
+typedef struct {
+  latency_distribution_t distribution;
+  double a;
+  double b;
+} latency_t;
+
+/* Probabilities of the faults [%]. */
+typedef struct {
+  double loss;
+  double truncation; /* UDP only. */
+  double servfail;
+  double duplicate; /* UDP only. */
+  double reorder;
+} faults_t;
+
+typedef struct {
+  int fd; /* -1: free. */
+
+  /* Incremented when the connection is closed, so that the replies to the
+   * queries of a previous connection are discarded.
+   */
+  unsigned generation;
+
+  /* Length-prefixed queries. */
+  uint8_t buf[2 + MAX_DNS_MESSAGE_SIZE];
+  size_t len;
+} connection_t;
+
+/* Reply waiting for its delay to expire. */
+typedef struct reply_t {
+  timer_entry_t timer;
+
+  /* Length prefix (TCP) and reply. */
+  uint8_t data[2 + MAX_DNS_MESSAGE_SIZE];
+  size_t len;
+
+  /* UDP: address of the client. */
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+
+  /* TCP: connection (NULL: UDP) and its generation. */
+  connection_t* connection;
+  unsigned generation;
+
+  struct reply_t* next; /* Free list. */
+} reply_t;
+
+typedef struct {
+  uint64_t udp_queries;
+  uint64_t tcp_queries;
+  uint64_t invalid;
+  uint64_t replies;
+  uint64_t dropped;
+  uint64_t truncated;
+  uint64_t servfails;
+  uint64_t duplicated;
+  uint64_t reordered;
+  uint64_t overflows; /* Queries dropped because all the replies were used. */
+  uint64_t tcp_connections;
+} fault_stats_t;
+
+typedef struct {
+  const zone_t* zone;
+
+  faults_t faults;
+  latency_t latency;
+  unsigned reorder_delay; /* [ms] */
+  uint64_t state;
+
+  int epfd;
+  int fd;
+  int listener;
+
+  connection_t* connections;
+  unsigned max_connections;
+
+  reply_t* replies;
+  reply_t* free_replies;
+  unsigned max_replies;
+
+  timer_heap_t timers;
+
+  /* Batch of queries received over UDP. */
+  struct mmsghdr msgs[BATCH_SIZE];
+  struct iovec iovs[BATCH_SIZE];
+  struct sockaddr_storage addrs[BATCH_SIZE];
+  uint8_t queries[BATCH_SIZE][MAX_DNS_MESSAGE_SIZE];
+
+  fault_stats_t stats;
+} server_t;
+
+static volatile sig_atomic_t stop;
+
+static void usage(const char* program);
+static void handle_signal(int nsignal);
+static int parse_latency(latency_t* latency, const char* arg);
+static int load_zone(zone_t* zone, char* arg);
+static int server_create(server_t* server,
+                         const struct sockaddr* addr,
+                         socklen_t addrlen);
+
+static void server_destroy(server_t* server);
+static int server_run(server_t* server);
+static void receive_udp(server_t* server);
+static void accept_connections(server_t* server);
+static void receive_tcp(server_t* server, connection_t* connection);
+static void close_connection(server_t* server, connection_t* connection);
+static void handle_query(server_t* server,
+                         const uint8_t* query,
+                         size_t len,
+                         const struct sockaddr_storage* addr,
+                         socklen_t addrlen,
+                         connection_t* connection);
+
+static int build_reply(const server_t* server,
+                       const dns_query_t* parsed,
+                       const uint8_t* query,
+                       size_t querylen,
+                       int fault,
+                       uint8_t* buf,
+                       size_t* len);
+
+static int build_canned_reply(const dns_query_t* parsed,
+                              const dns_question_t* question,
+                              uint8_t* buf,
+                              size_t* len);
+
+static void schedule_reply(server_t* server, reply_t* reply, uint64_t delay);
+static void send_replies(server_t* server);
+static void send_reply(server_t* server, reply_t* reply);
+static void print_stats(const server_t* server);
+static uint64_t sample_latency(server_t* server);
+
+static inline double random_percentage(server_t* server)
+{
+  return random_unit(&server->state) * 100.0;
+}
+
+static inline reply_t* allocate_reply(server_t* server)
+{
+  reply_t* reply;
+
+  if ((reply = server->free_replies) != NULL) {
+    server->free_replies = reply->next;
+  }
+
+  return reply;
+}
+
+static inline void free_reply(server_t* server, reply_t* reply)
+{
+  reply->next = server->free_replies;
+  server->free_replies = reply;
+}
+
+int main(int argc, char** argv)
+{
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  server_t* server;
+  zone_t zone;
+  char* zonearg;
+  double* probability;
+  int opt;
+  int ret;
+
+  if ((server = (server_t*) calloc(1, sizeof(server_t))) == NULL) {
+    fprintf(stderr, "Error allocating memory.\n");
+    return -1;
+  }
+
+  server->max_replies = DEFAULT_MAX_REPLIES;
+  server->max_connections = DEFAULT_MAX_CONNECTIONS;
+  server->reorder_delay = DEFAULT_REORDER_DELAY;
+  server->state = DEFAULT_SEED;
+
+  zonearg = NULL;
+
+  while ((opt = getopt(argc, argv, "z:l:T:F:u:R:d:o:q:c:s:")) != -1) {
+    probability = NULL;
+
+    switch (opt) {
+      case 'z':
+        zonearg = optarg;
+        break;
+      case 'l':
+        probability = &server->faults.loss;
+        break;
+      case 'T':
+        probability = &server->faults.truncation;
+        break;
+      case 'F':
+        probability = &server->faults.servfail;
+        break;
+      case 'u':
+        probability = &server->faults.duplicate;
+        break;
+      case 'R':
+        probability = &server->faults.reorder;
+        break;
+      case 'd':
+        if (parse_latency(&server->latency, optarg) < 0) {
+          usage(argv[0]);
+          free(server);
+          return -1;
+        }
+
+        break;
+      case 'o':
+        server->reorder_delay = atoi(optarg);
+        break;
+      case 'q':
+        server->max_replies = atoi(optarg);
+        break;
+      case 'c':
+        server->max_connections = atoi(optarg);
+        break;
+      case 's':
+        server->state = strtoull(optarg, NULL, 10);
+        break;
+      default:
+        usage(argv[0]);
+        free(server);
+        return -1;
+    }
+
+    if ((probability) &&
+        (((*probability = atof(optarg)) < 0) || (*probability > 100))) {
+      usage(argv[0]);
+      free(server);
+      return -1;
+    }
+  }
+
+  /* Check usage. */
+  if ((argc - optind != 1) || (server->max_replies == 0)) {
+    usage(argv[0]);
+    free(server);
+    return -1;
+  }
+
+  if (zonearg) {
+    if (load_zone(&zone, zonearg) < 0) {
+      free(server);
+      return -1;
+    }
+
+    server->zone = &zone;
+  }
+
+  if (build_socket_address(argv[optind], &addr, &addrlen) < 0) {
+    fprintf(stderr, "Invalid address '%s'.\n", argv[optind]);
+
+    if (zonearg) {
+      zone_destroy(&zone);
+    }
+
+    free(server);
+    return -1;
+  }
+
+  if (server_create(server, (const struct sockaddr*) &addr, addrlen) < 0) {
+    fprintf(stderr, "Error listening on '%s'.\n", argv[optind]);
+
+    server_destroy(server);
+
+    if (zonearg) {
+      zone_destroy(&zone);
+    }
+
+    free(server);
+    return -1;
+  }
+
+  signal(SIGINT, handle_signal);
+  signal(SIGTERM, handle_signal);
+
+  ret = server_run(server);
+
+  print_stats(server);
+
+  server_destroy(server);
+
+  if (zonearg) {
+    zone_destroy(&zone);
+  }
+
+  free(server);
+
+  return ret;
+}
+
+void usage(const char* program)
+{
+  printf("Usage: %s [-z <zone>:<zone-file>] [-l <loss>] [-T <truncation>] "
+         "[-F <servfail>] [-u <duplicate>] [-R <reorder>] "
+         "[-d <latency>] [-o <reorder-delay>] [-q <replies>] "
+         "[-c <connections>] [-s <seed>] <listen-address>\n",
+         program);
+
+  printf("  -z <zone>:<zone-file>: answer from the zone (default: A "
+         "192.0.2.1 / AAAA 2001:db8::1 for every name).\n");
+
+  printf("  -l <loss>: percentage of queries not answered.\n");
+  printf("  -T <truncation>: percentage of UDP replies truncated (TC set, "
+         "no records).\n");
+
+  printf("  -F <servfail>: percentage of SERVFAIL replies.\n");
+  printf("  -u <duplicate>: percentage of UDP replies sent twice.\n");
+  printf("  -R <reorder>: percentage of replies held back, so that later "
+         "replies overtake them.\n");
+
+  printf("  -d <latency>: delay of the replies [ms], 'fixed:<ms>', "
+         "'uniform:<min>:<max>', 'exp:<mean>' or 'pareto:<min>:<alpha>'.\n");
+
+  printf("  -o <reorder-delay>: extra delay of the replies held back [ms] "
+         "(default: %u).\n",
+         DEFAULT_REORDER_DELAY);
+
+  printf("  -q <replies>: maximum number of replies waiting (default: %u).\n",
+         DEFAULT_MAX_REPLIES);
+
+  printf("  -c <connections>: maximum number of TCP connections (default: "
+         "%u, 0: no TCP).\n",
+         DEFAULT_MAX_CONNECTIONS);
+
+  printf("  -s <seed>: seed of the faults (default: %u).\n", DEFAULT_SEED);
+}
+
+void handle_signal(int nsignal)
+{
+  stop = 1;
+}
+
+int parse_latency(latency_t* latency, const char* arg)
+{
+  static const struct {
+    const char* name;
+    latency_distribution_t distribution;
+    unsigned nparams;
+  } distributions[] = {
+    {"fixed", LATENCY_FIXED, 1},
+    {"uniform", LATENCY_UNIFORM, 2},
+    {"exp", LATENCY_EXPONENTIAL, 1},
+    {"pareto", LATENCY_PARETO, 2}
+  };
+
+  const char* params;
+  char* end;
+  size_t len;
+  unsigned i;
+
+  if ((params = strchr(arg, ':')) == NULL) {
+    return -1;
+  }
+
+  len = params - arg;
+
+  for (i = 0; i < ARRAY_SIZE(distributions); i++) {
+    if ((strlen(distributions[i].name) == len) &&
+        (memcmp(distributions[i].name, arg, len) == 0)) {
+      latency->distribution = distributions[i].distribution;
+
+      latency->a = strtod(params + 1, &end);
+
+      if (distributions[i].nparams == 2) {
+        if (*end != ':') {
+          return -1;
+        }
+
+        latency->b = strtod(end + 1, &end);
+      } else {
+        latency->b = 0;
+      }
+
+      if ((*end != 0) ||
+          (latency->a < 0) ||
+          ((latency->distribution == LATENCY_UNIFORM) &&
+           (latency->b < latency->a)) ||
+          ((latency->distribution == LATENCY_PARETO) && (latency->b <= 0))) {
+        return -1;
+      }
+
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+int load_zone(zone_t* zone, char* arg)
+{
+  char* filename;
+
+  if ((filename = strchr(arg, ':')) == NULL) {
+    fprintf(stderr, "Invalid zone '%s' (<zone>:<zone-file>).\n", arg);
+    return -1;
+  }
+
+  *filename++ = 0;
+
+  if (zone_load(zone, filename, arg, 0) < 0) {
+    if (zone->line != 0) {
+      fprintf(stderr,
+              "Error loading zone '%s' (%s:%u).\n",
+              arg,
+              filename,
+              zone->line);
+    } else {
+      fprintf(stderr, "Error loading zone '%s' from '%s'.\n", arg, filename);
+    }
+
+    return -1;
+  }
+
+  printf("Zone '%s': %u records.\n", arg, zone->nrecords);
+
+  return 0;
+}
+
+int server_create(server_t* server,
+                  const struct sockaddr* addr,
+                  socklen_t addrlen)
+{
+  struct epoll_event ev;
+  unsigned i;
+
+  server->epfd = -1;
+  server->fd = -1;
+  server->listener = -1;
+
+  if (((server->replies = (reply_t*) malloc(server->max_replies *
+                                            sizeof(reply_t))) == NULL) ||
+      (timer_heap_create(&server->timers, server->max_replies) < 0)) {
+    return -1;
+  }
+
+  for (i = 0; i < server->max_replies; i++) {
+    timer_init(&server->replies[i].timer);
+    free_reply(server, &server->replies[i]);
+  }
+
+  if (server->max_connections > 0) {
+    if ((server->connections =
+         (connection_t*) malloc(server->max_connections *
+                                sizeof(connection_t))) == NULL) {
+      return -1;
+    }
+
+    for (i = 0; i < server->max_connections; i++) {
+      server->connections[i].fd = -1;
+      server->connections[i].generation = 0;
+    }
+  }
+
+  for (i = 0; i < BATCH_SIZE; i++) {
+    server->iovs[i].iov_base = server->queries[i];
+    server->iovs[i].iov_len = sizeof(server->queries[i]);
+  }
+
+  if (((server->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) ||
+      ((server->fd = socket_create(addr->sa_family, SOCK_DGRAM)) == -1) ||
+      (socket_bind(server->fd, addr, addrlen) < 0)) {
+    return -1;
+  }
+
+  ev.events = EPOLLIN;
+  ev.data.u64 = EVENT_UDP;
+
+  if (epoll_ctl(server->epfd, EPOLL_CTL_ADD, server->fd, &ev) < 0) {
+    return -1;
+  }
+
+  /* TCP on the same address. */
+  if (server->max_connections > 0) {
+    if ((server->listener = socket_listen(addr, addrlen)) == -1) {
+      return -1;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = EVENT_LISTENER;
+
+    if (epoll_ctl(server->epfd, EPOLL_CTL_ADD, server->listener, &ev) < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+void server_destroy(server_t* server)
+{
+  unsigned i;
+
+  if (server->connections) {
+    for (i = 0; i < server->max_connections; i++) {
+      if (server->connections[i].fd != -1) {
+        close(server->connections[i].fd);
+      }
+    }
+
+    free(server->connections);
+    server->connections = NULL;
+  }
+
+  if (server->listener != -1) {
+    close(server->listener);
+    server->listener = -1;
+  }
+
+  if (server->fd != -1) {
+    close(server->fd);
+    server->fd = -1;
+  }
+
+  if (server->epfd != -1) {
+    close(server->epfd);
+    server->epfd = -1;
+  }
+
+  timer_heap_destroy(&server->timers);
+
+  if (server->replies) {
+    free(server->replies);
+    server->replies = NULL;
+  }
+}
+
+int server_run(server_t* server)
+{
+  struct epoll_event events[MAX_EVENTS];
+  uint64_t data;
+  int nevents;
+  int i;
+
+  while (!stop) {
+    if ((nevents = epoll_wait(server->epfd,
+                              events,
+                              MAX_EVENTS,
+                              timer_heap_timeout(&server->timers,
+                                                 timer_now()))) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      return -1;
+    }
+
+    for (i = 0; i < nevents; i++) {
+      data = events[i].data.u64;
+
+      if (data == EVENT_UDP) {
+        receive_udp(server);
+      } else if (data == EVENT_LISTENER) {
+        accept_connections(server);
+      } else {
+        receive_tcp(server, &server->connections[data - EVENT_CONNECTIONS]);
+      }
+    }
+
+    send_replies(server);
+  }
+
+  return 0;
+}
+
+void receive_udp(server_t* server)
+{
+  struct mmsghdr* msg;
+  int nmsgs;
+  int i;
+
+  do {
+    for (i = 0; i < BATCH_SIZE; i++) {
+      msg = &server->msgs[i];
+
+      memset(&msg->msg_hdr, 0, sizeof(struct msghdr));
+      msg->msg_hdr.msg_name = &server->addrs[i];
+      msg->msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+      msg->msg_hdr.msg_iov = &server->iovs[i];
+      msg->msg_hdr.msg_iovlen = 1;
+    }
+
+    if ((nmsgs = socket_recvmmsg(server->fd,
+                                 server->msgs,
+                                 BATCH_SIZE,
+                                 NULL)) <= 0) {
+      return;
+    }
+
+    for (i = 0; i < nmsgs; i++) {
+      msg = &server->msgs[i];
+
+      server->stats.udp_queries++;
+
+      handle_query(server,
+                   server->queries[i],
+                   msg->msg_len,
+                   &server->addrs[i],
+                   msg->msg_hdr.msg_namelen,
+                   NULL);
+    }
+  } while (nmsgs == BATCH_SIZE);
+}
+
+void accept_connections(server_t* server)
+{
+  connection_t* connection;
+  struct epoll_event ev;
+  unsigned i;
+  int fd;
+
+  while ((fd = socket_accept(server->listener, NULL, NULL)) != -1) {
+    connection = NULL;
+
+    for (i = 0; i < server->max_connections; i++) {
+      if (server->connections[i].fd == -1) {
+        connection = &server->connections[i];
+        break;
+      }
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = EVENT_CONNECTIONS + i;
+
+    if ((!connection) ||
+        (epoll_ctl(server->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)) {
+      close(fd);
+      continue;
+    }
+
+    connection->fd = fd;
+    connection->len = 0;
+
+    server->stats.tcp_connections++;
+  }
+}
+
+void receive_tcp(server_t* server, connection_t* connection)
+{
+  size_t msglen;
+  size_t offset;
+  ssize_t ret;
+
+  if ((ret = socket_recv(connection->fd,
+                         connection->buf + connection->len,
+                         sizeof(connection->buf) - connection->len)) <= 0) {
+    if ((ret == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK))) {
+      close_connection(server, connection);
+    }
+
+    return;
+  }
+
+  connection->len += ret;
+
+  /* Process the complete queries. */
+  offset = 0;
+
+  while (connection->len - offset >= 2) {
+    msglen = (connection->buf[offset] << 8) | connection->buf[offset + 1];
+
+    if ((msglen == 0) || (msglen > MAX_DNS_MESSAGE_SIZE)) {
+      close_connection(server, connection);
+      return;
+    }
+
+    if (connection->len - offset < 2 + msglen) {
+      break;
+    }
+
+    server->stats.tcp_queries++;
+
+    handle_query(server,
+                 connection->buf + offset + 2,
+                 msglen,
+                 NULL,
+                 0,
+                 connection);
+
+    offset += 2 + msglen;
+  }
+
+  if (offset > 0) {
+    memmove(connection->buf,
+            connection->buf + offset,
+            connection->len - offset);
+
+    connection->len -= offset;
+  }
+}
+
+void close_connection(server_t* server, connection_t* connection)
+{
+  close(connection->fd);
+
+  connection->fd = -1;
+  connection->generation++;
+}
+
+void handle_query(server_t* server,
+                  const uint8_t* query,
+                  size_t len,
+                  const struct sockaddr_storage* addr,
+                  socklen_t addrlen,
+                  connection_t* connection)
+{
+  dns_query_t parsed;
+  reply_t* reply;
+  reply_t* duplicate;
+  uint64_t delay;
+  int fault;
+
+  if (dns_parse_query(query, len, &parsed) != DNS_RCODE_NOERROR) {
+    server->stats.invalid++;
+    return;
+  }
+
+  if (random_percentage(server) < server->faults.loss) {
+    server->stats.dropped++;
+    return;
+  }
+
+  if ((reply = allocate_reply(server)) == NULL) {
+    server->stats.overflows++;
+    return;
+  }
+
+  /* Truncation (UDP only) or SERVFAIL. */
+  if ((!connection) &&
+      (random_percentage(server) < server->faults.truncation)) {
+    fault = DNS_FLAG_TC;
+    server->stats.truncated++;
+  } else if (random_percentage(server) < server->faults.servfail) {
+    fault = DNS_RCODE_SERVFAIL;
+    server->stats.servfails++;
+  } else {
+    fault = 0;
+  }
+
+  if (build_reply(server,
+                  &parsed,
+                  query,
+                  len,
+                  fault,
+                  reply->data + 2,
+                  &reply->len) < 0) {
+    free_reply(server, reply);
+    server->stats.invalid++;
+    return;
+  }
+
+  reply->connection = connection;
+
+  if (connection) {
+    reply->generation = connection->generation;
+
+    reply->data[0] = reply->len >> 8;
+    reply->data[1] = reply->len;
+  } else {
+    memcpy(&reply->addr, addr, addrlen);
+    reply->addrlen = addrlen;
+  }
+
+  delay = sample_latency(server);
+
+  if (random_percentage(server) < server->faults.reorder) {
+    delay += server->reorder_delay;
+    server->stats.reordered++;
+  }
+
+  /* The duplicate is sent right after the reply. */
+  if ((!connection) &&
+      (random_percentage(server) < server->faults.duplicate) &&
+      ((duplicate = allocate_reply(server)) != NULL)) {
+    memcpy(duplicate->data, reply->data, 2 + reply->len);
+    duplicate->len = reply->len;
+    memcpy(&duplicate->addr, &reply->addr, reply->addrlen);
+    duplicate->addrlen = reply->addrlen;
+    duplicate->connection = NULL;
+
+    schedule_reply(server, reply, delay);
+    schedule_reply(server, duplicate, delay);
+
+    server->stats.duplicated++;
+  } else {
+    schedule_reply(server, reply, delay);
+  }
+}
+
+int build_reply(const server_t* server,
+                const dns_query_t* parsed,
+                const uint8_t* query,
+                size_t querylen,
+                int fault,
+                uint8_t* buf,
+                size_t* len)
+{
+  dns_response_t response;
+  dns_header_t header;
+  dns_question_t question;
+  uint16_t flags;
+
+  if ((server->zone) && (fault == 0)) {
+    if (zone_answer(server->zone,
+                    parsed,
+                    query,
+                    buf,
+                    MAX_DNS_MESSAGE_SIZE,
+                    len) == 0) {
+      return 0;
+    }
+
+    /* Not in the zone. */
+    fault = DNS_RCODE_REFUSED;
+  }
+
+  /* The question is copied with its case. */
+  if (dns_process_header(query, querylen, &header, &question) < 0) {
+    return -1;
+  }
+
+  if (fault == 0) {
+    return build_canned_reply(parsed, &question, buf, len);
+  }
+
+  /* Truncated (header and question) or error. */
+  flags = DNS_FLAG_QR | (parsed->flags & DNS_FLAG_RD) | fault;
+
+  if (dns_response_init(&response,
+                        buf,
+                        MAX_DNS_MESSAGE_SIZE,
+                        parsed->id,
+                        flags,
+                        &question) < 0) {
+    return -1;
+  }
+
+  *len = dns_response_length(&response);
+
+  return 0;
+}
+
+int build_canned_reply(const dns_query_t* parsed,
+                       const dns_question_t* question,
+                       uint8_t* buf,
+                       size_t* len)
+{
+  dns_response_t response;
+  rr_t rr;
+
+  if (dns_response_init(&response,
+                        buf,
+                        MAX_DNS_MESSAGE_SIZE,
+                        parsed->id,
+                        DNS_FLAG_QR |
+                        DNS_FLAG_AA |
+                        (parsed->flags & DNS_FLAG_RD),
+                        question) < 0) {
+    return -1;
+  }
+
+  /* A / AAAA of the documentation ranges, other types: no data. */
+  if ((parsed->qclass == DNS_QCLASS_IN) &&
+      ((parsed->qtype == DNS_QTYPE_A) || (parsed->qtype == DNS_QTYPE_AAAA))) {
+    memset(&rr, 0, sizeof(rr_t));
+
+    memcpy(rr.name, question->name, question->namelen + 1);
+    rr.namelen = question->namelen;
+    rr.type = parsed->qtype;
+    rr.class = DNS_QCLASS_IN;
+    rr.ttl = CANNED_TTL;
+
+    if (parsed->qtype == DNS_QTYPE_A) {
+      inet_pton(AF_INET, "192.0.2.1", &rr.addr4);
+    } else {
+      inet_pton(AF_INET6, "2001:db8::1", &rr.addr6);
+    }
+
+    if (dns_response_add(&response, DNS_SECTION_ANSWER, &rr) < 0) {
+      return -1;
+    }
+  }
+
+  *len = dns_response_length(&response);
+
+  return 0;
+}
+
+void schedule_reply(server_t* server, reply_t* reply, uint64_t delay)
+{
+  /* The heap has room for all the replies. */
+  timer_heap_add(&server->timers, &reply->timer, timer_now() + delay);
+}
+
+void send_replies(server_t* server)
+{
+  timer_entry_t* timer;
+  uint64_t now;
+
+  now = timer_now();
+
+  while ((timer = timer_heap_pop_expired(&server->timers, now)) != NULL) {
+    send_reply(server, TIMER_CONTAINER(timer, reply_t, timer));
+  }
+}
+
+void send_reply(server_t* server, reply_t* reply)
+{
+  connection_t* connection;
+
+  if ((connection = reply->connection) != NULL) {
+    /* If the connection has not been closed in the meantime... */
+    if ((connection->fd != -1) &&
+        (connection->generation == reply->generation)) {
+      /* The replies are small: if one doesn't fit in the socket buffer,
+       * the client is not reading.
+       */
+      if (socket_send(connection->fd,
+                      reply->data,
+                      2 + reply->len) == (ssize_t) (2 + reply->len)) {
+        server->stats.replies++;
+      } else {
+        close_connection(server, connection);
+      }
+    }
+  } else {
+    if (socket_sendto(server->fd,
+                      reply->data + 2,
+                      reply->len,
+                      (const struct sockaddr*) &reply->addr,
+                      reply->addrlen) == (ssize_t) reply->len) {
+      server->stats.replies++;
+    }
+  }
+
+  free_reply(server, reply);
+}
+
+void print_stats(const server_t* server)
+{
+  const fault_stats_t* stats;
+
+  stats = &server->stats;
+
+  printf("Queries: %llu (UDP), %llu (TCP)\n",
+         (unsigned long long) stats->udp_queries,
+         (unsigned long long) stats->tcp_queries);
+
+  printf("Invalid: %llu\n", (unsigned long long) stats->invalid);
+  printf("Replies: %llu\n", (unsigned long long) stats->replies);
+  printf("Dropped: %llu (overflows: %llu)\n",
+         (unsigned long long) stats->dropped,
+         (unsigned long long) stats->overflows);
+
+  printf("Truncated: %llu\n", (unsigned long long) stats->truncated);
+  printf("SERVFAIL: %llu\n", (unsigned long long) stats->servfails);
+  printf("Duplicated: %llu\n", (unsigned long long) stats->duplicated);
+  printf("Reordered: %llu\n", (unsigned long long) stats->reordered);
+  printf("TCP connections: %llu\n",
+         (unsigned long long) stats->tcp_connections);
+}
+
+uint64_t sample_latency(server_t* server)
+{
+  const latency_t* latency;
+  double u;
+  double ms;
+
+  latency = &server->latency;
+
+  /* u in [0, 1). */
+  u = random_unit(&server->state);
+
+  switch (latency->distribution) {
+    case LATENCY_FIXED:
+      ms = latency->a;
+      break;
+    case LATENCY_UNIFORM:
+      ms = latency->a + u * (latency->b - latency->a);
+      break;
+    case LATENCY_EXPONENTIAL:
+      ms = -latency->a * log(1.0 - u);
+      break;
+    case LATENCY_PARETO:
+      ms = latency->a / pow(1.0 - u, 1.0 / latency->b);
+      break;
+    default:
+      return 0;
+  }
+
+  /* The timers have a resolution of one millisecond. */
+  return (ms < MAX_LATENCY) ? (uint64_t) (ms + 0.5) : MAX_LATENCY;
+}
@@ -0,0 +1,271 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include "workers.h"
+#include "stats.h"
+#include "socket.h"
+
+static void usage(const char* program);
+static void print_stats(const workers_t* workers);
+static int load_zone(zone_t* zone, char* arg, unsigned nthreads);
+
+int main(int argc, char** argv)
+{
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  workers_config_t config;
+  workers_t workers;
+  stats_server_t stats;
+  zone_t zone;
+  char* zonearg;
+  char* statsarg;
+  sigset_t set;
+  int nsignal;
+  int opt;
+  int i;
+
+  workers_config_init(&config);
+
+  zonearg = NULL;
+  statsarg = NULL;
+
+  while ((opt = getopt(argc, argv, "w:c:t:z:s:inpu")) != -1) {
+    switch (opt) {
+      case 'w':
+        config.nworkers = atoi(optarg);
+        break;
+      case 'c':
+        config.max_packets = atoi(optarg);
+        break;
+      case 't':
+        config.max_connections = atoi(optarg);
+        break;
+      case 'z':
+        zonearg = optarg;
+        break;
+      case 's':
+        statsarg = optarg;
+        break;
+      case 'i':
+        config.resolver.iterative = 1;
+        break;
+      case 'n':
+        config.steer_by_name = 1;
+        break;
+      case 'p':
+        config.pin_threads = 1;
+        break;
+      case 'u':
+        config.use_uring = 1;
+        break;
+      default:
+        usage(argv[0]);
+        return -1;
+    }
+  }
+
+  /* Check usage. */
+  if ((argc - optind < 2) || (argc - optind > UPSTREAMS_MAX + 1)) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  /* Load zone (shared by the workers). */
+  if (zonearg) {
+    if (load_zone(&zone, zonearg, config.nworkers) < 0) {
+      return -1;
+    }
+
+    config.zone = &zone;
+  }
+
+  /* Create workers. */
+  if ((build_socket_address(argv[optind], &addr, &addrlen) < 0) ||
+      (workers_create(&workers,
+                      &config,
+                      (const struct sockaddr*) &addr,
+                      addrlen) < 0)) {
+    fprintf(stderr, "Error listening on '%s'.\n", argv[optind]);
+
+    if (zonearg) {
+      zone_destroy(&zone);
+    }
+
+    return -1;
+  }
+
+  for (i = optind + 1; i < argc; i++) {
+    if ((build_socket_address(argv[i], &addr, &addrlen) < 0) ||
+        (workers_add_upstream(&workers,
+                              (const struct sockaddr*) &addr,
+                              addrlen) < 0)) {
+      fprintf(stderr, "Error adding DNS server '%s'.\n", argv[i]);
+
+      workers_destroy(&workers);
+
+      if (zonearg) {
+        zone_destroy(&zone);
+      }
+
+      return -1;
+    }
+  }
+
+  /* Create statistics endpoint. */
+  if ((statsarg) &&
+      ((build_socket_address(statsarg, &addr, &addrlen) < 0) ||
+       (stats_server_create(&stats,
+                            &workers,
+                            (const struct sockaddr*) &addr,
+                            addrlen) < 0))) {
+    fprintf(stderr, "Error listening on '%s' (statistics).\n", statsarg);
+
+    workers_destroy(&workers);
+
+    if (zonearg) {
+      zone_destroy(&zone);
+    }
+
+    return -1;
+  }
+
+  /* SIGINT / SIGTERM are handled by the main thread (the worker threads
+   * inherit the signal mask).
+   */
+  sigemptyset(&set);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGTERM);
+
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  if ((workers_start(&workers) < 0) ||
+      ((statsarg) && (stats_server_start(&stats) < 0))) {
+    fprintf(stderr, "Error starting workers.\n");
+
+    if (statsarg) {
+      stats_server_destroy(&stats);
+    }
+
+    workers_destroy(&workers);
+
+    if (zonearg) {
+      zone_destroy(&zone);
+    }
+
+    return -1;
+  }
+
+  sigwait(&set, &nsignal);
+
+  if (statsarg) {
+    stats_server_destroy(&stats);
+  }
+
+  workers_stop(&workers);
+
+  print_stats(&workers);
+
+  workers_destroy(&workers);
+
+  if (zonearg) {
+    zone_destroy(&zone);
+  }
+
+  return 0;
+}
+
+void usage(const char* program)
+{
+  printf("Usage: %s [-w <workers>] [-c <packets>] [-t <connections>] "
+         "[-z <zone>:<zone-file>] [-s <stats-address>] [-i] [-n] [-p] [-u] "
+         "<listen-address> "
+         "<DNS-server-address> "
+         "[<DNS-server-address> ...]\n",
+         program);
+
+  printf("  -w <workers>: number of worker threads (default: one per "
+         "CPU).\n");
+
+  printf("  -c <packets>: size of the packet cache of each worker (0: no "
+         "packet cache).\n");
+
+  printf("  -t <connections>: maximum number of TCP connections of each "
+         "worker (0: no TCP).\n");
+
+  printf("  -z <zone>:<zone-file>: serve the zone loaded from the master "
+         "file.\n");
+
+  printf("  -s <stats-address>: serve the statistics on a Unix socket (path) "
+         "or TCP address.\n");
+
+  printf("  -i: resolve the queries iteratively, the DNS servers are the "
+         "root servers.\n");
+
+  printf("  -n: queries for the same name go to the same worker.\n");
+  printf("  -p: pin the worker threads to CPUs.\n");
+  printf("  -u: use io_uring (if supported by the kernel).\n");
+}
+
+void print_stats(const workers_t* workers)
+{
+  forwarder_stats_t stats;
+  cache_stats_t ipv4;
+  cache_stats_t ipv6;
+  unsigned i;
+
+  for (i = 0; i < workers->nworkers; i++) {
+    workers_get_stats(workers, i, &stats);
+    workers_get_cache_stats(workers, i, &ipv4, &ipv6);
+
+    printf("Worker #%u:\n", i + 1);
+    printf("  Queries: %llu\n", (unsigned long long) stats.queries);
+    printf("  Cache hits: %llu\n", (unsigned long long) stats.cache_hits);
+    printf("  Authoritative: %llu\n",
+           (unsigned long long) stats.authoritative);
+    printf("  Forwarded: %llu\n", (unsigned long long) stats.forwarded);
+    printf("  Responses: %llu (dropped: %llu)\n",
+           (unsigned long long) stats.responses,
+           (unsigned long long) stats.dropped);
+    printf("  SERVFAIL: %llu\n", (unsigned long long) stats.servfails);
+    printf("  Invalid: %llu\n", (unsigned long long) stats.invalid);
+    printf("  TCP connections: %llu (rejected: %llu)\n",
+           (unsigned long long) stats.tcp_connections,
+           (unsigned long long) stats.tcp_rejected);
+    printf("  Cache entries: %llu (IPv4), %llu (IPv6)\n\n",
+           (unsigned long long) ipv4.entries,
+           (unsigned long long) ipv6.entries);
+  }
+}
+
+int load_zone(zone_t* zone, char* arg, unsigned nthreads)
+{
+  char* filename;
+
+  if ((filename = strchr(arg, ':')) == NULL) {
+    fprintf(stderr, "Invalid zone '%s' (<zone>:<zone-file>).\n", arg);
+    return -1;
+  }
+
+  *filename++ = 0;
+
+  if (zone_load(zone, filename, arg, nthreads) < 0) {
+    if (zone->line != 0) {
+      fprintf(stderr,
+              "Error loading zone '%s' (%s:%u).\n",
+              arg,
+              filename,
+              zone->line);
+    } else {
+      fprintf(stderr, "Error loading zone '%s' from '%s'.\n", arg, filename);
+    }
+
+    return -1;
+  }
+
+  printf("Zone '%s': %u records.\n", arg, zone->nrecords);
+
+  return 0;
+}
@@ -0,0 +1,834 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include "dns.h"
+#include "socket.h"
+#include "timers.h"
+#include "histogram.h"
+#include "macros.h"
+
+/* Load generator: replays a list of queries against a DNS server, either
+ * at a target rate (open loop) or keeping a number of queries outstanding
+ * (closed loop), and reports the throughput, the loss and the latency
+ * percentiles.
+ */
+
+#define NUMBER_IDS          65536
+#define MAX_BATCH_SIZE      64
+#define DEFAULT_BATCH_SIZE  32
+#define DEFAULT_OUTSTANDING 100
+#define DEFAULT_TIMEOUT     1000 /* [ms] */
+#define DEFAULT_BUFFER_SIZE (4 * 1024 * 1024)
+#define RESPONSE_SIZE       4096
+
+/* Requests of the query list (wire format, ID 0). */
+typedef struct {
+  uint8_t* data;
+  size_t len;
+  size_t size;
+
+  uint32_t* offsets;
+  uint32_t count;
+  uint32_t allocated;
+} query_list_t;
+
+/* Query in flight (by DNS ID). */
+typedef struct {
+  uint64_t sent; /* [us] */
+  uint64_t seq;
+  uint32_t query;
+  int active;
+} outstanding_t;
+
+/* Queries sent, in the order they were sent (to time them out). The
+ * entries of the queries already answered are skipped when they reach the
+ * head (or removed if the ring fills up); an entry belongs to the query in
+ * flight with its ID only if the sequence numbers match.
+ */
+typedef struct {
+  uint16_t id;
+  uint64_t seq;
+  uint64_t sent; /* [us] */
+} pending_t;
+
+typedef struct {
+  /* Configuration. */
+  unsigned rate; /* [queries / s] (0: closed loop). */
+  unsigned max_outstanding;
+  unsigned batch_size;
+  uint64_t duration; /* [us] (0: no limit). */
+  unsigned passes; /* Over the query list (0: no limit). */
+  uint64_t timeout; /* [us] */
+
+  int fd;
+  query_list_t list;
+
+  outstanding_t ids[NUMBER_IDS];
+
+  /* Free IDs (stack). */
+  uint16_t free_ids[NUMBER_IDS];
+  unsigned nfree;
+
+  pending_t pending[NUMBER_IDS];
+  unsigned head;
+  unsigned npending;
+
+  /* Queries waiting for their response. */
+  unsigned inflight;
+
+  /* Queries taken from the list (the list is replayed in passes). */
+  uint64_t issued;
+  int sending;
+
+  /* Counters. */
+  uint64_t sent;
+  uint64_t completed;
+  uint64_t lost;
+  uint64_t late; /* Unknown ID (e.g. response after the timeout). */
+  uint64_t mismatched; /* Question doesn't match. */
+  uint64_t malformed;
+  uint64_t truncated;
+  uint64_t rcodes[16];
+
+  histogram_t latency; /* [us] */
+
+  uint64_t start;
+
+  /* Batches. */
+  uint8_t requests[MAX_BATCH_SIZE][MAX_DNS_MESSAGE_SIZE];
+  struct iovec send_iov[MAX_BATCH_SIZE];
+  struct mmsghdr send_msgs[MAX_BATCH_SIZE];
+
+  uint8_t responses[MAX_BATCH_SIZE][RESPONSE_SIZE];
+  struct iovec iov[MAX_BATCH_SIZE];
+  struct mmsghdr msgs[MAX_BATCH_SIZE];
+
+  rr_t answers[64];
+} perf_t;
+
+static volatile sig_atomic_t stop;
+
+static void usage(const char* program);
+static int load_query_list(query_list_t* list, FILE* file);
+static int parse_qtype(const char* s, dns_qtype_t* qtype);
+static void run(perf_t* perf);
+static void send_queries(perf_t* perf, uint64_t now);
+static void receive_responses(perf_t* perf);
+static void process_response(perf_t* perf,
+                             const uint8_t* buf,
+                             size_t len,
+                             uint64_t now);
+
+static void compact_pending(perf_t* perf);
+static void expire_queries(perf_t* perf, uint64_t now);
+static int next_timeout(const perf_t* perf, uint64_t now);
+static void print_report(const perf_t* perf, uint64_t elapsed);
+
+static void handle_signal(int nsignal)
+{
+  stop = 1;
+}
+
+static inline const uint8_t* query_data(const query_list_t* list,
+                                        uint32_t query,
+                                        size_t* len)
+{
+  *len = ((query + 1 < list->count) ? list->offsets[query + 1] : list->len) -
+         list->offsets[query];
+
+  return list->data + list->offsets[query];
+}
+
+int main(int argc, char** argv)
+{
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  const char* filename;
+  perf_t* perf;
+  FILE* file;
+  int buffer_size;
+  uint16_t tmp;
+  unsigned i;
+  unsigned j;
+  int opt;
+  int ret;
+
+  if ((perf = (perf_t*) calloc(1, sizeof(perf_t))) == NULL) {
+    fprintf(stderr, "Error allocating memory.\n");
+    return -1;
+  }
+
+  perf->max_outstanding = DEFAULT_OUTSTANDING;
+  perf->batch_size = DEFAULT_BATCH_SIZE;
+  perf->timeout = DEFAULT_TIMEOUT * 1000ull;
+
+  filename = NULL;
+  buffer_size = DEFAULT_BUFFER_SIZE;
+
+  while ((opt = getopt(argc, argv, "d:Q:q:l:n:t:b:")) != -1) {
+    switch (opt) {
+      case 'd':
+        filename = optarg;
+        break;
+      case 'Q':
+        perf->rate = atoi(optarg);
+        break;
+      case 'q':
+        perf->max_outstanding = atoi(optarg);
+        break;
+      case 'l':
+        perf->duration = atoi(optarg) * 1000000ull;
+        break;
+      case 'n':
+        perf->passes = atoi(optarg);
+        break;
+      case 't':
+        perf->timeout = atoi(optarg) * 1000ull;
+        break;
+      case 'b':
+        perf->batch_size = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        free(perf);
+
+        return -1;
+    }
+  }
+
+  /* Check usage. */
+  if ((argc - optind != 1) ||
+      (perf->max_outstanding == 0) ||
+      (perf->max_outstanding > NUMBER_IDS) ||
+      (perf->batch_size == 0) ||
+      (perf->batch_size > MAX_BATCH_SIZE) ||
+      (perf->timeout == 0)) {
+    usage(argv[0]);
+    free(perf);
+
+    return -1;
+  }
+
+  /* Without limits, the query list is sent once. */
+  if ((perf->duration == 0) && (perf->passes == 0)) {
+    perf->passes = 1;
+  }
+
+  /* Load the query list. */
+  if (filename) {
+    if ((file = fopen(filename, "r")) == NULL) {
+      fprintf(stderr, "Error opening '%s'.\n", filename);
+      free(perf);
+
+      return -1;
+    }
+  } else {
+    file = stdin;
+  }
+
+  ret = load_query_list(&perf->list, file);
+
+  if (filename) {
+    fclose(file);
+  }
+
+  if (ret < 0) {
+    free(perf->list.data);
+    free(perf->list.offsets);
+    free(perf);
+
+    return -1;
+  }
+
+  /* Connected socket. */
+  if ((build_socket_address(argv[optind], &addr, &addrlen) < 0) ||
+      ((perf->fd = socket_create(addr.ss_family, SOCK_DGRAM)) == -1)) {
+    fprintf(stderr, "Invalid server address '%s'.\n", argv[optind]);
+
+    free(perf->list.data);
+    free(perf->list.offsets);
+    free(perf);
+
+    return -1;
+  }
+
+  /* The kernel might limit the size, it is not an error. */
+  setsockopt(perf->fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(int));
+  setsockopt(perf->fd, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(int));
+
+  if (connect(perf->fd, (const struct sockaddr*) &addr, addrlen) < 0) {
+    fprintf(stderr, "Error connecting to '%s'.\n", argv[optind]);
+
+    close(perf->fd);
+    free(perf->list.data);
+    free(perf->list.offsets);
+    free(perf);
+
+    return -1;
+  }
+
+  /* Free IDs in random order. */
+  srandom(timer_now_us());
+
+  for (i = 0; i < NUMBER_IDS; i++) {
+    perf->free_ids[i] = i;
+  }
+
+  for (i = NUMBER_IDS - 1; i > 0; i--) {
+    j = random() % (i + 1);
+
+    tmp = perf->free_ids[i];
+    perf->free_ids[i] = perf->free_ids[j];
+    perf->free_ids[j] = tmp;
+  }
+
+  perf->nfree = NUMBER_IDS;
+
+  signal(SIGINT, handle_signal);
+  signal(SIGTERM, handle_signal);
+
+  printf("Sending %u queries to %s (%s", perf->list.count, argv[optind],
+         perf->rate ? "open loop" : "closed loop");
+
+  if (perf->rate) {
+    printf(", %u queries/s).\n", perf->rate);
+  } else {
+    printf(", %u outstanding queries).\n", perf->max_outstanding);
+  }
+
+  run(perf);
+
+  close(perf->fd);
+  free(perf->list.data);
+  free(perf->list.offsets);
+  free(perf);
+
+  return 0;
+}
+
+void usage(const char* program)
+{
+  printf("Usage: %s [-d <query-file>] [-Q <qps>] [-q <outstanding>] "
+         "[-l <seconds>] [-n <passes>] [-t <timeout>] [-b <batch>] "
+         "<server-address>\n",
+         program);
+
+  printf("  -d <query-file>: queries, one per line: <name> <type> (default: "
+         "standard input).\n");
+
+  printf("  -Q <qps>: send the queries at this rate (open loop).\n");
+  printf("  -q <outstanding>: queries in flight in closed loop (default: "
+         "%u).\n",
+         DEFAULT_OUTSTANDING);
+
+  printf("  -l <seconds>: run for this time, replaying the query list.\n");
+  printf("  -n <passes>: number of passes over the query list (default: 1 "
+         "if there is no time limit).\n");
+
+  printf("  -t <timeout>: time after which a query is lost [ms] (default: "
+         "%u).\n",
+         DEFAULT_TIMEOUT);
+
+  printf("  -b <batch>: queries per sendmmsg() / recvmmsg() (default: %u, "
+         "max: %u).\n",
+         DEFAULT_BATCH_SIZE,
+         MAX_BATCH_SIZE);
+}
+
+int load_query_list(query_list_t* list, FILE* file)
+{
+  char line[1024];
+  char name[HOSTNAME_MAX_LEN + 2];
+  char type[16];
+  dns_qtype_t qtype;
+  unsigned nline;
+  size_t namelen;
+  size_t len;
+  void* p;
+
+  nline = 0;
+
+  while (fgets(line, sizeof(line), file)) {
+    nline++;
+
+    /* Skip empty lines and comments. */
+    if ((sscanf(line, "%256s", name) != 1) || (name[0] == '#')) {
+      continue;
+    }
+
+    if (sscanf(line, "%256s %15s", name, type) != 2) {
+      strcpy(type, "A");
+    }
+
+    /* Absolute names. */
+    namelen = strlen(name);
+
+    if ((namelen > 1) && (name[namelen - 1] == '.')) {
+      name[--namelen] = 0;
+    }
+
+    if ((namelen == 0) ||
+        (namelen > HOSTNAME_MAX_LEN) ||
+        (parse_qtype(type, &qtype) < 0)) {
+      fprintf(stderr, "Invalid query (line %u).\n", nline);
+      return -1;
+    }
+
+    /* Make room for the request. */
+    if (list->len + MAX_DNS_MESSAGE_SIZE > list->size) {
+      if ((p = realloc(list->data, 2 * list->size + 65536)) == NULL) {
+        fprintf(stderr, "Error allocating memory.\n");
+        return -1;
+      }
+
+      list->data = (uint8_t*) p;
+      list->size = 2 * list->size + 65536;
+    }
+
+    if (list->count == list->allocated) {
+      if ((p = realloc(list->offsets,
+                       (2 * list->allocated + 1024) * sizeof(uint32_t))) ==
+          NULL) {
+        fprintf(stderr, "Error allocating memory.\n");
+        return -1;
+      }
+
+      list->offsets = (uint32_t*) p;
+      list->allocated = 2 * list->allocated + 1024;
+    }
+
+    if (dns_build_request(0,
+                          qtype,
+                          DNS_QCLASS_IN,
+                          name,
+                          namelen,
+                          list->data + list->len,
+                          &len) < 0) {
+      fprintf(stderr, "Invalid name '%s' (line %u).\n", name, nline);
+      return -1;
+    }
+
+    list->offsets[list->count++] = list->len;
+    list->len += len;
+  }
+
+  if (list->count == 0) {
+    fprintf(stderr, "No queries.\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+int parse_qtype(const char* s, dns_qtype_t* qtype)
+{
+  static const dns_qtype_t qtypes[] = {
+    DNS_QTYPE_A,
+    DNS_QTYPE_NS,
+    DNS_QTYPE_CNAME,
+    DNS_QTYPE_SOA,
+    DNS_QTYPE_PTR,
+    DNS_QTYPE_MX,
+    DNS_QTYPE_TXT,
+    DNS_QTYPE_AAAA,
+    DNS_QTYPE_ALL
+  };
+
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE(qtypes); i++) {
+    if (strcasecmp(s, dns_qtype_to_string(qtypes[i])) == 0) {
+      *qtype = qtypes[i];
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+void run(perf_t* perf)
+{
+  struct pollfd pfd;
+  uint64_t now;
+  unsigned i;
+
+  for (i = 0; i < perf->batch_size; i++) {
+    perf->send_iov[i].iov_base = perf->requests[i];
+    perf->send_msgs[i].msg_hdr.msg_iov = &perf->send_iov[i];
+    perf->send_msgs[i].msg_hdr.msg_iovlen = 1;
+
+    perf->iov[i].iov_base = perf->responses[i];
+    perf->iov[i].iov_len = RESPONSE_SIZE;
+    perf->msgs[i].msg_hdr.msg_iov = &perf->iov[i];
+    perf->msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  pfd.fd = perf->fd;
+  pfd.events = POLLIN;
+
+  perf->sending = 1;
+  perf->start = timer_now_us();
+
+  /* Until all the queries have been answered or have timed out. */
+  while ((perf->sending) || (perf->inflight > 0)) {
+    now = timer_now_us();
+
+    if ((stop) ||
+        ((perf->duration != 0) && (now - perf->start >= perf->duration))) {
+      perf->sending = 0;
+    }
+
+    if (perf->sending) {
+      send_queries(perf, now);
+    }
+
+    receive_responses(perf);
+
+    now = timer_now_us();
+    expire_queries(perf, now);
+
+    if (((perf->sending) || (perf->inflight > 0)) &&
+        (poll(&pfd, 1, next_timeout(perf, now)) < 0) &&
+        (errno != EINTR)) {
+      break;
+    }
+  }
+
+  print_report(perf, timer_now_us() - perf->start);
+}
+
+void send_queries(perf_t* perf, uint64_t now)
+{
+  pending_t* pending;
+  const uint8_t* request;
+  uint64_t due;
+  unsigned count;
+  unsigned i;
+  size_t len;
+  uint16_t id;
+  uint64_t first;
+  int n;
+
+  do {
+    /* Queries to send now. */
+    if (perf->rate) {
+      due = ((now - perf->start) * perf->rate) / 1000000;
+      count = (due > perf->sent) ? MIN(due - perf->sent, perf->batch_size) :
+                                   0;
+    } else {
+      count = perf->max_outstanding - MIN(perf->inflight,
+                                          perf->max_outstanding);
+      count = MIN(count, perf->batch_size);
+    }
+
+    count = MIN(count, perf->nfree);
+
+    /* Make room in the ring (there are at most NUMBER_IDS - nfree queries
+     * in flight).
+     */
+    if (perf->npending + count > NUMBER_IDS) {
+      compact_pending(perf);
+    }
+
+    first = perf->issued;
+
+    for (i = 0; i < count; i++) {
+      /* All the passes done? */
+      if ((perf->passes != 0) &&
+          (perf->issued == (uint64_t) perf->passes * perf->list.count)) {
+        perf->sending = 0;
+        break;
+      }
+
+      request = query_data(&perf->list,
+                           perf->issued % perf->list.count,
+                           &len);
+
+      id = perf->free_ids[--perf->nfree];
+
+      memcpy(perf->requests[i], request, len);
+      perf->requests[i][0] = id >> 8;
+      perf->requests[i][1] = id & 0xff;
+
+      perf->send_iov[i].iov_len = len;
+
+      perf->ids[id].query = perf->issued++ % perf->list.count;
+    }
+
+    if ((count = i) == 0) {
+      return;
+    }
+
+    /* If the socket buffer is full, the queries are sent later; other
+     * errors (e.g. port unreachable) make them lost.
+     */
+    if ((n = socket_sendmmsg(perf->fd, perf->send_msgs, count)) < 0) {
+      n = ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == ENOBUFS)) ?
+          0 :
+          count;
+    }
+
+    now = timer_now_us();
+
+    for (i = 0; i < count; i++) {
+      id = (perf->requests[i][0] << 8) | perf->requests[i][1];
+
+      if (i < (unsigned) n) {
+        perf->ids[id].sent = now;
+        perf->ids[id].seq = perf->sent;
+        perf->ids[id].active = 1;
+
+        pending = &perf->pending[(perf->head + perf->npending) % NUMBER_IDS];
+        pending->id = id;
+        pending->seq = perf->sent;
+        pending->sent = now;
+        perf->npending++;
+
+        perf->inflight++;
+        perf->sent++;
+      } else {
+        /* Not sent (socket buffer full): the queries are sent later. */
+        if (i == (unsigned) n) {
+          perf->issued = first + i;
+          perf->sending = 1;
+        }
+
+        perf->free_ids[perf->nfree++] = id;
+      }
+    }
+
+    if ((unsigned) n < count) {
+      return;
+    }
+  } while (perf->sending);
+}
+
+void receive_responses(perf_t* perf)
+{
+  uint64_t now;
+  int n;
+  int i;
+
+  do {
+    if ((n = socket_recvmmsg(perf->fd,
+                             perf->msgs,
+                             perf->batch_size,
+                             NULL)) <= 0) {
+      return;
+    }
+
+    now = timer_now_us();
+
+    for (i = 0; i < n; i++) {
+      process_response(perf, perf->responses[i], perf->msgs[i].msg_len, now);
+    }
+  } while (n == (int) perf->batch_size);
+}
+
+void process_response(perf_t* perf,
+                      const uint8_t* buf,
+                      size_t len,
+                      uint64_t now)
+{
+  outstanding_t* outstanding;
+  const uint8_t* request;
+  dns_header_t header;
+  size_t requestlen;
+  size_t nanswers;
+  uint64_t latency;
+
+  if ((dns_process_header(buf, len, &header, NULL) < 0) ||
+      ((header.flags & DNS_FLAG_QR) == 0)) {
+    perf->malformed++;
+    return;
+  }
+
+  outstanding = &perf->ids[header.id];
+
+  if (!outstanding->active) {
+    perf->late++;
+    return;
+  }
+
+  /* The question must be the one sent. */
+  request = query_data(&perf->list, outstanding->query, &requestlen);
+
+  if ((len < requestlen) ||
+      (memcmp(buf + 12, request + 12, requestlen - 12) != 0)) {
+    perf->mismatched++;
+    return;
+  }
+
+  outstanding->active = 0;
+  perf->free_ids[perf->nfree++] = header.id;
+  perf->inflight--;
+
+  perf->completed++;
+  perf->rcodes[DNS_RCODE(header.flags)]++;
+
+  if (header.flags & DNS_FLAG_TC) {
+    perf->truncated++;
+  } else if ((DNS_RCODE(header.flags) == DNS_RCODE_NOERROR) &&
+             (len <= MAX_DNS_MESSAGE_SIZE)) {
+    nanswers = ARRAY_SIZE(perf->answers);
+
+    if (dns_process_response(buf,
+                             len,
+                             NULL,
+                             NULL,
+                             NULL,
+                             perf->answers,
+                             &nanswers,
+                             NULL,
+                             NULL) < 0) {
+      perf->malformed++;
+    }
+  }
+
+  latency = now - outstanding->sent;
+
+  histogram_add(&perf->latency, latency);
+}
+
+void compact_pending(perf_t* perf)
+{
+  const pending_t* pending;
+  const outstanding_t* outstanding;
+  unsigned npending;
+  unsigned i;
+
+  npending = 0;
+
+  for (i = 0; i < perf->npending; i++) {
+    pending = &perf->pending[(perf->head + i) % NUMBER_IDS];
+    outstanding = &perf->ids[pending->id];
+
+    if ((outstanding->active) && (outstanding->seq == pending->seq)) {
+      perf->pending[(perf->head + npending++) % NUMBER_IDS] = *pending;
+    }
+  }
+
+  perf->npending = npending;
+}
+
+void expire_queries(perf_t* perf, uint64_t now)
+{
+  const pending_t* pending;
+  outstanding_t* outstanding;
+
+  while (perf->npending > 0) {
+    pending = &perf->pending[perf->head];
+    outstanding = &perf->ids[pending->id];
+
+    /* Still waiting for the response? */
+    if ((outstanding->active) && (outstanding->seq == pending->seq)) {
+      if (now - pending->sent < perf->timeout) {
+        return;
+      }
+
+      outstanding->active = 0;
+      perf->free_ids[perf->nfree++] = pending->id;
+      perf->inflight--;
+
+      perf->lost++;
+    }
+
+    perf->head = (perf->head + 1) % NUMBER_IDS;
+    perf->npending--;
+  }
+}
+
+int next_timeout(const perf_t* perf, uint64_t now)
+{
+  uint64_t next;
+
+  next = UINT64_MAX;
+
+  /* Next query to send. */
+  if (perf->sending) {
+    if (perf->rate) {
+      next = perf->start + (((perf->sent + 1) * 1000000) / perf->rate);
+    } else if ((perf->inflight < perf->max_outstanding) && (perf->nfree > 0)) {
+      return 0;
+    }
+  }
+
+  /* Next query to time out (the head might have been answered already, then
+   * the queries are just expired earlier).
+   */
+  if (perf->inflight > 0) {
+    next = MIN(next, perf->pending[perf->head].sent + perf->timeout);
+  }
+
+  if (next == UINT64_MAX) {
+    return -1;
+  }
+
+  return (next > now) ? (int) MIN((next - now + 999) / 1000, 1000) : 0;
+}
+
+void print_report(const perf_t* perf, uint64_t elapsed)
+{
+  static const char* const rcodes[] = {
+    "NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED"
+  };
+
+  double seconds;
+  unsigned i;
+
+  seconds = elapsed / 1e6;
+
+  printf("\nStatistics:\n");
+  printf("  Queries sent:       %llu\n", (unsigned long long) perf->sent);
+  printf("  Queries completed:  %llu (%.2f%%)\n",
+         (unsigned long long) perf->completed,
+         perf->sent ? (100.0 * perf->completed) / perf->sent : 0.0);
+
+  printf("  Queries lost:       %llu (%.2f%%)\n",
+         (unsigned long long) perf->lost,
+         perf->sent ? (100.0 * perf->lost) / perf->sent : 0.0);
+
+  printf("  Late / mismatched / malformed responses: %llu / %llu / %llu\n",
+         (unsigned long long) perf->late,
+         (unsigned long long) perf->mismatched,
+         (unsigned long long) perf->malformed);
+
+  printf("  Truncated responses: %llu\n",
+         (unsigned long long) perf->truncated);
+
+  printf("  Response codes:");
+
+  for (i = 0; i < ARRAY_SIZE(perf->rcodes); i++) {
+    if (perf->rcodes[i] != 0) {
+      if (i < ARRAY_SIZE(rcodes)) {
+        printf(" %s %llu", rcodes[i], (unsigned long long) perf->rcodes[i]);
+      } else {
+        printf(" RCODE%u %llu", i, (unsigned long long) perf->rcodes[i]);
+      }
+    }
+  }
+
+  printf("\n");
+
+  printf("  Run time:           %.3f s\n", seconds);
+  printf("  Queries per second: %.1f\n",
+         (seconds > 0) ? perf->completed / seconds : 0.0);
+
+  if (perf->completed > 0) {
+    printf("  Latency [ms]: min %.3f, avg %.3f, p50 %.3f, p90 %.3f, "
+           "p99 %.3f, p99.9 %.3f, max %.3f\n",
+           perf->latency.min / 1e3,
+           (perf->latency.sum / 1e3) / perf->latency.count,
+           histogram_percentile(&perf->latency, 50) / 1e3,
+           histogram_percentile(&perf->latency, 90) / 1e3,
+           histogram_percentile(&perf->latency, 99) / 1e3,
+           histogram_percentile(&perf->latency, 99.9) / 1e3,
+           perf->latency.max / 1e3);
+  }
+}
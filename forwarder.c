@@ -0,0 +1,1744 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include "forwarder.h"
+#include "socket.h"
+#include "uring.h"
+#include "timers.h"
+#include "macros.h"
+#include "counters.h"
+
+#define MAX_EVENTS      FORWARDER_BATCH_SIZE
+#define LISTENER        0
+#define RESOLVER        1
+#define TCP_LISTENER    2
+
+/* Buffers of the TCP connections: queries and responses are preceded by
+ * their length (2 bytes). The queries are only processed while the output
+ * buffer can take one more response of the maximum size, the rest of the
+ * buffer holds the responses to the queries being resolved (the responses
+ * which don't fit are kept aside until the client reads the others).
+ */
+#define TCP_INPUT_SIZE  4096
+#define TCP_OUTPUT_SIZE ((FORWARDER_MAX_PIPELINED * \
+                          (2 + MAX_DNS_MESSAGE_SIZE)) + \
+                         (2 + MAX_DNS_TCP_MESSAGE_SIZE))
+
+/* io_uring backend. */
+#define URING_ENTRIES   256
+#define URING_BUFFERS   256 /* Power of 2. */
+#define URING_BGID      0
+
+/* user_data of the SQEs. */
+#define URING_RECV      1
+#define URING_POLL      2
+#define URING_SEND      3
+#define URING_EPOLL     4
+
+/* Received message: header, source address and payload. */
+#define URING_BUFFER_SIZE (sizeof(struct io_uring_recvmsg_out) + \
+                           sizeof(struct sockaddr_storage) + \
+                           MAX_DNS_MESSAGE_SIZE)
+
+struct forwarder_request_t {
+  forwarder_t* forwarder;
+
+  /* Client. */
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+
+  /* ID and flags of the query. */
+  uint16_t id;
+  uint16_t flags;
+
+  /* UDP payload size of the client (0: no EDNS). */
+  uint16_t udp_size;
+
+  /* Question as received (the response keeps the case of the name). */
+  uint8_t question[DNS_MAX_QUESTION_LEN];
+  size_t questionlen;
+
+  /* TCP connection (NULL: UDP). */
+  forwarder_connection_t* connection;
+
+  /* Next free request. */
+  forwarder_request_t* next;
+};
+
+struct forwarder_buffers_t {
+  /* Queries received. */
+  uint8_t queries[FORWARDER_BATCH_SIZE][MAX_DNS_MESSAGE_SIZE];
+  struct sockaddr_storage addrs[FORWARDER_BATCH_SIZE];
+  struct iovec iov[FORWARDER_BATCH_SIZE];
+  struct mmsghdr msgs[FORWARDER_BATCH_SIZE];
+
+  /* Responses to be sent. */
+  uint8_t responses[FORWARDER_BATCH_SIZE][FORWARDER_MAX_UDP_SIZE];
+  struct sockaddr_storage dests[FORWARDER_BATCH_SIZE];
+  struct iovec response_iov[FORWARDER_BATCH_SIZE];
+  struct mmsghdr response_msgs[FORWARDER_BATCH_SIZE];
+  unsigned nresponses;
+
+  /* Response to be queued on a TCP connection (it can be longer than a
+   * UDP response).
+   */
+  uint8_t tcp_response[MAX_DNS_TCP_MESSAGE_SIZE];
+};
+
+struct forwarder_uring_t {
+  uring_t uring;
+  uring_buffers_t buffers;
+
+  /* Template of the multishot receive (size of the source address). */
+  struct msghdr msg;
+
+  /* Are the multishot receive and the polls of the resolver and of the
+   * TCP connections active?
+   */
+  int receiving;
+  int polling;
+  int epolling;
+};
+
+struct forwarder_connection_t {
+  int fd;
+
+  /* Client. */
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+
+  /* Queries received (the last one might be incomplete). */
+  uint8_t in[TCP_INPUT_SIZE];
+  size_t inlen;
+
+  /* Responses not sent yet. */
+  uint8_t out[TCP_OUTPUT_SIZE];
+  size_t outlen;
+
+  /* Responses which didn't fit in the output buffer (several large
+   * responses at once), allocated when needed and moved to the output
+   * buffer as it is sent. It is only used while the output buffer is not
+   * empty.
+   */
+  uint8_t* spill;
+  size_t spilllen;
+
+  /* Queries being resolved. */
+  unsigned nrequests;
+
+  /* Has the client closed its side of the connection? */
+  int eof;
+
+  /* Did the last send fill the socket buffer? */
+  int blocked;
+
+  /* Events registered in epoll. */
+  uint32_t events;
+
+  /* Is the connection in the list of connections with responses to be
+   * sent?
+   */
+  int dirty;
+  forwarder_connection_t* next_dirty;
+
+  /* Idle timeout. */
+  timer_entry_t timer;
+
+  /* Is the connection in use (open or referred to by requests)? */
+  int active;
+
+  /* Next free connection. */
+  forwarder_connection_t* next;
+};
+
+struct forwarder_tcp_t {
+  int fd;
+
+  forwarder_connection_t* connections;
+  unsigned max_connections;
+
+  forwarder_connection_t* free_connections;
+
+  /* Connections with responses to be sent. */
+  forwarder_connection_t* dirty;
+
+  timer_heap_t timers;
+  int idle_timeout;
+};
+
+static int next_timeout(const forwarder_t* forwarder, int timeout);
+static void dispatch_events(forwarder_t* forwarder,
+                            const struct epoll_event* events,
+                            int nevents);
+
+static void receive_queries(forwarder_t* forwarder);
+static int process_uring(forwarder_t* forwarder, int timeout);
+
+#if HAVE_URING
+static int arm_receive(forwarder_t* forwarder);
+static int arm_poll(forwarder_t* forwarder, int fd, uint64_t user_data);
+static void receive_completion(forwarder_t* forwarder,
+                               const struct io_uring_cqe* cqe);
+#endif
+
+static void destroy_tcp(forwarder_tcp_t* tcp);
+static void accept_connections(forwarder_t* forwarder);
+static void connection_event(forwarder_t* forwarder,
+                             forwarder_connection_t* connection,
+                             uint32_t events);
+
+static void read_queries(forwarder_t* forwarder,
+                         forwarder_connection_t* connection);
+
+static void process_queries(forwarder_t* forwarder,
+                            forwarder_connection_t* connection);
+
+static void write_responses(forwarder_t* forwarder,
+                            forwarder_connection_t* connection);
+
+static void queue_tcp_response(forwarder_t* forwarder,
+                               forwarder_connection_t* connection,
+                               size_t len);
+
+static void schedule_connection(forwarder_t* forwarder,
+                                forwarder_connection_t* connection);
+
+static void flush_connections(forwarder_t* forwarder);
+static void expire_connections(forwarder_t* forwarder);
+static void close_connection(forwarder_t* forwarder,
+                             forwarder_connection_t* connection);
+
+static void update_connection(forwarder_t* forwarder,
+                              forwarder_connection_t* connection);
+
+static void process_query(forwarder_t* forwarder,
+                          forwarder_connection_t* connection,
+                          const uint8_t* buf,
+                          size_t len,
+                          const struct sockaddr* addr,
+                          socklen_t addrlen);
+
+static void resolved(const resolver_result_t* result, void* data);
+
+static size_t build_header(uint8_t* buf,
+                           uint16_t id,
+                           uint16_t flags,
+                           dns_rcode_t rcode,
+                           uint16_t qdcount,
+                           uint16_t ancount);
+
+static void send_error(forwarder_t* forwarder,
+                       forwarder_connection_t* connection,
+                       uint16_t id,
+                       uint16_t flags,
+                       const uint8_t* question,
+                       size_t questionlen,
+                       dns_rcode_t rcode,
+                       const struct sockaddr* addr,
+                       socklen_t addrlen);
+
+static void send_response(forwarder_t* forwarder,
+                          forwarder_connection_t* connection,
+                          size_t len,
+                          const struct sockaddr* addr,
+                          socklen_t addrlen);
+
+static void flush_responses(forwarder_t* forwarder);
+static void send_responses(forwarder_t* forwarder, unsigned first);
+static void queue_responses(forwarder_t* forwarder);
+
+/* Can the output buffer of the connection take one more response of the
+ * maximum size?
+ */
+static inline int output_available(const forwarder_connection_t* connection)
+{
+  return ((connection->spilllen == 0) &&
+          (connection->outlen + 2 + MAX_DNS_TCP_MESSAGE_SIZE <=
+           TCP_OUTPUT_SIZE));
+}
+
+/* Buffer for the next response. */
+static inline uint8_t* response_buffer(forwarder_t* forwarder,
+                                       const forwarder_connection_t* connection)
+{
+  if (connection) {
+    return forwarder->buffers->tcp_response;
+  }
+
+  return forwarder->buffers->responses[forwarder->buffers->nresponses];
+}
+
+/* Maximum size of a response to the client. */
+static inline size_t response_size(const forwarder_connection_t* connection,
+                                   uint16_t udp_size)
+{
+  if (connection) {
+    return MAX_DNS_TCP_MESSAGE_SIZE;
+  }
+
+  return MIN(MAX(udp_size, MAX_DNS_MESSAGE_SIZE), FORWARDER_MAX_UDP_SIZE);
+}
+
+static inline void free_request(forwarder_t* forwarder,
+                                forwarder_request_t* request)
+{
+  request->next = forwarder->free_requests;
+  forwarder->free_requests = request;
+}
+
+static inline void release_request(forwarder_t* forwarder,
+                                   forwarder_request_t* request)
+{
+  forwarder_connection_t* connection;
+
+  connection = request->connection;
+
+  free_request(forwarder, request);
+
+  if (connection) {
+    connection->nrequests--;
+
+    /* Queries received but not processed yet (too many being resolved)
+     * are processed with the next flush.
+     */
+    if ((connection->fd != -1) && (connection->inlen >= 2)) {
+      schedule_connection(forwarder, connection);
+    }
+
+    /* The connection might be waiting for its last queries. */
+    update_connection(forwarder, connection);
+  }
+}
+
+int forwarder_create(forwarder_t* forwarder,
+                     resolver_t* resolver,
+                     packetcache_t* packetcache,
+                     const struct sockaddr* addr,
+                     socklen_t addrlen,
+                     unsigned max_requests)
+{
+  forwarder_buffers_t* buffers;
+  struct epoll_event ev;
+  unsigned i;
+
+  if (max_requests == 0) {
+    return -1;
+  }
+
+  memset(forwarder, 0, sizeof(forwarder_t));
+
+  forwarder->epfd = -1;
+  forwarder->fd = -1;
+
+  forwarder->resolver = resolver;
+  forwarder->packetcache = packetcache;
+  forwarder->zone = NULL;
+
+  if (((forwarder->requests = (forwarder_request_t*)
+                              malloc(max_requests *
+                                     sizeof(forwarder_request_t))) != NULL) &&
+      ((forwarder->buffers = (forwarder_buffers_t*)
+                             malloc(sizeof(forwarder_buffers_t))) != NULL)) {
+    /* Build list of free requests. */
+    forwarder->free_requests = NULL;
+
+    for (i = max_requests; i > 0; i--) {
+      forwarder->requests[i - 1].forwarder = forwarder;
+      free_request(forwarder, &forwarder->requests[i - 1]);
+    }
+
+    /* Prepare the receive buffers. */
+    buffers = forwarder->buffers;
+
+    for (i = 0; i < FORWARDER_BATCH_SIZE; i++) {
+      buffers->iov[i].iov_base = buffers->queries[i];
+      buffers->iov[i].iov_len = MAX_DNS_MESSAGE_SIZE;
+
+      memset(&buffers->msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+      buffers->msgs[i].msg_hdr.msg_name = &buffers->addrs[i];
+      buffers->msgs[i].msg_hdr.msg_iov = &buffers->iov[i];
+      buffers->msgs[i].msg_hdr.msg_iovlen = 1;
+
+      buffers->response_iov[i].iov_base = buffers->responses[i];
+
+      memset(&buffers->response_msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+      buffers->response_msgs[i].msg_hdr.msg_name = &buffers->dests[i];
+      buffers->response_msgs[i].msg_hdr.msg_iov = &buffers->response_iov[i];
+      buffers->response_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    buffers->nresponses = 0;
+
+    if (((forwarder->epfd = epoll_create1(EPOLL_CLOEXEC)) != -1) &&
+        ((forwarder->fd = socket_create(addr->sa_family, SOCK_DGRAM)) != -1) &&
+        (socket_bind(forwarder->fd, addr, addrlen) == 0)) {
+      ev.events = EPOLLIN;
+      ev.data.u64 = LISTENER;
+
+      if (epoll_ctl(forwarder->epfd, EPOLL_CTL_ADD, forwarder->fd, &ev) == 0) {
+        ev.events = EPOLLIN;
+        ev.data.u64 = RESOLVER;
+
+        if (epoll_ctl(forwarder->epfd,
+                      EPOLL_CTL_ADD,
+                      resolver_fd(resolver),
+                      &ev) == 0) {
+          return 0;
+        }
+      }
+    }
+  }
+
+  forwarder_destroy(forwarder);
+
+  return -1;
+}
+
+void forwarder_destroy(forwarder_t* forwarder)
+{
+  if (forwarder->tcp) {
+    destroy_tcp(forwarder->tcp);
+    forwarder->tcp = NULL;
+  }
+
+  if (forwarder->uring) {
+    uring_buffers_destroy(&forwarder->uring->uring,
+                          &forwarder->uring->buffers);
+
+    uring_destroy(&forwarder->uring->uring);
+
+    free(forwarder->uring);
+    forwarder->uring = NULL;
+  }
+
+  if (forwarder->fd != -1) {
+    close(forwarder->fd);
+    forwarder->fd = -1;
+  }
+
+  if (forwarder->epfd != -1) {
+    close(forwarder->epfd);
+    forwarder->epfd = -1;
+  }
+
+  if (forwarder->buffers) {
+    free(forwarder->buffers);
+    forwarder->buffers = NULL;
+  }
+
+  if (forwarder->requests) {
+    free(forwarder->requests);
+    forwarder->requests = NULL;
+  }
+}
+
+int forwarder_listen_tcp(forwarder_t* forwarder,
+                         unsigned max_connections,
+                         int idle_timeout)
+{
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  forwarder_tcp_t* tcp;
+  forwarder_connection_t* connection;
+  struct epoll_event ev;
+  unsigned i;
+
+  if ((forwarder->tcp) || (max_connections == 0)) {
+    return -1;
+  }
+
+  /* Same address as the UDP socket (the port might have been chosen by
+   * the kernel).
+   */
+  addrlen = sizeof(struct sockaddr_storage);
+
+  if ((getsockname(forwarder->fd, (struct sockaddr*) &addr, &addrlen) < 0) ||
+      ((tcp = (forwarder_tcp_t*) calloc(1, sizeof(forwarder_tcp_t))) ==
+       NULL)) {
+    return -1;
+  }
+
+  tcp->fd = -1;
+  tcp->idle_timeout = idle_timeout;
+
+  if (((tcp->connections = (forwarder_connection_t*)
+                           malloc(max_connections *
+                                  sizeof(forwarder_connection_t))) != NULL) &&
+      (timer_heap_create(&tcp->timers, max_connections) == 0)) {
+    tcp->max_connections = max_connections;
+
+    /* Build list of free connections. */
+    for (i = max_connections; i > 0; i--) {
+      connection = &tcp->connections[i - 1];
+
+      connection->fd = -1;
+      connection->spill = NULL;
+      connection->spilllen = 0;
+      connection->active = 0;
+      timer_init(&connection->timer);
+
+      connection->next = tcp->free_connections;
+      tcp->free_connections = connection;
+    }
+
+    if ((tcp->fd = socket_listen((const struct sockaddr*) &addr,
+                                 addrlen)) != -1) {
+      ev.events = EPOLLIN;
+      ev.data.u64 = TCP_LISTENER;
+
+      if (epoll_ctl(forwarder->epfd, EPOLL_CTL_ADD, tcp->fd, &ev) == 0) {
+        forwarder->tcp = tcp;
+        return 0;
+      }
+    }
+  }
+
+  destroy_tcp(tcp);
+
+  return -1;
+}
+
+void forwarder_serve_zone(forwarder_t* forwarder, const zone_t* zone)
+{
+  forwarder->zone = zone;
+}
+
+int forwarder_use_uring(forwarder_t* forwarder)
+{
+#if HAVE_URING
+  forwarder_uring_t* uring;
+
+  if (forwarder->uring) {
+    return 0;
+  }
+
+  if ((uring = (forwarder_uring_t*) malloc(sizeof(forwarder_uring_t))) ==
+      NULL) {
+    return -1;
+  }
+
+  if (uring_create(&uring->uring, URING_ENTRIES) == 0) {
+    if (uring_buffers_create(&uring->uring,
+                             &uring->buffers,
+                             URING_BGID,
+                             URING_BUFFERS,
+                             URING_BUFFER_SIZE) == 0) {
+      memset(&uring->msg, 0, sizeof(struct msghdr));
+      uring->msg.msg_namelen = sizeof(struct sockaddr_storage);
+
+      uring->receiving = 0;
+      uring->polling = 0;
+      uring->epolling = 0;
+
+      forwarder->uring = uring;
+
+      /* Start receiving. */
+      if ((arm_receive(forwarder) == 0) &&
+          (uring_submit(&uring->uring) == 0)) {
+        /* The UDP socket and the resolver are handled by the ring, the
+         * epoll instance only keeps the TCP sockets.
+         */
+        epoll_ctl(forwarder->epfd, EPOLL_CTL_DEL, forwarder->fd, NULL);
+
+        epoll_ctl(forwarder->epfd,
+                  EPOLL_CTL_DEL,
+                  resolver_fd(forwarder->resolver),
+                  NULL);
+
+        return 0;
+      }
+
+      forwarder->uring = NULL;
+
+      uring_buffers_destroy(&uring->uring, &uring->buffers);
+    }
+
+    uring_destroy(&uring->uring);
+  }
+
+  free(uring);
+#endif /* HAVE_URING */
+
+  return -1;
+}
+
+int forwarder_process(forwarder_t* forwarder, int timeout)
+{
+  struct epoll_event events[MAX_EVENTS];
+  int ret;
+  int n;
+
+  if (forwarder->uring) {
+    return process_uring(forwarder, timeout);
+  }
+
+  if ((n = epoll_wait(forwarder->epfd,
+                      events,
+                      MAX_EVENTS,
+                      next_timeout(forwarder, timeout))) < 0) {
+    if (errno != EINTR) {
+      return -1;
+    }
+
+    n = 0;
+  }
+
+  dispatch_events(forwarder, events, n);
+
+  /* Responses from the upstream servers and expired queries. */
+  ret = resolver_process(forwarder->resolver, 0);
+
+  /* TCP connections. */
+  if (forwarder->tcp) {
+    expire_connections(forwarder);
+    flush_connections(forwarder);
+  }
+
+  flush_responses(forwarder);
+
+  return ret;
+}
+
+void forwarder_get_stats(const forwarder_t* forwarder,
+                         forwarder_stats_t* stats)
+{
+  counters_snapshot(&forwarder->stats, stats, sizeof(forwarder_stats_t));
+}
+
+int next_timeout(const forwarder_t* forwarder, int timeout)
+{
+  int t;
+
+  /* Don't wait past the next query timeout... */
+  if (((t = resolver_timeout(forwarder->resolver)) != -1) &&
+      ((timeout == -1) || (t < timeout))) {
+    timeout = t;
+  }
+
+  /* ... nor past the next idle timeout. */
+  if ((forwarder->tcp) &&
+      ((t = timer_heap_timeout(&forwarder->tcp->timers, timer_now())) != -1) &&
+      ((timeout == -1) || (t < timeout))) {
+    timeout = t;
+  }
+
+  return timeout;
+}
+
+void dispatch_events(forwarder_t* forwarder,
+                     const struct epoll_event* events,
+                     int nevents)
+{
+  int i;
+
+  for (i = 0; i < nevents; i++) {
+    switch (events[i].data.u64) {
+      case LISTENER:
+        receive_queries(forwarder);
+        break;
+      case RESOLVER:
+        /* The resolver is processed after the events. */
+        break;
+      case TCP_LISTENER:
+        accept_connections(forwarder);
+        break;
+      default:
+        connection_event(forwarder,
+                         (forwarder_connection_t*) events[i].data.ptr,
+                         events[i].events);
+
+        break;
+    }
+  }
+}
+
+void receive_queries(forwarder_t* forwarder)
+{
+  forwarder_buffers_t* buffers;
+  int n;
+  int i;
+
+  buffers = forwarder->buffers;
+
+  do {
+    for (i = 0; i < FORWARDER_BATCH_SIZE; i++) {
+      buffers->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    }
+
+    if ((n = socket_recvmmsg(forwarder->fd,
+                             buffers->msgs,
+                             FORWARDER_BATCH_SIZE,
+                             NULL)) <= 0) {
+      return;
+    }
+
+    for (i = 0; i < n; i++) {
+      process_query(forwarder,
+                    NULL,
+                    buffers->queries[i],
+                    buffers->msgs[i].msg_len,
+                    (const struct sockaddr*) &buffers->addrs[i],
+                    buffers->msgs[i].msg_hdr.msg_namelen);
+    }
+
+    /* Responses from the caches and errors. */
+    flush_responses(forwarder);
+  } while (n == FORWARDER_BATCH_SIZE);
+}
+
+void process_query(forwarder_t* forwarder,
+                   forwarder_connection_t* connection,
+                   const uint8_t* buf,
+                   size_t len,
+                   const struct sockaddr* addr,
+                   socklen_t addrlen)
+{
+  forwarder_request_t* request;
+  dns_query_t parsed;
+  char name[HOSTNAME_MAX_LEN + 1];
+  size_t namelen;
+  size_t questionlen;
+  size_t responselen;
+  int rcode;
+
+  counter_inc(&forwarder->stats.queries);
+
+  /* Never answer a response (nor a message too short to be a query). */
+  if ((rcode = dns_parse_query(buf, len, &parsed)) < 0) {
+    counter_inc(&forwarder->stats.invalid);
+    return;
+  }
+
+  if (rcode != DNS_RCODE_NOERROR) {
+    if (rcode == DNS_RCODE_FORMERR) {
+      counter_inc(&forwarder->stats.invalid);
+    }
+
+    send_error(forwarder,
+               connection,
+               parsed.id,
+               parsed.flags,
+               NULL,
+               0,
+               rcode,
+               addr,
+               addrlen);
+
+    return;
+  }
+
+  /* The question is the first thing after the header. */
+  questionlen = parsed.keylen;
+
+  if ((forwarder->zone) &&
+      (zone_answer(forwarder->zone,
+                   &parsed,
+                   buf,
+                   response_buffer(forwarder, connection),
+                   response_size(connection, parsed.udp_size),
+                   &responselen) == 0)) {
+    counter_inc(&forwarder->stats.authoritative);
+
+    send_response(forwarder, connection, responselen, addr, addrlen);
+
+    return;
+  }
+
+  /* Try first with the packet cache. */
+  if ((forwarder->packetcache) &&
+      (packetcache_lookup(forwarder->packetcache,
+                          &parsed,
+                          buf,
+                          time(NULL),
+                          response_buffer(forwarder, connection),
+                          &responselen) == 0)) {
+    counter_inc(&forwarder->stats.cache_hits);
+
+    send_response(forwarder, connection, responselen, addr, addrlen);
+
+    return;
+  }
+
+  if ((request = forwarder->free_requests) == NULL) {
+    send_error(forwarder,
+               connection,
+               parsed.id,
+               parsed.flags,
+               buf + 12,
+               questionlen,
+               DNS_RCODE_SERVFAIL,
+               addr,
+               addrlen);
+
+    return;
+  }
+
+  forwarder->free_requests = request->next;
+
+  memcpy(&request->addr, addr, addrlen);
+  request->addrlen = addrlen;
+
+  request->id = parsed.id;
+  request->flags = parsed.flags;
+  request->udp_size = parsed.udp_size;
+
+  memcpy(request->question, buf + 12, questionlen);
+  request->questionlen = questionlen;
+
+  request->connection = connection;
+
+  if (connection) {
+    connection->nrequests++;
+  }
+
+  /* The callback is invoked before returning if the answer is in the DNS
+   * cache.
+   */
+  if ((dns_query_name(&parsed, name, &namelen) < 0) ||
+      (resolver_resolve(forwarder->resolver,
+                        name,
+                        namelen,
+                        parsed.qtype,
+                        parsed.qclass,
+                        resolved,
+                        request) < 0)) {
+    send_error(forwarder,
+               connection,
+               parsed.id,
+               parsed.flags,
+               buf + 12,
+               questionlen,
+               DNS_RCODE_SERVFAIL,
+               addr,
+               addrlen);
+
+    release_request(forwarder, request);
+  }
+}
+
+void resolved(const resolver_result_t* result, void* data)
+{
+  forwarder_request_t* request;
+  forwarder_t* forwarder;
+  const rr_t* rr;
+  uint8_t* buf;
+  uint8_t* p;
+  size_t len;
+
+  request = (forwarder_request_t*) data;
+  forwarder = request->forwarder;
+
+  buf = response_buffer(forwarder, request->connection);
+
+  if (result->cached) {
+    counter_inc(&forwarder->stats.cache_hits);
+
+    /* Build the response with the address from the DNS cache. */
+    rr = &result->answers[0];
+
+    len = build_header(buf,
+                       request->id,
+                       request->flags,
+                       DNS_RCODE_NOERROR,
+                       1,
+                       1);
+
+    memcpy(buf + len, request->question, request->questionlen);
+    p = buf + len + request->questionlen;
+
+    /* Pointer to the name of the question. */
+    *p++ = 0xc0;
+    *p++ = 12;
+
+    *p++ = (rr->type >> 8) & 0xff;
+    *p++ = rr->type & 0xff;
+
+    *p++ = (rr->class >> 8) & 0xff;
+    *p++ = rr->class & 0xff;
+
+    /* Remaining time to live. */
+    *p++ = (rr->ttl >> 24) & 0xff;
+    *p++ = (rr->ttl >> 16) & 0xff;
+    *p++ = (rr->ttl >> 8) & 0xff;
+    *p++ = rr->ttl & 0xff;
+
+    *p++ = (rr->rdlength >> 8) & 0xff;
+    *p++ = rr->rdlength & 0xff;
+
+    memcpy(p, &rr->addr6, rr->rdlength);
+
+    send_response(forwarder,
+                  request->connection,
+                  (p + rr->rdlength) - buf,
+                  (const struct sockaddr*) &request->addr,
+                  request->addrlen);
+  } else {
+    counter_inc(&forwarder->stats.forwarded);
+
+    if ((result->response) &&
+        (result->responselen > response_size(request->connection,
+                                             request->udp_size)) &&
+        (result->status != RESOLVER_TIMEOUT)) {
+      /* Too long for UDP: header and question with the TC flag (the client
+       * repeats the query over TCP).
+       */
+      len = build_header(buf,
+                         request->id,
+                         request->flags,
+                         DNS_RCODE(((const uint8_t*) result->response)[3]),
+                         1,
+                         0);
+
+      buf[2] |= DNS_FLAG_TC >> 8;
+
+      memcpy(buf + len, request->question, request->questionlen);
+
+      send_response(forwarder,
+                    request->connection,
+                    len + request->questionlen,
+                    (const struct sockaddr*) &request->addr,
+                    request->addrlen);
+    } else if ((result->response) &&
+               (result->responselen >= 12 + request->questionlen) &&
+               (result->status != RESOLVER_TIMEOUT)) {
+      /* Relay the response with the ID, the question and the "recursion
+       * desired" flag of the query.
+       */
+      memcpy(buf, result->response, result->responselen);
+
+      buf[0] = (request->id >> 8) & 0xff;
+      buf[1] = request->id & 0xff;
+
+      buf[2] = (buf[2] & ~(DNS_FLAG_RD >> 8)) |
+               ((request->flags & DNS_FLAG_RD) >> 8);
+
+      memcpy(buf + 12, request->question, request->questionlen);
+
+      if (forwarder->packetcache) {
+        packetcache_add(forwarder->packetcache,
+                        buf,
+                        result->responselen,
+                        time(NULL));
+      }
+
+      send_response(forwarder,
+                    request->connection,
+                    result->responselen,
+                    (const struct sockaddr*) &request->addr,
+                    request->addrlen);
+    } else {
+      send_error(forwarder,
+                 request->connection,
+                 request->id,
+                 request->flags,
+                 request->question,
+                 request->questionlen,
+                 DNS_RCODE_SERVFAIL,
+                 (const struct sockaddr*) &request->addr,
+                 request->addrlen);
+    }
+  }
+
+  release_request(forwarder, request);
+}
+
+size_t build_header(uint8_t* buf,
+                    uint16_t id,
+                    uint16_t flags,
+                    dns_rcode_t rcode,
+                    uint16_t qdcount,
+                    uint16_t ancount)
+{
+  /* Response with the opcode and the "recursion desired" flag of the
+   * query, recursion available.
+   */
+  flags = DNS_FLAG_QR |
+          (flags & (0x7800 | DNS_FLAG_RD)) |
+          DNS_FLAG_RA |
+          rcode;
+
+  buf[0] = (id >> 8) & 0xff;
+  buf[1] = id & 0xff;
+
+  buf[2] = (flags >> 8) & 0xff;
+  buf[3] = flags & 0xff;
+
+  buf[4] = (qdcount >> 8) & 0xff;
+  buf[5] = qdcount & 0xff;
+
+  buf[6] = (ancount >> 8) & 0xff;
+  buf[7] = ancount & 0xff;
+
+  /* NSCOUNT = ARCOUNT = 0. */
+  buf[8] = 0;
+  buf[9] = 0;
+  buf[10] = 0;
+  buf[11] = 0;
+
+  return 12;
+}
+
+void send_error(forwarder_t* forwarder,
+                forwarder_connection_t* connection,
+                uint16_t id,
+                uint16_t flags,
+                const uint8_t* question,
+                size_t questionlen,
+                dns_rcode_t rcode,
+                const struct sockaddr* addr,
+                socklen_t addrlen)
+{
+  uint8_t* buf;
+  size_t len;
+
+  if (rcode == DNS_RCODE_SERVFAIL) {
+    counter_inc(&forwarder->stats.servfails);
+  }
+
+  buf = response_buffer(forwarder, connection);
+
+  len = build_header(buf, id, flags, rcode, question ? 1 : 0, 0);
+
+  if (question) {
+    memcpy(buf + len, question, questionlen);
+    len += questionlen;
+  }
+
+  send_response(forwarder, connection, len, addr, addrlen);
+}
+
+void send_response(forwarder_t* forwarder,
+                   forwarder_connection_t* connection,
+                   size_t len,
+                   const struct sockaddr* addr,
+                   socklen_t addrlen)
+{
+  forwarder_buffers_t* buffers;
+  unsigned n;
+
+  counter_inc(&forwarder->stats.responses);
+
+  if (connection) {
+    queue_tcp_response(forwarder, connection, len);
+    return;
+  }
+
+  /* The response has been built in the next buffer. */
+  buffers = forwarder->buffers;
+  n = buffers->nresponses++;
+
+  buffers->response_iov[n].iov_len = len;
+
+  memcpy(&buffers->dests[n], addr, addrlen);
+  buffers->response_msgs[n].msg_hdr.msg_namelen = addrlen;
+
+  if (buffers->nresponses == FORWARDER_BATCH_SIZE) {
+    flush_responses(forwarder);
+
+    /* The buffers are about to be reused. */
+    if (forwarder->uring) {
+      uring_submit(&forwarder->uring->uring);
+    }
+  }
+}
+
+void flush_responses(forwarder_t* forwarder)
+{
+  if (forwarder->uring) {
+    queue_responses(forwarder);
+  } else {
+    send_responses(forwarder, 0);
+  }
+
+  forwarder->buffers->nresponses = 0;
+}
+
+void send_responses(forwarder_t* forwarder, unsigned first)
+{
+  forwarder_buffers_t* buffers;
+  unsigned sent;
+  int n;
+
+  buffers = forwarder->buffers;
+
+  for (sent = first; sent < buffers->nresponses; sent += n) {
+    if ((n = socket_sendmmsg(forwarder->fd,
+                             buffers->response_msgs + sent,
+                             buffers->nresponses - sent)) <= 0) {
+      /* Socket buffer full: the rest of the responses are dropped (the
+       * clients will retransmit their queries).
+       */
+      counter_add(&forwarder->stats.dropped, buffers->nresponses - sent);
+      break;
+    }
+  }
+}
+
+void destroy_tcp(forwarder_tcp_t* tcp)
+{
+  unsigned i;
+
+  for (i = 0; i < tcp->max_connections; i++) {
+    if (tcp->connections[i].fd != -1) {
+      close(tcp->connections[i].fd);
+    }
+
+    free(tcp->connections[i].spill);
+  }
+
+  if (tcp->fd != -1) {
+    close(tcp->fd);
+  }
+
+  timer_heap_destroy(&tcp->timers);
+
+  if (tcp->connections) {
+    free(tcp->connections);
+  }
+
+  free(tcp);
+}
+
+void accept_connections(forwarder_t* forwarder)
+{
+  forwarder_tcp_t* tcp;
+  forwarder_connection_t* connection;
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  struct epoll_event ev;
+  unsigned i;
+  int fd;
+
+  tcp = forwarder->tcp;
+
+  /* A bounded number of connections per call (the UDP socket is not
+   * starved).
+   */
+  for (i = 0; i < FORWARDER_BATCH_SIZE; i++) {
+    addrlen = sizeof(struct sockaddr_storage);
+
+    if ((fd = socket_accept(tcp->fd,
+                            (struct sockaddr*) &addr,
+                            &addrlen)) == -1) {
+      return;
+    }
+
+    if ((connection = tcp->free_connections) == NULL) {
+      counter_inc(&forwarder->stats.tcp_rejected);
+
+      close(fd);
+      continue;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = connection;
+
+    if ((epoll_ctl(forwarder->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) ||
+        (timer_heap_add(&tcp->timers,
+                        &connection->timer,
+                        timer_now() + tcp->idle_timeout) < 0)) {
+      close(fd);
+      continue;
+    }
+
+    counter_inc(&forwarder->stats.tcp_connections);
+
+    tcp->free_connections = connection->next;
+
+    connection->fd = fd;
+
+    memcpy(&connection->addr, &addr, addrlen);
+    connection->addrlen = addrlen;
+
+    connection->inlen = 0;
+    connection->outlen = 0;
+    connection->nrequests = 0;
+    connection->eof = 0;
+    connection->blocked = 0;
+    connection->events = EPOLLIN;
+    connection->dirty = 0;
+    connection->active = 1;
+  }
+}
+
+void connection_event(forwarder_t* forwarder,
+                      forwarder_connection_t* connection,
+                      uint32_t events)
+{
+  /* The connection might have been closed by a previous event. */
+  if (connection->fd == -1) {
+    return;
+  }
+
+  if (events & EPOLLERR) {
+    close_connection(forwarder, connection);
+  } else {
+    if (events & EPOLLIN) {
+      read_queries(forwarder, connection);
+    }
+
+    if ((connection->fd != -1) && (events & EPOLLOUT)) {
+      write_responses(forwarder, connection);
+
+      /* Queries waiting for room in the output buffer. */
+      if ((connection->fd != -1) && (connection->inlen >= 2)) {
+        schedule_connection(forwarder, connection);
+      }
+    }
+  }
+
+  update_connection(forwarder, connection);
+}
+
+void read_queries(forwarder_t* forwarder, forwarder_connection_t* connection)
+{
+  ssize_t n;
+
+  /* The buffer is full of queries waiting for others to be resolved. */
+  if (connection->inlen == TCP_INPUT_SIZE) {
+    return;
+  }
+
+  /* A single read per event. */
+  if ((n = socket_recv(connection->fd,
+                       connection->in + connection->inlen,
+                       TCP_INPUT_SIZE - connection->inlen)) <= 0) {
+    if (n == 0) {
+      connection->eof = 1;
+    } else if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+      close_connection(forwarder, connection);
+    }
+
+    return;
+  }
+
+  connection->inlen += n;
+
+  timer_heap_add(&forwarder->tcp->timers,
+                 &connection->timer,
+                 timer_now() + forwarder->tcp->idle_timeout);
+
+  process_queries(forwarder, connection);
+}
+
+void process_queries(forwarder_t* forwarder,
+                     forwarder_connection_t* connection)
+{
+  const uint8_t* p;
+  size_t left;
+  size_t len;
+
+  /* Process the complete queries (up to FORWARDER_MAX_PIPELINED being
+   * resolved, and while the responses not sent yet leave room for one of
+   * the maximum size).
+   */
+  p = connection->in;
+  left = connection->inlen;
+
+  while ((left >= 2) &&
+         (connection->nrequests < FORWARDER_MAX_PIPELINED) &&
+         (output_available(connection))) {
+    len = (p[0] << 8) | p[1];
+
+    if ((len < 12) || (len > MAX_DNS_MESSAGE_SIZE)) {
+      counter_inc(&forwarder->stats.invalid);
+
+      close_connection(forwarder, connection);
+      return;
+    }
+
+    if (left < 2 + len) {
+      break;
+    }
+
+    process_query(forwarder,
+                  connection,
+                  p + 2,
+                  len,
+                  (const struct sockaddr*) &connection->addr,
+                  connection->addrlen);
+
+    /* The client doesn't read the responses? */
+    if (connection->fd == -1) {
+      return;
+    }
+
+    p += 2 + len;
+    left -= 2 + len;
+  }
+
+  if (left < connection->inlen) {
+    memmove(connection->in, p, left);
+    connection->inlen = left;
+  }
+}
+
+void write_responses(forwarder_t* forwarder,
+                     forwarder_connection_t* connection)
+{
+  size_t len;
+  ssize_t n;
+
+  if ((n = socket_send(connection->fd,
+                       connection->out,
+                       connection->outlen)) < 0) {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+      connection->blocked = 1;
+    } else {
+      close_connection(forwarder, connection);
+    }
+
+    return;
+  }
+
+  connection->outlen -= n;
+
+  if (connection->outlen > 0) {
+    memmove(connection->out, connection->out + n, connection->outlen);
+    connection->blocked = 1;
+  } else {
+    connection->blocked = 0;
+  }
+
+  /* Responses kept aside: they are sent with the next flush (or when the
+   * socket buffer has room).
+   */
+  if (connection->spilllen > 0) {
+    len = MIN(connection->spilllen, TCP_OUTPUT_SIZE - connection->outlen);
+
+    memcpy(connection->out + connection->outlen, connection->spill, len);
+    connection->outlen += len;
+
+    if ((connection->spilllen -= len) > 0) {
+      memmove(connection->spill,
+              connection->spill + len,
+              connection->spilllen);
+    } else {
+      free(connection->spill);
+      connection->spill = NULL;
+    }
+
+    if (!connection->blocked) {
+      schedule_connection(forwarder, connection);
+    }
+  }
+
+  timer_heap_add(&forwarder->tcp->timers,
+                 &connection->timer,
+                 timer_now() + forwarder->tcp->idle_timeout);
+}
+
+void queue_tcp_response(forwarder_t* forwarder,
+                        forwarder_connection_t* connection,
+                        size_t len)
+{
+  uint8_t* spill;
+  uint8_t* out;
+
+  /* The connection has been closed while the query was being resolved. */
+  if (connection->fd == -1) {
+    return;
+  }
+
+  if ((connection->spilllen == 0) &&
+      (connection->outlen + 2 + len <= TCP_OUTPUT_SIZE)) {
+    out = connection->out + connection->outlen;
+    connection->outlen += 2 + len;
+  } else {
+    /* Several large responses at once: the response is kept aside (no new
+     * queries are processed until it has been moved to the output buffer).
+     */
+    if ((spill = (uint8_t*) realloc(connection->spill,
+                                    connection->spilllen + 2 + len)) ==
+        NULL) {
+      close_connection(forwarder, connection);
+      return;
+    }
+
+    connection->spill = spill;
+
+    out = spill + connection->spilllen;
+    connection->spilllen += 2 + len;
+  }
+
+  /* The response has been built in the next buffer. */
+  out[0] = (len >> 8) & 0xff;
+  out[1] = len & 0xff;
+
+  memcpy(out + 2, response_buffer(forwarder, connection), len);
+
+  /* Sent with the next flush. */
+  schedule_connection(forwarder, connection);
+}
+
+void schedule_connection(forwarder_t* forwarder,
+                         forwarder_connection_t* connection)
+{
+  if (!connection->dirty) {
+    connection->dirty = 1;
+
+    connection->next_dirty = forwarder->tcp->dirty;
+    forwarder->tcp->dirty = connection;
+  }
+}
+
+void flush_connections(forwarder_t* forwarder)
+{
+  forwarder_connection_t* connection;
+
+  while ((connection = forwarder->tcp->dirty) != NULL) {
+    forwarder->tcp->dirty = connection->next_dirty;
+    connection->dirty = 0;
+
+    /* If the socket buffer was full, wait for EPOLLOUT. */
+    if ((connection->fd != -1) &&
+        (connection->outlen > 0) &&
+        (!connection->blocked)) {
+      write_responses(forwarder, connection);
+    }
+
+    /* Queries which were waiting for others to be resolved or for room in
+     * the output buffer (the responses found right away schedule the
+     * connection again).
+     */
+    if ((connection->fd != -1) &&
+        (connection->inlen >= 2) &&
+        (connection->nrequests < FORWARDER_MAX_PIPELINED) &&
+        (output_available(connection))) {
+      process_queries(forwarder, connection);
+    }
+
+    update_connection(forwarder, connection);
+  }
+}
+
+void expire_connections(forwarder_t* forwarder)
+{
+  forwarder_connection_t* connection;
+  timer_entry_t* timer;
+  uint64_t now;
+
+  now = timer_now();
+
+  while ((timer = timer_heap_pop_expired(&forwarder->tcp->timers, now)) !=
+         NULL) {
+    connection = TIMER_CONTAINER(timer, forwarder_connection_t, timer);
+
+    /* Not idle: queries being resolved or responses to be sent. */
+    if ((connection->nrequests > 0) || (connection->outlen > 0)) {
+      timer_heap_add(&forwarder->tcp->timers,
+                     &connection->timer,
+                     now + forwarder->tcp->idle_timeout);
+    } else {
+      close_connection(forwarder, connection);
+      update_connection(forwarder, connection);
+    }
+  }
+}
+
+void close_connection(forwarder_t* forwarder,
+                      forwarder_connection_t* connection)
+{
+  /* Also removes the socket from epoll. */
+  close(connection->fd);
+  connection->fd = -1;
+
+  connection->outlen = 0;
+
+  free(connection->spill);
+  connection->spill = NULL;
+  connection->spilllen = 0;
+
+  timer_heap_remove(&forwarder->tcp->timers, &connection->timer);
+}
+
+void update_connection(forwarder_t* forwarder,
+                       forwarder_connection_t* connection)
+{
+  forwarder_tcp_t* tcp;
+  struct epoll_event ev;
+
+  tcp = forwarder->tcp;
+
+  if (connection->fd != -1) {
+    /* The client has closed its side and has all the responses. */
+    if ((connection->eof) &&
+        (connection->nrequests == 0) &&
+        (connection->outlen == 0)) {
+      close_connection(forwarder, connection);
+    } else {
+      /* Stop reading while the client doesn't read the responses, the
+       * output buffer is short of room or there are too many queries being
+       * resolved.
+       */
+      ev.events = 0;
+
+      if ((!connection->eof) &&
+          (!connection->blocked) &&
+          (output_available(connection)) &&
+          (connection->nrequests < FORWARDER_MAX_PIPELINED)) {
+        ev.events |= EPOLLIN;
+      }
+
+      if (connection->blocked) {
+        ev.events |= EPOLLOUT;
+      }
+
+      if (ev.events != connection->events) {
+        ev.data.ptr = connection;
+
+        if (epoll_ctl(forwarder->epfd,
+                      EPOLL_CTL_MOD,
+                      connection->fd,
+                      &ev) < 0) {
+          close_connection(forwarder, connection);
+        } else {
+          connection->events = ev.events;
+        }
+      }
+
+      return;
+    }
+  }
+
+  /* The connection can be reused when nothing refers to it. */
+  if ((connection->active) &&
+      (connection->nrequests == 0) &&
+      (!connection->dirty)) {
+    connection->active = 0;
+
+    connection->next = tcp->free_connections;
+    tcp->free_connections = connection;
+  }
+}
+
+#if HAVE_URING
+
+int process_uring(forwarder_t* forwarder, int timeout)
+{
+  struct epoll_event events[MAX_EVENTS];
+  forwarder_uring_t* uring;
+  struct io_uring_cqe* cqe;
+  int resolver_ready;
+  int tcp_ready;
+  int n;
+
+  uring = forwarder->uring;
+
+  /* Re-arm the multishot receive if it has been stopped (e.g. no buffers
+   * were available) and the polls of the resolver and of the TCP
+   * connections (single shot, so that the pending events are reported
+   * again).
+   */
+  if (((!uring->receiving) && (arm_receive(forwarder) < 0)) ||
+      ((!uring->polling) &&
+       (arm_poll(forwarder,
+                 resolver_fd(forwarder->resolver),
+                 URING_POLL) < 0)) ||
+      ((forwarder->tcp) &&
+       (!uring->epolling) &&
+       (arm_poll(forwarder, forwarder->epfd, URING_EPOLL) < 0))) {
+    return -1;
+  }
+
+  /* Submits the responses of the previous call as well. */
+  if (uring_submit_and_wait(&uring->uring,
+                            next_timeout(forwarder, timeout)) < 0) {
+    return -1;
+  }
+
+  resolver_ready = 0;
+  tcp_ready = 0;
+
+  while ((cqe = uring_peek_cqe(&uring->uring)) != NULL) {
+    switch (cqe->user_data) {
+      case URING_RECV:
+        receive_completion(forwarder, cqe);
+        break;
+      case URING_POLL:
+        uring->polling = 0;
+        resolver_ready = 1;
+
+        break;
+      case URING_EPOLL:
+        uring->epolling = 0;
+        tcp_ready = 1;
+
+        break;
+      default:
+        /* Failed send (the successful ones don't post completions). */
+        counter_inc(&forwarder->stats.dropped);
+        break;
+    }
+
+    uring_cqe_seen(&uring->uring);
+  }
+
+  /* TCP listener and connections. */
+  if ((tcp_ready) &&
+      ((n = epoll_wait(forwarder->epfd, events, MAX_EVENTS, 0)) > 0)) {
+    dispatch_events(forwarder, events, n);
+  }
+
+  /* Responses from the upstream servers and expired queries. */
+  if ((resolver_ready) || (resolver_timeout(forwarder->resolver) == 0)) {
+    if (resolver_process(forwarder->resolver, 0) < 0) {
+      return -1;
+    }
+  }
+
+  if (forwarder->tcp) {
+    expire_connections(forwarder);
+    flush_connections(forwarder);
+  }
+
+  flush_responses(forwarder);
+
+  return 0;
+}
+
+int arm_receive(forwarder_t* forwarder)
+{
+  forwarder_uring_t* uring;
+  struct io_uring_sqe* sqe;
+
+  uring = forwarder->uring;
+
+  if ((sqe = uring_get_sqe(&uring->uring)) != NULL) {
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = forwarder->fd;
+    sqe->addr = (uint64_t) (uintptr_t) &uring->msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = uring->buffers.bgid;
+    sqe->user_data = URING_RECV;
+
+    uring->receiving = 1;
+
+    return 0;
+  }
+
+  return -1;
+}
+
+int arm_poll(forwarder_t* forwarder, int fd, uint64_t user_data)
+{
+  forwarder_uring_t* uring;
+  struct io_uring_sqe* sqe;
+
+  uring = forwarder->uring;
+
+  if ((sqe = uring_get_sqe(&uring->uring)) != NULL) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = user_data;
+
+    if (user_data == URING_POLL) {
+      uring->polling = 1;
+    } else {
+      uring->epolling = 1;
+    }
+
+    return 0;
+  }
+
+  return -1;
+}
+
+void receive_completion(forwarder_t* forwarder,
+                        const struct io_uring_cqe* cqe)
+{
+  forwarder_uring_t* uring;
+  const struct io_uring_recvmsg_out* out;
+  const uint8_t* buf;
+  socklen_t addrlen;
+  unsigned bid;
+
+  uring = forwarder->uring;
+
+  /* The multishot receive has been stopped? */
+  if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+    uring->receiving = 0;
+  }
+
+  if ((cqe->flags & IORING_CQE_F_BUFFER) == 0) {
+    /* Error (e.g. ENOBUFS). */
+    return;
+  }
+
+  bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+  if (cqe->res >= (int) sizeof(struct io_uring_recvmsg_out)) {
+    buf = uring_buffer(&uring->buffers, bid);
+    out = (const struct io_uring_recvmsg_out*) buf;
+
+    /* Truncated messages are not valid queries. */
+    if ((out->flags & MSG_TRUNC) == 0) {
+      addrlen = (out->namelen <= uring->msg.msg_namelen) ?
+                  out->namelen :
+                  uring->msg.msg_namelen;
+
+      process_query(forwarder,
+                    NULL,
+                    buf + sizeof(struct io_uring_recvmsg_out) +
+                    uring->msg.msg_namelen,
+                    out->payloadlen,
+                    (const struct sockaddr*) (out + 1),
+                    addrlen);
+    } else {
+      counter_inc(&forwarder->stats.invalid);
+    }
+  }
+
+  uring_buffers_recycle(&uring->buffers, bid);
+}
+
+void queue_responses(forwarder_t* forwarder)
+{
+  forwarder_buffers_t* buffers;
+  struct io_uring_sqe* sqe;
+  unsigned i;
+
+  buffers = forwarder->buffers;
+
+  /* The sends don't wait for space in the socket buffer (MSG_DONTWAIT):
+   * they complete when submitted and the buffers can be reused afterwards
+   * (if the socket buffer is full, the responses are dropped).
+   */
+  for (i = 0; i < buffers->nresponses; i++) {
+    /* The submission queue is still full after submitting it: the rest of
+     * the responses are sent directly.
+     */
+    if ((sqe = uring_get_sqe(&forwarder->uring->uring)) == NULL) {
+      send_responses(forwarder, i);
+      break;
+    }
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = forwarder->fd;
+    sqe->addr = (uint64_t) (uintptr_t) &buffers->response_msgs[i].msg_hdr;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = URING_SEND;
+  }
+}
+
+#else /* !HAVE_URING */
+
+int process_uring(forwarder_t* forwarder, int timeout)
+{
+  return -1;
+}
+
+void queue_responses(forwarder_t* forwarder)
+{
+}
+
+#endif /* HAVE_URING */
@@ -0,0 +1,137 @@
+#ifndef FORWARDER_H
+#define FORWARDER_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include "resolver.h"
+#include "packetcache.h"
+#include "zone.h"
+
+/* Caching DNS forwarder.
+ * Queries received on a UDP socket are answered from the zone served (if
+ * any), from the packet cache (if any), from the DNS cache of the
+ * resolver (A / AAAA, with the remaining time to live) or forwarded to the
+ * upstream servers through the resolver, and the responses are relayed to
+ * the clients (and added to the packet cache).
+ * UDP responses are limited to 512 bytes, or to the UDP payload size of
+ * the client (EDNS, up to FORWARDER_MAX_UDP_SIZE).
+ */
+
+#define FORWARDER_DEFAULT_MAX_REQUESTS    4096
+#define FORWARDER_BATCH_SIZE              32
+#define FORWARDER_MAX_UDP_SIZE            1232
+
+/* TCP. */
+#define FORWARDER_DEFAULT_MAX_CONNECTIONS 64
+#define FORWARDER_DEFAULT_IDLE_TIMEOUT    10000 /* [ms] */
+#define FORWARDER_MAX_PIPELINED           16
+
+typedef struct {
+  /* Queries received. */
+  uint64_t queries;
+
+  /* Queries answered from the packet cache or the DNS cache. */
+  uint64_t cache_hits;
+
+  /* Queries answered from the zone. */
+  uint64_t authoritative;
+
+  /* Queries forwarded to the upstream servers (including the queries
+   * coalesced by the resolver).
+   */
+  uint64_t forwarded;
+
+  /* Responses sent. */
+  uint64_t responses;
+
+  /* UDP responses dropped (socket buffer full or failed send). */
+  uint64_t dropped;
+
+  /* SERVFAIL responses sent (timeouts, errors or no free requests). */
+  uint64_t servfails;
+
+  /* Invalid messages. */
+  uint64_t invalid;
+
+  /* TCP connections accepted and rejected (too many connections). */
+  uint64_t tcp_connections;
+  uint64_t tcp_rejected;
+} forwarder_stats_t;
+
+typedef struct forwarder_request_t forwarder_request_t;
+typedef struct forwarder_buffers_t forwarder_buffers_t;
+typedef struct forwarder_uring_t forwarder_uring_t;
+typedef struct forwarder_tcp_t forwarder_tcp_t;
+typedef struct forwarder_connection_t forwarder_connection_t;
+
+typedef struct {
+  int epfd;
+  int fd;
+
+  resolver_t* resolver;
+  packetcache_t* packetcache;
+
+  /* Zone served (NULL: none), read-only (it can be shared). */
+  const zone_t* zone;
+
+  /* Requests being resolved. */
+  forwarder_request_t* requests;
+  forwarder_request_t* free_requests;
+
+  forwarder_buffers_t* buffers;
+
+  /* io_uring backend (NULL: epoll). */
+  forwarder_uring_t* uring;
+
+  /* TCP front end (NULL: UDP only). */
+  forwarder_tcp_t* tcp;
+
+  forwarder_stats_t stats;
+} forwarder_t;
+
+/* Creates a forwarder listening on 'addr' ('packetcache': optional packet
+ * cache, 'max_requests': maximum number of queries being resolved).
+ */
+int forwarder_create(forwarder_t* forwarder,
+                     resolver_t* resolver,
+                     packetcache_t* packetcache,
+                     const struct sockaddr* addr,
+                     socklen_t addrlen,
+                     unsigned max_requests);
+
+void forwarder_destroy(forwarder_t* forwarder);
+
+/* Accepts TCP connections on the address of the UDP socket (RFC 7766):
+ * several queries can be sent on each connection without waiting for the
+ * responses, which are sent as soon as they are available (in any order).
+ * Connections without queries being resolved are closed after
+ * 'idle_timeout' milliseconds, and connections beyond 'max_connections'
+ * are closed right after being accepted.
+ */
+int forwarder_listen_tcp(forwarder_t* forwarder,
+                         unsigned max_connections,
+                         int idle_timeout);
+
+/* Answers authoritatively the queries for the names of 'zone' (the other
+ * queries are forwarded).
+ */
+void forwarder_serve_zone(forwarder_t* forwarder, const zone_t* zone);
+
+/* Switches the forwarder to io_uring: multishot receives into provided
+ * buffers and the responses sent with the next submission. Returns -1 if
+ * the kernel doesn't support it (the forwarder keeps using epoll).
+ */
+int forwarder_use_uring(forwarder_t* forwarder);
+
+/* Waits up to 'timeout' milliseconds (-1: no limit) for queries and
+ * responses, and handles them.
+ */
+int forwarder_process(forwarder_t* forwarder, int timeout);
+
+/* Takes a snapshot of the statistics (it can be called from another
+ * thread).
+ */
+void forwarder_get_stats(const forwarder_t* forwarder,
+                         forwarder_stats_t* stats);
+
+#endif /* FORWARDER_H */
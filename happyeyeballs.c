@@ -0,0 +1,292 @@
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include "happyeyeballs.h"
+#include "socket.h"
+#include "macros.h"
+
+#define MAX_CONNECTIONS (2 * HAPPY_EYEBALLS_MAX_ADDRESSES)
+
+/* Addresses of an address family. */
+typedef struct {
+  struct sockaddr_storage addrs[HAPPY_EYEBALLS_MAX_ADDRESSES];
+  socklen_t addrlens[HAPPY_EYEBALLS_MAX_ADDRESSES];
+  unsigned count;
+
+  /* Next address to try. */
+  unsigned next;
+
+  /* Has the query finished? When [ms]? */
+  int done;
+  uint64_t when;
+} family_t;
+
+typedef struct {
+  in_port_t port;
+
+  family_t ipv6;
+  family_t ipv4;
+
+  /* Family of the next connection attempt. */
+  int ipv6_next;
+} context_t;
+
+static void resolved(const resolver_result_t* result, void* data);
+static const struct sockaddr* next_address(context_t* ctx, socklen_t* addrlen);
+
+static inline int more_addresses(const context_t* ctx)
+{
+  return ((ctx->ipv6.next < ctx->ipv6.count) ||
+          (ctx->ipv4.next < ctx->ipv4.count));
+}
+
+int happy_eyeballs_connect(resolver_t* resolver,
+                           const char* name,
+                           size_t namelen,
+                           in_port_t port,
+                           int timeout)
+{
+  context_t ctx;
+  struct pollfd fds[1 + MAX_CONNECTIONS];
+  int sockets[MAX_CONNECTIONS];
+  unsigned nsockets;
+  const struct sockaddr* addr;
+  socklen_t addrlen;
+  uint64_t deadline;
+  uint64_t next_attempt;
+  uint64_t now;
+  int can_connect;
+  int wait;
+  int error;
+  int fd;
+  int s;
+  int t;
+  unsigned i;
+
+  ctx.port = port;
+
+  ctx.ipv6.count = 0;
+  ctx.ipv6.next = 0;
+  ctx.ipv6.done = 0;
+
+  ctx.ipv4.count = 0;
+  ctx.ipv4.next = 0;
+  ctx.ipv4.done = 0;
+
+  ctx.ipv6_next = 1;
+
+  /* Send both queries (the callbacks are invoked immediately if the
+   * addresses are in the DNS cache).
+   */
+  if (resolver_resolve(resolver,
+                       name,
+                       namelen,
+                       DNS_QTYPE_AAAA,
+                       DNS_QCLASS_IN,
+                       resolved,
+                       &ctx) < 0) {
+    ctx.ipv6.done = 1;
+    ctx.ipv6.when = timer_now();
+  }
+
+  if (resolver_resolve(resolver,
+                       name,
+                       namelen,
+                       DNS_QTYPE_A,
+                       DNS_QCLASS_IN,
+                       resolved,
+                       &ctx) < 0) {
+    ctx.ipv4.done = 1;
+    ctx.ipv4.when = timer_now();
+  }
+
+  deadline = timer_now() + timeout;
+  next_attempt = 0;
+
+  nsockets = 0;
+  fd = -1;
+
+  do {
+    now = timer_now();
+
+    /* Don't wait for the AAAA response more than the resolution delay
+     * after the A response.
+     */
+    can_connect = (ctx.ipv6.done) ||
+                  ((ctx.ipv4.done) &&
+                   (now >= ctx.ipv4.when + HAPPY_EYEBALLS_RESOLUTION_DELAY));
+
+    /* Start the next connection attempt (if the previous one has not
+     * finished yet after the connection attempt delay).
+     */
+    if ((can_connect) && (now >= next_attempt)) {
+      while ((addr = next_address(&ctx, &addrlen)) != NULL) {
+        if ((s = socket_connect(addr, addrlen)) != -1) {
+          sockets[nsockets++] = s;
+
+          next_attempt = now + HAPPY_EYEBALLS_CONNECTION_ATTEMPT_DELAY;
+          break;
+        }
+
+        /* The connection failed immediately, try the next address. */
+      }
+    }
+
+    /* No more addresses to try? */
+    if ((nsockets == 0) &&
+        (ctx.ipv6.done) &&
+        (ctx.ipv4.done) &&
+        (!more_addresses(&ctx))) {
+      break;
+    }
+
+    if (now >= deadline) {
+      break;
+    }
+
+    /* Wait for the responses / connections, until the next event. */
+    wait = deadline - now;
+
+    if (!can_connect) {
+      if (ctx.ipv4.done) {
+        wait = MIN(wait,
+                   (int) (ctx.ipv4.when + HAPPY_EYEBALLS_RESOLUTION_DELAY -
+                          now));
+      }
+    } else if (more_addresses(&ctx)) {
+      wait = MIN(wait, (next_attempt > now) ? (int) (next_attempt - now) : 0);
+    }
+
+    if (((t = resolver_timeout(resolver)) != -1) && (t < wait)) {
+      wait = t;
+    }
+
+    fds[0].fd = resolver_fd(resolver);
+    fds[0].events = POLLIN;
+
+    for (i = 0; i < nsockets; i++) {
+      fds[i + 1].fd = sockets[i];
+      fds[i + 1].events = POLLOUT;
+    }
+
+    if (poll(fds, nsockets + 1, wait) < 0) {
+      if (errno != EINTR) {
+        break;
+      }
+
+      continue;
+    }
+
+    /* Process responses and expired queries. */
+    if (resolver_process(resolver, 0) < 0) {
+      break;
+    }
+
+    /* Check the connections (in reverse order, the last socket takes the
+     * place of the sockets which are closed).
+     */
+    for (i = nsockets; i > 0; i--) {
+      if (fds[i].revents != 0) {
+        if ((socket_get_error(sockets[i - 1], &error) == 0) && (error == 0)) {
+          fd = sockets[i - 1];
+          sockets[i - 1] = sockets[--nsockets];
+
+          break;
+        }
+
+        close(sockets[i - 1]);
+        sockets[i - 1] = sockets[--nsockets];
+
+        /* Start the next connection attempt immediately. */
+        next_attempt = 0;
+      }
+    }
+  } while (fd == -1);
+
+  /* Close the other connections. */
+  for (i = 0; i < nsockets; i++) {
+    close(sockets[i]);
+  }
+
+  /* Don't invoke the callback for the queries which have not finished. */
+  resolver_cancel(resolver, resolved, &ctx);
+
+  return fd;
+}
+
+void resolved(const resolver_result_t* result, void* data)
+{
+  context_t* ctx;
+  family_t* family;
+  struct sockaddr_in* sin;
+  struct sockaddr_in6* sin6;
+  size_t i;
+
+  ctx = (context_t*) data;
+
+  family = (result->qtype == DNS_QTYPE_AAAA) ? &ctx->ipv6 : &ctx->ipv4;
+
+  if (result->status == RESOLVER_SUCCESS) {
+    for (i = 0;
+         (i < result->nanswers) &&
+         (family->count < HAPPY_EYEBALLS_MAX_ADDRESSES);
+         i++) {
+      if (result->answers[i].type == result->qtype) {
+        if (result->qtype == DNS_QTYPE_AAAA) {
+          sin6 = (struct sockaddr_in6*) &family->addrs[family->count];
+
+          memset(sin6, 0, sizeof(struct sockaddr_in6));
+          sin6->sin6_family = AF_INET6;
+          sin6->sin6_port = htons(ctx->port);
+          sin6->sin6_addr = result->answers[i].addr6;
+
+          family->addrlens[family->count++] = sizeof(struct sockaddr_in6);
+        } else {
+          sin = (struct sockaddr_in*) &family->addrs[family->count];
+
+          memset(sin, 0, sizeof(struct sockaddr_in));
+          sin->sin_family = AF_INET;
+          sin->sin_port = htons(ctx->port);
+          sin->sin_addr = result->answers[i].addr4;
+
+          family->addrlens[family->count++] = sizeof(struct sockaddr_in);
+        }
+      }
+    }
+  }
+
+  family->done = 1;
+  family->when = timer_now();
+}
+
+const struct sockaddr* next_address(context_t* ctx, socklen_t* addrlen)
+{
+  family_t* families[2];
+  family_t* family;
+  unsigned i;
+
+  /* Alternate the address families, IPv6 first. */
+  if (ctx->ipv6_next) {
+    families[0] = &ctx->ipv6;
+    families[1] = &ctx->ipv4;
+  } else {
+    families[0] = &ctx->ipv4;
+    families[1] = &ctx->ipv6;
+  }
+
+  for (i = 0; i < 2; i++) {
+    family = families[i];
+
+    if (family->next < family->count) {
+      ctx->ipv6_next = (family == &ctx->ipv4);
+
+      *addrlen = family->addrlens[family->next];
+      return (const struct sockaddr*) &family->addrs[family->next++];
+    }
+  }
+
+  return NULL;
+}
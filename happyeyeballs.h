@@ -0,0 +1,33 @@
+#ifndef HAPPYEYEBALLS_H
+#define HAPPYEYEBALLS_H
+
+#include <netinet/in.h>
+#include "resolver.h"
+
+/* Connection to a host name using "Happy Eyeballs" (RFC 8305).
+ * The A and AAAA queries are sent at the same time (the DNS cache of the
+ * resolver is checked first). IPv6 addresses are preferred: if the A
+ * response arrives first, the AAAA response is awaited for a short time.
+ * Then connections to the addresses (alternating address families) are
+ * started one after another, without waiting for the previous ones to
+ * fail, and the first one to succeed wins.
+ */
+
+#define HAPPY_EYEBALLS_RESOLUTION_DELAY         50  /* [ms] */
+#define HAPPY_EYEBALLS_CONNECTION_ATTEMPT_DELAY 250 /* [ms] */
+
+/* Maximum number of addresses per address family. */
+#define HAPPY_EYEBALLS_MAX_ADDRESSES            8
+
+/* Connects (TCP) to 'name' and 'port' in less than 'timeout' milliseconds.
+ * The resolver is driven by this function meanwhile (the callbacks of
+ * other queries might be invoked).
+ * Returns the connected (non-blocking) socket or -1.
+ */
+int happy_eyeballs_connect(resolver_t* resolver,
+                           const char* name,
+                           size_t namelen,
+                           in_port_t port,
+                           int timeout);
+
+#endif /* HAPPYEYEBALLS_H */
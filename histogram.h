@@ -0,0 +1,123 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include "macros.h"
+
+/* Log-linear histogram (e.g. latencies): values below 32 have their own
+ * bucket, the others 32 buckets per power of two (error below 3%).
+ */
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_SIZE     ((65 - HISTOGRAM_SUB_BITS) << HISTOGRAM_SUB_BITS)
+
+/* Zero-initialized (the minimum is only meaningful if count > 0). */
+typedef struct {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t buckets[HISTOGRAM_SIZE];
+} histogram_t;
+
+static inline unsigned histogram_bucket(uint64_t value)
+{
+  unsigned e;
+
+  if (value < (1 << HISTOGRAM_SUB_BITS)) {
+    return value;
+  }
+
+  /* Position of the most significant bit and the next bits. */
+  e = 63 - __builtin_clzll(value);
+
+  return ((e - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) +
+         ((value >> (e - HISTOGRAM_SUB_BITS)) &
+          ((1 << HISTOGRAM_SUB_BITS) - 1));
+}
+
+/* Lower limit of the bucket. */
+static inline uint64_t histogram_value(unsigned bucket)
+{
+  unsigned e;
+
+  if (bucket < (1 << HISTOGRAM_SUB_BITS)) {
+    return bucket;
+  }
+
+  e = (bucket >> HISTOGRAM_SUB_BITS) + HISTOGRAM_SUB_BITS - 1;
+
+  return ((uint64_t) (1 << HISTOGRAM_SUB_BITS) +
+          (bucket & ((1 << HISTOGRAM_SUB_BITS) - 1))) <<
+         (e - HISTOGRAM_SUB_BITS);
+}
+
+static inline void histogram_add(histogram_t* histogram, uint64_t value)
+{
+  histogram->buckets[histogram_bucket(value)]++;
+
+  if ((histogram->count == 0) || (value < histogram->min)) {
+    histogram->min = value;
+  }
+
+  if (value > histogram->max) {
+    histogram->max = value;
+  }
+
+  histogram->count++;
+  histogram->sum += value;
+}
+
+/* Adds the values of 'histogram' to 'total' (e.g. to aggregate the
+ * histograms of several threads).
+ */
+static inline void histogram_merge(histogram_t* total,
+                                   const histogram_t* histogram)
+{
+  unsigned i;
+
+  if (histogram->count == 0) {
+    return;
+  }
+
+  for (i = 0; i < HISTOGRAM_SIZE; i++) {
+    total->buckets[i] += histogram->buckets[i];
+  }
+
+  if ((total->count == 0) || (histogram->min < total->min)) {
+    total->min = histogram->min;
+  }
+
+  total->max = MAX(total->max, histogram->max);
+
+  total->count += histogram->count;
+  total->sum += histogram->sum;
+}
+
+/* Percentile 'p' (0-100): lower limit of its bucket, within the minimum and
+ * the maximum.
+ */
+static inline uint64_t histogram_percentile(const histogram_t* histogram,
+                                            double p)
+{
+  uint64_t target;
+  uint64_t count;
+  unsigned i;
+
+  target = (uint64_t) ((p * histogram->count) / 100.0);
+
+  if (target == 0) {
+    target = 1;
+  }
+
+  count = 0;
+
+  for (i = 0; i < HISTOGRAM_SIZE; i++) {
+    if ((count += histogram->buckets[i]) >= target) {
+      return MIN(MAX(histogram_value(i), histogram->min), histogram->max);
+    }
+  }
+
+  return histogram->max;
+}
+
+#endif /* HISTOGRAM_H */
@@ -0,0 +1,491 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "packetcache.h"
+#include "dns.h"
+#include "ctype.h"
+#include "macros.h"
+
+typedef struct packet_entry_t {
+  /* Bucket. */
+  struct packet_entry_t* prev;
+  struct packet_entry_t* next;
+
+  /* List of entries by use. */
+  node_t lru;
+
+  time_t inserted;
+  time_t expiration_time;
+
+  /* Length of the question (the key, at offset 12 of the packet). */
+  uint16_t questionlen;
+
+  uint16_t len;
+
+  /* Offsets of the TTL fields, followed by the packet. */
+  uint16_t nttls;
+  uint16_t ttls[1];
+} packet_entry_t;
+
+static size_t canonical_question(const uint8_t* msg, size_t len, uint8_t* key);
+static const uint8_t* skip_name(const uint8_t* p, const uint8_t* end);
+static packet_entry_t* find_entry(node_t* header,
+                                  const uint8_t* key,
+                                  size_t keylen,
+                                  unsigned* probes);
+
+static inline uint16_t get16(const uint8_t* p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t get32(const uint8_t* p)
+{
+  return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline void set32(uint8_t* p, uint32_t n)
+{
+  p[0] = (n >> 24) & 0xff;
+  p[1] = (n >> 16) & 0xff;
+  p[2] = (n >> 8) & 0xff;
+  p[3] = n & 0xff;
+}
+
+static inline uint8_t* entry_packet(const packet_entry_t* entry)
+{
+  return (uint8_t*) &entry->ttls[entry->nttls];
+}
+
+static inline packet_entry_t* lru_entry(node_t* node)
+{
+  return (packet_entry_t*) ((uint8_t*) node - offsetof(packet_entry_t, lru));
+}
+
+static inline size_t packet_entry_size(size_t nttls, size_t len)
+{
+  return offsetof(packet_entry_t, ttls) + (nttls * sizeof(uint16_t)) + len;
+}
+
+static inline void push_front(node_t* header, node_t* node)
+{
+  node->next = header->next;
+  node->prev = header;
+
+  header->next->prev = node;
+  header->next = node;
+}
+
+static inline void touch_packet_entry(packetcache_t* cache,
+                                      node_t* header,
+                                      packet_entry_t* entry)
+{
+  node_unlink((node_t*) entry);
+  push_front(header, (node_t*) entry);
+
+  node_unlink(&entry->lru);
+  push_front(&cache->lru, &entry->lru);
+}
+
+static inline void free_packet_entry(packetcache_t* cache,
+                                     packet_entry_t* entry)
+{
+  cache_stats_inc(&cache->stats.frees);
+  cache_stats_sub(&cache->stats.entries, 1);
+  cache_stats_sub(&cache->stats.bytes,
+                  packet_entry_size(entry->nttls, entry->len));
+
+  node_unlink((node_t*) entry);
+  node_unlink(&entry->lru);
+
+  free(entry);
+}
+
+int packetcache_create(packetcache_t* cache,
+                       unsigned nbuckets,
+                       unsigned max_entries)
+{
+  unsigned i;
+
+  if ((cache->buckets = (node_t*) malloc(nbuckets * sizeof(node_t))) != NULL) {
+    for (i = 0; i < nbuckets; i++) {
+      cache->buckets[i].prev = &cache->buckets[i];
+      cache->buckets[i].next = &cache->buckets[i];
+    }
+
+    cache->nbuckets = nbuckets;
+
+    cache->lru.prev = &cache->lru;
+    cache->lru.next = &cache->lru;
+
+    cache->max_entries = max_entries;
+
+    memset(&cache->stats, 0, sizeof(cache_stats_t));
+    cache->stats.bytes = nbuckets * sizeof(node_t);
+
+    return 0;
+  }
+
+  return -1;
+}
+
+void packetcache_destroy(packetcache_t* cache)
+{
+  unsigned i;
+
+  if (cache->buckets) {
+    for (i = 0; i < cache->nbuckets; i++) {
+      node_free_list(cache->buckets[i].next, &cache->buckets[i]);
+    }
+
+    free(cache->buckets);
+    cache->buckets = NULL;
+  }
+}
+
+int packetcache_add(packetcache_t* cache,
+                    const void* response,
+                    size_t len,
+                    time_t now)
+{
+  const uint8_t* b;
+  const uint8_t* end;
+  const uint8_t* p;
+  uint8_t key[DNS_MAX_QUESTION_LEN];
+  uint16_t offsets[PACKETCACHE_MAX_RECORDS];
+  uint32_t rrttls[PACKETCACHE_MAX_RECORDS];
+  node_t* header;
+  packet_entry_t* entry;
+  uint8_t* packet;
+  size_t questionlen;
+  uint16_t flags;
+  uint16_t ancount;
+  uint16_t nscount;
+  uint16_t rdlength;
+  uint16_t type;
+  unsigned count;
+  unsigned nttls;
+  unsigned probes;
+  unsigned i;
+  uint32_t rrttl;
+  uint32_t ttl;
+
+  b = (const uint8_t*) response;
+  end = b + len;
+
+  if ((len < 12) || (len > MAX_DNS_MESSAGE_SIZE)) {
+    return -1;
+  }
+
+  /* Complete response to a standard query, with a single question. */
+  flags = get16(b + 2);
+
+  if (((flags & DNS_FLAG_QR) == 0) ||
+      (flags & DNS_FLAG_TC) ||
+      (DNS_OPCODE(flags) != 0) ||
+      ((DNS_RCODE(flags) != DNS_RCODE_NOERROR) &&
+       (DNS_RCODE(flags) != DNS_RCODE_NXDOMAIN)) ||
+      (get16(b + 4) != 1) ||
+      ((questionlen = canonical_question(b, len, key)) == 0)) {
+    return -1;
+  }
+
+  ancount = get16(b + 6);
+  nscount = get16(b + 8);
+  count = ancount + nscount + get16(b + 10);
+
+  /* Record the TTL fields, the response expires with the first record. */
+  p = b + 12 + questionlen;
+  nttls = 0;
+  ttl = PACKETCACHE_MAX_TTL;
+
+  for (i = 0; i < count; i++) {
+    if (((p = skip_name(p, end)) == NULL) || (p + 10 > end)) {
+      return -1;
+    }
+
+    type = get16(p);
+    rdlength = get16(p + 8);
+
+    if (p + 10 + rdlength > end) {
+      return -1;
+    }
+
+    /* The TTL of the OPT pseudo-record contains flags. */
+    if (type != DNS_QTYPE_OPT) {
+      if (nttls == PACKETCACHE_MAX_RECORDS) {
+        return -1;
+      }
+
+      /* TTLs with the most significant bit set are treated as 0
+       * (RFC 2181).
+       */
+      if ((rrttl = get32(p + 4)) > 0x7fffffff) {
+        return -1;
+      }
+
+      /* Negative responses are cached for the minimum of the TTL of the
+       * SOA record and its MINIMUM field (RFC 2308).
+       */
+      if ((type == DNS_QTYPE_SOA) &&
+          (ancount == 0) &&
+          (i < nscount) &&
+          (rdlength >= 4)) {
+        rrttl = MIN(rrttl, get32(p + 10 + rdlength - 4));
+      }
+
+      rrttl = MIN(rrttl, PACKETCACHE_MAX_TTL);
+
+      offsets[nttls] = (p + 4) - b;
+      rrttls[nttls++] = rrttl;
+
+      ttl = MIN(ttl, rrttl);
+    }
+
+    p += 10 + rdlength;
+  }
+
+  /* Nothing to cache (e.g. negative response without SOA record). */
+  if ((nttls == 0) || (ttl == 0)) {
+    return -1;
+  }
+
+  header = &cache->buckets[dns_key_hash(key, questionlen) % cache->nbuckets];
+
+  /* Replace the previous response (if any). */
+  if ((entry = find_entry(header, key, questionlen, &probes)) != NULL) {
+    free_packet_entry(cache, entry);
+    cache_stats_inc(&cache->stats.updates);
+  } else {
+    cache_stats_inc(&cache->stats.inserts);
+  }
+
+  cache_stats_probes(&cache->stats, probes);
+
+  /* If the cache is full, evict the least recently used entry. */
+  if ((cache->stats.entries >= cache->max_entries) &&
+      (cache->lru.prev != &cache->lru)) {
+    free_packet_entry(cache, lru_entry(cache->lru.prev));
+    cache_stats_inc(&cache->stats.evictions);
+  }
+
+  if ((entry = (packet_entry_t*) malloc(packet_entry_size(nttls, len))) !=
+      NULL) {
+    entry->inserted = now;
+    entry->expiration_time = now + ttl;
+
+    entry->questionlen = questionlen;
+    entry->len = len;
+
+    entry->nttls = nttls;
+    memcpy(entry->ttls, offsets, nttls * sizeof(uint16_t));
+
+    /* The name of the question is saved in lowercase (key), the TTLs
+     * capped.
+     */
+    packet = entry_packet(entry);
+    memcpy(packet, b, len);
+    memcpy(packet + 12, key, questionlen);
+
+    for (i = 0; i < nttls; i++) {
+      set32(packet + offsets[i], rrttls[i]);
+    }
+
+    push_front(header, (node_t*) entry);
+    push_front(&cache->lru, &entry->lru);
+
+    cache_stats_inc(&cache->stats.entries);
+    cache_stats_add(&cache->stats.bytes, packet_entry_size(nttls, len));
+
+    return 0;
+  }
+
+  return -1;
+}
+
+int packetcache_get(packetcache_t* cache,
+                    const void* query,
+                    size_t querylen,
+                    time_t now,
+                    void* response,
+                    size_t* len)
+{
+  dns_query_t parsed;
+
+  if (dns_parse_query(query, querylen, &parsed) == DNS_RCODE_NOERROR) {
+    return packetcache_lookup(cache, &parsed, query, now, response, len);
+  }
+
+  cache_stats_inc(&cache->stats.misses);
+
+  return -1;
+}
+
+int packetcache_lookup(packetcache_t* cache,
+                       const dns_query_t* parsed,
+                       const void* query,
+                       time_t now,
+                       void* response,
+                       size_t* len)
+{
+  const uint8_t* q;
+  node_t* header;
+  packet_entry_t* entry;
+  uint8_t* r;
+  unsigned probes;
+  unsigned i;
+  uint32_t elapsed;
+
+  q = (const uint8_t*) query;
+
+  header = &cache->buckets[parsed->hash % cache->nbuckets];
+
+  entry = find_entry(header, parsed->key, parsed->keylen, &probes);
+
+  cache_stats_probes(&cache->stats, probes);
+
+  if (entry) {
+    /* If the entry has not expired... */
+    if (now <= entry->expiration_time) {
+      r = (uint8_t*) response;
+
+      memcpy(r, entry_packet(entry), entry->len);
+
+      /* ID, "recursion desired" flag and question of the query. */
+      r[0] = q[0];
+      r[1] = q[1];
+
+      r[2] = (r[2] & ~(DNS_FLAG_RD >> 8)) | (q[2] & (DNS_FLAG_RD >> 8));
+
+      memcpy(r + 12, q + 12, parsed->keylen);
+
+      /* Remaining time to live. */
+      elapsed = now - entry->inserted;
+
+      for (i = 0; i < entry->nttls; i++) {
+        set32(r + entry->ttls[i], get32(r + entry->ttls[i]) - elapsed);
+      }
+
+      *len = entry->len;
+
+      touch_packet_entry(cache, header, entry);
+
+      cache_stats_inc(&cache->stats.hits);
+
+      return 0;
+    }
+
+    free_packet_entry(cache, entry);
+
+    cache_stats_inc(&cache->stats.expired);
+  }
+
+  cache_stats_inc(&cache->stats.misses);
+
+  return -1;
+}
+
+void packetcache_remove_expired(packetcache_t* cache, time_t now)
+{
+  node_t* header;
+  packet_entry_t* entry;
+  packet_entry_t* next;
+  unsigned i;
+
+  for (i = 0; i < cache->nbuckets; i++) {
+    header = &cache->buckets[i];
+    entry = (packet_entry_t*) header->next;
+
+    while (entry != (packet_entry_t*) header) {
+      next = entry->next;
+
+      /* If the entry has expired... */
+      if (now > entry->expiration_time) {
+        free_packet_entry(cache, entry);
+      }
+
+      entry = next;
+    }
+  }
+}
+
+void packetcache_get_stats(const packetcache_t* cache, cache_stats_t* stats)
+{
+  cache_stats_snapshot(&cache->stats, stats);
+}
+
+size_t canonical_question(const uint8_t* msg, size_t len, uint8_t* key)
+{
+  size_t pos;
+  size_t i;
+
+  /* Labels (the name of the question cannot be compressed). */
+  pos = 12;
+
+  while ((pos < len) && (msg[pos] != 0)) {
+    if ((msg[pos] & 0xc0) != 0) {
+      return 0;
+    }
+
+    pos += msg[pos] + 1;
+  }
+
+  /* Final label, type and class. */
+  if ((pos + 5 > len) || (pos + 5 - 12 > DNS_MAX_QUESTION_LEN)) {
+    return 0;
+  }
+
+  for (i = 12; i < pos; i++) {
+    key[i - 12] = to_lower(msg[i]);
+  }
+
+  memcpy(key + (pos - 12), msg + pos, 5);
+
+  return pos + 5 - 12;
+}
+
+const uint8_t* skip_name(const uint8_t* p, const uint8_t* end)
+{
+  while (p < end) {
+    if (*p == 0) {
+      return p + 1;
+    }
+
+    /* Pointer. */
+    if ((*p & 0xc0) == 0xc0) {
+      return (p + 2 <= end) ? p + 2 : NULL;
+    }
+
+    if ((*p & 0xc0) != 0) {
+      return NULL;
+    }
+
+    p += *p + 1;
+  }
+
+  return NULL;
+}
+
+packet_entry_t* find_entry(node_t* header,
+                           const uint8_t* key,
+                           size_t keylen,
+                           unsigned* probes)
+{
+  packet_entry_t* entry;
+
+  *probes = 0;
+
+  for (entry = (packet_entry_t*) header->next;
+       entry != (packet_entry_t*) header;
+       entry = entry->next) {
+    (*probes)++;
+
+    if ((keylen == entry->questionlen) &&
+        (memcmp(key, entry_packet(entry) + 12, keylen) == 0)) {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
@@ -0,0 +1,79 @@
+#ifndef PACKETCACHE_H
+#define PACKETCACHE_H
+
+#include <stdint.h>
+#include <time.h>
+#include "node.h"
+#include "cachestats.h"
+#include "dns.h"
+
+/* Cache of complete DNS responses, keyed by the question (name in
+ * lowercase, type and class in wire format).
+ * The offsets of the TTL fields are recorded when a response is added, so
+ * that a hit only copies the packet, patches the ID, the question (case of
+ * the query) and the "recursion desired" flag, and rewrites the TTLs with
+ * the remaining time to live.
+ * NOERROR and NXDOMAIN responses are cached, the negative responses for
+ * the time to live of the SOA record (RFC 2308).
+ */
+
+/* Maximum number of TTL fields of a cached response. */
+#define PACKETCACHE_MAX_RECORDS 64
+
+/* Maximum time to live of a cached response [s]. */
+#define PACKETCACHE_MAX_TTL     86400
+
+typedef struct {
+  node_t* buckets;
+  unsigned nbuckets;
+
+  /* Least recently used entries last. */
+  node_t lru;
+
+  unsigned max_entries;
+
+  cache_stats_t stats;
+} packetcache_t;
+
+int packetcache_create(packetcache_t* cache,
+                       unsigned nbuckets,
+                       unsigned max_entries);
+
+void packetcache_destroy(packetcache_t* cache);
+
+/* Adds a response to the cache (if the cache is full, the least recently
+ * used entry is evicted).
+ */
+int packetcache_add(packetcache_t* cache,
+                    const void* response,
+                    size_t len,
+                    time_t now);
+
+/* Looks up the question of 'query' and builds the response to it in
+ * 'response' (MAX_DNS_MESSAGE_SIZE bytes).
+ */
+int packetcache_get(packetcache_t* cache,
+                    const void* query,
+                    size_t querylen,
+                    time_t now,
+                    void* response,
+                    size_t* len);
+
+/* Same as packetcache_get() for a query already parsed with
+ * dns_parse_query().
+ */
+int packetcache_lookup(packetcache_t* cache,
+                       const dns_query_t* parsed,
+                       const void* query,
+                       time_t now,
+                       void* response,
+                       size_t* len);
+
+void packetcache_remove_expired(packetcache_t* cache, time_t now);
+
+/* Takes a snapshot of the statistics of the cache (it can be called from a
+ * thread other than the one using the cache).
+ */
+void packetcache_get_stats(const packetcache_t* cache, cache_stats_t* stats);
+
+#endif /* PACKETCACHE_H */
@@ -0,0 +1,27 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+
+/* Pseudo-random numbers (splitmix64): fast and good enough to generate
+ * workloads and faults, a state per thread (not for cryptographic use).
+ */
+
+static inline uint64_t next_random(uint64_t* state)
+{
+  uint64_t z;
+
+  z = (*state += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+
+  return z ^ (z >> 31);
+}
+
+/* Uniform double in [0, 1). */
+static inline double random_unit(uint64_t* state)
+{
+  return (next_random(state) >> 11) * 0x1.0p-53;
+}
+
+#endif /* RANDOM_H */
@@ -0,0 +1,2564 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/random.h>
+#include "resolver.h"
+#include "socket.h"
+#include "hash.h"
+#include "ctype.h"
+#include "macros.h"
+#include "counters.h"
+#include "trace.h"
+
+#define MAX_EVENTS 16
+#define NO_QUERY   ((uint32_t) -1)
+#define NUMBER_IDS 65536
+
+/* Index of the sockets used to send the requests to the nameservers
+ * (iterative mode) in the epoll events, the socket number is
+ * family * UPSTREAM_MAX_SOCKETS + n (family 0: IPv4, 1: IPv6).
+ */
+#define NAMESERVERS UPSTREAMS_MAX
+
+/* Index of the TCP connections in the epoll events (the socket number is
+ * the index of the connection).
+ */
+#define TCP_CONNECTIONS (UPSTREAMS_MAX + 1)
+
+/* Attempts to bind a socket to a random port. */
+#define RANDOM_PORT_ATTEMPTS 16
+
+/* Space for the CNAME records followed by a query (iterative mode). */
+#define CNAMES_SIZE 512
+
+/* Request sent to an upstream server. */
+typedef struct {
+  uint16_t id;
+  unsigned upstream; /* Iterative mode: index of the nameserver. */
+  unsigned socket;
+  uint64_t sent; /* [us] */
+  int active;
+} request_t;
+
+struct resolver_query_t {
+  /* Queries in flight with the same hash (must be the first field). */
+  node_t node;
+
+  char name[HOSTNAME_MAX_LEN + 1];
+  size_t namelen;
+
+  uint16_t qtype;
+  uint16_t qclass;
+
+  /* Name asked to the servers: the name of the query or, in iterative
+   * mode, the target of the last CNAME record followed.
+   */
+  const char* target;
+  size_t targetlen;
+
+  /* Last request sent and hedged request (sent to another server if the
+   * first one takes too long). Each one has its own DNS ID.
+   */
+  request_t request;
+  request_t hedge;
+
+  /* Number of requests sent (not counting the hedged requests). */
+  unsigned attempts;
+
+  /* When the hedged request is sent, when the last request times out and
+   * when the query times out [ms].
+   */
+  uint64_t hedge_at;
+  uint64_t retransmit;
+  uint64_t deadline;
+
+  /* Servers already tried (bitmask). */
+  uint32_t tried;
+
+  /* TCP connection repeating the request (index + 1, 0: none). */
+  unsigned tcp;
+
+  /* Iterative mode: zone cut whose nameservers are asked (TTL of its NS
+   * records), their addresses (none while one of them is being resolved),
+   * number of referrals followed and nesting level (the query started to
+   * resolve the address of a nameserver is one level deeper than the query
+   * waiting for it).
+   */
+  char zone[HOSTNAME_MAX_LEN + 1];
+  size_t zonelen;
+  uint32_t zonettl;
+  delegation_address_t servers[DELEGATION_MAX_ADDRESSES];
+  unsigned nservers;
+  unsigned referrals;
+  unsigned depth;
+  resolver_t* resolver;
+
+  /* Iterative mode: CNAME records pointing out of the zone of the server
+   * which answered, followed by restarting the query with their target.
+   * For each one: TTL (uint32_t), length of the target (1 byte) and target
+   * (lowercase, NUL-terminated); the owner is the previous target.
+   */
+  uint8_t cnames[CNAMES_SIZE];
+  size_t cnameslen;
+
+  timer_entry_t timer;
+
+  resolver_callback_t callback;
+  void* data;
+
+  /* Other queries waiting for the response. */
+  resolver_waiter_t* waiters;
+  resolver_waiter_t* last_waiter;
+
+  /* Next free query. */
+  uint32_t next;
+};
+
+struct resolver_waiter_t {
+  resolver_callback_t callback;
+  void* data;
+
+  resolver_waiter_t* next;
+};
+
+struct resolver_buffers_t {
+  uint8_t request[MAX_DNS_MESSAGE_SIZE];
+
+  uint8_t responses[RESOLVER_BATCH_SIZE][MAX_DNS_MESSAGE_SIZE];
+  struct sockaddr_storage addrs[RESOLVER_BATCH_SIZE];
+  struct iovec iov[RESOLVER_BATCH_SIZE];
+  struct mmsghdr msgs[RESOLVER_BATCH_SIZE];
+
+  dns_question_t question;
+  rr_t answers[RESOLVER_MAX_ANSWERS];
+  rr_t authorities[RESOLVER_MAX_AUTHORITIES];
+  rr_t additionals[RESOLVER_MAX_ADDITIONALS];
+
+  /* Response built for a query which followed CNAME records. */
+  uint8_t response[MAX_DNS_TCP_MESSAGE_SIZE];
+};
+
+/* TCP connection used to repeat a request whose response was truncated. */
+struct resolver_tcp_t {
+  int fd;
+
+  /* Query (NO_QUERY: free connection). */
+  uint32_t query;
+
+  uint16_t id;
+
+  /* Request and response, preceded by their length. */
+  uint8_t request[2 + MAX_DNS_MESSAGE_SIZE];
+  size_t requestlen;
+  size_t sent;
+
+  uint8_t response[2 + MAX_DNS_TCP_MESSAGE_SIZE];
+  size_t received;
+};
+
+static int lookup_cache(resolver_t* resolver,
+                        const char* name,
+                        size_t namelen,
+                        dns_qtype_t qtype,
+                        dns_qclass_t qclass,
+                        resolver_callback_t callback,
+                        void* data);
+
+static void add_to_cache(resolver_t* resolver,
+                         const resolver_query_t* query,
+                         const rr_t* answers,
+                         size_t nanswers);
+
+static resolver_query_t* find_query(resolver_t* resolver,
+                                    node_t* header,
+                                    const char* name,
+                                    size_t namelen,
+                                    dns_qtype_t qtype,
+                                    dns_qclass_t qclass);
+
+static int add_waiter(resolver_t* resolver,
+                      resolver_query_t* query,
+                      resolver_callback_t callback,
+                      void* data);
+
+static int start_query(resolver_t* resolver,
+                       const char* name,
+                       size_t namelen,
+                       dns_qtype_t qtype,
+                       dns_qclass_t qclass,
+                       resolver_callback_t callback,
+                       void* data,
+                       unsigned depth);
+
+static int create_socket(resolver_t* resolver,
+                         int family,
+                         const upstream_t* upstream,
+                         unsigned index,
+                         unsigned n);
+
+static int create_nameserver_sockets(resolver_t* resolver);
+static int select_nameserver(resolver_t* resolver,
+                             resolver_query_t* query,
+                             int hedge);
+
+static int send_request(resolver_t* resolver,
+                        resolver_query_t* query,
+                        request_t* request,
+                        int hedge);
+
+static int send_query(resolver_t* resolver, resolver_query_t* query);
+static void receive_responses(resolver_t* resolver,
+                              unsigned upstream,
+                              unsigned socket);
+
+static void process_response(resolver_t* resolver,
+                             unsigned upstream,
+                             unsigned socket,
+                             const uint8_t* buf,
+                             size_t len,
+                             const struct sockaddr* addr);
+
+static int question_matches(const resolver_t* resolver,
+                            const resolver_query_t* query);
+
+static void handle_response(resolver_t* resolver,
+                            resolver_query_t* query,
+                            request_t* request,
+                            const dns_header_t* header,
+                            const uint8_t* buf,
+                            size_t len);
+
+static int start_tcp(resolver_t* resolver,
+                     resolver_query_t* query,
+                     const struct sockaddr* addr,
+                     socklen_t addrlen);
+
+static void tcp_event(resolver_t* resolver, unsigned index);
+static void tcp_response(resolver_t* resolver, resolver_tcp_t* tcp);
+static void release_tcp(resolver_t* resolver, resolver_query_t* query);
+
+static void retry_query(resolver_t* resolver,
+                        resolver_query_t* query,
+                        request_t* request,
+                        const uint8_t* buf,
+                        size_t len);
+
+static int is_referral(const resolver_t* resolver,
+                       const dns_header_t* header,
+                       size_t nauthorities);
+
+static void follow_referral(resolver_t* resolver,
+                            resolver_query_t* query,
+                            request_t* request,
+                            const uint8_t* buf,
+                            size_t len,
+                            size_t nauthorities,
+                            size_t nadditionals);
+
+static void find_zone_cut(resolver_t* resolver, resolver_query_t* query);
+
+static int follow_cname(resolver_t* resolver,
+                        resolver_query_t* query,
+                        size_t nanswers);
+
+static int build_response(resolver_t* resolver,
+                          const resolver_query_t* query,
+                          const uint8_t* buf,
+                          size_t len,
+                          size_t* responselen,
+                          size_t* nanswers,
+                          size_t* nauthorities);
+
+static int resolve_nameserver(resolver_t* resolver,
+                              resolver_query_t* query,
+                              size_t nauthorities);
+
+static void nameserver_resolved(const resolver_result_t* result, void* data);
+
+static int resolving_nameserver(const resolver_query_t* query,
+                                const char* name,
+                                size_t namelen);
+
+static void expire_queries(resolver_t* resolver);
+
+static void complete_query(resolver_t* resolver,
+                           resolver_query_t* query,
+                           resolver_status_t status,
+                           const void* response,
+                           size_t responselen,
+                           size_t nanswers,
+                           size_t nauthorities);
+
+static const uint32_t initval = 0xdeaddead;
+
+/* Callback of the cancelled queries. */
+static void cancelled(const resolver_result_t* result, void* data)
+{
+}
+
+static inline uint32_t next_random(resolver_t* resolver)
+{
+  /* xorshift32. */
+  resolver->random ^= resolver->random << 13;
+  resolver->random ^= resolver->random >> 17;
+  resolver->random ^= resolver->random << 5;
+
+  return resolver->random;
+}
+
+static inline uint32_t query_index(const resolver_t* resolver,
+                                   const resolver_query_t* query)
+{
+  return query - resolver->queries;
+}
+
+static int allocate_id(resolver_t* resolver, const resolver_query_t* query)
+{
+  uint32_t id;
+  unsigned i;
+
+  id = next_random(resolver);
+
+  for (i = 0; i < NUMBER_IDS; i++, id++) {
+    if (resolver->ids[id & (NUMBER_IDS - 1)] == 0) {
+      resolver->ids[id & (NUMBER_IDS - 1)] = query_index(resolver, query) + 1;
+      return id & (NUMBER_IDS - 1);
+    }
+  }
+
+  return -1;
+}
+
+static inline void release_id(resolver_t* resolver,
+                              const resolver_query_t* query,
+                              request_t* request)
+{
+  if (request->active) {
+    if (resolver->ids[request->id] == query_index(resolver, query) + 1) {
+      resolver->ids[request->id] = 0;
+    }
+
+    request->active = 0;
+  }
+}
+
+/* Responses to the requests sent are not accepted anymore. */
+static inline void release_ids(resolver_t* resolver, resolver_query_t* query)
+{
+  release_id(resolver, query, &query->request);
+  release_id(resolver, query, &query->hedge);
+}
+
+static void set_port(struct sockaddr_storage* addr, in_port_t port)
+{
+  if (addr->ss_family == AF_INET) {
+    ((struct sockaddr_in*) addr)->sin_port = port;
+  } else {
+    ((struct sockaddr_in6*) addr)->sin6_port = port;
+  }
+}
+
+static void close_sockets(upstream_t* upstream)
+{
+  unsigned i;
+
+  for (i = 0; i < upstream->nfds; i++) {
+    close(upstream->fds[i]);
+  }
+
+  upstream->nfds = 0;
+}
+
+static inline uint64_t next_expiration(const resolver_query_t* query)
+{
+  return MIN(MIN(query->hedge_at, query->retransmit), query->deadline);
+}
+
+static void close_nameserver_sockets(resolver_t* resolver, unsigned family)
+{
+  unsigned i;
+
+  for (i = 0; i < resolver->nfds[family]; i++) {
+    close(resolver->fds[family][i]);
+  }
+
+  resolver->nfds[family] = 0;
+}
+
+/* Returns 1 if 'name' is 'zone' or a name below it (both lowercase). */
+static int in_zone(const char* name,
+                   size_t namelen,
+                   const char* zone,
+                   size_t zonelen)
+{
+  if (zonelen == 0) {
+    return 1;
+  }
+
+  return (((namelen == zonelen) ||
+           ((namelen > zonelen) && (name[namelen - zonelen - 1] == '.'))) &&
+          (memcmp(name + namelen - zonelen, zone, zonelen) == 0));
+}
+
+static void lowercase(const char* name, size_t namelen, char* dest)
+{
+  size_t i;
+
+  for (i = 0; i < namelen; i++) {
+    dest[i] = to_lower(name[i]);
+  }
+
+  dest[namelen] = 0;
+}
+
+void resolver_config_init(resolver_config_t* config)
+{
+  config->max_queries = RESOLVER_DEFAULT_MAX_QUERIES;
+  config->coalesce = 1;
+  config->max_waiters = RESOLVER_DEFAULT_MAX_WAITERS;
+  config->timeout = RESOLVER_DEFAULT_TIMEOUT;
+  config->min_timeout = RESOLVER_DEFAULT_MIN_TIMEOUT;
+  config->max_timeout = RESOLVER_DEFAULT_MAX_TIMEOUT;
+  config->deadline = RESOLVER_DEFAULT_DEADLINE;
+  config->hedge_delay = 0;
+  config->hedge_percentile = RESOLVER_DEFAULT_HEDGE_PERCENTILE;
+  config->attempts = RESOLVER_DEFAULT_ATTEMPTS;
+  config->buffer_size = RESOLVER_DEFAULT_BUFFER_SIZE;
+  config->sockets = RESOLVER_DEFAULT_SOCKETS;
+  config->random_ports = 1;
+  config->connected = 0;
+  config->cpu_affinity = 0;
+  config->max_tcp = RESOLVER_DEFAULT_MAX_TCP;
+  config->tcp_timeout = RESOLVER_DEFAULT_TCP_TIMEOUT;
+  config->caches = NULL;
+  config->iterative = 0;
+  config->delegations = RESOLVER_DEFAULT_DELEGATIONS;
+  config->nameserver_port = RESOLVER_DEFAULT_NAMESERVER_PORT;
+}
+
+int resolver_create(resolver_t* resolver, const resolver_config_t* config)
+{
+  resolver_buffers_t* buffers;
+  long ncpus;
+  unsigned i;
+
+  if ((config->max_queries == 0) ||
+      (config->max_queries >= NUMBER_IDS) ||
+      (config->attempts == 0) ||
+      (config->sockets == 0) ||
+      (config->sockets > UPSTREAM_MAX_SOCKETS)) {
+    return -1;
+  }
+
+  if ((config->iterative) && (config->delegations == 0)) {
+    return -1;
+  }
+
+  memset(resolver, 0, sizeof(resolver_t));
+
+  resolver->epfd = -1;
+
+  upstreams_init(&resolver->upstreams,
+                 config->timeout,
+                 config->min_timeout,
+                 config->max_timeout);
+
+  resolver->buffer_size = config->buffer_size;
+  resolver->sockets = config->sockets;
+  resolver->random_ports = config->random_ports;
+  resolver->connected = config->connected;
+  resolver->cpu_affinity = config->cpu_affinity;
+
+  if ((ncpus = sysconf(_SC_NPROCESSORS_ONLN)) <= 0) {
+    ncpus = 1;
+  }
+
+  resolver->ncpus = ncpus;
+
+  resolver->deadline = config->deadline;
+  resolver->hedge_delay = config->hedge_delay;
+  resolver->hedge_percentile = MIN(config->hedge_percentile, 100);
+  resolver->attempts = config->attempts;
+  resolver->caches = config->caches;
+
+  resolver->max_tcp = config->max_tcp;
+  resolver->tcp_timeout = config->tcp_timeout;
+
+  resolver->iterative = config->iterative;
+  resolver->nameserver_port = htons(config->nameserver_port);
+
+  resolver->max_queries = config->max_queries;
+  resolver->nbuckets = config->max_queries;
+  resolver->coalesce = config->coalesce;
+
+  if (((resolver->queries = (resolver_query_t*)
+                            malloc(config->max_queries *
+                                   sizeof(resolver_query_t))) != NULL) &&
+      ((resolver->buckets = (node_t*) malloc(resolver->nbuckets *
+                                             sizeof(node_t))) != NULL) &&
+      ((config->max_waiters == 0) ||
+       ((resolver->waiters = (resolver_waiter_t*)
+                             malloc(config->max_waiters *
+                                    sizeof(resolver_waiter_t))) != NULL)) &&
+      ((resolver->ids = (uint32_t*) calloc(NUMBER_IDS, sizeof(uint32_t))) !=
+       NULL) &&
+      ((resolver->buffers = (resolver_buffers_t*)
+                            malloc(sizeof(resolver_buffers_t))) != NULL) &&
+      ((config->max_tcp == 0) ||
+       ((resolver->tcp = (resolver_tcp_t*)
+                         malloc(config->max_tcp *
+                                sizeof(resolver_tcp_t))) != NULL)) &&
+      (timer_heap_create(&resolver->timers, config->max_queries) == 0)) {
+    /* Build list of free queries. */
+    resolver->free_queries = NO_QUERY;
+
+    for (i = config->max_queries; i > 0; i--) {
+      timer_init(&resolver->queries[i - 1].timer);
+
+      resolver->queries[i - 1].next = resolver->free_queries;
+      resolver->free_queries = i - 1;
+    }
+
+    for (i = 0; i < resolver->nbuckets; i++) {
+      resolver->buckets[i].prev = &resolver->buckets[i];
+      resolver->buckets[i].next = &resolver->buckets[i];
+    }
+
+    for (i = 0; i < config->max_tcp; i++) {
+      resolver->tcp[i].fd = -1;
+      resolver->tcp[i].query = NO_QUERY;
+    }
+
+    /* Build list of free waiters. */
+    resolver->free_waiters = NULL;
+
+    for (i = config->max_waiters; i > 0; i--) {
+      resolver->waiters[i - 1].next = resolver->free_waiters;
+      resolver->free_waiters = &resolver->waiters[i - 1];
+    }
+
+    /* Prepare the receive buffers. */
+    buffers = resolver->buffers;
+
+    for (i = 0; i < RESOLVER_BATCH_SIZE; i++) {
+      buffers->iov[i].iov_base = buffers->responses[i];
+      buffers->iov[i].iov_len = MAX_DNS_MESSAGE_SIZE;
+
+      memset(&buffers->msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+      buffers->msgs[i].msg_hdr.msg_name = &buffers->addrs[i];
+      buffers->msgs[i].msg_hdr.msg_iov = &buffers->iov[i];
+      buffers->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    /* Seed the generator of DNS IDs. */
+    if (getrandom(&resolver->random, sizeof(uint32_t), 0) !=
+        sizeof(uint32_t)) {
+      resolver->random = time(NULL) ^ getpid();
+    }
+
+    if (resolver->random == 0) {
+      resolver->random = 0x9e3779b9;
+    }
+
+    if (((resolver->epfd = epoll_create1(EPOLL_CLOEXEC)) != -1) &&
+        ((!resolver->iterative) ||
+         ((delegations_create(&resolver->delegations,
+                              config->delegations) == 0) &&
+          (create_nameserver_sockets(resolver) == 0)))) {
+      return 0;
+    }
+  }
+
+  resolver_destroy(resolver);
+
+  return -1;
+}
+
+void resolver_destroy(resolver_t* resolver)
+{
+  unsigned i;
+
+  for (i = 0; i < resolver->upstreams.count; i++) {
+    close_sockets(&resolver->upstreams.servers[i]);
+  }
+
+  resolver->upstreams.count = 0;
+
+  close_nameserver_sockets(resolver, 0);
+  close_nameserver_sockets(resolver, 1);
+
+  delegations_destroy(&resolver->delegations);
+
+  if (resolver->tcp) {
+    for (i = 0; i < resolver->max_tcp; i++) {
+      if (resolver->tcp[i].fd != -1) {
+        close(resolver->tcp[i].fd);
+      }
+    }
+
+    free(resolver->tcp);
+    resolver->tcp = NULL;
+  }
+
+  if (resolver->epfd != -1) {
+    close(resolver->epfd);
+    resolver->epfd = -1;
+  }
+
+  timer_heap_destroy(&resolver->timers);
+
+  if (resolver->buffers) {
+    free(resolver->buffers);
+    resolver->buffers = NULL;
+  }
+
+  if (resolver->ids) {
+    free(resolver->ids);
+    resolver->ids = NULL;
+  }
+
+  if (resolver->waiters) {
+    free(resolver->waiters);
+    resolver->waiters = NULL;
+  }
+
+  if (resolver->buckets) {
+    free(resolver->buckets);
+    resolver->buckets = NULL;
+  }
+
+  if (resolver->queries) {
+    free(resolver->queries);
+    resolver->queries = NULL;
+  }
+}
+
+int resolver_add_upstream(resolver_t* resolver,
+                          const struct sockaddr* addr,
+                          socklen_t addrlen)
+{
+  upstream_t* upstream;
+  int index;
+  int fd;
+
+  if (resolver->iterative) {
+    /* Root hint (there must be sockets for its address family). */
+    if ((resolver->nfds[(addr->sa_family == AF_INET6) ? 1 : 0] > 0) &&
+        (delegations_add_root(&resolver->delegations, addr, addrlen) == 0)) {
+      return resolver->delegations.root.naddrs - 1;
+    }
+
+    return -1;
+  }
+
+  if ((addr->sa_family == AF_INET) || (addr->sa_family == AF_INET6)) {
+    if ((index = upstreams_add(&resolver->upstreams, addr, addrlen)) != -1) {
+      upstream = &resolver->upstreams.servers[index];
+
+      /* Create the pool of sockets. */
+      while (upstream->nfds < resolver->sockets) {
+        if ((fd = create_socket(resolver,
+                                addr->sa_family,
+                                upstream,
+                                index,
+                                upstream->nfds)) == -1) {
+          close_sockets(upstream);
+          resolver->upstreams.count--;
+
+          return -1;
+        }
+
+        upstream->fds[upstream->nfds++] = fd;
+      }
+
+      return index;
+    }
+  }
+
+  return -1;
+}
+
+int resolver_resolve(resolver_t* resolver,
+                     const char* name,
+                     size_t namelen,
+                     dns_qtype_t qtype,
+                     dns_qclass_t qclass,
+                     resolver_callback_t callback,
+                     void* data)
+{
+  counter_inc(&resolver->stats.queries);
+
+  return start_query(resolver, name, namelen, qtype, qclass, callback, data, 0);
+}
+
+void resolver_cancel(resolver_t* resolver,
+                     resolver_callback_t callback,
+                     const void* data)
+{
+  resolver_query_t* query;
+  resolver_waiter_t* waiter;
+  unsigned i;
+
+  for (i = 0; i < resolver->max_queries; i++) {
+    query = &resolver->queries[i];
+
+    /* The queries in flight have their timer armed. */
+    if (timer_is_active(&query->timer)) {
+      if ((query->callback == callback) && (query->data == data)) {
+        query->callback = cancelled;
+      }
+
+      for (waiter = query->waiters; waiter; waiter = waiter->next) {
+        if ((waiter->callback == callback) && (waiter->data == data)) {
+          waiter->callback = cancelled;
+        }
+      }
+    }
+  }
+}
+
+int resolver_process(resolver_t* resolver, int timeout)
+{
+  struct epoll_event events[MAX_EVENTS];
+  int t;
+  int n;
+  int i;
+
+  /* Don't wait past the next query timeout. */
+  if (((t = resolver_timeout(resolver)) != -1) &&
+      ((timeout == -1) || (t < timeout))) {
+    timeout = t;
+  }
+
+  if ((n = epoll_wait(resolver->epfd, events, MAX_EVENTS, timeout)) < 0) {
+    if (errno != EINTR) {
+      return -1;
+    }
+
+    n = 0;
+  }
+
+  for (i = 0; i < n; i++) {
+    if ((events[i].data.u64 >> 32) == TCP_CONNECTIONS) {
+      tcp_event(resolver, events[i].data.u64 & 0xffffffff);
+    } else {
+      receive_responses(resolver,
+                        events[i].data.u64 >> 32,
+                        events[i].data.u64 & 0xffffffff);
+    }
+  }
+
+  expire_queries(resolver);
+
+  return 0;
+}
+
+void resolver_get_stats(const resolver_t* resolver, resolver_stats_t* stats)
+{
+  counters_snapshot(&resolver->stats, stats, sizeof(resolver_stats_t));
+}
+
+int resolver_get_upstream_stats(const resolver_t* resolver,
+                                unsigned index,
+                                upstream_stats_t* stats)
+{
+  if (index < resolver->upstreams.count) {
+    upstream_get_stats(&resolver->upstreams.servers[index], stats);
+    return 0;
+  }
+
+  return -1;
+}
+
+const char* resolver_status_to_string(resolver_status_t status)
+{
+  switch (status) {
+    case RESOLVER_SUCCESS:
+      return "success";
+    case RESOLVER_NXDOMAIN:
+      return "non-existent domain";
+    case RESOLVER_SERVFAIL:
+      return "server failure";
+    case RESOLVER_TIMEOUT:
+      return "timeout";
+    case RESOLVER_ERROR:
+      return "error";
+    default:
+      return "(unknown)";
+  }
+}
+
+int start_query(resolver_t* resolver,
+                const char* name,
+                size_t namelen,
+                dns_qtype_t qtype,
+                dns_qclass_t qclass,
+                resolver_callback_t callback,
+                void* data,
+                unsigned depth)
+{
+  resolver_query_t* query;
+  char host[HOSTNAME_MAX_LEN + 1];
+  node_t* header;
+
+  if ((namelen > 0) && (namelen <= HOSTNAME_MAX_LEN)) {
+    lowercase(name, namelen, host);
+
+    /* Try first with the DNS cache. */
+    if (lookup_cache(resolver,
+                     host,
+                     namelen,
+                     qtype,
+                     qclass,
+                     callback,
+                     data) == 0) {
+      counter_inc(&resolver->stats.cache_hits);
+      return 0;
+    }
+
+    header = &resolver->buckets[hash(host,
+                                     namelen,
+                                     initval ^ ((qtype << 16) | qclass),
+                                     resolver->nbuckets)];
+
+    /* Is there already a query in flight for the same question? The
+     * lookups of nameservers are not coalesced: the query in flight could
+     * be waiting, directly or not, for the query which needs the address.
+     */
+    if ((resolver->coalesce) &&
+        (depth == 0) &&
+        ((query = find_query(resolver,
+                             header,
+                             host,
+                             namelen,
+                             qtype,
+                             qclass)) != NULL) &&
+        (add_waiter(resolver, query, callback, data) == 0)) {
+      counter_inc(&resolver->stats.coalesced);
+      return 0;
+    }
+
+    if (resolver->free_queries != NO_QUERY) {
+      query = &resolver->queries[resolver->free_queries];
+
+      memcpy(query->name, host, namelen + 1);
+      query->namelen = namelen;
+
+      query->qtype = qtype;
+      query->qclass = qclass;
+
+      query->target = query->name;
+      query->targetlen = namelen;
+      query->cnameslen = 0;
+
+      query->request.active = 0;
+      query->hedge.active = 0;
+
+      query->attempts = 0;
+      query->tried = 0;
+      query->tcp = 0;
+
+      query->deadline = (resolver->deadline != 0) ?
+                        timer_now() + resolver->deadline :
+                        UINT64_MAX;
+
+      query->callback = callback;
+      query->data = data;
+
+      /* Iterative mode: start with the closest known zone cut. */
+      if (resolver->iterative) {
+        find_zone_cut(resolver, query);
+
+        query->depth = depth;
+        query->resolver = resolver;
+      }
+
+      query->waiters = NULL;
+
+      if (send_query(resolver, query) == 0) {
+        resolver->free_queries = query->next;
+        resolver->nqueries++;
+
+        /* Insert in the table of queries in flight. */
+        query->node.next = header->next;
+        query->node.prev = header;
+
+        header->next->prev = &query->node;
+        header->next = &query->node;
+
+        return 0;
+      }
+    }
+  }
+
+  return -1;
+}
+
+int lookup_cache(resolver_t* resolver,
+                 const char* name,
+                 size_t namelen,
+                 dns_qtype_t qtype,
+                 dns_qclass_t qclass,
+                 resolver_callback_t callback,
+                 void* data)
+{
+  resolver_result_t result;
+  rr_t rr;
+  time_t expiration_time;
+  time_t now;
+
+  if ((resolver->caches) && (qclass == DNS_QCLASS_IN)) {
+    now = time(NULL);
+
+    switch (qtype) {
+      case DNS_QTYPE_A:
+        if (dnscaches_lookup_ipv4(resolver->caches,
+                                  name,
+                                  namelen,
+                                  now,
+                                  &rr.addr4,
+                                  &expiration_time) < 0) {
+          return -1;
+        }
+
+        rr.rdlength = sizeof(struct in_addr);
+
+        break;
+      case DNS_QTYPE_AAAA:
+        if (dnscaches_lookup_ipv6(resolver->caches,
+                                  name,
+                                  namelen,
+                                  now,
+                                  &rr.addr6,
+                                  &expiration_time) < 0) {
+          return -1;
+        }
+
+        rr.rdlength = sizeof(struct in6_addr);
+
+        break;
+      default:
+        return -1;
+    }
+
+    memcpy(rr.name, name, namelen + 1);
+    rr.namelen = namelen;
+    rr.type = qtype;
+    rr.class = qclass;
+    rr.ttl = expiration_time - now;
+
+    result.status = RESOLVER_SUCCESS;
+
+    result.name = rr.name;
+    result.namelen = namelen;
+    result.qtype = qtype;
+    result.qclass = qclass;
+
+    result.cached = 1;
+
+    result.response = NULL;
+    result.responselen = 0;
+
+    result.answers = &rr;
+    result.nanswers = 1;
+
+    result.authorities = NULL;
+    result.nauthorities = 0;
+
+    callback(&result, data);
+
+    return 0;
+  }
+
+  return -1;
+}
+
+void add_to_cache(resolver_t* resolver,
+                  const resolver_query_t* query,
+                  const rr_t* answers,
+                  size_t nanswers)
+{
+  const rr_t* addr;
+  uint32_t ttl;
+  time_t now;
+  size_t i;
+
+  if ((resolver->caches) &&
+      (query->qclass == DNS_QCLASS_IN) &&
+      ((query->qtype == DNS_QTYPE_A) || (query->qtype == DNS_QTYPE_AAAA))) {
+    addr = NULL;
+    ttl = UINT32_MAX;
+
+    /* The address expires when the first record of the CNAME chain
+     * expires.
+     */
+    for (i = 0; i < nanswers; i++) {
+      if ((answers[i].type == query->qtype) ||
+          (answers[i].type == DNS_QTYPE_CNAME)) {
+        ttl = MIN(ttl, answers[i].ttl);
+
+        if ((!addr) && (answers[i].type == query->qtype)) {
+          addr = &answers[i];
+        }
+      }
+    }
+
+    if (addr) {
+      now = time(NULL);
+
+      if (query->qtype == DNS_QTYPE_A) {
+        dnscaches_add_ipv4(resolver->caches,
+                           query->name,
+                           query->namelen,
+                           &addr->addr4,
+                           now + ttl,
+                           now);
+      } else {
+        dnscaches_add_ipv6(resolver->caches,
+                           query->name,
+                           query->namelen,
+                           &addr->addr6,
+                           now + ttl,
+                           now);
+      }
+    }
+  }
+}
+
+resolver_query_t* find_query(resolver_t* resolver,
+                             node_t* header,
+                             const char* name,
+                             size_t namelen,
+                             dns_qtype_t qtype,
+                             dns_qclass_t qclass)
+{
+  resolver_query_t* query;
+
+  query = (resolver_query_t*) header->next;
+
+  while (&query->node != header) {
+    if ((query->namelen == namelen) &&
+        (query->qtype == qtype) &&
+        (query->qclass == qclass) &&
+        (memcmp(query->name, name, namelen) == 0)) {
+      return query;
+    }
+
+    query = (resolver_query_t*) query->node.next;
+  }
+
+  return NULL;
+}
+
+int add_waiter(resolver_t* resolver,
+               resolver_query_t* query,
+               resolver_callback_t callback,
+               void* data)
+{
+  resolver_waiter_t* waiter;
+
+  if ((waiter = resolver->free_waiters) != NULL) {
+    resolver->free_waiters = waiter->next;
+
+    waiter->callback = callback;
+    waiter->data = data;
+    waiter->next = NULL;
+
+    /* Append waiter (the callbacks are invoked in order). */
+    if (query->waiters) {
+      query->last_waiter->next = waiter;
+    } else {
+      query->waiters = waiter;
+    }
+
+    query->last_waiter = waiter;
+
+    return 0;
+  }
+
+  return -1;
+}
+
+int create_socket(resolver_t* resolver,
+                  int family,
+                  const upstream_t* upstream,
+                  unsigned index,
+                  unsigned n)
+{
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  struct epoll_event ev;
+  unsigned i;
+  int ret;
+  int fd;
+
+#if defined(SO_REUSEPORT) && defined(SO_INCOMING_CPU)
+  int cpu;
+#endif
+
+  if ((fd = socket_create(family, SOCK_DGRAM)) != -1) {
+    /* The kernel might limit the size, it is not an error. */
+    setsockopt(fd,
+               SOL_SOCKET,
+               SO_RCVBUF,
+               &resolver->buffer_size,
+               sizeof(int));
+
+    setsockopt(fd,
+               SOL_SOCKET,
+               SO_SNDBUF,
+               &resolver->buffer_size,
+               sizeof(int));
+
+    /* Wildcard address. */
+    memset(&addr, 0, sizeof(struct sockaddr_storage));
+    addr.ss_family = family;
+    addrlen = (addr.ss_family == AF_INET) ? sizeof(struct sockaddr_in) :
+                                            sizeof(struct sockaddr_in6);
+
+    ret = 0;
+
+#if defined(SO_REUSEPORT) && defined(SO_INCOMING_CPU)
+    if ((upstream) && (resolver->cpu_affinity)) {
+      cpu = n % resolver->ncpus;
+      setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(int));
+
+      /* The first socket gets a free port from the kernel, the others
+       * share it.
+       */
+      if ((n > 0) &&
+          (getsockname(upstream->fds[0],
+                       (struct sockaddr*) &addr,
+                       &addrlen) < 0)) {
+        ret = -1;
+      } else {
+        ret = socket_bind(fd, (const struct sockaddr*) &addr, addrlen);
+      }
+    } else
+#endif
+    {
+      if (resolver->random_ports) {
+        /* If no random port is free, the kernel chooses the port. */
+        for (i = 0; i < RANDOM_PORT_ATTEMPTS; i++) {
+          set_port(&addr, htons(1024 + (next_random(resolver) % 64512)));
+
+          if (bind(fd, (const struct sockaddr*) &addr, addrlen) == 0) {
+            break;
+          }
+        }
+      }
+
+      if ((upstream) && (resolver->connected)) {
+        ret = connect(fd,
+                      (const struct sockaddr*) &upstream->addr,
+                      upstream->addrlen);
+      }
+    }
+
+    if (ret == 0) {
+      ev.events = EPOLLIN;
+      ev.data.u64 = ((uint64_t) index << 32) | n;
+
+      if (epoll_ctl(resolver->epfd, EPOLL_CTL_ADD, fd, &ev) == 0) {
+        return fd;
+      }
+    }
+
+    close(fd);
+  }
+
+  return -1;
+}
+
+int create_nameserver_sockets(resolver_t* resolver)
+{
+  static const int families[] = {AF_INET, AF_INET6};
+  unsigned family;
+  int fd;
+
+  for (family = 0; family < ARRAY_SIZE(families); family++) {
+    while (resolver->nfds[family] < resolver->sockets) {
+      if ((fd = create_socket(resolver,
+                              families[family],
+                              NULL,
+                              NAMESERVERS,
+                              (family * UPSTREAM_MAX_SOCKETS) +
+                              resolver->nfds[family])) == -1) {
+        close_nameserver_sockets(resolver, family);
+
+        /* IPv6 might not be available. */
+        if (families[family] == AF_INET) {
+          return -1;
+        }
+
+        break;
+      }
+
+      resolver->fds[family][resolver->nfds[family]++] = fd;
+    }
+  }
+
+  return 0;
+}
+
+int select_nameserver(resolver_t* resolver,
+                      resolver_query_t* query,
+                      int hedge)
+{
+  unsigned first;
+  unsigned i;
+
+  if (query->nservers > 0) {
+    /* Random nameserver which has not been tried yet (if all of them have
+     * been tried, start again, but hedged requests only go to other
+     * nameservers).
+     */
+    first = next_random(resolver) % query->nservers;
+
+    for (i = 0; i < query->nservers; i++) {
+      if ((query->tried & ((uint32_t) 1 << ((first + i) % query->nservers)))
+          == 0) {
+        return (first + i) % query->nservers;
+      }
+    }
+
+    if (!hedge) {
+      query->tried = 0;
+      return first;
+    }
+  }
+
+  return -1;
+}
+
+int send_request(resolver_t* resolver,
+                 resolver_query_t* query,
+                 request_t* request,
+                 int hedge)
+{
+  const delegation_address_t* nameserver;
+  upstream_t* upstream;
+  uint64_t now;
+  unsigned family;
+  unsigned socket;
+  size_t len;
+  int index;
+  int id;
+
+  now = timer_now();
+
+  if (resolver->iterative) {
+    if ((index = select_nameserver(resolver, query, hedge)) == -1) {
+      return -1;
+    }
+
+    nameserver = &query->servers[index];
+    upstream = NULL;
+  } else {
+    /* Select a server which has not been tried yet (if all of them have
+     * been tried, start again, but hedged requests only go to other
+     * servers).
+     */
+    if ((index = upstreams_select(&resolver->upstreams,
+                                  query->tried,
+                                  now,
+                                  next_random(resolver))) == -1) {
+      if ((hedge) ||
+          ((index = upstreams_select(&resolver->upstreams,
+                                     0,
+                                     now,
+                                     next_random(resolver))) == -1)) {
+        return -1;
+      }
+
+      query->tried = 0;
+    }
+
+    nameserver = NULL;
+    upstream = &resolver->upstreams.servers[index];
+  }
+
+  if ((id = allocate_id(resolver, query)) != -1) {
+    /* Build DNS request. */
+    if (dns_build_request(id,
+                          query->qtype,
+                          query->qclass,
+                          query->target,
+                          query->targetlen,
+                          resolver->buffers->request,
+                          &len) == 0) {
+      request->id = id;
+      request->upstream = index;
+      request->sent = timer_now_us();
+      request->active = 1;
+
+      query->tried |= (uint32_t) 1 << index;
+
+      counter_inc(&resolver->stats.requests);
+
+      /* If the request cannot be sent, it is handled as if it had been
+       * lost.
+       */
+      if (nameserver) {
+        /* The nameservers are not asked for recursion. */
+        resolver->buffers->request[2] &= ~(DNS_FLAG_RD >> 8);
+
+        family = (nameserver->sa.sa_family == AF_INET6) ? 1 : 0;
+        socket = (resolver->nfds[family] > 1) ?
+                 next_random(resolver) % resolver->nfds[family] :
+                 0;
+
+        request->socket = (family * UPSTREAM_MAX_SOCKETS) + socket;
+
+        socket_sendto(resolver->fds[family][socket],
+                      resolver->buffers->request,
+                      len,
+                      &nameserver->sa,
+                      delegation_addrlen(nameserver));
+
+        return 0;
+      }
+
+      /* Random socket of the pool. */
+      socket = (upstream->nfds > 1) ? next_random(resolver) % upstream->nfds :
+                                      0;
+
+      request->socket = socket;
+
+      counter_inc(&upstream->stats.requests);
+
+      if ((resolver->connected) && (!resolver->cpu_affinity)) {
+        socket_send(upstream->fds[socket], resolver->buffers->request, len);
+      } else {
+        socket_sendto(upstream->fds[socket],
+                      resolver->buffers->request,
+                      len,
+                      (const struct sockaddr*) &upstream->addr,
+                      upstream->addrlen);
+      }
+
+      return 0;
+    }
+
+    resolver->ids[id] = 0;
+  }
+
+  return -1;
+}
+
+int send_query(resolver_t* resolver, resolver_query_t* query)
+{
+  const upstream_t* upstream;
+  uint64_t percentile;
+  uint64_t delay;
+  uint64_t now;
+  unsigned nservers;
+
+  if (send_request(resolver, query, &query->request, 0) == 0) {
+    query->attempts++;
+
+    now = timer_now();
+
+    /* The round-trip times of the nameservers are not tracked. */
+    if (resolver->iterative) {
+      upstream = NULL;
+      nservers = query->nservers;
+
+      query->retransmit = now + resolver->upstreams.initial_rto;
+    } else {
+      upstream = &resolver->upstreams.servers[query->request.upstream];
+      nservers = resolver->upstreams.count;
+
+      query->retransmit = now + upstream->rto;
+    }
+
+    /* Send a hedged request if the response takes longer than usual
+     * (if there is another server).
+     */
+    query->hedge_at = UINT64_MAX;
+
+    if ((resolver->hedge_delay != 0) && (nservers > 1)) {
+      delay = resolver->hedge_delay;
+
+      if ((upstream) &&
+          (resolver->hedge_percentile != 0) &&
+          ((percentile = upstream_rtt_percentile(upstream,
+                                                 resolver->hedge_percentile))
+           != 0)) {
+        delay = MAX(delay, (percentile + 999) / 1000);
+      }
+
+      if (now + delay < query->retransmit) {
+        query->hedge_at = now + delay;
+      }
+    }
+
+    if (timer_heap_add(&resolver->timers,
+                       &query->timer,
+                       next_expiration(query)) == 0) {
+      return 0;
+    }
+
+    /* Without a timer the query would never complete: give its IDs back
+     * (the caller keeps or frees the slot).
+     */
+    release_ids(resolver, query);
+  }
+
+  return -1;
+}
+
+void receive_responses(resolver_t* resolver,
+                       unsigned upstream,
+                       unsigned socket)
+{
+  resolver_buffers_t* buffers;
+  int fd;
+  int n;
+  int i;
+
+  buffers = resolver->buffers;
+
+  if (upstream == NAMESERVERS) {
+    fd = resolver->fds[socket / UPSTREAM_MAX_SOCKETS]
+                      [socket % UPSTREAM_MAX_SOCKETS];
+  } else {
+    fd = resolver->upstreams.servers[upstream].fds[socket];
+  }
+
+  do {
+    for (i = 0; i < RESOLVER_BATCH_SIZE; i++) {
+      buffers->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    }
+
+    if ((n = socket_recvmmsg(fd, buffers->msgs, RESOLVER_BATCH_SIZE, NULL)) <=
+        0) {
+      return;
+    }
+
+    for (i = 0; i < n; i++) {
+      process_response(resolver,
+                       upstream,
+                       socket,
+                       buffers->responses[i],
+                       buffers->msgs[i].msg_len,
+                       (const struct sockaddr*) &buffers->addrs[i]);
+    }
+  } while (n == RESOLVER_BATCH_SIZE);
+}
+
+void process_response(resolver_t* resolver,
+                      unsigned upstream,
+                      unsigned socket,
+                      const uint8_t* buf,
+                      size_t len,
+                      const struct sockaddr* addr)
+{
+  resolver_buffers_t* buffers;
+  resolver_query_t* query;
+  request_t* request;
+  upstream_t* server;
+  const struct sockaddr* serveraddr;
+  socklen_t serveraddrlen;
+  dns_header_t header;
+  uint32_t index;
+
+  buffers = resolver->buffers;
+
+  if (dns_process_header(buf, len, &header, &buffers->question) < 0) {
+    return;
+  }
+
+  /* Not a response or unknown ID (e.g. response to a previous attempt)? */
+  if (((header.flags & DNS_FLAG_QR) == 0) ||
+      ((index = resolver->ids[header.id]) == 0)) {
+    return;
+  }
+
+  query = &resolver->queries[index - 1];
+
+  /* Response to the last request or to the hedged request? */
+  if ((query->request.active) && (query->request.id == header.id)) {
+    request = &query->request;
+  } else if ((query->hedge.active) && (query->hedge.id == header.id)) {
+    request = &query->hedge;
+  } else {
+    return;
+  }
+
+  if (resolver->iterative) {
+    server = NULL;
+    serveraddr = &query->servers[request->upstream].sa;
+    serveraddrlen = delegation_addrlen(&query->servers[request->upstream]);
+  } else {
+    if (request->upstream != upstream) {
+      return;
+    }
+
+    server = &resolver->upstreams.servers[upstream];
+    serveraddr = (const struct sockaddr*) &server->addr;
+    serveraddrlen = server->addrlen;
+  }
+
+  /* The response must come from the server the request was sent to
+   * (through the same socket, unless the kernel chooses the socket) and
+   * match the question.
+   */
+  if (((request->socket != socket) &&
+       ((!resolver->cpu_affinity) || (resolver->iterative))) ||
+      (!socket_address_equal(addr, serveraddr)) ||
+      (!question_matches(resolver, query))) {
+    return;
+  }
+
+  counter_inc(&resolver->stats.responses);
+
+  /* The ID changes with each request, so the response belongs to the last
+   * request sent and the round-trip time is not ambiguous (Karn).
+   */
+  if (server) {
+    upstream_response(&resolver->upstreams,
+                      server,
+                      timer_now_us() - request->sent);
+  }
+
+  if (request == &query->hedge) {
+    counter_inc(&resolver->stats.hedge_wins);
+  }
+
+  /* Truncated response: the request is repeated over TCP to the same
+   * server (if there is a free connection).
+   */
+  if ((header.flags & DNS_FLAG_TC) &&
+      (start_tcp(resolver, query, serveraddr, serveraddrlen) == 0)) {
+    return;
+  }
+
+  handle_response(resolver, query, request, &header, buf, len);
+}
+
+int question_matches(const resolver_t* resolver,
+                     const resolver_query_t* query)
+{
+  const dns_question_t* question = &resolver->buffers->question;
+
+  return ((question->namelen == query->targetlen) &&
+          (strncasecmp(question->name,
+                       query->target,
+                       query->targetlen) == 0) &&
+          (question->qtype == query->qtype) &&
+          (question->qclass == query->qclass));
+}
+
+void handle_response(resolver_t* resolver,
+                     resolver_query_t* query,
+                     request_t* request,
+                     const dns_header_t* header,
+                     const uint8_t* buf,
+                     size_t len)
+{
+  resolver_buffers_t* buffers;
+  size_t nanswers;
+  size_t nauthorities;
+  size_t nadditionals;
+  int ret;
+
+  buffers = resolver->buffers;
+
+  switch (DNS_RCODE(header->flags)) {
+    case DNS_RCODE_NOERROR:
+      nanswers = ARRAY_SIZE(buffers->answers);
+      nauthorities = ARRAY_SIZE(buffers->authorities);
+      nadditionals = ARRAY_SIZE(buffers->additionals);
+
+      /* The glue is only needed in iterative mode. */
+      if (resolver->iterative) {
+        ret = dns_process_sections(buf,
+                                   len,
+                                   buffers->answers,
+                                   &nanswers,
+                                   buffers->authorities,
+                                   &nauthorities,
+                                   buffers->additionals,
+                                   &nadditionals);
+      } else {
+        ret = dns_process_response(buf,
+                                   len,
+                                   NULL,
+                                   NULL,
+                                   NULL,
+                                   buffers->answers,
+                                   &nanswers,
+                                   buffers->authorities,
+                                   &nauthorities);
+      }
+
+      if (ret == 0) {
+        if (is_referral(resolver, header, nauthorities)) {
+          follow_referral(resolver,
+                          query,
+                          request,
+                          buf,
+                          len,
+                          nauthorities,
+                          nadditionals);
+
+          return;
+        }
+
+        /* Iterative mode: the query may go on with the target of a CNAME
+         * record.
+         */
+        if ((resolver->iterative) &&
+            (follow_cname(resolver, query, nanswers) == 0)) {
+          return;
+        }
+
+        if ((query->cnameslen > 0) &&
+            (build_response(resolver,
+                            query,
+                            buf,
+                            len,
+                            &len,
+                            &nanswers,
+                            &nauthorities) < 0)) {
+          complete_query(resolver, query, RESOLVER_ERROR, NULL, 0, 0, 0);
+          return;
+        }
+
+        if (query->cnameslen > 0) {
+          buf = buffers->response;
+        }
+
+        add_to_cache(resolver, query, buffers->answers, nanswers);
+
+        complete_query(resolver,
+                       query,
+                       RESOLVER_SUCCESS,
+                       buf,
+                       len,
+                       nanswers,
+                       nauthorities);
+      } else {
+        /* Truncated or invalid response. */
+        complete_query(resolver, query, RESOLVER_ERROR, buf, len, 0, 0);
+      }
+
+      break;
+    case DNS_RCODE_NXDOMAIN:
+      nanswers = 0;
+      nauthorities = 0;
+
+      if (query->cnameslen > 0) {
+        if (build_response(resolver,
+                           query,
+                           buf,
+                           len,
+                           &len,
+                           &nanswers,
+                           &nauthorities) < 0) {
+          complete_query(resolver, query, RESOLVER_ERROR, NULL, 0, 0, 0);
+          break;
+        }
+
+        buf = buffers->response;
+      }
+
+      complete_query(resolver,
+                     query,
+                     RESOLVER_NXDOMAIN,
+                     buf,
+                     len,
+                     nanswers,
+                     nauthorities);
+
+      break;
+    default:
+      retry_query(resolver, query, request, buf, len);
+  }
+}
+
+int start_tcp(resolver_t* resolver,
+              resolver_query_t* query,
+              const struct sockaddr* addr,
+              socklen_t addrlen)
+{
+  resolver_tcp_t* tcp;
+  struct epoll_event ev;
+  size_t len;
+  unsigned i;
+
+  for (i = 0; i < resolver->max_tcp; i++) {
+    tcp = &resolver->tcp[i];
+
+    if (tcp->query != NO_QUERY) {
+      continue;
+    }
+
+    tcp->id = next_random(resolver) & 0xffff;
+
+    if (dns_build_request(tcp->id,
+                          query->qtype,
+                          query->qclass,
+                          query->target,
+                          query->targetlen,
+                          tcp->request + 2,
+                          &len) < 0) {
+      return -1;
+    }
+
+    /* The nameservers are not asked for recursion. */
+    if (resolver->iterative) {
+      tcp->request[4] &= ~(DNS_FLAG_RD >> 8);
+    }
+
+    tcp->request[0] = (len >> 8) & 0xff;
+    tcp->request[1] = len & 0xff;
+
+    tcp->requestlen = 2 + len;
+    tcp->sent = 0;
+    tcp->received = 0;
+
+    if ((tcp->fd = socket_connect(addr, addrlen)) == -1) {
+      return -1;
+    }
+
+    /* Writable when connected. */
+    ev.events = EPOLLOUT;
+    ev.data.u64 = ((uint64_t) TCP_CONNECTIONS << 32) | i;
+
+    if (epoll_ctl(resolver->epfd, EPOLL_CTL_ADD, tcp->fd, &ev) < 0) {
+      close(tcp->fd);
+      tcp->fd = -1;
+
+      return -1;
+    }
+
+    tcp->query = query_index(resolver, query);
+    query->tcp = i + 1;
+
+    counter_inc(&resolver->stats.tcp_requests);
+
+    /* The responses to the UDP requests are not accepted anymore and the
+     * response over TCP has 'tcp_timeout' milliseconds to arrive (then the
+     * query is retried as if the request had timed out).
+     */
+    release_ids(resolver, query);
+
+    query->hedge_at = UINT64_MAX;
+    query->retransmit = timer_now() + resolver->tcp_timeout;
+
+    timer_heap_add(&resolver->timers, &query->timer, next_expiration(query));
+
+    return 0;
+  }
+
+  return -1;
+}
+
+void tcp_event(resolver_t* resolver, unsigned index)
+{
+  resolver_tcp_t* tcp;
+  resolver_query_t* query;
+  struct epoll_event ev;
+  size_t len;
+  ssize_t n;
+
+  tcp = &resolver->tcp[index];
+
+  /* The connection might have been closed by a previous event. */
+  if (tcp->fd == -1) {
+    return;
+  }
+
+  query = &resolver->queries[tcp->query];
+
+  if (tcp->sent < tcp->requestlen) {
+    if ((n = socket_send(tcp->fd,
+                         tcp->request + tcp->sent,
+                         tcp->requestlen - tcp->sent)) < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        return;
+      }
+    } else {
+      /* Wait for the response once the request has been sent. */
+      if ((tcp->sent += n) == tcp->requestlen) {
+        ev.events = EPOLLIN;
+        ev.data.u64 = ((uint64_t) TCP_CONNECTIONS << 32) | index;
+
+        if (epoll_ctl(resolver->epfd, EPOLL_CTL_MOD, tcp->fd, &ev) < 0) {
+          n = -1;
+        }
+      }
+    }
+  } else {
+    if ((n = socket_recv(tcp->fd,
+                         tcp->response + tcp->received,
+                         sizeof(tcp->response) - tcp->received)) < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        return;
+      }
+    } else if (n > 0) {
+      tcp->received += n;
+
+      /* Complete response? */
+      if ((tcp->received >= 2) &&
+          (tcp->received >= 2 + (len = (tcp->response[0] << 8) |
+                                       tcp->response[1]))) {
+        tcp_response(resolver, tcp);
+        return;
+      }
+    } else {
+      /* Connection closed by the server. */
+      n = -1;
+    }
+  }
+
+  /* Connection error: try again over UDP. */
+  if (n < 0) {
+    release_tcp(resolver, query);
+    retry_query(resolver, query, &query->request, NULL, 0);
+  }
+}
+
+void tcp_response(resolver_t* resolver, resolver_tcp_t* tcp)
+{
+  resolver_query_t* query;
+  dns_header_t header;
+  const uint8_t* buf;
+  size_t len;
+
+  query = &resolver->queries[tcp->query];
+
+  buf = tcp->response + 2;
+  len = (tcp->response[0] << 8) | tcp->response[1];
+
+  /* The connection is not needed anymore, but the response stays in its
+   * buffer (and the connection is not reused) until it has been handled.
+   */
+  close(tcp->fd);
+  tcp->fd = -1;
+
+  query->tcp = 0;
+
+  if ((dns_process_header(buf,
+                          len,
+                          &header,
+                          &resolver->buffers->question) == 0) &&
+      (header.flags & DNS_FLAG_QR) &&
+      (header.id == tcp->id) &&
+      (question_matches(resolver, query))) {
+    handle_response(resolver, query, &query->request, &header, buf, len);
+  } else {
+    retry_query(resolver, query, &query->request, NULL, 0);
+  }
+
+  tcp->query = NO_QUERY;
+}
+
+void release_tcp(resolver_t* resolver, resolver_query_t* query)
+{
+  resolver_tcp_t* tcp;
+
+  if (query->tcp) {
+    tcp = &resolver->tcp[query->tcp - 1];
+
+    /* Also removes the socket from epoll. */
+    close(tcp->fd);
+    tcp->fd = -1;
+
+    tcp->query = NO_QUERY;
+    query->tcp = 0;
+  }
+}
+
+void retry_query(resolver_t* resolver,
+                 resolver_query_t* query,
+                 request_t* request,
+                 const uint8_t* buf,
+                 size_t len)
+{
+  release_id(resolver, query, request);
+
+  /* Wait for the response to the other request (if any). */
+  if ((query->request.active) || (query->hedge.active)) {
+    return;
+  }
+
+  /* Try with another server (if there are attempts left). */
+  if ((query->attempts < resolver->attempts) &&
+      (send_query(resolver, query) == 0)) {
+    return;
+  }
+
+  complete_query(resolver, query, RESOLVER_SERVFAIL, buf, len, 0, 0);
+}
+
+int is_referral(const resolver_t* resolver,
+                const dns_header_t* header,
+                size_t nauthorities)
+{
+  size_t i;
+
+  /* A referral is a non-authoritative response without answers and with
+   * the NS records of the zone cut in the authority section.
+   */
+  if ((resolver->iterative) &&
+      (header->ancount == 0) &&
+      ((header->flags & DNS_FLAG_AA) == 0)) {
+    for (i = 0; i < nauthorities; i++) {
+      if (resolver->buffers->authorities[i].type == DNS_QTYPE_NS) {
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+void follow_referral(resolver_t* resolver,
+                     resolver_query_t* query,
+                     request_t* request,
+                     const uint8_t* buf,
+                     size_t len,
+                     size_t nauthorities,
+                     size_t nadditionals)
+{
+  const resolver_buffers_t* buffers;
+  const rr_t* ns;
+  const rr_t* glue;
+  char zone[HOSTNAME_MAX_LEN + 1];
+  char target[HOSTNAME_MAX_LEN + 1];
+  size_t zonelen;
+  uint32_t ttl;
+  time_t now;
+  size_t i;
+  size_t j;
+
+  buffers = resolver->buffers;
+
+  zonelen = 0;
+  ttl = DELEGATION_MAX_TTL;
+
+  /* Zone cut: owner of the first NS record. */
+  for (i = 0; i < nauthorities; i++) {
+    ns = &buffers->authorities[i];
+
+    if (ns->type == DNS_QTYPE_NS) {
+      if (zonelen == 0) {
+        zonelen = ns->namelen;
+        lowercase(ns->name, zonelen, zone);
+      }
+
+      if ((ns->namelen == zonelen) &&
+          (strncasecmp(ns->name, zone, zonelen) == 0)) {
+        ttl = MIN(ttl, ns->ttl);
+      }
+    }
+  }
+
+  /* The zone cut must be below the zone asked and contain the name (the
+   * server is lame or bogus otherwise).
+   */
+  if ((zonelen <= query->zonelen) ||
+      (!in_zone(zone, zonelen, query->zone, query->zonelen)) ||
+      (!in_zone(query->target, query->targetlen, zone, zonelen))) {
+    retry_query(resolver, query, request, buf, len);
+    return;
+  }
+
+  if (++query->referrals > RESOLVER_MAX_REFERRALS) {
+    complete_query(resolver, query, RESOLVER_SERVFAIL, buf, len, 0, 0);
+    return;
+  }
+
+  counter_inc(&resolver->stats.referrals);
+
+  /* Responses to the requests sent to the previous servers are not
+   * accepted anymore.
+   */
+  release_ids(resolver, query);
+
+  query->nservers = 0;
+
+  /* Addresses of the nameservers from the additional section (only those
+   * in the zone of the server which sent the referral).
+   */
+  for (i = 0; i < nauthorities; i++) {
+    ns = &buffers->authorities[i];
+
+    if ((ns->type != DNS_QTYPE_NS) ||
+        (ns->namelen != zonelen) ||
+        (strncasecmp(ns->name, zone, zonelen) != 0)) {
+      continue;
+    }
+
+    lowercase(ns->cname.name, ns->cname.namelen, target);
+
+    if (!in_zone(target, ns->cname.namelen, query->zone, query->zonelen)) {
+      continue;
+    }
+
+    for (j = 0;
+         (j < nadditionals) && (query->nservers < DELEGATION_MAX_ADDRESSES);
+         j++) {
+      glue = &buffers->additionals[j];
+
+      if ((glue->namelen != ns->cname.namelen) ||
+          (strncasecmp(glue->name, target, glue->namelen) != 0)) {
+        continue;
+      }
+
+      if ((glue->type == DNS_QTYPE_A) && (resolver->nfds[0] > 0)) {
+        memset(&query->servers[query->nservers].sin,
+               0,
+               sizeof(struct sockaddr_in));
+
+        query->servers[query->nservers].sin.sin_family = AF_INET;
+        query->servers[query->nservers].sin.sin_addr = glue->addr4;
+        query->servers[query->nservers].sin.sin_port =
+          resolver->nameserver_port;
+      } else if ((glue->type == DNS_QTYPE_AAAA) && (resolver->nfds[1] > 0)) {
+        memset(&query->servers[query->nservers].sin6,
+               0,
+               sizeof(struct sockaddr_in6));
+
+        query->servers[query->nservers].sin6.sin6_family = AF_INET6;
+        query->servers[query->nservers].sin6.sin6_addr = glue->addr6;
+        query->servers[query->nservers].sin6.sin6_port =
+          resolver->nameserver_port;
+      } else {
+        continue;
+      }
+
+      ttl = MIN(ttl, glue->ttl);
+      query->nservers++;
+    }
+  }
+
+  memcpy(query->zone, zone, zonelen + 1);
+  query->zonelen = zonelen;
+  query->zonettl = ttl;
+
+  query->attempts = 0;
+  query->tried = 0;
+
+  if (query->nservers > 0) {
+    now = time(NULL);
+
+    delegations_add(&resolver->delegations,
+                    zone,
+                    zonelen,
+                    query->servers,
+                    query->nservers,
+                    now + ttl);
+
+    if (send_query(resolver, query) < 0) {
+      complete_query(resolver, query, RESOLVER_SERVFAIL, buf, len, 0, 0);
+    }
+  } else if (resolve_nameserver(resolver, query, nauthorities) < 0) {
+    /* No glue and no nameserver could be resolved. */
+    complete_query(resolver, query, RESOLVER_SERVFAIL, buf, len, 0, 0);
+  }
+}
+
+void find_zone_cut(resolver_t* resolver, resolver_query_t* query)
+{
+  const delegation_t* delegation;
+
+  delegation = delegations_find(&resolver->delegations,
+                                query->target,
+                                query->targetlen,
+                                time(NULL));
+
+  memcpy(query->zone, delegation->zone, delegation->zonelen + 1);
+  query->zonelen = delegation->zonelen;
+
+  memcpy(query->servers,
+         delegation->addrs,
+         delegation->naddrs * sizeof(delegation_address_t));
+
+  query->nservers = delegation->naddrs;
+
+  query->referrals = 0;
+}
+
+int follow_cname(resolver_t* resolver,
+                 resolver_query_t* query,
+                 size_t nanswers)
+{
+  const rr_t* answers;
+  const rr_t* cname;
+  const char* name;
+  uint8_t* cnames;
+  char* target;
+  size_t cnameslen;
+  size_t namelen;
+  size_t i;
+
+  /* Only the types kept by the parser can be put in the response built at
+   * the end.
+   */
+  switch (query->qtype) {
+    case DNS_QTYPE_A:
+    case DNS_QTYPE_AAAA:
+    case DNS_QTYPE_NS:
+    case DNS_QTYPE_PTR:
+    case DNS_QTYPE_MX:
+    case DNS_QTYPE_SOA:
+      break;
+    default:
+      return -1;
+  }
+
+  answers = resolver->buffers->answers;
+
+  name = query->target;
+  namelen = query->targetlen;
+
+  cnameslen = query->cnameslen;
+
+  /* Follow the CNAME chain of the answer section. */
+  do {
+    cname = NULL;
+
+    for (i = 0; i < nanswers; i++) {
+      if ((answers[i].namelen == namelen) &&
+          (strncasecmp(answers[i].name, name, namelen) == 0)) {
+        if (answers[i].type == query->qtype) {
+          /* The chain ends with an answer. */
+          query->cnameslen = cnameslen;
+          return -1;
+        } else if (answers[i].type == DNS_QTYPE_CNAME) {
+          cname = &answers[i];
+        }
+      }
+    }
+
+    if (!cname) {
+      break;
+    }
+
+    /* The chain is too long (or it is a loop). */
+    if (query->cnameslen + sizeof(uint32_t) + 1 + cname->cname.namelen + 1 >
+        CNAMES_SIZE) {
+      complete_query(resolver, query, RESOLVER_SERVFAIL, NULL, 0, 0, 0);
+      return 0;
+    }
+
+    cnames = query->cnames + query->cnameslen;
+
+    memcpy(cnames, &cname->ttl, sizeof(uint32_t));
+    cnames[sizeof(uint32_t)] = cname->cname.namelen;
+
+    target = (char*) cnames + sizeof(uint32_t) + 1;
+    lowercase(cname->cname.name, cname->cname.namelen, target);
+
+    name = target;
+    namelen = cname->cname.namelen;
+
+    query->cnameslen += sizeof(uint32_t) + 1 + namelen + 1;
+  } while (1);
+
+  /* No CNAME record, or the server is authoritative for the target (NODATA):
+   * the response is final.
+   */
+  if ((query->cnameslen == cnameslen) ||
+      (in_zone(name, namelen, query->zone, query->zonelen))) {
+    query->cnameslen = cnameslen;
+    return -1;
+  }
+
+  /* Restarting the query counts as a nesting level. */
+  if (query->depth >= RESOLVER_MAX_DEPTH) {
+    complete_query(resolver, query, RESOLVER_SERVFAIL, NULL, 0, 0, 0);
+    return 0;
+  }
+
+  query->depth++;
+
+  counter_inc(&resolver->stats.cnames);
+
+  /* Responses to the requests for the previous name are not accepted
+   * anymore.
+   */
+  release_ids(resolver, query);
+
+  query->target = name;
+  query->targetlen = namelen;
+
+  find_zone_cut(resolver, query);
+
+  query->attempts = 0;
+  query->tried = 0;
+
+  if (send_query(resolver, query) < 0) {
+    complete_query(resolver, query, RESOLVER_SERVFAIL, NULL, 0, 0, 0);
+  }
+
+  return 0;
+}
+
+int build_response(resolver_t* resolver,
+                   const resolver_query_t* query,
+                   const uint8_t* buf,
+                   size_t len,
+                   size_t* responselen,
+                   size_t* nanswers,
+                   size_t* nauthorities)
+{
+  resolver_buffers_t* buffers;
+  dns_response_t response;
+  dns_question_t question;
+  const uint8_t* cnames;
+  const char* owner;
+  size_t ownerlen;
+  size_t ncnames;
+  size_t pos;
+  size_t i;
+  rr_t* rr;
+
+  buffers = resolver->buffers;
+
+  /* CNAME records followed. */
+  owner = query->name;
+  ownerlen = query->namelen;
+
+  ncnames = 0;
+
+  pos = 0;
+
+  while (pos < query->cnameslen) {
+    if (ncnames == ARRAY_SIZE(buffers->answers)) {
+      return -1;
+    }
+
+    cnames = query->cnames + pos;
+    rr = &buffers->answers[ncnames++];
+
+    memcpy(rr->name, owner, ownerlen + 1);
+    rr->namelen = ownerlen;
+
+    rr->type = DNS_QTYPE_CNAME;
+    rr->class = query->qclass;
+
+    memcpy(&rr->ttl, cnames, sizeof(uint32_t));
+
+    owner = (const char*) cnames + sizeof(uint32_t) + 1;
+    ownerlen = cnames[sizeof(uint32_t)];
+
+    memcpy(rr->cname.name, owner, ownerlen + 1);
+    rr->cname.namelen = ownerlen;
+
+    pos += sizeof(uint32_t) + 1 + ownerlen + 1;
+  }
+
+  /* Answers and authorities of the last response (only for NOERROR). */
+  *nanswers = ARRAY_SIZE(buffers->answers) - ncnames;
+  *nauthorities = ARRAY_SIZE(buffers->authorities);
+
+  if (DNS_RCODE(buf[3]) == DNS_RCODE_NOERROR) {
+    if (dns_process_response(buf,
+                             len,
+                             NULL,
+                             NULL,
+                             NULL,
+                             buffers->answers + ncnames,
+                             nanswers,
+                             buffers->authorities,
+                             nauthorities) < 0) {
+      return -1;
+    }
+  } else {
+    *nanswers = 0;
+    *nauthorities = 0;
+  }
+
+  *nanswers += ncnames;
+
+  /* The response has the question of the query. */
+  memcpy(question.name, query->name, query->namelen + 1);
+  question.namelen = query->namelen;
+  question.qtype = query->qtype;
+  question.qclass = query->qclass;
+
+  if (dns_response_init(&response,
+                        buffers->response,
+                        sizeof(buffers->response),
+                        0,
+                        DNS_FLAG_QR | DNS_RCODE(buf[3]),
+                        &question) < 0) {
+    return -1;
+  }
+
+  for (i = 0; i < *nanswers; i++) {
+    if (dns_response_add(&response,
+                         DNS_SECTION_ANSWER,
+                         &buffers->answers[i]) < 0) {
+      return -1;
+    }
+  }
+
+  for (i = 0; i < *nauthorities; i++) {
+    if (dns_response_add(&response,
+                         DNS_SECTION_AUTHORITY,
+                         &buffers->authorities[i]) < 0) {
+      return -1;
+    }
+  }
+
+  *responselen = dns_response_length(&response);
+
+  return 0;
+}
+
+int resolve_nameserver(resolver_t* resolver,
+                       resolver_query_t* query,
+                       size_t nauthorities)
+{
+  const rr_t* ns;
+  size_t i;
+
+  if (query->depth >= RESOLVER_MAX_DEPTH) {
+    return -1;
+  }
+
+  /* The query waits (until its deadline at most) for the address of one of
+   * the nameservers.
+   */
+  query->hedge_at = UINT64_MAX;
+  query->retransmit = UINT64_MAX;
+
+  timer_heap_add(&resolver->timers, &query->timer, query->deadline);
+
+  for (i = 0; i < nauthorities; i++) {
+    ns = &resolver->buffers->authorities[i];
+
+    /* A nameserver whose address is already being resolved by this query
+     * or by one of the queries waiting for it is skipped (it would only be
+     * reachable through itself).
+     */
+    if ((ns->type == DNS_QTYPE_NS) &&
+        (ns->namelen == query->zonelen) &&
+        (strncasecmp(ns->name, query->zone, query->zonelen) == 0) &&
+        (!resolving_nameserver(query, ns->cname.name, ns->cname.namelen)) &&
+        (start_query(resolver,
+                     ns->cname.name,
+                     ns->cname.namelen,
+                     DNS_QTYPE_A,
+                     DNS_QCLASS_IN,
+                     nameserver_resolved,
+                     query,
+                     query->depth + 1) == 0)) {
+      counter_inc(&resolver->stats.nameserver_lookups);
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+void nameserver_resolved(const resolver_result_t* result, void* data)
+{
+  resolver_query_t* query;
+  resolver_t* resolver;
+  uint32_t ttl;
+  size_t i;
+
+  query = (resolver_query_t*) data;
+  resolver = query->resolver;
+
+  ttl = query->zonettl;
+
+  if (result->status == RESOLVER_SUCCESS) {
+    for (i = 0;
+         (i < result->nanswers) && (query->nservers < DELEGATION_MAX_ADDRESSES);
+         i++) {
+      if (result->answers[i].type == DNS_QTYPE_A) {
+        memset(&query->servers[query->nservers].sin,
+               0,
+               sizeof(struct sockaddr_in));
+
+        query->servers[query->nservers].sin.sin_family = AF_INET;
+        query->servers[query->nservers].sin.sin_addr =
+          result->answers[i].addr4;
+        query->servers[query->nservers].sin.sin_port =
+          resolver->nameserver_port;
+
+        ttl = MIN(ttl, result->answers[i].ttl);
+        query->nservers++;
+      }
+    }
+  }
+
+  if (query->nservers > 0) {
+    delegations_add(&resolver->delegations,
+                    query->zone,
+                    query->zonelen,
+                    query->servers,
+                    query->nservers,
+                    time(NULL) + ttl);
+
+    if (send_query(resolver, query) == 0) {
+      return;
+    }
+  }
+
+  complete_query(resolver, query, RESOLVER_SERVFAIL, NULL, 0, 0, 0);
+}
+
+int resolving_nameserver(const resolver_query_t* query,
+                         const char* name,
+                         size_t namelen)
+{
+  do {
+    if ((query->qtype == DNS_QTYPE_A) &&
+        (query->targetlen == namelen) &&
+        (strncasecmp(query->target, name, namelen) == 0)) {
+      return 1;
+    }
+
+    /* The query resolves the address of a nameserver for another query? */
+    if (query->callback != nameserver_resolved) {
+      return 0;
+    }
+
+    query = (const resolver_query_t*) query->data;
+  } while (1);
+}
+
+void expire_queries(resolver_t* resolver)
+{
+  resolver_query_t* query;
+  timer_entry_t* timer;
+  uint64_t now;
+
+  now = timer_now();
+
+  while ((timer = timer_heap_pop_expired(&resolver->timers, now)) != NULL) {
+    query = TIMER_CONTAINER(timer, resolver_query_t, timer);
+
+    /* Time to send the hedged request? */
+    if ((query->hedge_at <= now) &&
+        (now < query->retransmit) &&
+        (now < query->deadline)) {
+      query->hedge_at = UINT64_MAX;
+
+      if (send_request(resolver, query, &query->hedge, 1) == 0) {
+        counter_inc(&resolver->stats.hedges);
+      }
+
+      /* The timer has just been removed from the heap. */
+      timer_heap_add(&resolver->timers, &query->timer, next_expiration(query));
+
+      continue;
+    }
+
+    TRACE2(query_timeout, query->name, query->attempts);
+
+    /* The timer might have expired because of the deadline. */
+    if ((now >= query->retransmit) &&
+        (query->request.active) &&
+        (!resolver->iterative)) {
+      upstream_timeout(&resolver->upstreams,
+                       &resolver->upstreams.servers[query->request.upstream],
+                       query->request.sent,
+                       timer_now_us());
+    }
+
+    /* Responses to the previous requests are not accepted anymore, the
+     * next request goes to another server.
+     */
+    release_ids(resolver, query);
+    release_tcp(resolver, query);
+
+    if ((query->attempts >= resolver->attempts) ||
+        (now >= query->deadline) ||
+        (send_query(resolver, query) < 0)) {
+      counter_inc(&resolver->stats.timeouts);
+
+      complete_query(resolver, query, RESOLVER_TIMEOUT, NULL, 0, 0, 0);
+    }
+  }
+}
+
+void complete_query(resolver_t* resolver,
+                    resolver_query_t* query,
+                    resolver_status_t status,
+                    const void* response,
+                    size_t responselen,
+                    size_t nanswers,
+                    size_t nauthorities)
+{
+  resolver_result_t result;
+  resolver_waiter_t* waiter;
+  resolver_waiter_t* next;
+
+  release_ids(resolver, query);
+  release_tcp(resolver, query);
+  timer_heap_remove(&resolver->timers, &query->timer);
+
+  /* Iterative mode: if the query was waiting for the address of a
+   * nameserver, it is not needed anymore.
+   */
+  if ((resolver->iterative) && (query->nservers == 0)) {
+    resolver_cancel(resolver, nameserver_resolved, query);
+  }
+
+  /* Remove from the table of queries in flight, so that the callbacks
+   * don't attach new queries to this one.
+   */
+  node_unlink(&query->node);
+
+  /* After following a CNAME record, the responses received are for another
+   * question: only the response built from them is returned.
+   */
+  if ((query->cnameslen > 0) && (response != resolver->buffers->response)) {
+    response = NULL;
+    responselen = 0;
+  }
+
+  result.status = status;
+
+  result.name = query->name;
+  result.namelen = query->namelen;
+  result.qtype = query->qtype;
+  result.qclass = query->qclass;
+
+  result.cached = 0;
+
+  result.response = response;
+  result.responselen = responselen;
+
+  result.answers = resolver->buffers->answers;
+  result.nanswers = nanswers;
+
+  result.authorities = resolver->buffers->authorities;
+  result.nauthorities = nauthorities;
+
+  query->callback(&result, query->data);
+
+  /* Complete the queries waiting for the same response. */
+  waiter = query->waiters;
+
+  while (waiter) {
+    next = waiter->next;
+
+    waiter->callback(&result, waiter->data);
+
+    waiter->next = resolver->free_waiters;
+    resolver->free_waiters = waiter;
+
+    waiter = next;
+  }
+
+  /* Free query. */
+  query->next = resolver->free_queries;
+  resolver->free_queries = query_index(resolver, query);
+
+  resolver->nqueries--;
+}
@@ -0,0 +1,362 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "dns.h"
+#include "dnscache.h"
+#include "delegation.h"
+#include "node.h"
+#include "timers.h"
+#include "upstream.h"
+
+/* Asynchronous DNS resolver.
+ * Queries are sent through non-blocking UDP sockets driven by epoll, many
+ * of them can be in flight at the same time. Each request goes to the
+ * fastest upstream server which is not failing, retransmissions go to
+ * another server. If a response is truncated, the request is repeated over
+ * TCP to the same server.
+ * In iterative mode, the queries are resolved starting from the root
+ * servers (the servers added with resolver_add_upstream() are the root
+ * hints): the referrals are followed, with the addresses of the
+ * nameservers taken from the additional section (glue) or resolved with
+ * another query, and the delegations are cached, so that the next queries
+ * go straight to the closest known zone cut. A CNAME record pointing out
+ * of the zone of the server which answered is followed by restarting the
+ * query with its target (A, AAAA, NS, PTR, MX and SOA queries), and the
+ * response returned is built from the CNAME records followed and the last
+ * response. The caller drives the resolver by calling resolver_process()
+ * (directly or when the file descriptor returned by resolver_fd() becomes
+ * readable), which invokes the completion callbacks.
+ */
+
+#define RESOLVER_DEFAULT_MAX_QUERIES      4096
+#define RESOLVER_DEFAULT_MAX_WAITERS      4096
+#define RESOLVER_DEFAULT_TIMEOUT          UPSTREAM_DEFAULT_RTO
+#define RESOLVER_DEFAULT_MIN_TIMEOUT      UPSTREAM_DEFAULT_MIN_RTO
+#define RESOLVER_DEFAULT_MAX_TIMEOUT      UPSTREAM_DEFAULT_MAX_RTO
+#define RESOLVER_DEFAULT_DEADLINE         5000 /* [ms] */
+#define RESOLVER_DEFAULT_ATTEMPTS         5
+#define RESOLVER_DEFAULT_HEDGE_PERCENTILE 95
+#define RESOLVER_DEFAULT_BUFFER_SIZE      (1024 * 1024)
+#define RESOLVER_DEFAULT_SOCKETS          1
+#define RESOLVER_DEFAULT_DELEGATIONS      1024
+#define RESOLVER_DEFAULT_NAMESERVER_PORT  53
+#define RESOLVER_DEFAULT_MAX_TCP          8
+#define RESOLVER_DEFAULT_TCP_TIMEOUT      2000 /* [ms] */
+
+#define RESOLVER_MAX_ANSWERS              32
+#define RESOLVER_MAX_AUTHORITIES          16
+#define RESOLVER_MAX_ADDITIONALS          32
+#define RESOLVER_BATCH_SIZE               32
+
+/* Iterative mode: maximum number of referrals followed per query and
+ * maximum nesting of the queries started to resolve the address of a
+ * nameserver.
+ */
+#define RESOLVER_MAX_REFERRALS            16
+#define RESOLVER_MAX_DEPTH                3
+
+typedef enum {
+  RESOLVER_SUCCESS,
+  RESOLVER_NXDOMAIN,
+  RESOLVER_SERVFAIL, /* The server returned another error. */
+  RESOLVER_TIMEOUT,
+  RESOLVER_ERROR
+} resolver_status_t;
+
+typedef struct {
+  resolver_status_t status;
+
+  /* Question (lowercase). */
+  const char* name;
+  size_t namelen;
+  uint16_t qtype;
+  uint16_t qclass;
+
+  /* If the answer was taken from the DNS cache, 'answers' contains a single
+   * resource record and there is no response.
+   */
+  int cached;
+
+  /* Response (only valid while the callback runs). */
+  const void* response;
+  size_t responselen;
+
+  const rr_t* answers;
+  size_t nanswers;
+
+  const rr_t* authorities;
+  size_t nauthorities;
+} resolver_result_t;
+
+typedef void (*resolver_callback_t)(const resolver_result_t* result,
+                                    void* data);
+
+typedef struct {
+  /* Calls to resolver_resolve(). */
+  uint64_t queries;
+
+  /* Queries answered from the DNS cache. */
+  uint64_t cache_hits;
+
+  /* Queries attached to an identical query in flight. */
+  uint64_t coalesced;
+
+  /* Requests sent (including retransmissions and requests to other servers
+   * after a server failure).
+   */
+  uint64_t requests;
+
+  /* Responses accepted. */
+  uint64_t responses;
+
+  /* Queries which timed out. */
+  uint64_t timeouts;
+
+  /* Hedged requests sent and queries completed by them. */
+  uint64_t hedges;
+  uint64_t hedge_wins;
+
+  /* Iterative mode: referrals followed, queries started to resolve the
+   * address of a nameserver (no glue) and queries restarted with the
+   * target of a CNAME record pointing out of the zone.
+   */
+  uint64_t referrals;
+  uint64_t nameserver_lookups;
+  uint64_t cnames;
+
+  /* Requests repeated over TCP (truncated responses). */
+  uint64_t tcp_requests;
+} resolver_stats_t;
+
+typedef struct {
+  /* Maximum number of queries in flight (up to 65535). */
+  unsigned max_queries;
+
+  /* If set, a query for a question (name, type and class) for which there
+   * is already a query in flight doesn't send a new request, but waits for
+   * the response to the first one.
+   */
+  int coalesce;
+
+  /* Maximum number of such waiting queries. */
+  unsigned max_waiters;
+
+  /* Retransmission timeouts [ms]: the timeout of each server is computed
+   * from its round-trip times (RFC 6298), 'timeout' is used until the first
+   * response has been received, and it is doubled after each timeout.
+   */
+  unsigned timeout;
+  unsigned min_timeout;
+  unsigned max_timeout;
+
+  /* Maximum time to resolve a query, including all the attempts [ms]
+   * (0: no limit).
+   */
+  unsigned deadline;
+
+  /* Hedged requests: if the response to a request has not been received
+   * after 'hedge_delay' milliseconds (0: disabled), or after the
+   * 'hedge_percentile' of the round-trip times of the server if it is
+   * higher, a second request is sent to another server. The first response
+   * completes the query, the other one is ignored.
+   */
+  unsigned hedge_delay;
+  unsigned hedge_percentile;
+
+  /* Maximum number of attempts per query (each attempt goes to a different
+   * server while there are servers which have not been tried).
+   */
+  unsigned attempts;
+
+  /* Size of the socket buffers (bursts of requests / responses). */
+  int buffer_size;
+
+  /* Number of sockets per server (up to UPSTREAM_MAX_SOCKETS), each request
+   * goes through a random one, so that the responses are spread among
+   * several receive queues.
+   */
+  unsigned sockets;
+
+  /* If set, the sockets are bound to random source ports (otherwise the
+   * kernel chooses them).
+   */
+  int random_ports;
+
+  /* If set, the sockets are connected to the server (no route lookup per
+   * request).
+   */
+  int connected;
+
+  /* If set, the sockets of a server share the source port (SO_REUSEPORT)
+   * and each one is bound to a CPU (SO_INCOMING_CPU): the kernel delivers
+   * each response to the socket of the CPU which received it. The sockets
+   * are not connected in this case.
+   */
+  int cpu_affinity;
+
+  /* Maximum number of requests being repeated over TCP at the same time
+   * (0: the truncated responses are returned as they are) and time to
+   * receive the response over TCP [ms].
+   */
+  unsigned max_tcp;
+  unsigned tcp_timeout;
+
+  /* DNS caches (optional): A / AAAA queries are answered from them and the
+   * addresses received are added to them.
+   */
+  dnscaches_t* caches;
+
+  /* Iterative mode: size of the cache of delegations and port of the
+   * nameservers learned from the referrals. The requests to the
+   * nameservers go through 'sockets' unconnected sockets per address
+   * family ('connected' and 'cpu_affinity' don't apply).
+   */
+  int iterative;
+  unsigned delegations;
+  in_port_t nameserver_port;
+} resolver_config_t;
+
+typedef struct resolver_query_t resolver_query_t;
+typedef struct resolver_waiter_t resolver_waiter_t;
+typedef struct resolver_buffers_t resolver_buffers_t;
+typedef struct resolver_tcp_t resolver_tcp_t;
+
+typedef struct {
+  int epfd;
+
+  upstreams_t upstreams;
+  int buffer_size;
+  unsigned sockets;
+  int random_ports;
+  int connected;
+  int cpu_affinity;
+  unsigned ncpus;
+
+  unsigned deadline;
+  unsigned hedge_delay;
+  unsigned hedge_percentile;
+  unsigned attempts;
+  dnscaches_t* caches;
+
+  /* Connections used to repeat the requests over TCP. */
+  resolver_tcp_t* tcp;
+  unsigned max_tcp;
+  unsigned tcp_timeout;
+
+  /* Iterative mode: cache of delegations and sockets used to send the
+   * requests to the nameservers (IPv4 and IPv6; no IPv6 sockets if IPv6 is
+   * not available).
+   */
+  int iterative;
+  delegations_t delegations;
+  in_port_t nameserver_port;
+  int fds[2][UPSTREAM_MAX_SOCKETS];
+  unsigned nfds[2];
+
+  resolver_query_t* queries;
+  unsigned max_queries;
+  unsigned nqueries;
+  uint32_t free_queries;
+
+  /* Queries in flight by question. */
+  node_t* buckets;
+  unsigned nbuckets;
+
+  int coalesce;
+  resolver_waiter_t* waiters;
+  resolver_waiter_t* free_waiters;
+
+  /* Query index + 1 for each DNS ID (0: ID not in use). */
+  uint32_t* ids;
+
+  timer_heap_t timers;
+
+  uint32_t random;
+
+  resolver_buffers_t* buffers;
+
+  resolver_stats_t stats;
+} resolver_t;
+
+void resolver_config_init(resolver_config_t* config);
+
+int resolver_create(resolver_t* resolver, const resolver_config_t* config);
+void resolver_destroy(resolver_t* resolver);
+
+/* Adds an upstream server (up to UPSTREAMS_MAX) or, in iterative mode, a
+ * root server (up to DELEGATION_MAX_ADDRESSES).
+ * Returns the index of the server or -1.
+ */
+int resolver_add_upstream(resolver_t* resolver,
+                          const struct sockaddr* addr,
+                          socklen_t addrlen);
+
+/* Starts resolving 'name'.
+ * If the answer is in the DNS cache, the callback is invoked before
+ * returning.
+ * Returns -1 if the query could not be started (the callback is not
+ * invoked in that case).
+ */
+int resolver_resolve(resolver_t* resolver,
+                     const char* name,
+                     size_t namelen,
+                     dns_qtype_t qtype,
+                     dns_qclass_t qclass,
+                     resolver_callback_t callback,
+                     void* data);
+
+/* The callback won't be invoked for the queries started with 'callback' and
+ * 'data' (the queries are not stopped, their responses still go to the DNS
+ * cache and to the other queries waiting for them).
+ */
+void resolver_cancel(resolver_t* resolver,
+                     resolver_callback_t callback,
+                     const void* data);
+
+/* Waits up to 'timeout' milliseconds (-1: no limit) for responses, handles
+ * them and the expired queries.
+ */
+int resolver_process(resolver_t* resolver, int timeout);
+
+/* File descriptor which becomes readable when there are responses to be
+ * processed (to integrate the resolver in another event loop).
+ */
+static inline int resolver_fd(const resolver_t* resolver)
+{
+  return resolver->epfd;
+}
+
+/* Milliseconds until the next query times out (-1: no queries). */
+static inline int resolver_timeout(const resolver_t* resolver)
+{
+  return timer_heap_timeout(&resolver->timers, timer_now());
+}
+
+/* Number of queries in flight. */
+static inline unsigned resolver_pending(const resolver_t* resolver)
+{
+  return resolver->nqueries;
+}
+
+/* Takes a snapshot of the statistics (it can be called from another
+ * thread).
+ */
+void resolver_get_stats(const resolver_t* resolver, resolver_stats_t* stats);
+
+/* Number of upstream servers. */
+static inline unsigned resolver_upstreams(const resolver_t* resolver)
+{
+  return resolver->upstreams.count;
+}
+
+/* Takes a snapshot of the statistics of an upstream server. */
+int resolver_get_upstream_stats(const resolver_t* resolver,
+                                unsigned index,
+                                upstream_stats_t* stats);
+
+const char* resolver_status_to_string(resolver_status_t status);
+
+#endif /* RESOLVER_H */
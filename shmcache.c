@@ -0,0 +1,677 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shmcache.h"
+#include "dns.h"
+#include "hash.h"
+#include "macros.h"
+
+#define SHMCACHE_MAGIC   0x444e5343 /* "DNSC" */
+#define SHMCACHE_VERSION 1
+#define MAX_STRIPES      64
+#define SHM_ALIGNMENT    64
+
+static const uint32_t initval = 0xdeaddead;
+
+/* Doubly linked list node, with offsets instead of pointers. */
+typedef struct {
+  uint32_t prev;
+  uint32_t next;
+} shmnode_t;
+
+typedef struct {
+  shmnode_t node;
+
+  time_t expiration_time;
+
+  uint8_t addr[sizeof(struct in6_addr)];
+  uint8_t addrlen;
+
+  uint8_t hostlen;
+  char host[HOSTNAME_MAX_LEN + 1];
+} shm_entry_t;
+
+/* A stripe owns the buckets 'i' for which (i % nstripes) == stripe number
+ * and a fixed set of entries.
+ */
+typedef struct {
+  pthread_mutex_t mutex;
+
+  /* Free entries (singly linked through 'node.next'). */
+  uint32_t free;
+
+  /* Entries of the stripe. */
+  uint32_t first_entry;
+  uint32_t nentries;
+
+  /* Number of entries in use. */
+  uint32_t nused;
+
+  /* Next bucket to evict from when there are no free entries. */
+  uint32_t cursor;
+} shm_stripe_t;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+
+  uint64_t size;
+
+  uint32_t nbuckets;
+  uint32_t nstripes;
+  uint32_t nentries;
+
+  /* Offsets. */
+  uint32_t stripes;
+  uint32_t buckets;
+  uint32_t entries;
+} shm_header_t;
+
+static int shmcache_add(shmcaches_t* caches,
+                        const char* host,
+                        size_t hostlen,
+                        const void* addr,
+                        socklen_t addrlen,
+                        time_t expiration_time,
+                        time_t now);
+
+static int shmcache_get(shmcaches_t* caches,
+                        const char* host,
+                        size_t hostlen,
+                        time_t now,
+                        void* addr,
+                        socklen_t addrlen);
+
+static int map_segment(shmcaches_t* caches, int fd, size_t size);
+static void init_segment(shmcaches_t* caches,
+                         unsigned nbuckets,
+                         unsigned nstripes,
+                         unsigned nentries);
+
+static void stripe_reset(shmcaches_t* caches, unsigned s);
+static int stripe_lock(shmcaches_t* caches, unsigned s);
+
+static inline size_t align(size_t n)
+{
+  return (n + (SHM_ALIGNMENT - 1)) & ~((size_t) SHM_ALIGNMENT - 1);
+}
+
+static inline shm_header_t* header(const shmcaches_t* caches)
+{
+  return (shm_header_t*) caches->base;
+}
+
+static inline void* at(const shmcaches_t* caches, uint32_t offset)
+{
+  return (uint8_t*) caches->base + offset;
+}
+
+static inline uint32_t offset_of(const shmcaches_t* caches, const void* ptr)
+{
+  return (uint32_t) ((const uint8_t*) ptr - (const uint8_t*) caches->base);
+}
+
+static inline shm_stripe_t* stripe_at(const shmcaches_t* caches, unsigned s)
+{
+  return (shm_stripe_t*) at(caches, header(caches)->stripes) + s;
+}
+
+static inline shmnode_t* bucket_at(const shmcaches_t* caches, unsigned b)
+{
+  return (shmnode_t*) at(caches, header(caches)->buckets) + b;
+}
+
+static inline void shmnode_unlink(const shmcaches_t* caches, shmnode_t* node)
+{
+  ((shmnode_t*) at(caches, node->prev))->next = node->next;
+  ((shmnode_t*) at(caches, node->next))->prev = node->prev;
+}
+
+static inline void shmnode_push_front(const shmcaches_t* caches,
+                                      shmnode_t* header,
+                                      shmnode_t* node)
+{
+  uint32_t off = offset_of(caches, node);
+
+  node->next = header->next;
+  node->prev = offset_of(caches, header);
+
+  ((shmnode_t*) at(caches, header->next))->prev = off;
+  header->next = off;
+}
+
+static inline void free_entry(shmcaches_t* caches,
+                              shm_stripe_t* stripe,
+                              shm_entry_t* entry)
+{
+  cache_stats_inc(&caches->stats.frees);
+  __atomic_store_n(&stripe->nused, stripe->nused - 1, __ATOMIC_RELAXED);
+
+  shmnode_unlink(caches, &entry->node);
+
+  entry->node.next = stripe->free;
+  stripe->free = offset_of(caches, entry);
+}
+
+int shmcaches_create(shmcaches_t* caches,
+                     const char* name,
+                     unsigned nbuckets,
+                     unsigned nentries)
+{
+  unsigned nstripes;
+  size_t size;
+  int fd;
+
+  if ((nbuckets == 0) || (nentries == 0)) {
+    return -1;
+  }
+
+  nstripes = MIN(MIN(nbuckets, nentries), MAX_STRIPES);
+
+  size = align(sizeof(shm_header_t)) +
+         align(nstripes * sizeof(shm_stripe_t)) +
+         align((size_t) nbuckets * sizeof(shmnode_t)) +
+         (size_t) nentries * sizeof(shm_entry_t);
+
+  /* Offsets are 32-bit. */
+  if (size > UINT32_MAX) {
+    return -1;
+  }
+
+  if (name) {
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  } else {
+    fd = memfd_create("dnscache", MFD_CLOEXEC);
+  }
+
+  if (fd != -1) {
+    if (ftruncate(fd, size) == 0) {
+      if (map_segment(caches, fd, size) == 0) {
+        memset(&caches->stats, 0, sizeof(cache_stats_t));
+
+        init_segment(caches, nbuckets, nstripes, nentries);
+        return 0;
+      }
+    }
+
+    close(fd);
+
+    if (name) {
+      shm_unlink(name);
+    }
+  }
+
+  return -1;
+}
+
+int shmcaches_attach(shmcaches_t* caches, const char* name)
+{
+  struct stat sbuf;
+  int fd;
+
+  if ((fd = shm_open(name, O_RDWR, 0)) != -1) {
+    if ((fstat(fd, &sbuf) == 0) &&
+        ((size_t) sbuf.st_size >= sizeof(shm_header_t))) {
+      if (map_segment(caches, fd, sbuf.st_size) == 0) {
+        /* Has the creator finished initializing the segment? */
+        if ((__atomic_load_n(&header(caches)->magic, __ATOMIC_ACQUIRE) ==
+             SHMCACHE_MAGIC) &&
+            (header(caches)->version == SHMCACHE_VERSION) &&
+            (header(caches)->size == (uint64_t) sbuf.st_size)) {
+          memset(&caches->stats, 0, sizeof(cache_stats_t));
+          return 0;
+        }
+
+        munmap(caches->base, caches->size);
+      }
+    }
+
+    close(fd);
+  }
+
+  return -1;
+}
+
+void shmcaches_detach(shmcaches_t* caches)
+{
+  if (caches->base) {
+    munmap(caches->base, caches->size);
+    caches->base = NULL;
+  }
+
+  if (caches->fd != -1) {
+    close(caches->fd);
+    caches->fd = -1;
+  }
+}
+
+int shmcaches_unlink(const char* name)
+{
+  return shm_unlink(name);
+}
+
+int shmcaches_add_ipv4(shmcaches_t* caches,
+                       const char* host,
+                       size_t hostlen,
+                       const struct in_addr* addr,
+                       time_t expiration_time,
+                       time_t now)
+{
+  return shmcache_add(caches, host, hostlen, addr, 4, expiration_time, now);
+}
+
+int shmcaches_add_ipv6(shmcaches_t* caches,
+                       const char* host,
+                       size_t hostlen,
+                       const struct in6_addr* addr,
+                       time_t expiration_time,
+                       time_t now)
+{
+  return shmcache_add(caches, host, hostlen, addr, 16, expiration_time, now);
+}
+
+int shmcaches_get_ipv4(shmcaches_t* caches,
+                       const char* host,
+                       size_t hostlen,
+                       time_t now,
+                       struct in_addr* addr)
+{
+  return shmcache_get(caches, host, hostlen, now, addr, 4);
+}
+
+int shmcaches_get_ipv6(shmcaches_t* caches,
+                       const char* host,
+                       size_t hostlen,
+                       time_t now,
+                       struct in6_addr* addr)
+{
+  return shmcache_get(caches, host, hostlen, now, addr, 16);
+}
+
+void shmcaches_remove_expired(shmcaches_t* caches, time_t now)
+{
+  const shm_header_t* hdr;
+  shm_stripe_t* stripe;
+  shmnode_t* bucket;
+  shm_entry_t* entry;
+  shm_entry_t* next;
+  unsigned s;
+  unsigned b;
+
+  hdr = header(caches);
+
+  for (s = 0; s < hdr->nstripes; s++) {
+    if (stripe_lock(caches, s) == 0) {
+      stripe = stripe_at(caches, s);
+
+      for (b = s; b < hdr->nbuckets; b += hdr->nstripes) {
+        bucket = bucket_at(caches, b);
+        entry = (shm_entry_t*) at(caches, bucket->next);
+
+        while (&entry->node != bucket) {
+          next = (shm_entry_t*) at(caches, entry->node.next);
+
+          /* If the entry has expired... */
+          if (now > entry->expiration_time) {
+            free_entry(caches, stripe, entry);
+          }
+
+          entry = next;
+        }
+      }
+
+      pthread_mutex_unlock(&stripe->mutex);
+    }
+  }
+}
+
+void shmcaches_get_stats(const shmcaches_t* caches, cache_stats_t* stats)
+{
+  const shm_header_t* hdr;
+  unsigned s;
+
+  cache_stats_snapshot(&caches->stats, stats);
+
+  hdr = header(caches);
+
+  stats->entries = 0;
+  for (s = 0; s < hdr->nstripes; s++) {
+    stats->entries += __atomic_load_n(&stripe_at(caches, s)->nused,
+                                      __ATOMIC_RELAXED);
+  }
+
+  stats->bytes = stats->entries * sizeof(shm_entry_t);
+}
+
+int shmcache_add(shmcaches_t* caches,
+                 const char* host,
+                 size_t hostlen,
+                 const void* addr,
+                 socklen_t addrlen,
+                 time_t expiration_time,
+                 time_t now)
+{
+  const shm_header_t* hdr;
+  shm_stripe_t* stripe;
+  shmnode_t* bucket;
+  shmnode_t* victim;
+  shm_entry_t* entry;
+  shm_entry_t* next;
+  unsigned probes;
+  unsigned b;
+  unsigned s;
+  unsigned i;
+
+  if (hostlen <= HOSTNAME_MAX_LEN) {
+    hdr = header(caches);
+
+    b = hash(host, hostlen, initval, hdr->nbuckets);
+    s = b % hdr->nstripes;
+
+    if (stripe_lock(caches, s) == 0) {
+      stripe = stripe_at(caches, s);
+      bucket = bucket_at(caches, b);
+      entry = (shm_entry_t*) at(caches, bucket->next);
+      probes = 0;
+
+      while (&entry->node != bucket) {
+        probes++;
+
+        /* Same host?
+         * (The caller is responsible for always using the same case, either
+         *  lowercase or uppercase).
+         */
+        if ((addrlen == entry->addrlen) &&
+            (hostlen == entry->hostlen) &&
+            (memcmp(host, entry->host, hostlen) == 0)) {
+          memcpy(entry->addr, addr, addrlen);
+          entry->expiration_time = expiration_time;
+
+          shmnode_unlink(caches, &entry->node);
+          shmnode_push_front(caches, bucket, &entry->node);
+
+          pthread_mutex_unlock(&stripe->mutex);
+
+          cache_stats_inc(&caches->stats.updates);
+          cache_stats_probes(&caches->stats, probes);
+
+          return 0;
+        }
+
+        next = (shm_entry_t*) at(caches, entry->node.next);
+
+        /* If the entry has expired... */
+        if (now > entry->expiration_time) {
+          free_entry(caches, stripe, entry);
+        }
+
+        entry = next;
+      }
+
+      cache_stats_probes(&caches->stats, probes);
+
+      /* If there are no free entries, evict the least recently used entry
+       * of this bucket or, if the bucket is empty, of another bucket of the
+       * stripe.
+       */
+      if (stripe->free == 0) {
+        victim = bucket;
+
+        for (i = 0;
+             (victim->prev == offset_of(caches, victim)) && (i < hdr->nbuckets);
+             i += hdr->nstripes) {
+          if ((stripe->cursor += hdr->nstripes) >= hdr->nbuckets) {
+            stripe->cursor = s;
+          }
+
+          victim = bucket_at(caches, stripe->cursor);
+        }
+
+        free_entry(caches, stripe, (shm_entry_t*) at(caches, victim->prev));
+
+        cache_stats_inc(&caches->stats.evictions);
+      }
+
+      /* Create new entry. */
+      entry = (shm_entry_t*) at(caches, stripe->free);
+      stripe->free = entry->node.next;
+
+      memcpy(entry->addr, addr, addrlen);
+      entry->addrlen = addrlen;
+
+      entry->expiration_time = expiration_time;
+
+      memcpy(entry->host, host, hostlen);
+      entry->host[hostlen] = 0;
+
+      entry->hostlen = hostlen;
+
+      shmnode_push_front(caches, bucket, &entry->node);
+
+      __atomic_store_n(&stripe->nused, stripe->nused + 1, __ATOMIC_RELAXED);
+
+      pthread_mutex_unlock(&stripe->mutex);
+
+      cache_stats_inc(&caches->stats.inserts);
+
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+int shmcache_get(shmcaches_t* caches,
+                 const char* host,
+                 size_t hostlen,
+                 time_t now,
+                 void* addr,
+                 socklen_t addrlen)
+{
+  const shm_header_t* hdr;
+  shm_stripe_t* stripe;
+  shmnode_t* bucket;
+  shm_entry_t* entry;
+  shm_entry_t* next;
+  unsigned probes;
+  unsigned b;
+  unsigned s;
+  int ret;
+
+  if (hostlen <= HOSTNAME_MAX_LEN) {
+    hdr = header(caches);
+
+    b = hash(host, hostlen, initval, hdr->nbuckets);
+    s = b % hdr->nstripes;
+
+    if (stripe_lock(caches, s) == 0) {
+      stripe = stripe_at(caches, s);
+      bucket = bucket_at(caches, b);
+      entry = (shm_entry_t*) at(caches, bucket->next);
+
+      probes = 0;
+      ret = -1;
+
+      while (&entry->node != bucket) {
+        next = (shm_entry_t*) at(caches, entry->node.next);
+        probes++;
+
+        /* Same host?
+         * (The caller is responsible for always using the same case, either
+         *  lowercase or uppercase).
+         */
+        if ((addrlen == entry->addrlen) &&
+            (hostlen == entry->hostlen) &&
+            (memcmp(host, entry->host, hostlen) == 0)) {
+          /* If the entry has not expired... */
+          if (now <= entry->expiration_time) {
+            /* Save address. */
+            memcpy(addr, entry->addr, addrlen);
+
+            shmnode_unlink(caches, &entry->node);
+            shmnode_push_front(caches, bucket, &entry->node);
+
+            ret = 0;
+          } else {
+            free_entry(caches, stripe, entry);
+
+            cache_stats_inc(&caches->stats.expired);
+          }
+
+          break;
+        } else if (now > entry->expiration_time) {
+          /* The entry has expired. */
+          free_entry(caches, stripe, entry);
+        }
+
+        entry = next;
+      }
+
+      pthread_mutex_unlock(&stripe->mutex);
+
+      cache_stats_probes(&caches->stats, probes);
+      cache_stats_inc((ret == 0) ? &caches->stats.hits : &caches->stats.misses);
+
+      return ret;
+    }
+  }
+
+  cache_stats_inc(&caches->stats.misses);
+
+  return -1;
+}
+
+int map_segment(shmcaches_t* caches, int fd, size_t size)
+{
+  void* base;
+
+  if ((base = mmap(NULL,
+                   size,
+                   PROT_READ | PROT_WRITE,
+                   MAP_SHARED,
+                   fd,
+                   0)) != MAP_FAILED) {
+    caches->base = base;
+    caches->size = size;
+    caches->fd = fd;
+
+    return 0;
+  }
+
+  return -1;
+}
+
+void init_segment(shmcaches_t* caches,
+                  unsigned nbuckets,
+                  unsigned nstripes,
+                  unsigned nentries)
+{
+  shm_header_t* hdr;
+  shm_stripe_t* stripe;
+  pthread_mutexattr_t attr;
+  size_t off;
+  unsigned s;
+
+  hdr = header(caches);
+
+  hdr->version = SHMCACHE_VERSION;
+  hdr->size = caches->size;
+
+  hdr->nbuckets = nbuckets;
+  hdr->nstripes = nstripes;
+  hdr->nentries = nentries;
+
+  off = align(sizeof(shm_header_t));
+  hdr->stripes = off;
+
+  off += align(nstripes * sizeof(shm_stripe_t));
+  hdr->buckets = off;
+
+  off += align((size_t) nbuckets * sizeof(shmnode_t));
+  hdr->entries = off;
+
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+
+  for (s = 0; s < nstripes; s++) {
+    stripe = stripe_at(caches, s);
+
+    pthread_mutex_init(&stripe->mutex, &attr);
+
+    /* Distribute the entries among the stripes. */
+    stripe->first_entry = (uint32_t) (((uint64_t) s * nentries) / nstripes);
+    stripe->nentries = (uint32_t) ((((uint64_t) s + 1) * nentries) /
+                                   nstripes) -
+                       stripe->first_entry;
+
+    stripe_reset(caches, s);
+  }
+
+  pthread_mutexattr_destroy(&attr);
+
+  /* Publish the segment. */
+  __atomic_store_n(&hdr->magic, SHMCACHE_MAGIC, __ATOMIC_RELEASE);
+}
+
+void stripe_reset(shmcaches_t* caches, unsigned s)
+{
+  const shm_header_t* hdr;
+  shm_stripe_t* stripe;
+  shmnode_t* bucket;
+  shm_entry_t* entries;
+  uint32_t i;
+
+  hdr = header(caches);
+  stripe = stripe_at(caches, s);
+
+  /* Empty buckets. */
+  for (i = s; i < hdr->nbuckets; i += hdr->nstripes) {
+    bucket = bucket_at(caches, i);
+
+    bucket->prev = offset_of(caches, bucket);
+    bucket->next = bucket->prev;
+  }
+
+  /* Build list of free entries. */
+  entries = (shm_entry_t*) at(caches, hdr->entries) + stripe->first_entry;
+
+  stripe->free = 0;
+  stripe->nused = 0;
+
+  for (i = stripe->nentries; i > 0; i--) {
+    entries[i - 1].node.next = stripe->free;
+    stripe->free = offset_of(caches, &entries[i - 1]);
+  }
+
+  stripe->cursor = s;
+}
+
+int stripe_lock(shmcaches_t* caches, unsigned s)
+{
+  shm_stripe_t* stripe;
+
+  stripe = stripe_at(caches, s);
+
+  switch (pthread_mutex_lock(&stripe->mutex)) {
+    case 0:
+      return 0;
+    case EOWNERDEAD:
+      /* The previous owner died while holding the lock, the lists of the
+       * stripe might be inconsistent.
+       */
+      stripe_reset(caches, s);
+      pthread_mutex_consistent(&stripe->mutex);
+
+      return 0;
+    default:
+      return -1;
+  }
+}
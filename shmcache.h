@@ -0,0 +1,82 @@
+#ifndef SHMCACHE_H
+#define SHMCACHE_H
+
+#include <time.h>
+#include <netinet/in.h>
+#include "cachestats.h"
+
+/* DNS cache living in a shared memory segment, so that several processes
+ * (e.g. pre-forked workers) share the same table.
+ *
+ * The segment only contains offsets (relative to the start of the mapping),
+ * never pointers, so it can be mapped at different addresses in different
+ * processes. Concurrency is handled with robust process-shared mutexes, one
+ * per stripe of buckets.
+ */
+
+typedef struct {
+  void* base;
+  size_t size;
+  int fd;
+
+  /* Statistics of this process. */
+  cache_stats_t stats;
+} shmcaches_t;
+
+/* Creates the cache.
+ * If 'name' is NULL, an anonymous segment (memfd) is created, which can be
+ * shared with the processes forked after the creation. Otherwise, a named
+ * POSIX shared memory object is created, which can be attached to by other
+ * processes with shmcaches_attach().
+ * 'nentries' is the maximum number of entries (IPv4 + IPv6) in the cache.
+ */
+int shmcaches_create(shmcaches_t* caches,
+                     const char* name,
+                     unsigned nbuckets,
+                     unsigned nentries);
+
+/* Attaches to a cache created by another process. */
+int shmcaches_attach(shmcaches_t* caches, const char* name);
+
+/* Unmaps the cache (the segment itself is freed when the last process
+ * detaches from it).
+ */
+void shmcaches_detach(shmcaches_t* caches);
+
+/* Removes the name of a named cache. */
+int shmcaches_unlink(const char* name);
+
+int shmcaches_add_ipv4(shmcaches_t* caches,
+                       const char* host,
+                       size_t hostlen,
+                       const struct in_addr* addr,
+                       time_t expiration_time,
+                       time_t now);
+
+int shmcaches_add_ipv6(shmcaches_t* caches,
+                       const char* host,
+                       size_t hostlen,
+                       const struct in6_addr* addr,
+                       time_t expiration_time,
+                       time_t now);
+
+int shmcaches_get_ipv4(shmcaches_t* caches,
+                       const char* host,
+                       size_t hostlen,
+                       time_t now,
+                       struct in_addr* addr);
+
+int shmcaches_get_ipv6(shmcaches_t* caches,
+                       const char* host,
+                       size_t hostlen,
+                       time_t now,
+                       struct in6_addr* addr);
+
+void shmcaches_remove_expired(shmcaches_t* caches, time_t now);
+
+/* Takes a snapshot of the statistics of this process ('entries' and 'bytes'
+ * are those of the whole segment).
+ */
+void shmcaches_get_stats(const shmcaches_t* caches, cache_stats_t* stats);
+
+#endif /* SHMCACHE_H */
@@ -9,6 +9,7 @@
 #include <sys/syscall.h>
 #include <errno.h>
 #include "socket.h"
+#include "trace.h"
 
 int build_socket_address(const char* str,
                          struct sockaddr_storage* addr,
@@ -109,6 +110,36 @@ int build_ip_address(const char* str,
   return 0;
 }
 
+int socket_address_equal(const struct sockaddr* addr1,
+                         const struct sockaddr* addr2)
+{
+  const struct sockaddr_in* sin1;
+  const struct sockaddr_in* sin2;
+  const struct sockaddr_in6* sin61;
+  const struct sockaddr_in6* sin62;
+
+  if (addr1->sa_family == addr2->sa_family) {
+    switch (addr1->sa_family) {
+      case AF_INET:
+        sin1 = (const struct sockaddr_in*) addr1;
+        sin2 = (const struct sockaddr_in*) addr2;
+
+        return ((sin1->sin_port == sin2->sin_port) &&
+                (sin1->sin_addr.s_addr == sin2->sin_addr.s_addr));
+      case AF_INET6:
+        sin61 = (const struct sockaddr_in6*) addr1;
+        sin62 = (const struct sockaddr_in6*) addr2;
+
+        return ((sin61->sin6_port == sin62->sin6_port) &&
+                (memcmp(&sin61->sin6_addr,
+                        &sin62->sin6_addr,
+                        sizeof(struct in6_addr)) == 0));
+    }
+  }
+
+  return 0;
+}
+
 int socket_connect(const struct sockaddr* addr, socklen_t addrlen)
 {
   int fd;
@@ -183,6 +214,9 @@ ssize_t socket_recv(int fd, void* buf, size_t len)
 {
   ssize_t ret;
   while (((ret = recv(fd, buf, len, 0)) < 0) && (errno == EINTR));
+
+  TRACE2(socket_receive, fd, ret);
+
   return ret;
 }
 
@@ -190,6 +224,9 @@ ssize_t socket_send(int fd, const void* buf, size_t len)
 {
   ssize_t ret;
   while (((ret = send(fd, buf, len, MSG_NOSIGNAL)) < 0) && (errno == EINTR));
+
+  TRACE2(socket_send, fd, ret);
+
   return ret;
 }
 
@@ -203,6 +240,8 @@ ssize_t socket_recvfrom(int fd,
   while (((ret = recvfrom(fd, buf, len, 0, addr, addrlen)) < 0) &&
          (errno == EINTR));
 
+  TRACE2(socket_receive, fd, ret);
+
   return ret;
 }
 
@@ -216,6 +255,8 @@ ssize_t socket_sendto(int fd,
   while (((ret = sendto(fd, buf, len, MSG_NOSIGNAL, addr, addrlen)) < 0) &&
          (errno == EINTR));
 
+  TRACE2(socket_send, fd, ret);
+
   return ret;
 }
 
@@ -228,6 +269,8 @@ int socket_recvmmsg(int fd,
   while (((ret = recvmmsg(fd, msgvec, vlen, 0, timeout)) < 0) &&
          (errno == EINTR));
 
+  TRACE2(socket_recvmmsg, fd, ret);
+
   return ret;
 }
 
@@ -237,6 +280,8 @@ int socket_sendmmsg(int fd, struct mmsghdr* msgvec, unsigned vlen)
   while (((ret = syscall(__NR_sendmmsg, fd, msgvec, vlen, MSG_NOSIGNAL)) < 0) &&
          (errno == EINTR));
 
+  TRACE2(socket_sendmmsg, fd, ret);
+
   return ret;
 }
 
@@ -457,6 +502,12 @@ int socket_bind(int fd, const struct sockaddr* addr, socklen_t addrlen)
 {
   /* Reuse address. */
   int optval = 1;
+
+  /* Unix sockets don't support SO_REUSEPORT. */
+  if (addr->sa_family == AF_UNIX) {
+    return bind(fd, addr, addrlen);
+  }
+
   if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(int)) == 0) {
 #ifdef SO_REUSEPORT
     /* Reuse port. */
@@ -474,21 +525,31 @@ int socket_bind(int fd, const struct sockaddr* addr, socklen_t addrlen)
 int socket_wait_readable(int fd, int timeout)
 {
   struct pollfd pollfd;
+  int ret;
 
   pollfd.fd = fd;
   pollfd.events = POLLRDHUP | POLLIN;
   pollfd.revents = 0;
 
-  return poll(&pollfd, 1, timeout);
+  if ((ret = poll(&pollfd, 1, timeout)) == 0) {
+    TRACE2(socket_timeout, fd, timeout);
+  }
+
+  return ret;
 }
 
 int socket_wait_writable(int fd, int timeout)
 {
   struct pollfd pollfd;
+  int ret;
 
   pollfd.fd = fd;
   pollfd.events = POLLRDHUP | POLLOUT;
   pollfd.revents = 0;
 
-  return poll(&pollfd, 1, timeout);
+  if ((ret = poll(&pollfd, 1, timeout)) == 0) {
+    TRACE2(socket_timeout, fd, timeout);
+  }
+
+  return ret;
 }
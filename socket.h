@@ -13,6 +13,10 @@ int build_ip_address(const char* str,
                      struct sockaddr_storage* addr,
                      socklen_t* addrlen);
 
+/* Returns 1 if both (IPv4 / IPv6) socket addresses are the same. */
+int socket_address_equal(const struct sockaddr* addr1,
+                         const struct sockaddr* addr2);
+
 int socket_connect(const struct sockaddr* addr, socklen_t addrlen);
 int socket_get_error(int fd, int* error);
 int socket_listen(const struct sockaddr* addr, socklen_t addrlen);
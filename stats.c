@@ -0,0 +1,732 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "stats.h"
+#include "socket.h"
+#include "macros.h"
+
+#define PREFIX              "dns_"
+#define REPORT_INITIAL_SIZE 4096
+#define ADDRESS_MAX_LEN     (INET6_ADDRSTRLEN + 8)
+
+/* Caches of a worker. */
+#define CACHE_IPV4          0
+#define CACHE_IPV6          1
+#define CACHE_PACKETS       2
+#define NCACHES             3
+
+typedef struct {
+  /* Prometheus name (without PREFIX). */
+  const char* name;
+
+  /* Name in the text format. */
+  const char* text;
+
+  const char* help;
+
+  int gauge;
+
+  /* Offset of the counter in the statistics. */
+  size_t offset;
+} metric_t;
+
+typedef enum {
+  GROUP_FORWARDER,
+  GROUP_RESOLVER,
+  GROUP_CACHE,
+  GROUP_UPSTREAM
+} group_type_t;
+
+typedef struct {
+  group_type_t type;
+
+  /* Name in the text format. */
+  const char* text;
+
+  /* Prometheus label identifying the instance (NULL: single instance). */
+  const char* label;
+
+  const metric_t* metrics;
+  unsigned nmetrics;
+} group_t;
+
+/* Snapshot of the statistics of a worker. */
+typedef struct {
+  forwarder_stats_t forwarder;
+  resolver_stats_t resolver;
+  cache_stats_t caches[NCACHES];
+  upstream_stats_t upstreams[UPSTREAMS_MAX];
+} snapshot_t;
+
+static const metric_t forwarder_metrics[] = {
+  {"forwarder_queries_total", "Queries", "Queries received.", 0,
+   offsetof(forwarder_stats_t, queries)},
+  {"forwarder_cache_hits_total", "Cache hits",
+   "Queries answered from the packet cache.", 0,
+   offsetof(forwarder_stats_t, cache_hits)},
+  {"forwarder_authoritative_total", "Authoritative",
+   "Queries answered from the zone.", 0,
+   offsetof(forwarder_stats_t, authoritative)},
+  {"forwarder_forwarded_total", "Forwarded",
+   "Queries passed to the resolver.", 0,
+   offsetof(forwarder_stats_t, forwarded)},
+  {"forwarder_responses_total", "Responses", "Responses sent.", 0,
+   offsetof(forwarder_stats_t, responses)},
+  {"forwarder_dropped_total", "Dropped",
+   "UDP responses dropped (socket buffer full or failed send).", 0,
+   offsetof(forwarder_stats_t, dropped)},
+  {"forwarder_servfails_total", "SERVFAIL", "SERVFAIL responses sent.", 0,
+   offsetof(forwarder_stats_t, servfails)},
+  {"forwarder_invalid_total", "Invalid", "Invalid queries.", 0,
+   offsetof(forwarder_stats_t, invalid)},
+  {"forwarder_tcp_connections_total", "TCP connections",
+   "TCP connections accepted.", 0,
+   offsetof(forwarder_stats_t, tcp_connections)},
+  {"forwarder_tcp_rejected_total", "TCP rejected",
+   "TCP connections rejected.", 0,
+   offsetof(forwarder_stats_t, tcp_rejected)}
+};
+
+static const metric_t resolver_metrics[] = {
+  {"resolver_queries_total", "Queries", "Queries to resolve.", 0,
+   offsetof(resolver_stats_t, queries)},
+  {"resolver_cache_hits_total", "Cache hits",
+   "Queries answered from the DNS cache.", 0,
+   offsetof(resolver_stats_t, cache_hits)},
+  {"resolver_coalesced_total", "Coalesced",
+   "Queries attached to an identical query in flight.", 0,
+   offsetof(resolver_stats_t, coalesced)},
+  {"resolver_requests_total", "Requests", "Requests sent upstream.", 0,
+   offsetof(resolver_stats_t, requests)},
+  {"resolver_responses_total", "Responses", "Responses accepted.", 0,
+   offsetof(resolver_stats_t, responses)},
+  {"resolver_timeouts_total", "Timeouts", "Queries which timed out.", 0,
+   offsetof(resolver_stats_t, timeouts)},
+  {"resolver_hedges_total", "Hedges", "Hedged requests sent.", 0,
+   offsetof(resolver_stats_t, hedges)},
+  {"resolver_hedge_wins_total", "Hedge wins",
+   "Queries completed by a hedged request.", 0,
+   offsetof(resolver_stats_t, hedge_wins)},
+  {"resolver_referrals_total", "Referrals", "Referrals followed.", 0,
+   offsetof(resolver_stats_t, referrals)},
+  {"resolver_nameserver_lookups_total", "Nameserver lookups",
+   "Lookups of the address of a nameserver.", 0,
+   offsetof(resolver_stats_t, nameserver_lookups)},
+  {"resolver_cnames_total", "CNAMEs followed",
+   "Queries restarted with the target of an out-of-zone CNAME record.", 0,
+   offsetof(resolver_stats_t, cnames)},
+  {"resolver_tcp_requests_total", "TCP requests",
+   "Requests repeated over TCP (truncated responses).", 0,
+   offsetof(resolver_stats_t, tcp_requests)}
+};
+
+static const metric_t cache_metrics[] = {
+  {"cache_hits_total", "Hits", "Cache hits.", 0,
+   offsetof(cache_stats_t, hits)},
+  {"cache_misses_total", "Misses", "Cache misses.", 0,
+   offsetof(cache_stats_t, misses)},
+  {"cache_expired_total", "Expired", "Lookups which found an expired entry.",
+   0, offsetof(cache_stats_t, expired)},
+  {"cache_inserts_total", "Inserts", "Entries inserted.", 0,
+   offsetof(cache_stats_t, inserts)},
+  {"cache_updates_total", "Updates", "Entries updated.", 0,
+   offsetof(cache_stats_t, updates)},
+  {"cache_evictions_total", "Evictions", "Live entries evicted.", 0,
+   offsetof(cache_stats_t, evictions)},
+  {"cache_frees_total", "Frees", "Entries released (expired or evicted).", 0,
+   offsetof(cache_stats_t, frees)},
+  {"cache_entries", "Entries", "Entries in the cache.", 1,
+   offsetof(cache_stats_t, entries)},
+  {"cache_bytes", "Bytes", "Memory used by the entries.", 1,
+   offsetof(cache_stats_t, bytes)}
+};
+
+static const metric_t upstream_metrics[] = {
+  {"upstream_requests_total", "Requests", "Requests sent.", 0,
+   offsetof(upstream_stats_t, requests)},
+  {"upstream_responses_total", "Responses", "Responses received.", 0,
+   offsetof(upstream_stats_t, responses)},
+  {"upstream_timeouts_total", "Timeouts", "Requests which timed out.", 0,
+   offsetof(upstream_stats_t, timeouts)},
+  {"upstream_srtt_microseconds", "SRTT [us]",
+   "Smoothed round-trip time (0: not measured yet).", 1,
+   offsetof(upstream_stats_t, srtt)},
+  {"upstream_rto_milliseconds", "RTO [ms]", "Retransmission timeout.", 1,
+   offsetof(upstream_stats_t, rto)}
+};
+
+static const group_t groups[] = {
+  {GROUP_FORWARDER, "Forwarder", NULL,
+   forwarder_metrics, ARRAY_SIZE(forwarder_metrics)},
+  {GROUP_RESOLVER, "Resolver", NULL,
+   resolver_metrics, ARRAY_SIZE(resolver_metrics)},
+  {GROUP_CACHE, "Cache", "cache",
+   cache_metrics, ARRAY_SIZE(cache_metrics)},
+  {GROUP_UPSTREAM, "Upstream", "upstream",
+   upstream_metrics, ARRAY_SIZE(upstream_metrics)}
+};
+
+static const char* cache_names[NCACHES] = {"ipv4", "ipv6", "packets"};
+
+static const char http_header[] = "HTTP/1.0 200 OK\r\n"
+                                  "Content-Type: text/plain; version=0.0.4"
+                                  "\r\n"
+                                  "Connection: close\r\n"
+                                  "\r\n";
+
+static void take_snapshot(const workers_t* workers,
+                          snapshot_t* snapshots,
+                          unsigned nupstreams);
+
+static unsigned ninstances(const group_t* group, unsigned nupstreams);
+static const void* instance_stats(const group_t* group,
+                                  const snapshot_t* snapshot,
+                                  unsigned instance);
+
+static const char* instance_name(const group_t* group,
+                                 char names[][ADDRESS_MAX_LEN],
+                                 unsigned instance);
+
+static void format_address(const struct sockaddr* addr,
+                           char* buf,
+                           size_t size);
+
+static int build_text(stats_report_t* report,
+                      const snapshot_t* snapshots,
+                      unsigned nworkers,
+                      unsigned nupstreams,
+                      char names[][ADDRESS_MAX_LEN]);
+
+static int build_prometheus(stats_report_t* report,
+                            const snapshot_t* snapshots,
+                            unsigned nworkers,
+                            unsigned nupstreams,
+                            char names[][ADDRESS_MAX_LEN]);
+
+/* Histogram of the entries visited per lookup / insert of the caches (an
+ * array of counters, outside of the metric tables).
+ */
+static int probes_text(stats_report_t* report, const cache_stats_t* stats);
+static int probes_prometheus(stats_report_t* report,
+                             const snapshot_t* snapshots,
+                             unsigned nworkers);
+
+static int append(stats_report_t* report, const char* format, ...);
+static void* run(void* arg);
+static void serve(stats_server_t* server, int fd);
+
+void stats_report_init(stats_report_t* report)
+{
+  report->data = NULL;
+  report->len = 0;
+  report->size = 0;
+}
+
+void stats_report_free(stats_report_t* report)
+{
+  if (report->data) {
+    free(report->data);
+  }
+
+  stats_report_init(report);
+}
+
+int stats_report_build(stats_report_t* report,
+                       const workers_t* workers,
+                       stats_format_t format)
+{
+  char names[UPSTREAMS_MAX][ADDRESS_MAX_LEN];
+  snapshot_t* snapshots;
+  unsigned nupstreams;
+  unsigned i;
+  int ret;
+
+  report->len = 0;
+
+  if ((snapshots = malloc(workers->nworkers * sizeof(snapshot_t))) == NULL) {
+    return -1;
+  }
+
+  nupstreams = workers_upstreams(workers);
+
+  for (i = 0; i < nupstreams; i++) {
+    format_address(workers_upstream_address(workers, i),
+                   names[i],
+                   sizeof(names[i]));
+  }
+
+  /* Take the snapshot of all the workers before formatting it, so that the
+   * counters are read in a short window.
+   */
+  take_snapshot(workers, snapshots, nupstreams);
+
+  if (format == STATS_FORMAT_PROMETHEUS) {
+    ret = build_prometheus(report,
+                           snapshots,
+                           workers->nworkers,
+                           nupstreams,
+                           names);
+  } else {
+    ret = build_text(report, snapshots, workers->nworkers, nupstreams, names);
+  }
+
+  free(snapshots);
+
+  return ret;
+}
+
+int stats_server_create(stats_server_t* server,
+                        const workers_t* workers,
+                        const struct sockaddr* addr,
+                        socklen_t addrlen)
+{
+  /* Remove a stale Unix socket (left by a previous run). */
+  if (addr->sa_family == AF_UNIX) {
+    unlink(((const struct sockaddr_un*) addr)->sun_path);
+  }
+
+  if ((server->fd = socket_listen(addr, addrlen)) != -1) {
+    server->workers = workers;
+
+    memcpy(&server->addr, addr, addrlen);
+
+    stats_report_init(&server->report);
+
+    server->running = 0;
+    server->started = 0;
+
+    return 0;
+  }
+
+  return -1;
+}
+
+void stats_server_destroy(stats_server_t* server)
+{
+  stats_server_stop(server);
+
+  close(server->fd);
+
+  if (server->addr.ss_family == AF_UNIX) {
+    unlink(((const struct sockaddr_un*) &server->addr)->sun_path);
+  }
+
+  stats_report_free(&server->report);
+}
+
+int stats_server_start(stats_server_t* server)
+{
+  if (server->started) {
+    return -1;
+  }
+
+  __atomic_store_n(&server->running, 1, __ATOMIC_RELAXED);
+
+  if (pthread_create(&server->thread, NULL, run, server) == 0) {
+    server->started = 1;
+    return 0;
+  }
+
+  return -1;
+}
+
+void stats_server_stop(stats_server_t* server)
+{
+  if (server->started) {
+    __atomic_store_n(&server->running, 0, __ATOMIC_RELAXED);
+
+    pthread_join(server->thread, NULL);
+
+    server->started = 0;
+  }
+}
+
+void take_snapshot(const workers_t* workers,
+                   snapshot_t* snapshots,
+                   unsigned nupstreams)
+{
+  snapshot_t* snapshot;
+  unsigned i;
+  unsigned j;
+
+  for (i = 0; i < workers->nworkers; i++) {
+    snapshot = &snapshots[i];
+
+    workers_get_stats(workers, i, &snapshot->forwarder);
+    workers_get_resolver_stats(workers, i, &snapshot->resolver);
+
+    workers_get_cache_stats(workers,
+                            i,
+                            &snapshot->caches[CACHE_IPV4],
+                            &snapshot->caches[CACHE_IPV6]);
+
+    workers_get_packetcache_stats(workers,
+                                  i,
+                                  &snapshot->caches[CACHE_PACKETS]);
+
+    for (j = 0; j < nupstreams; j++) {
+      workers_get_upstream_stats(workers, i, j, &snapshot->upstreams[j]);
+    }
+  }
+}
+
+unsigned ninstances(const group_t* group, unsigned nupstreams)
+{
+  switch (group->type) {
+    case GROUP_CACHE:
+      return NCACHES;
+    case GROUP_UPSTREAM:
+      return nupstreams;
+    default:
+      return 1;
+  }
+}
+
+const void* instance_stats(const group_t* group,
+                           const snapshot_t* snapshot,
+                           unsigned instance)
+{
+  switch (group->type) {
+    case GROUP_FORWARDER:
+      return &snapshot->forwarder;
+    case GROUP_RESOLVER:
+      return &snapshot->resolver;
+    case GROUP_CACHE:
+      return &snapshot->caches[instance];
+    default:
+      return &snapshot->upstreams[instance];
+  }
+}
+
+const char* instance_name(const group_t* group,
+                          char names[][ADDRESS_MAX_LEN],
+                          unsigned instance)
+{
+  return (group->type == GROUP_CACHE) ? cache_names[instance] :
+                                        names[instance];
+}
+
+void format_address(const struct sockaddr* addr, char* buf, size_t size)
+{
+  const struct sockaddr_in* sin;
+  const struct sockaddr_in6* sin6;
+  char ip[INET6_ADDRSTRLEN];
+
+  switch (addr->sa_family) {
+    case AF_INET:
+      sin = (const struct sockaddr_in*) addr;
+
+      if (inet_ntop(AF_INET, &sin->sin_addr, ip, sizeof(ip))) {
+        snprintf(buf, size, "%s:%u", ip, ntohs(sin->sin_port));
+        return;
+      }
+
+      break;
+    case AF_INET6:
+      sin6 = (const struct sockaddr_in6*) addr;
+
+      if (inet_ntop(AF_INET6, &sin6->sin6_addr, ip, sizeof(ip))) {
+        snprintf(buf, size, "[%s]:%u", ip, ntohs(sin6->sin6_port));
+        return;
+      }
+
+      break;
+  }
+
+  snprintf(buf, size, "unknown");
+}
+
+int build_text(stats_report_t* report,
+               const snapshot_t* snapshots,
+               unsigned nworkers,
+               unsigned nupstreams,
+               char names[][ADDRESS_MAX_LEN])
+{
+  const group_t* group;
+  const metric_t* metric;
+  const uint8_t* stats;
+  unsigned long long value;
+  unsigned i;
+  unsigned g;
+  unsigned j;
+  unsigned m;
+
+  for (i = 0; i < nworkers; i++) {
+    if (append(report, "Worker #%u:\n", i + 1) < 0) {
+      return -1;
+    }
+
+    for (g = 0; g < ARRAY_SIZE(groups); g++) {
+      group = &groups[g];
+
+      for (j = 0; j < ninstances(group, nupstreams); j++) {
+        if (group->label) {
+          if (append(report,
+                     "  %s %s:\n",
+                     group->text,
+                     instance_name(group, names, j)) < 0) {
+            return -1;
+          }
+        } else if (append(report, "  %s:\n", group->text) < 0) {
+          return -1;
+        }
+
+        stats = instance_stats(group, &snapshots[i], j);
+
+        for (m = 0; m < group->nmetrics; m++) {
+          metric = &group->metrics[m];
+
+          value = *((const uint64_t*) (stats + metric->offset));
+
+          if (append(report, "    %s: %llu\n", metric->text, value) < 0) {
+            return -1;
+          }
+        }
+
+        if ((group->type == GROUP_CACHE) &&
+            (probes_text(report, (const cache_stats_t*) stats) < 0)) {
+          return -1;
+        }
+      }
+    }
+
+    if (append(report, "\n") < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int build_prometheus(stats_report_t* report,
+                     const snapshot_t* snapshots,
+                     unsigned nworkers,
+                     unsigned nupstreams,
+                     char names[][ADDRESS_MAX_LEN])
+{
+  const group_t* group;
+  const metric_t* metric;
+  const uint8_t* stats;
+  unsigned long long value;
+  unsigned g;
+  unsigned m;
+  unsigned i;
+  unsigned j;
+
+  for (g = 0; g < ARRAY_SIZE(groups); g++) {
+    group = &groups[g];
+
+    if (ninstances(group, nupstreams) == 0) {
+      continue;
+    }
+
+    /* The samples of a metric must be grouped together. */
+    for (m = 0; m < group->nmetrics; m++) {
+      metric = &group->metrics[m];
+
+      if (append(report,
+                 "# HELP " PREFIX "%s %s\n"
+                 "# TYPE " PREFIX "%s %s\n",
+                 metric->name,
+                 metric->help,
+                 metric->name,
+                 metric->gauge ? "gauge" : "counter") < 0) {
+        return -1;
+      }
+
+      for (i = 0; i < nworkers; i++) {
+        for (j = 0; j < ninstances(group, nupstreams); j++) {
+          stats = instance_stats(group, &snapshots[i], j);
+          value = *((const uint64_t*) (stats + metric->offset));
+
+          if (group->label) {
+            if (append(report,
+                       PREFIX "%s{worker=\"%u\",%s=\"%s\"} %llu\n",
+                       metric->name,
+                       i,
+                       group->label,
+                       instance_name(group, names, j),
+                       value) < 0) {
+              return -1;
+            }
+          } else if (append(report,
+                            PREFIX "%s{worker=\"%u\"} %llu\n",
+                            metric->name,
+                            i,
+                            value) < 0) {
+            return -1;
+          }
+        }
+      }
+    }
+
+    if ((group->type == GROUP_CACHE) &&
+        (probes_prometheus(report, snapshots, nworkers) < 0)) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int probes_text(stats_report_t* report, const cache_stats_t* stats)
+{
+  unsigned i;
+
+  if (append(report, "    Probes:") < 0) {
+    return -1;
+  }
+
+  for (i = 0; i < CACHE_PROBES_HISTOGRAM_SIZE; i++) {
+    if (append(report,
+               " %llu",
+               (unsigned long long) stats->probes[i]) < 0) {
+      return -1;
+    }
+  }
+
+  return append(report, "\n");
+}
+
+int probes_prometheus(stats_report_t* report,
+                      const snapshot_t* snapshots,
+                      unsigned nworkers)
+{
+  unsigned i;
+  unsigned j;
+  unsigned k;
+
+  if (append(report,
+             "# HELP " PREFIX "cache_probes_total Lookups and inserts by "
+             "number of entries visited (the last value: this number or "
+             "more).\n"
+             "# TYPE " PREFIX "cache_probes_total counter\n") < 0) {
+    return -1;
+  }
+
+  for (i = 0; i < nworkers; i++) {
+    for (j = 0; j < NCACHES; j++) {
+      for (k = 0; k < CACHE_PROBES_HISTOGRAM_SIZE; k++) {
+        if (append(report,
+                   PREFIX "cache_probes_total{worker=\"%u\",cache=\"%s\","
+                   "probes=\"%u%s\"} %llu\n",
+                   i,
+                   cache_names[j],
+                   k,
+                   (k == CACHE_PROBES_HISTOGRAM_SIZE - 1) ? "+" : "",
+                   (unsigned long long) snapshots[i].caches[j].probes[k]) <
+            0) {
+          return -1;
+        }
+      }
+    }
+  }
+
+  return 0;
+}
+
+int append(stats_report_t* report, const char* format, ...)
+{
+  va_list ap;
+  size_t size;
+  char* data;
+  int len;
+
+  do {
+    va_start(ap, format);
+
+    len = vsnprintf(report->data ? report->data + report->len : NULL,
+                    report->size - report->len,
+                    format,
+                    ap);
+
+    va_end(ap);
+
+    if (len < 0) {
+      return -1;
+    }
+
+    if ((size_t) len < report->size - report->len) {
+      report->len += len;
+      return 0;
+    }
+
+    /* Grow the buffer and format again. */
+    size = (report->size == 0) ? REPORT_INITIAL_SIZE : report->size * 2;
+
+    while (size - report->len <= (size_t) len) {
+      size *= 2;
+    }
+
+    if ((data = realloc(report->data, size)) == NULL) {
+      return -1;
+    }
+
+    report->data = data;
+    report->size = size;
+  } while (1);
+}
+
+void* run(void* arg)
+{
+  stats_server_t* server = (stats_server_t*) arg;
+  int fd;
+
+  while (__atomic_load_n(&server->running, __ATOMIC_RELAXED)) {
+    if (socket_wait_readable(server->fd, STATS_POLL_INTERVAL) == 1) {
+      /* The clients are served one at a time (a scrape is short). */
+      while ((fd = socket_accept(server->fd, NULL, NULL)) != -1) {
+        serve(server, fd);
+        close(fd);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+void serve(stats_server_t* server, int fd)
+{
+  stats_format_t format;
+  char request[256];
+  ssize_t ret;
+  int http;
+
+  format = STATS_FORMAT_TEXT;
+  http = 0;
+
+  /* Read the request (if any). */
+  if ((ret = socket_timed_recv(fd,
+                               request,
+                               sizeof(request) - 1,
+                               STATS_REQUEST_TIMEOUT)) > 0) {
+    request[ret] = 0;
+
+    if (strncmp(request, "GET ", 4) == 0) {
+      format = STATS_FORMAT_PROMETHEUS;
+      http = 1;
+    } else if (strncasecmp(request, "prometheus", 10) == 0) {
+      format = STATS_FORMAT_PROMETHEUS;
+    }
+  }
+
+  if (stats_report_build(&server->report, server->workers, format) == 0) {
+    if ((!http) ||
+        (socket_timed_send_all(fd,
+                               http_header,
+                               sizeof(http_header) - 1,
+                               STATS_SEND_TIMEOUT) == 0)) {
+      socket_timed_send_all(fd,
+                            server->report.data,
+                            server->report.len,
+                            STATS_SEND_TIMEOUT);
+    }
+  }
+}
@@ -0,0 +1,77 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <sys/socket.h>
+#include <pthread.h>
+#include "workers.h"
+
+/* Statistics endpoint.
+ * A thread accepts connections on a stream socket (a Unix socket, or a TCP
+ * address to be scraped directly by Prometheus), sends a report of the
+ * statistics of the workers and closes the connection. The format is chosen
+ * by the first line sent by the client:
+ *   "prometheus": Prometheus text exposition format.
+ *   "GET ...": HTTP request, Prometheus format in an HTTP/1.0 response.
+ *   anything else (or nothing within STATS_REQUEST_TIMEOUT): plain text.
+ * The counters are read from snapshots (relaxed atomic loads): the workers
+ * never block on the endpoint.
+ */
+
+#define STATS_POLL_INTERVAL    100  /* [ms] */
+#define STATS_REQUEST_TIMEOUT  100  /* [ms] */
+#define STATS_SEND_TIMEOUT     1000 /* [ms] */
+
+typedef enum {
+  STATS_FORMAT_TEXT,
+  STATS_FORMAT_PROMETHEUS
+} stats_format_t;
+
+typedef struct {
+  char* data;
+  size_t len;
+  size_t size;
+} stats_report_t;
+
+typedef struct {
+  const workers_t* workers;
+
+  /* Listening socket. */
+  int fd;
+
+  /* Address (to remove the Unix socket on destroy). */
+  struct sockaddr_storage addr;
+
+  stats_report_t report;
+
+  pthread_t thread;
+
+  int running;
+  int started;
+} stats_server_t;
+
+void stats_report_init(stats_report_t* report);
+void stats_report_free(stats_report_t* report);
+
+/* Builds the report of the statistics of the workers. */
+int stats_report_build(stats_report_t* report,
+                       const workers_t* workers,
+                       stats_format_t format);
+
+/* Creates the endpoint listening on 'addr' (a stale Unix socket is
+ * removed).
+ */
+int stats_server_create(stats_server_t* server,
+                        const workers_t* workers,
+                        const struct sockaddr* addr,
+                        socklen_t addrlen);
+
+/* Stops the thread (if it is running) and destroys the endpoint. */
+void stats_server_destroy(stats_server_t* server);
+
+/* Starts the thread. */
+int stats_server_start(stats_server_t* server);
+
+/* Stops the thread (within STATS_POLL_INTERVAL milliseconds). */
+void stats_server_stop(stats_server_t* server);
+
+#endif /* STATS_H */
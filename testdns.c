@@ -7,13 +7,12 @@
 #include <arpa/inet.h>
 #include "dns.h"
 #include "dnscache.h"
+#include "resolver.h"
 #include "socket.h"
 #include "ctype.h"
 #include "macros.h"
 
 #define MAX_PARAMETERS  2
-#define MAX_ATTEMPTS    3
-#define DNS_TIMEOUT     5000 /* [ms] */
 #define PRINT_QUESTIONS 1
 #define MAX_QUESTIONS   8
 #define MAX_ANSWERS     8
@@ -25,9 +24,18 @@ typedef enum {
   CMD_UNKNOWN,
   CMD_HELP,
   CMD_RESOLVE,
+  CMD_STATS,
   CMD_QUIT
 } command_t;
 
+/* Result of a lookup (copied in the callback). */
+typedef struct {
+  int done;
+  resolver_status_t status;
+  uint8_t response[MAX_DNS_MESSAGE_SIZE];
+  size_t responselen;
+} lookup_t;
+
 typedef enum {
   EMPTY_LINE,
   UNKNOWN_COMMAND,
@@ -50,11 +58,18 @@ static int yes_or_no(const char* msg);
 static void process_help(const char** parameters, unsigned nparameters);
 static void process_resolve(const char** parameters,
                             unsigned nparameters,
-                            int fd,
-                            const struct sockaddr* addr,
-                            socklen_t addrlen,
+                            resolver_t* resolver,
                             dnscaches_t* caches);
 
+static void lookup_callback(const resolver_result_t* result, void* data);
+
+static void process_stats(const char** parameters,
+                          unsigned nparameters,
+                          const resolver_t* resolver,
+                          const dnscaches_t* caches);
+
+static void print_cache_stats(const char* name, const cache_stats_t* stats);
+
 static int process_quit(const char** parameters, unsigned nparameters);
 
 static void print_response(uint16_t id,
@@ -73,35 +88,52 @@ int main(int argc, const char** argv)
 {
   struct sockaddr_storage addr;
   socklen_t addrlen;
-  int fd;
+  resolver_config_t config;
+  resolver_t resolver;
   dnscaches_t caches;
   char line[512];
   command_t cmd;
   const char* parameters[MAX_PARAMETERS];
   unsigned nparameters;
+  int i;
 
   /* Check usage. */
-  if (argc != 2) {
+  if ((argc < 2) || (argc > UPSTREAMS_MAX + 1)) {
     usage(argv[0]);
     return -1;
   }
 
-  if (build_socket_address(argv[1], &addr, &addrlen) < 0) {
-    fprintf(stderr, "Invalid socket address '%s'.\n", argv[1]);
+  /* Create resolver (the DNS cache is handled by the program). */
+  resolver_config_init(&config);
+
+  if (resolver_create(&resolver, &config) < 0) {
+    fprintf(stderr, "Error creating resolver.\n");
     return -1;
   }
 
-  /* Create socket. */
-  if ((fd = socket_create(addr.ss_family, SOCK_DGRAM)) < 0) {
-    fprintf(stderr, "Error creating socket.\n");
-    return -1;
+  for (i = 1; i < argc; i++) {
+    if (build_socket_address(argv[i], &addr, &addrlen) < 0) {
+      fprintf(stderr, "Invalid socket address '%s'.\n", argv[i]);
+
+      resolver_destroy(&resolver);
+      return -1;
+    }
+
+    if (resolver_add_upstream(&resolver,
+                              (const struct sockaddr*) &addr,
+                              addrlen) < 0) {
+      fprintf(stderr, "Error adding DNS server '%s'.\n", argv[i]);
+
+      resolver_destroy(&resolver);
+      return -1;
+    }
   }
 
   /* Create DNS caches. */
   if (dnscaches_create(&caches, NUMBER_BUCKETS) < 0) {
     fprintf(stderr, "Error creating DNS caches.\n");
 
-    close(fd);
+    resolver_destroy(&resolver);
     return -1;
   }
 
@@ -124,18 +156,15 @@ int main(int argc, const char** argv)
             process_help(parameters, nparameters);
             break;
           case CMD_RESOLVE:
-            process_resolve(parameters,
-                            nparameters,
-                            fd,
-                            (const struct sockaddr*) &addr,
-                            addrlen,
-                            &caches);
-
+            process_resolve(parameters, nparameters, &resolver, &caches);
+            break;
+          case CMD_STATS:
+            process_stats(parameters, nparameters, &resolver, &caches);
             break;
           case CMD_QUIT:
             if (process_quit(parameters, nparameters)) {
               dnscaches_destroy(&caches);
-              close(fd);
+              resolver_destroy(&resolver);
 
               return 0;
             }
@@ -154,7 +183,8 @@ int main(int argc, const char** argv)
 
 void usage(const char* program)
 {
-  printf("Usage: %s <DNS-server-address>\n", program);
+  printf("Usage: %s <DNS-server-address> [<DNS-server-address> ...]\n",
+         program);
 }
 
 void help(void)
@@ -180,6 +210,12 @@ void cmdhelp(command_t cmd)
 
       printf("\n");
 
+      break;
+    case CMD_STATS:
+      printf("  stats: shows the statistics of the DNS cache and the DNS "
+             "servers.\n");
+      printf("\n");
+
       break;
     case CMD_HELP:
       printf("  help: shows this help.\n");
@@ -270,6 +306,12 @@ command_t find_command(const char* cmd, size_t len)
         return CMD_RESOLVE;
       }
 
+      break;
+    case 5:
+      if (strncasecmp(cmd, "stats", 5) == 0) {
+        return CMD_STATS;
+      }
+
       break;
     case 4:
       if (strncasecmp(cmd, "help", 4) == 0) {
@@ -337,20 +379,14 @@ void process_help(const char** parameters, unsigned nparameters)
 
 void process_resolve(const char** parameters,
                      unsigned nparameters,
-                     int fd,
-                     const struct sockaddr* addr,
-                     socklen_t addrlen,
+                     resolver_t* resolver,
                      dnscaches_t* caches)
 {
   dns_qtype_t qtype;
   char host[HOSTNAME_MAX_LEN + 1];
   size_t hostlen;
   size_t j;
-  uint8_t request[MAX_DNS_MESSAGE_SIZE];
-  uint8_t response[MAX_DNS_MESSAGE_SIZE];
-  size_t len;
-  ssize_t l;
-  unsigned i;
+  lookup_t lookup;
 
   struct in_addr addr4;
   struct in6_addr addr6;
@@ -425,76 +461,141 @@ void process_resolve(const char** parameters,
     return;
   }
 
-  /* Build DNS request. */
-  if (dns_build_request(random() % 65536,
-                        qtype,
-                        DNS_QCLASS_IN,
-                        host,
-                        hostlen,
-                        request,
-                        &len) != 0) {
-    printf("Error building DNS request.\n");
+  lookup.done = 0;
+
+  if (resolver_resolve(resolver,
+                       host,
+                       hostlen,
+                       qtype,
+                       DNS_QCLASS_IN,
+                       lookup_callback,
+                       &lookup) < 0) {
+    printf("Error sending DNS request.\n");
+    return;
+  }
+
+  /* Wait for the response. */
+  while (!lookup.done) {
+    if (resolver_process(resolver, -1) < 0) {
+      printf("Error waiting for DNS response.\n");
+      return;
+    }
+  }
+
+  if (lookup.status != RESOLVER_SUCCESS) {
+    printf("Error resolving DNS request (%s).\n",
+           resolver_status_to_string(lookup.status));
+
     return;
   }
 
-  for (i = 0; i < MAX_ATTEMPTS; i++) {
-    /* Send DNS request. */
-    if (socket_timed_sendto(fd,
-                            request,
-                            len,
-                            addr,
-                            addrlen,
-                            DNS_TIMEOUT) == (ssize_t) len) {
-      /* Receive response. */
-      if ((l = socket_timed_recvfrom(fd,
-                                     response,
-                                     sizeof(response),
-                                     NULL,
-                                     NULL,
-                                     DNS_TIMEOUT)) > 0) {
-        /* Process response. */
+  /* Process response. */
 #if PRINT_QUESTIONS
-        nquestions = ARRAY_SIZE(questions);
+  nquestions = ARRAY_SIZE(questions);
 #endif
 
-        nanswers = ARRAY_SIZE(answers);
-        nauthorities = ARRAY_SIZE(authorities);
+  nanswers = ARRAY_SIZE(answers);
+  nauthorities = ARRAY_SIZE(authorities);
 
-        if (dns_process_response(response,
-                                 l,
-                                 &id,
+  if (dns_process_response(lookup.response,
+                           lookup.responselen,
+                           &id,
 #if PRINT_QUESTIONS
-                                 questions,
-                                 &nquestions,
+                           questions,
+                           &nquestions,
 #else
-                                 NULL,
-                                 NULL,
+                           NULL,
+                           NULL,
 #endif
-                                 answers,
-                                 &nanswers,
-                                 authorities,
-                                 &nauthorities) == 0) {
-          print_response(id,
-                         questions,
-                         nquestions,
-                         answers,
-                         nanswers,
-                         authorities,
-                         nauthorities);
-
-          if (yes_or_no("Add to DNS cache")) {
-            add_to_dns_cache(caches, answers, nanswers);
-          }
-        } else {
-          printf("Error processing response.\n");
-        }
-
-        return;
-      }
+                           answers,
+                           &nanswers,
+                           authorities,
+                           &nauthorities) == 0) {
+    print_response(id,
+                   questions,
+                   nquestions,
+                   answers,
+                   nanswers,
+                   authorities,
+                   nauthorities);
+
+    if (yes_or_no("Add to DNS cache")) {
+      add_to_dns_cache(caches, answers, nanswers);
     }
+  } else {
+    printf("Error processing response.\n");
+  }
+}
+
+void lookup_callback(const resolver_result_t* result, void* data)
+{
+  lookup_t* lookup = (lookup_t*) data;
+
+  lookup->done = 1;
+  lookup->status = result->status;
+
+  if (result->responselen <= sizeof(lookup->response)) {
+    memcpy(lookup->response, result->response, result->responselen);
+    lookup->responselen = result->responselen;
+  } else {
+    lookup->responselen = 0;
+  }
+}
+
+void process_stats(const char** parameters,
+                   unsigned nparameters,
+                   const resolver_t* resolver,
+                   const dnscaches_t* caches)
+{
+  cache_stats_t ipv4;
+  cache_stats_t ipv6;
+  upstream_stats_t stats;
+  unsigned i;
+
+  if (nparameters != 0) {
+    cmdhelp(CMD_STATS);
+    return;
+  }
+
+  dnscaches_get_stats(caches, &ipv4, &ipv6);
+
+  print_cache_stats("IPv4", &ipv4);
+  print_cache_stats("IPv6", &ipv6);
+
+  for (i = 0; i < resolver_upstreams(resolver); i++) {
+    resolver_get_upstream_stats(resolver, i, &stats);
+
+    printf("DNS server #%u:\n", i + 1);
+    printf("  Requests: %llu\n", (unsigned long long) stats.requests);
+    printf("  Responses: %llu\n", (unsigned long long) stats.responses);
+    printf("  Timeouts: %llu\n", (unsigned long long) stats.timeouts);
+    printf("  Smoothed RTT: %.3f ms\n", stats.srtt / 1000.0);
+    printf("  Retransmission timeout: %llu ms\n\n",
+           (unsigned long long) stats.rto);
+  }
+}
+
+void print_cache_stats(const char* name, const cache_stats_t* stats)
+{
+  unsigned i;
+
+  printf("%s cache:\n", name);
+  printf("  Hits: %llu\n", (unsigned long long) stats->hits);
+  printf("  Misses: %llu\n", (unsigned long long) stats->misses);
+  printf("  Expired on lookup: %llu\n", (unsigned long long) stats->expired);
+  printf("  Inserts: %llu\n", (unsigned long long) stats->inserts);
+  printf("  Updates: %llu\n", (unsigned long long) stats->updates);
+  printf("  Evictions: %llu\n", (unsigned long long) stats->evictions);
+  printf("  Frees: %llu\n", (unsigned long long) stats->frees);
+  printf("  Entries: %llu\n", (unsigned long long) stats->entries);
+  printf("  Bytes: %llu\n", (unsigned long long) stats->bytes);
+
+  printf("  Probes:");
+  for (i = 0; i < CACHE_PROBES_HISTOGRAM_SIZE; i++) {
+    printf(" %llu", (unsigned long long) stats->probes[i]);
   }
 
-  printf("Error resolving DNS request.\n");
+  printf("\n\n");
 }
 
 int process_quit(const char** parameters, unsigned nparameters)
@@ -9,6 +9,8 @@
 #define NUMBER_IPS         (5 * 1000)
 #define NUMBER_REPETITIONS 3
 
+static int check_stats(const dnscaches_t* caches);
+
 int main()
 {
   dnscaches_t caches;
@@ -160,7 +162,47 @@ int main()
     }
   }
 
+  if (check_stats(&caches) < 0) {
+    dnscaches_destroy(&caches);
+    return -1;
+  }
+
   dnscaches_destroy(&caches);
 
   return 0;
 }
+
+int check_stats(const dnscaches_t* caches)
+{
+  cache_stats_t ipv4;
+  cache_stats_t ipv6;
+  uint64_t probes;
+  unsigned i;
+
+  dnscaches_get_stats(caches, &ipv4, &ipv6);
+
+  probes = 0;
+  for (i = 0; i < CACHE_PROBES_HISTOGRAM_SIZE; i++) {
+    probes += ipv4.probes[i];
+  }
+
+  if ((ipv4.hits != 2 * NUMBER_REPETITIONS * NUMBER_IPS) ||
+      (ipv4.misses != 2 * NUMBER_REPETITIONS * NUMBER_IPS) ||
+      (ipv4.entries != NUMBER_IPS) ||
+      (ipv4.inserts - ipv4.frees != NUMBER_IPS) ||
+      (probes != ipv4.hits + ipv4.misses + ipv4.inserts + ipv4.updates) ||
+      (ipv6.entries != 0)) {
+    fprintf(stderr,
+            "Unexpected statistics (hits: %llu, misses: %llu, entries: %llu, "
+            "inserts: %llu, frees: %llu).\n",
+            (unsigned long long) ipv4.hits,
+            (unsigned long long) ipv4.misses,
+            (unsigned long long) ipv4.entries,
+            (unsigned long long) ipv4.inserts,
+            (unsigned long long) ipv4.frees);
+
+    return -1;
+  }
+
+  return 0;
+}
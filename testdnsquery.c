@@ -0,0 +1,222 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include "dns.h"
+
+/* Number of queries parsed to measure the cost of dns_parse_query(). */
+#define NUMBER_PARSES 1000000
+
+static size_t build_query(const char* name, int opt, uint8_t* query);
+static size_t add_opt(uint8_t* p);
+static int test_valid(void);
+static int test_invalid(void);
+static int test_speed(void);
+
+int main()
+{
+  return ((test_valid() == 0) &&
+          (test_invalid() == 0) &&
+          (test_speed() == 0)) ? 0 : -1;
+}
+
+int test_valid(void)
+{
+  uint8_t query[MAX_DNS_MESSAGE_SIZE];
+  uint8_t lower[MAX_DNS_MESSAGE_SIZE];
+  dns_query_t parsed;
+  char name[HOSTNAME_MAX_LEN + 1];
+  size_t querylen;
+  size_t lowerlen;
+  size_t namelen;
+
+  querylen = build_query("WWW.Example.COM", 1, query);
+  lowerlen = build_query("www.example.com", 0, lower);
+
+  /* The key is the question with the name in lowercase. */
+  if ((dns_parse_query(query, querylen, &parsed) != DNS_RCODE_NOERROR) ||
+      (parsed.id != 0x1234) ||
+      ((parsed.flags & DNS_FLAG_RD) == 0) ||
+      (parsed.keylen != lowerlen - 12) ||
+      (memcmp(parsed.key, lower + 12, parsed.keylen) != 0) ||
+      (parsed.hash != dns_key_hash(lower + 12, lowerlen - 12)) ||
+      (parsed.qtype != DNS_QTYPE_A) ||
+      (parsed.qclass != DNS_QCLASS_IN)) {
+    fprintf(stderr, "Unexpected parsed query.\n");
+    return -1;
+  }
+
+  if ((parsed.opt != lowerlen) ||
+      (parsed.udp_size != 1232) ||
+      (parsed.edns_flags != 0x8000)) {
+    fprintf(stderr, "Unexpected OPT record.\n");
+    return -1;
+  }
+
+  if ((dns_query_name(&parsed, name, &namelen) < 0) ||
+      (namelen != 15) ||
+      (strcmp(name, "www.example.com") != 0)) {
+    fprintf(stderr, "Unexpected name '%s'.\n", name);
+    return -1;
+  }
+
+  /* Without OPT record. */
+  if ((dns_parse_query(lower, lowerlen, &parsed) != DNS_RCODE_NOERROR) ||
+      (parsed.opt != 0) ||
+      (parsed.udp_size != 0)) {
+    fprintf(stderr, "Unexpected query without OPT record.\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+int test_invalid(void)
+{
+  uint8_t query[MAX_DNS_MESSAGE_SIZE];
+  uint8_t buf[MAX_DNS_MESSAGE_SIZE];
+  dns_query_t parsed;
+  size_t querylen;
+  size_t len;
+
+  querylen = build_query("www.example.com", 1, query);
+
+  /* Too short. */
+  if (dns_parse_query(query, 11, &parsed) != -1) {
+    fprintf(stderr, "Short message parsed.\n");
+    return -1;
+  }
+
+  /* Response. */
+  memcpy(buf, query, querylen);
+  buf[2] |= 0x80;
+
+  if (dns_parse_query(buf, querylen, &parsed) != -1) {
+    fprintf(stderr, "Response parsed as a query.\n");
+    return -1;
+  }
+
+  /* Opcode STATUS. */
+  memcpy(buf, query, querylen);
+  buf[2] |= 2 << 3;
+
+  if (dns_parse_query(buf, querylen, &parsed) != DNS_RCODE_NOTIMP) {
+    fprintf(stderr, "Unexpected result for opcode STATUS.\n");
+    return -1;
+  }
+
+  /* Two questions. */
+  memcpy(buf, query, querylen);
+  buf[5] = 2;
+
+  if (dns_parse_query(buf, querylen, &parsed) != DNS_RCODE_FORMERR) {
+    fprintf(stderr, "Query with two questions parsed.\n");
+    return -1;
+  }
+
+  /* Truncated question. */
+  if (dns_parse_query(query, 12 + 10, &parsed) != DNS_RCODE_FORMERR) {
+    fprintf(stderr, "Truncated question parsed.\n");
+    return -1;
+  }
+
+  /* Compressed name. */
+  memcpy(buf, query, querylen);
+  buf[12] = 0xc0;
+
+  if (dns_parse_query(buf, querylen, &parsed) != DNS_RCODE_FORMERR) {
+    fprintf(stderr, "Compressed name in question parsed.\n");
+    return -1;
+  }
+
+  /* Two OPT records. */
+  memcpy(buf, query, querylen);
+  buf[11] = 2;
+  len = querylen + add_opt(buf + querylen);
+
+  if (dns_parse_query(buf, len, &parsed) != DNS_RCODE_FORMERR) {
+    fprintf(stderr, "Query with two OPT records parsed.\n");
+    return -1;
+  }
+
+  /* Truncated OPT record. */
+  if (dns_parse_query(query, querylen - 1, &parsed) != DNS_RCODE_FORMERR) {
+    fprintf(stderr, "Truncated OPT record parsed.\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+int test_speed(void)
+{
+  uint8_t query[MAX_DNS_MESSAGE_SIZE];
+  dns_query_t parsed;
+  struct timespec start;
+  struct timespec end;
+  size_t querylen;
+  uint32_t hash;
+  unsigned i;
+  double ns;
+
+  querylen = build_query("WWW.Example.COM", 1, query);
+
+  hash = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (i = 0; i < NUMBER_PARSES; i++) {
+    if (dns_parse_query(query, querylen, &parsed) != DNS_RCODE_NOERROR) {
+      fprintf(stderr, "Error parsing query.\n");
+      return -1;
+    }
+
+    hash += parsed.hash;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) /
+       NUMBER_PARSES;
+
+  printf("dns_parse_query(): %.1f ns per query (%08x).\n",
+         ns,
+         (unsigned) hash);
+
+  return 0;
+}
+
+size_t build_query(const char* name, int opt, uint8_t* query)
+{
+  size_t len;
+
+  dns_build_request(0x1234,
+                    DNS_QTYPE_A,
+                    DNS_QCLASS_IN,
+                    name,
+                    strlen(name),
+                    query,
+                    &len);
+
+  if (opt) {
+    query[11] = 1;
+    len += add_opt(query + len);
+  }
+
+  return len;
+}
+
+size_t add_opt(uint8_t* p)
+{
+  /* Root, type OPT, UDP payload size (1232), extended RCODE and version,
+   * flags (DO) and no options.
+   */
+  static const uint8_t opt[] = {
+    0, 0, DNS_QTYPE_OPT, 0x04, 0xd0, 0, 0, 0x80, 0, 0, 0
+  };
+
+  memcpy(p, opt, sizeof(opt));
+
+  return sizeof(opt);
+}
@@ -0,0 +1,171 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <arpa/inet.h>
+#include "dns.h"
+
+/* Compressed length of the response built by build_response(). */
+#define COMPRESSED_LEN 101
+
+static int build_response(uint8_t* buf, size_t size, dns_response_t* response);
+static void set_name(char* dest, size_t* len, const char* name);
+static int test_compression(void);
+static int test_truncation(void);
+
+int main()
+{
+  return ((test_compression() == 0) && (test_truncation() == 0)) ? 0 : -1;
+}
+
+int test_compression(void)
+{
+  uint8_t buf[MAX_DNS_MESSAGE_SIZE];
+  dns_response_t response;
+  dns_question_t questions[1];
+  rr_t answers[2];
+  rr_t authorities[1];
+  size_t nquestions;
+  size_t nanswers;
+  size_t nauthorities;
+  uint16_t id;
+
+  if (build_response(buf, sizeof(buf), &response) < 0) {
+    fprintf(stderr, "Error building response.\n");
+    return -1;
+  }
+
+  /* Every name but the one of the question ends with a pointer (the
+   * suffixes are compared without case).
+   */
+  if (dns_response_length(&response) != COMPRESSED_LEN) {
+    fprintf(stderr,
+            "Unexpected length of the response (%zu instead of %u).\n",
+            dns_response_length(&response),
+            COMPRESSED_LEN);
+
+    return -1;
+  }
+
+  nquestions = 1;
+  nanswers = 2;
+  nauthorities = 1;
+
+  if ((dns_process_response(buf,
+                            dns_response_length(&response),
+                            &id,
+                            questions,
+                            &nquestions,
+                            answers,
+                            &nanswers,
+                            authorities,
+                            &nauthorities) < 0) ||
+      (id != 0x1234) ||
+      (nquestions != 1) ||
+      (strcmp(questions[0].name, "www.Example.com") != 0) ||
+      (nanswers != 2) ||
+      (answers[0].type != DNS_QTYPE_CNAME) ||
+      (strcmp(answers[0].name, "www.Example.com") != 0) ||
+      (strcasecmp(answers[0].cname.name, "web.example.com") != 0) ||
+      (answers[1].type != DNS_QTYPE_A) ||
+      (strcasecmp(answers[1].name, "web.example.com") != 0) ||
+      (ntohl(answers[1].addr4.s_addr) != 0x0a000001) ||
+      (answers[1].ttl != 300) ||
+      (buf[10] != 0) ||
+      (buf[11] != 1)) {
+    fprintf(stderr, "Unexpected response.\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+int test_truncation(void)
+{
+  uint8_t buf[MAX_DNS_MESSAGE_SIZE];
+  dns_response_t response;
+  dns_header_t header;
+
+  /* The answers fit, the NS record doesn't. */
+  if ((build_response(buf, 70, &response) == 0) ||
+      (dns_response_length(&response) != 67) ||
+      (dns_process_header(buf, 67, &header, NULL) < 0) ||
+      (header.ancount != 2) ||
+      (header.nscount != 0) ||
+      (header.arcount != 0) ||
+      ((header.flags & DNS_FLAG_TC) == 0)) {
+    fprintf(stderr, "Unexpected truncated response.\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+int build_response(uint8_t* buf, size_t size, dns_response_t* response)
+{
+  dns_question_t question;
+  rr_t rr;
+
+  set_name(question.name, &question.namelen, "www.Example.com");
+  question.qtype = DNS_QTYPE_A;
+  question.qclass = DNS_QCLASS_IN;
+
+  if (dns_response_init(response,
+                        buf,
+                        size,
+                        0x1234,
+                        DNS_FLAG_QR | DNS_FLAG_RD | DNS_FLAG_RA,
+                        &question) < 0) {
+    return -1;
+  }
+
+  memset(&rr, 0, sizeof(rr_t));
+  rr.class = DNS_QCLASS_IN;
+  rr.ttl = 300;
+
+  /* www.Example.com CNAME web.example.com (the case doesn't matter). */
+  set_name(rr.name, &rr.namelen, "www.Example.com");
+  rr.type = DNS_QTYPE_CNAME;
+  set_name(rr.cname.name, &rr.cname.namelen, "web.example.com");
+
+  if (dns_response_add(response, DNS_SECTION_ANSWER, &rr) < 0) {
+    return -1;
+  }
+
+  /* web.example.com A 10.0.0.1 */
+  set_name(rr.name, &rr.namelen, "web.example.com");
+  rr.type = DNS_QTYPE_A;
+  rr.addr4.s_addr = htonl(0x0a000001);
+
+  if (dns_response_add(response, DNS_SECTION_ANSWER, &rr) < 0) {
+    return -1;
+  }
+
+  /* example.com NS ns1.example.com */
+  set_name(rr.name, &rr.namelen, "example.com");
+  rr.type = DNS_QTYPE_NS;
+  set_name(rr.cname.name, &rr.cname.namelen, "ns1.example.com");
+
+  if (dns_response_add(response, DNS_SECTION_AUTHORITY, &rr) < 0) {
+    return -1;
+  }
+
+  /* No more answers after the authority section. */
+  if (dns_response_add(response, DNS_SECTION_ANSWER, &rr) == 0) {
+    return -1;
+  }
+
+  /* ns1.example.com A 10.0.0.53 */
+  set_name(rr.name, &rr.namelen, "ns1.example.com");
+  rr.type = DNS_QTYPE_A;
+  rr.addr4.s_addr = htonl(0x0a000035);
+
+  return dns_response_add(response, DNS_SECTION_ADDITIONAL, &rr);
+}
+
+void set_name(char* dest, size_t* len, const char* name)
+{
+  *len = strlen(name);
+  memcpy(dest, name, *len + 1);
+}
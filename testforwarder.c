@@ -0,0 +1,1414 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include "resolver.h"
+#include "forwarder.h"
+#include "workers.h"
+#include "socket.h"
+#include "testserver.h"
+#include "macros.h"
+
+#define NUMBER_BUCKETS  1021
+#define TEST_TIMEOUT    (30 * 1000) /* [ms] */
+
+/* Forwarder test. */
+#define FORWARDER_DEADLINE 300 /* [ms] */
+#define BURST_QUERIES   (3 * FORWARDER_BATCH_SIZE + 5)
+#define BURST_FIRST_HOST 300000
+#define TCP_QUERIES     (FORWARDER_MAX_PIPELINED + 4)
+#define TCP_FIRST_HOST  400000
+#define TCP_IDLE_TIMEOUT 200 /* [ms] */
+
+/* Truncation test: records of the response over TCP (longer than
+ * MAX_DNS_MESSAGE_SIZE).
+ */
+#define TRUNCATED_RECORDS 40
+
+/* Truncation test: records of the responses to the pipelined queries (all
+ * of them don't fit in the output buffer of the connection).
+ */
+#define HUGE_RECORDS    4000
+
+/* Zone test: records of the large RRset (longer than MAX_DNS_MESSAGE_SIZE).
+ */
+#define ZONE_RECORDS    40
+
+/* Workers test. */
+#define NUMBER_WORKERS  4
+#define STEERED_QUERIES 8
+#define SPREAD_QUERIES  32
+#define WORKERS_FIRST_HOST 500000
+
+static int test_forwarder(int uring);
+static int forward_query(forwarder_t* forwarder,
+                         uint16_t id,
+                         const char* name,
+                         uint8_t* query,
+                         size_t* querylen,
+                         uint8_t* response,
+                         size_t* responselen);
+
+static int forward_message(forwarder_t* forwarder,
+                           const uint8_t* query,
+                           size_t querylen,
+                           uint8_t* response,
+                           size_t size,
+                           size_t* responselen);
+
+static int forward_burst(forwarder_t* forwarder);
+static int forward_zone(forwarder_t* forwarder);
+static int forward_tcp(forwarder_t* forwarder);
+static int tcp_connect(const forwarder_t* forwarder);
+static int tcp_exchange(forwarder_t* forwarder,
+                        int fd,
+                        uint8_t* query,
+                        size_t querylen,
+                        uint8_t* response,
+                        size_t size,
+                        size_t* responselen);
+
+static int drive_forwarder(forwarder_t* forwarder,
+                           const uint64_t* counter,
+                           uint64_t value);
+
+static int test_truncation(void);
+static size_t answer_truncated(const void* data,
+                               const uint8_t* query,
+                               size_t len,
+                               int tcp,
+                               uint8_t* response,
+                               unsigned* delay);
+
+static int test_workers(void);
+static int ask_workers(const workers_t* workers,
+                       uint16_t id,
+                       const char* name,
+                       uint32_t addr);
+
+static unsigned busy_workers(const workers_t* workers);
+
+int main()
+{
+  if ((test_forwarder(0) < 0) ||
+      (test_forwarder(1) < 0) ||
+      (test_truncation() < 0) ||
+      (test_workers() < 0)) {
+    return -1;
+  }
+
+  return 0;
+}
+
+int test_forwarder(int uring)
+{
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  resolver_config_t config;
+  resolver_t resolver;
+  dnscaches_t caches;
+  forwarder_t forwarder;
+  forwarder_stats_t stats;
+  uint8_t query[MAX_DNS_MESSAGE_SIZE];
+  uint8_t response[MAX_DNS_MESSAGE_SIZE];
+  size_t querylen;
+  size_t responselen;
+  dns_header_t header;
+  uint16_t id;
+  rr_t answer;
+  size_t nanswers;
+  pid_t pid;
+  int ret;
+
+  if ((pid = start_hosts_server(SERVER_NORMAL, &addr, &addrlen)) == -1) {
+    fprintf(stderr, "Error starting DNS server.\n");
+    return -1;
+  }
+
+  if (dnscaches_create(&caches, NUMBER_BUCKETS) < 0) {
+    fprintf(stderr, "Error creating DNS caches.\n");
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    return -1;
+  }
+
+  resolver_config_init(&config);
+  config.deadline = FORWARDER_DEADLINE;
+  config.caches = &caches;
+
+  if ((resolver_create(&resolver, &config) < 0) ||
+      (resolver_add_upstream(&resolver,
+                             (const struct sockaddr*) &addr,
+                             addrlen) < 0)) {
+    fprintf(stderr, "Error creating resolver.\n");
+
+    dnscaches_destroy(&caches);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    return -1;
+  }
+
+  /* Listen on an ephemeral port of the loopback interface. */
+  if ((build_ip_address("127.0.0.1", 0, &addr, &addrlen) < 0) ||
+      (forwarder_create(&forwarder,
+                        &resolver,
+                        NULL,
+                        (const struct sockaddr*) &addr,
+                        addrlen,
+                        FORWARDER_DEFAULT_MAX_REQUESTS) < 0)) {
+    fprintf(stderr, "Error creating forwarder.\n");
+
+    resolver_destroy(&resolver);
+    dnscaches_destroy(&caches);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    return -1;
+  }
+
+  /* A single TCP connection at a time. */
+  if (forwarder_listen_tcp(&forwarder, 1, TCP_IDLE_TIMEOUT) < 0) {
+    fprintf(stderr, "Error listening on TCP.\n");
+
+    forwarder_destroy(&forwarder);
+    resolver_destroy(&resolver);
+    dnscaches_destroy(&caches);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    return -1;
+  }
+
+  /* Same tests with io_uring (if supported). */
+  if ((uring) && (forwarder_use_uring(&forwarder) < 0)) {
+    printf("io_uring not supported, using epoll.\n");
+  }
+
+  ret = -1;
+
+  do {
+    /* Forwarded: the response keeps the ID and the case of the query. */
+    nanswers = 1;
+
+    if ((forward_query(&forwarder,
+                       0x1234,
+                       "H5.Test",
+                       query,
+                       &querylen,
+                       response,
+                       &responselen) < 0) ||
+        (memcmp(query + 12, response + 12, querylen - 12) != 0) ||
+        (dns_process_response(response,
+                              responselen,
+                              &id,
+                              NULL,
+                              NULL,
+                              &answer,
+                              &nanswers,
+                              NULL,
+                              NULL) < 0) ||
+        (id != 0x1234) ||
+        (nanswers != 1) ||
+        (ntohl(answer.addr4.s_addr) != 0x0a000005)) {
+      fprintf(stderr, "Unexpected forwarded response.\n");
+      break;
+    }
+
+    /* Answered from the DNS cache, with the remaining time to live. */
+    sleep(1);
+
+    nanswers = 1;
+
+    if ((forward_query(&forwarder,
+                       0x5678,
+                       "h5.TEST",
+                       query,
+                       &querylen,
+                       response,
+                       &responselen) < 0) ||
+        (memcmp(query + 12, response + 12, querylen - 12) != 0) ||
+        (dns_process_response(response,
+                              responselen,
+                              &id,
+                              NULL,
+                              NULL,
+                              &answer,
+                              &nanswers,
+                              NULL,
+                              NULL) < 0) ||
+        (id != 0x5678) ||
+        (nanswers != 1) ||
+        (ntohl(answer.addr4.s_addr) != 0x0a000005) ||
+        (answer.ttl >= 60)) {
+      fprintf(stderr, "Unexpected cached response.\n");
+      break;
+    }
+
+    /* Relayed error. */
+    if ((forward_query(&forwarder,
+                       1,
+                       "nx1.test",
+                       query,
+                       &querylen,
+                       response,
+                       &responselen) < 0) ||
+        (dns_process_header(response, responselen, &header, NULL) < 0) ||
+        (DNS_RCODE(header.flags) != DNS_RCODE_NXDOMAIN)) {
+      fprintf(stderr, "Unexpected NXDOMAIN response.\n");
+      break;
+    }
+
+    /* No response from the server. */
+    if ((forward_query(&forwarder,
+                       2,
+                       "unknown.test",
+                       query,
+                       &querylen,
+                       response,
+                       &responselen) < 0) ||
+        (dns_process_header(response, responselen, &header, NULL) < 0) ||
+        (DNS_RCODE(header.flags) != DNS_RCODE_SERVFAIL) ||
+        (memcmp(query + 12, response + 12, querylen - 12) != 0)) {
+      fprintf(stderr, "Unexpected SERVFAIL response.\n");
+      break;
+    }
+
+    forwarder_get_stats(&forwarder, &stats);
+
+    if ((stats.queries != 4) ||
+        (stats.cache_hits != 1) ||
+        (stats.forwarded != 3) ||
+        (stats.responses != 4) ||
+        (stats.servfails != 1)) {
+      fprintf(stderr, "Unexpected forwarder statistics.\n");
+      break;
+    }
+
+    /* Burst of queries from the same client (several batches). */
+    if (forward_burst(&forwarder) < 0) {
+      break;
+    }
+
+    /* Authoritative answers. */
+    if (forward_zone(&forwarder) < 0) {
+      break;
+    }
+
+    /* Pipelined queries over TCP. */
+    if (forward_tcp(&forwarder) < 0) {
+      break;
+    }
+
+    ret = 0;
+  } while (0);
+
+  forwarder_destroy(&forwarder);
+  resolver_destroy(&resolver);
+  dnscaches_destroy(&caches);
+
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+
+  return ret;
+}
+
+int forward_query(forwarder_t* forwarder,
+                  uint16_t id,
+                  const char* name,
+                  uint8_t* query,
+                  size_t* querylen,
+                  uint8_t* response,
+                  size_t* responselen)
+{
+  if (dns_build_request(id,
+                        DNS_QTYPE_A,
+                        DNS_QCLASS_IN,
+                        name,
+                        strlen(name),
+                        query,
+                        querylen) < 0) {
+    return -1;
+  }
+
+  return forward_message(forwarder,
+                         query,
+                         *querylen,
+                         response,
+                         MAX_DNS_MESSAGE_SIZE,
+                         responselen);
+}
+
+int forward_message(forwarder_t* forwarder,
+                    const uint8_t* query,
+                    size_t querylen,
+                    uint8_t* response,
+                    size_t size,
+                    size_t* responselen)
+{
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  uint64_t deadline;
+  ssize_t len;
+  int ret;
+  int fd;
+
+  addrlen = sizeof(struct sockaddr_storage);
+
+  if ((getsockname(forwarder->fd, (struct sockaddr*) &addr, &addrlen) < 0) ||
+      ((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)) {
+    return -1;
+  }
+
+  ret = -1;
+
+  if (sendto(fd,
+             query,
+             querylen,
+             0,
+             (const struct sockaddr*) &addr,
+             addrlen) == (ssize_t) querylen) {
+    deadline = timer_now() + TEST_TIMEOUT;
+
+    /* Drive the forwarder until the response arrives. */
+    do {
+      if ((len = recv(fd, response, size, MSG_DONTWAIT)) > 0) {
+        *responselen = len;
+        ret = 0;
+
+        break;
+      }
+    } while ((timer_now() < deadline) &&
+             (forwarder_process(forwarder, 10) == 0));
+  }
+
+  close(fd);
+
+  return ret;
+}
+
+int forward_burst(forwarder_t* forwarder)
+{
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  uint8_t query[MAX_DNS_MESSAGE_SIZE];
+  uint8_t response[MAX_DNS_MESSAGE_SIZE];
+  uint8_t answered[BURST_QUERIES];
+  char host[64];
+  size_t querylen;
+  uint64_t deadline;
+  unsigned count;
+  unsigned id;
+  unsigned i;
+  ssize_t len;
+  int fd;
+
+  addrlen = sizeof(struct sockaddr_storage);
+
+  if ((getsockname(forwarder->fd, (struct sockaddr*) &addr, &addrlen) < 0) ||
+      ((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1)) {
+    return -1;
+  }
+
+  for (i = 0; i < BURST_QUERIES; i++) {
+    snprintf(host, sizeof(host), "h%u.test", BURST_FIRST_HOST + i);
+
+    dns_build_request(i,
+                      DNS_QTYPE_A,
+                      DNS_QCLASS_IN,
+                      host,
+                      strlen(host),
+                      query,
+                      &querylen);
+
+    sendto(fd, query, querylen, 0, (const struct sockaddr*) &addr, addrlen);
+  }
+
+  memset(answered, 0, sizeof(answered));
+  count = 0;
+
+  deadline = timer_now() + TEST_TIMEOUT;
+
+  /* Drive the forwarder until all the responses arrive. */
+  while ((count < BURST_QUERIES) &&
+         (timer_now() < deadline) &&
+         (forwarder_process(forwarder, 10) == 0)) {
+    while ((len = recv(fd, response, sizeof(response), MSG_DONTWAIT)) >= 12) {
+      id = (response[0] << 8) | response[1];
+
+      if ((id < BURST_QUERIES) &&
+          (!answered[id]) &&
+          (DNS_RCODE(response[3]) == DNS_RCODE_NOERROR)) {
+        answered[id] = 1;
+        count++;
+      }
+    }
+  }
+
+  close(fd);
+
+  if (count != BURST_QUERIES) {
+    fprintf(stderr,
+            "Burst of queries: %u responses out of %u.\n",
+            count,
+            BURST_QUERIES);
+
+    return -1;
+  }
+
+  return 0;
+}
+
+int forward_zone(forwarder_t* forwarder)
+{
+  char filename[] = "/tmp/testresolver.XXXXXX";
+  uint8_t query[2 + MAX_DNS_MESSAGE_SIZE];
+  uint8_t response[2 + MAX_DNS_TCP_MESSAGE_SIZE];
+  size_t querylen;
+  size_t responselen;
+  forwarder_stats_t stats;
+  dns_header_t header;
+  zone_t zone;
+  rr_t answers[ZONE_RECORDS];
+  size_t nanswers;
+  uint64_t deadline;
+  unsigned i;
+  FILE* file;
+  ssize_t n;
+  int ret;
+  int fd;
+
+  if ((fd = mkstemp(filename)) == -1) {
+    return -1;
+  }
+
+  if ((file = fdopen(fd, "w")) == NULL) {
+    close(fd);
+    unlink(filename);
+
+    return -1;
+  }
+
+  fputs("$TTL 60\n"
+        "@ SOA ns hostmaster 1 7200 3600 1209600 300\n"
+        "  NS ns\n"
+        "ns A 192.0.2.1\n"
+        "www A 192.0.2.10\n",
+        file);
+
+  for (i = 0; i < ZONE_RECORDS; i++) {
+    fprintf(file, "big A 10.0.1.%u\n", i);
+  }
+
+  fclose(file);
+
+  ret = zone_load(&zone, filename, "zone.test", 1);
+
+  unlink(filename);
+
+  if (ret < 0) {
+    fprintf(stderr, "Error loading zone.\n");
+    return -1;
+  }
+
+  forwarder_serve_zone(forwarder, &zone);
+
+  ret = -1;
+
+  do {
+    nanswers = 1;
+
+    if ((forward_query(forwarder,
+                       0x4321,
+                       "WWW.zone.test",
+                       query,
+                       &querylen,
+                       response,
+                       &responselen) < 0) ||
+        (dns_process_header(response, responselen, &header, NULL) < 0) ||
+        ((header.flags & DNS_FLAG_AA) == 0) ||
+        (memcmp(query + 12, response + 12, querylen - 12) != 0) ||
+        (dns_process_response(response,
+                              responselen,
+                              NULL,
+                              NULL,
+                              NULL,
+                              answers,
+                              &nanswers,
+                              NULL,
+                              NULL) < 0) ||
+        (nanswers != 1) ||
+        (ntohl(answers[0].addr4.s_addr) != 0xc000020a)) {
+      fprintf(stderr, "Unexpected authoritative answer.\n");
+      break;
+    }
+
+    if ((forward_query(forwarder,
+                       0x4322,
+                       "nx.zone.test",
+                       query,
+                       &querylen,
+                       response,
+                       &responselen) < 0) ||
+        (dns_process_header(response, responselen, &header, NULL) < 0) ||
+        ((header.flags & DNS_FLAG_AA) == 0) ||
+        (DNS_RCODE(header.flags) != DNS_RCODE_NXDOMAIN)) {
+      fprintf(stderr, "Unexpected authoritative NXDOMAIN response.\n");
+      break;
+    }
+
+    /* Large RRset over UDP without EDNS: truncated to 512 bytes. */
+    if ((forward_query(forwarder,
+                       0x4323,
+                       "big.zone.test",
+                       query,
+                       &querylen,
+                       response,
+                       &responselen) < 0) ||
+        (dns_process_header(response, responselen, &header, NULL) < 0) ||
+        ((header.flags & DNS_FLAG_TC) == 0)) {
+      fprintf(stderr, "Large authoritative answer not truncated.\n");
+      break;
+    }
+
+    /* With EDNS (OPT record: UDP payload size FORWARDER_MAX_UDP_SIZE). */
+    query[11] = 1;
+
+    query[querylen++] = 0;
+    query[querylen++] = 0;
+    query[querylen++] = 41;
+    query[querylen++] = (FORWARDER_MAX_UDP_SIZE >> 8) & 0xff;
+    query[querylen++] = FORWARDER_MAX_UDP_SIZE & 0xff;
+    memset(query + querylen, 0, 6);
+    querylen += 6;
+
+    nanswers = ARRAY_SIZE(answers);
+
+    if ((forward_message(forwarder,
+                         query,
+                         querylen,
+                         response,
+                         FORWARDER_MAX_UDP_SIZE,
+                         &responselen) < 0) ||
+        (responselen <= MAX_DNS_MESSAGE_SIZE) ||
+        (dns_process_header(response, responselen, &header, NULL) < 0) ||
+        (header.flags & DNS_FLAG_TC) ||
+        (dns_process_response(response,
+                              responselen,
+                              NULL,
+                              NULL,
+                              NULL,
+                              answers,
+                              &nanswers,
+                              NULL,
+                              NULL) < 0) ||
+        (nanswers != ZONE_RECORDS)) {
+      fprintf(stderr, "Unexpected authoritative answer with EDNS.\n");
+      break;
+    }
+
+    /* Over TCP: the whole RRset. */
+    if ((dns_build_request(0x4324,
+                           DNS_QTYPE_A,
+                           DNS_QCLASS_IN,
+                           "big.zone.test",
+                           13,
+                           query + 2,
+                           &querylen) < 0) ||
+        ((fd = tcp_connect(forwarder)) == -1)) {
+      break;
+    }
+
+    nanswers = ARRAY_SIZE(answers);
+
+    if ((tcp_exchange(forwarder,
+                      fd,
+                      query,
+                      querylen,
+                      response,
+                      sizeof(response),
+                      &responselen) < 0) ||
+        (dns_process_header(response + 2,
+                            responselen,
+                            &header,
+                            NULL) < 0) ||
+        (header.flags & DNS_FLAG_TC) ||
+        (dns_process_response(response + 2,
+                              responselen,
+                              NULL,
+                              NULL,
+                              NULL,
+                              answers,
+                              &nanswers,
+                              NULL,
+                              NULL) < 0) ||
+        (nanswers != ZONE_RECORDS)) {
+      fprintf(stderr, "Unexpected authoritative answer over TCP.\n");
+
+      close(fd);
+      break;
+    }
+
+    /* Wait for the forwarder to close the idle connection (a single
+     * connection is allowed).
+     */
+    deadline = timer_now() + TEST_TIMEOUT;
+
+    while (((n = recv(fd, response, sizeof(response), MSG_DONTWAIT)) < 0) &&
+           (timer_now() < deadline) &&
+           (forwarder_process(forwarder, 10) == 0));
+
+    close(fd);
+
+    if (n != 0) {
+      fprintf(stderr, "Idle TCP connection not closed.\n");
+      break;
+    }
+
+    forwarder_get_stats(forwarder, &stats);
+
+    if (stats.authoritative != 5) {
+      fprintf(stderr, "Unexpected number of authoritative answers.\n");
+      break;
+    }
+
+    ret = 0;
+  } while (0);
+
+  forwarder_serve_zone(forwarder, NULL);
+  zone_destroy(&zone);
+
+  return ret;
+}
+
+int forward_tcp(forwarder_t* forwarder)
+{
+  uint8_t queries[TCP_QUERIES * (2 + MAX_DNS_MESSAGE_SIZE)];
+  uint8_t responses[TCP_QUERIES * (2 + MAX_DNS_MESSAGE_SIZE)];
+  uint8_t answered[TCP_QUERIES];
+  char host[64];
+  size_t querylen;
+  size_t total;
+  size_t received;
+  size_t pos;
+  size_t len;
+  uint64_t nqueries;
+  uint64_t deadline;
+  unsigned count;
+  unsigned id;
+  unsigned i;
+  ssize_t n;
+  int fd;
+  int fd2;
+  int ret;
+
+  /* Queries preceded by their length. */
+  total = 0;
+
+  for (i = 0; i < TCP_QUERIES; i++) {
+    snprintf(host, sizeof(host), "h%u.test", TCP_FIRST_HOST + i);
+
+    dns_build_request(i,
+                      DNS_QTYPE_A,
+                      DNS_QCLASS_IN,
+                      host,
+                      strlen(host),
+                      queries + total + 2,
+                      &querylen);
+
+    queries[total] = (querylen >> 8) & 0xff;
+    queries[total + 1] = querylen & 0xff;
+
+    total += 2 + querylen;
+  }
+
+  if ((fd = tcp_connect(forwarder)) == -1) {
+    fprintf(stderr, "Error connecting to the forwarder.\n");
+    return -1;
+  }
+
+  ret = -1;
+  fd2 = -1;
+
+  do {
+    /* The queries are split in the middle of the length of the second
+     * one, which is sent after the first one has been processed.
+     */
+    pos = 2 + ((queries[0] << 8) | queries[1]) + 1;
+    nqueries = forwarder->stats.queries;
+
+    if ((send(fd, queries, pos, 0) != (ssize_t) pos) ||
+        (drive_forwarder(forwarder,
+                         &forwarder->stats.queries,
+                         nqueries + 1) < 0) ||
+        (send(fd, queries + pos, total - pos, 0) != (ssize_t) (total - pos))) {
+      fprintf(stderr, "Error sending queries over TCP.\n");
+      break;
+    }
+
+    /* Second connection: closed right after being accepted. */
+    if (((fd2 = tcp_connect(forwarder)) == -1) ||
+        (drive_forwarder(forwarder, &forwarder->stats.tcp_rejected, 1) < 0)) {
+      fprintf(stderr, "Second TCP connection not rejected.\n");
+      break;
+    }
+
+    memset(answered, 0, sizeof(answered));
+    count = 0;
+    received = 0;
+
+    deadline = timer_now() + TEST_TIMEOUT;
+
+    /* The responses might arrive in any order. */
+    while ((count < TCP_QUERIES) &&
+           (timer_now() < deadline) &&
+           (forwarder_process(forwarder, 10) == 0)) {
+      if ((n = recv(fd,
+                    responses + received,
+                    sizeof(responses) - received,
+                    MSG_DONTWAIT)) > 0) {
+        received += n;
+
+        while ((received >= 2) &&
+               (received >= 2 + (len = (responses[0] << 8) | responses[1]))) {
+          id = (responses[2] << 8) | responses[3];
+
+          if ((len >= 12) &&
+              (id < TCP_QUERIES) &&
+              (!answered[id]) &&
+              (DNS_RCODE(responses[5]) == DNS_RCODE_NOERROR)) {
+            answered[id] = 1;
+            count++;
+          }
+
+          received -= 2 + len;
+          memmove(responses, responses + 2 + len, received);
+        }
+      }
+    }
+
+    if (count != TCP_QUERIES) {
+      fprintf(stderr,
+              "TCP: %u responses out of %u.\n",
+              count,
+              TCP_QUERIES);
+
+      break;
+    }
+
+    /* The idle connection is closed by the forwarder. */
+    deadline = timer_now() + TEST_TIMEOUT;
+
+    while (((n = recv(fd, responses, sizeof(responses), MSG_DONTWAIT)) < 0) &&
+           (timer_now() < deadline) &&
+           (forwarder_process(forwarder, 10) == 0));
+
+    if (n != 0) {
+      fprintf(stderr, "Idle TCP connection not closed.\n");
+      break;
+    }
+
+    ret = 0;
+  } while (0);
+
+  if (fd2 != -1) {
+    close(fd2);
+  }
+
+  close(fd);
+
+  return ret;
+}
+
+int tcp_connect(const forwarder_t* forwarder)
+{
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  int fd;
+
+  addrlen = sizeof(struct sockaddr_storage);
+
+  if ((getsockname(forwarder->fd, (struct sockaddr*) &addr, &addrlen) == 0) &&
+      ((fd = socket(AF_INET, SOCK_STREAM, 0)) != -1)) {
+    /* The connection is completed by the kernel (listen backlog). */
+    if (connect(fd, (const struct sockaddr*) &addr, addrlen) == 0) {
+      return fd;
+    }
+
+    close(fd);
+  }
+
+  return -1;
+}
+
+int tcp_exchange(forwarder_t* forwarder,
+                 int fd,
+                 uint8_t* query,
+                 size_t querylen,
+                 uint8_t* response,
+                 size_t size,
+                 size_t* responselen)
+{
+  uint64_t deadline;
+  size_t received;
+  ssize_t n;
+
+  /* The query (after the first 2 bytes) is preceded by its length. */
+  query[0] = (querylen >> 8) & 0xff;
+  query[1] = querylen & 0xff;
+
+  if (send(fd, query, 2 + querylen, 0) != (ssize_t) (2 + querylen)) {
+    return -1;
+  }
+
+  received = 0;
+
+  deadline = timer_now() + TEST_TIMEOUT;
+
+  while ((timer_now() < deadline) &&
+         (forwarder_process(forwarder, 10) == 0)) {
+    if ((n = recv(fd,
+                  response + received,
+                  size - received,
+                  MSG_DONTWAIT)) > 0) {
+      received += n;
+
+      if ((received >= 2) &&
+          (received >= 2 + (*responselen = (response[0] << 8) |
+                                           response[1]))) {
+        return (received == 2 + *responselen) ? 0 : -1;
+      }
+    }
+  }
+
+  return -1;
+}
+
+int drive_forwarder(forwarder_t* forwarder,
+                    const uint64_t* counter,
+                    uint64_t value)
+{
+  uint64_t deadline;
+
+  deadline = timer_now() + TEST_TIMEOUT;
+
+  while (*counter < value) {
+    if ((timer_now() >= deadline) ||
+        (forwarder_process(forwarder, 10) < 0)) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int test_truncation(void)
+{
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  resolver_config_t config;
+  resolver_t resolver;
+  resolver_stats_t stats;
+  forwarder_t forwarder;
+  uint8_t query[2 + MAX_DNS_MESSAGE_SIZE];
+  uint8_t response[2 + MAX_DNS_TCP_MESSAGE_SIZE];
+  rr_t answers[TRUNCATED_RECORDS];
+  dns_header_t header;
+  uint64_t deadline;
+  size_t querylen;
+  size_t responselen;
+  size_t nanswers;
+  size_t received;
+  unsigned nresponses;
+  unsigned i;
+  ssize_t n;
+  pid_t pid;
+  int ret;
+  int fd;
+
+  /* UDP and TCP on an ephemeral port of the loopback interface. */
+  if ((build_ip_address("127.0.0.1", 0, &addr, &addrlen) < 0) ||
+      ((pid = start_server(answer_truncated,
+                           NULL,
+                           1,
+                           &addr,
+                           &addrlen)) == -1)) {
+    fprintf(stderr, "Error starting DNS server.\n");
+    return -1;
+  }
+
+  resolver_config_init(&config);
+  config.deadline = FORWARDER_DEADLINE;
+
+  if ((resolver_create(&resolver, &config) < 0) ||
+      (resolver_add_upstream(&resolver,
+                             (const struct sockaddr*) &addr,
+                             addrlen) < 0)) {
+    fprintf(stderr, "Error creating resolver.\n");
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    return -1;
+  }
+
+  if ((build_ip_address("127.0.0.1", 0, &addr, &addrlen) < 0) ||
+      (forwarder_create(&forwarder,
+                        &resolver,
+                        NULL,
+                        (const struct sockaddr*) &addr,
+                        addrlen,
+                        FORWARDER_DEFAULT_MAX_REQUESTS) < 0)) {
+    fprintf(stderr, "Error creating forwarder.\n");
+
+    resolver_destroy(&resolver);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    return -1;
+  }
+
+  if (forwarder_listen_tcp(&forwarder, 1, TCP_IDLE_TIMEOUT) < 0) {
+    fprintf(stderr, "Error listening on TCP.\n");
+
+    forwarder_destroy(&forwarder);
+    resolver_destroy(&resolver);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    return -1;
+  }
+
+  ret = -1;
+  fd = -1;
+
+  do {
+    /* UDP client: the full response (over TCP from the server) doesn't
+     * fit, the client gets the question with the TC flag.
+     */
+    if ((forward_query(&forwarder,
+                       1,
+                       "big.test",
+                       query,
+                       &querylen,
+                       response,
+                       &responselen) < 0) ||
+        (dns_process_header(response, responselen, &header, NULL) < 0) ||
+        ((header.flags & DNS_FLAG_TC) == 0) ||
+        (DNS_RCODE(header.flags) != DNS_RCODE_NOERROR) ||
+        (header.ancount != 0) ||
+        (responselen != querylen) ||
+        (memcmp(query + 12, response + 12, querylen - 12) != 0)) {
+      fprintf(stderr, "Unexpected truncated response over UDP.\n");
+      break;
+    }
+
+    /* TCP client: the full response. */
+    if (dns_build_request(2,
+                          DNS_QTYPE_A,
+                          DNS_QCLASS_IN,
+                          "big.test",
+                          8,
+                          query + 2,
+                          &querylen) < 0) {
+      break;
+    }
+
+    if ((fd = tcp_connect(&forwarder)) == -1) {
+      fprintf(stderr, "Error connecting to the forwarder.\n");
+      break;
+    }
+
+    nanswers = ARRAY_SIZE(answers);
+
+    if ((tcp_exchange(&forwarder,
+                      fd,
+                      query,
+                      querylen,
+                      response,
+                      sizeof(response),
+                      &responselen) < 0) ||
+        (responselen <= MAX_DNS_MESSAGE_SIZE) ||
+        (dns_process_header(response + 2,
+                            responselen,
+                            &header,
+                            NULL) < 0) ||
+        (header.id != 2) ||
+        (header.flags & DNS_FLAG_TC) ||
+        (dns_process_response(response + 2,
+                              responselen,
+                              NULL,
+                              NULL,
+                              NULL,
+                              answers,
+                              &nanswers,
+                              NULL,
+                              NULL) < 0) ||
+        (nanswers != TRUNCATED_RECORDS) ||
+        (ntohl(answers[TRUNCATED_RECORDS - 1].addr4.s_addr) !=
+         0x0a000000 + TRUNCATED_RECORDS - 1)) {
+      fprintf(stderr, "Unexpected response over TCP.\n");
+
+      break;
+    }
+
+    /* Both queries were repeated over TCP by the resolver. */
+    resolver_get_stats(&resolver, &stats);
+
+    if (stats.tcp_requests != 2) {
+      fprintf(stderr,
+              "Unexpected number of requests over TCP (%llu).\n",
+              (unsigned long long) stats.tcp_requests);
+
+      break;
+    }
+
+    /* Pipelined queries with responses which don't fit together in the
+     * output buffer of the connection: they are all sent.
+     */
+    if (dns_build_request(0,
+                          DNS_QTYPE_A,
+                          DNS_QCLASS_IN,
+                          "huge.test",
+                          9,
+                          query + 2,
+                          &querylen) < 0) {
+      break;
+    }
+
+    query[0] = (querylen >> 8) & 0xff;
+    query[1] = querylen & 0xff;
+
+    for (i = 0; i < FORWARDER_MAX_PIPELINED; i++) {
+      query[2] = (i >> 8) & 0xff;
+      query[3] = i & 0xff;
+
+      if (send(fd, query, 2 + querylen, 0) != (ssize_t) (2 + querylen)) {
+        break;
+      }
+    }
+
+    if (i < FORWARDER_MAX_PIPELINED) {
+      fprintf(stderr, "Error sending pipelined queries.\n");
+      break;
+    }
+
+    received = 0;
+    nresponses = 0;
+
+    deadline = timer_now() + TEST_TIMEOUT;
+
+    while ((nresponses < FORWARDER_MAX_PIPELINED) &&
+           (timer_now() < deadline) &&
+           (forwarder_process(&forwarder, 10) == 0)) {
+      if ((n = recv(fd,
+                    response + received,
+                    sizeof(response) - received,
+                    MSG_DONTWAIT)) <= 0) {
+        if (n == 0) {
+          break;
+        }
+
+        continue;
+      }
+
+      received += n;
+
+      /* Complete responses. */
+      while ((received >= 2) &&
+             (received >= 2 + (responselen = (response[0] << 8) |
+                                             response[1]))) {
+        if ((dns_process_header(response + 2,
+                                responselen,
+                                &header,
+                                NULL) < 0) ||
+            (header.id != nresponses) ||
+            (header.flags & DNS_FLAG_TC) ||
+            (header.ancount != HUGE_RECORDS)) {
+          break;
+        }
+
+        nresponses++;
+
+        received -= 2 + responselen;
+        memmove(response, response + 2 + responselen, received);
+      }
+
+      /* Unexpected response. */
+      if ((received >= 2) && (received >= 2 + responselen)) {
+        break;
+      }
+    }
+
+    if (nresponses != FORWARDER_MAX_PIPELINED) {
+      fprintf(stderr,
+              "Unexpected number of pipelined responses (%u).\n",
+              nresponses);
+
+      break;
+    }
+
+    ret = 0;
+  } while (0);
+
+  if (fd != -1) {
+    close(fd);
+  }
+
+  forwarder_destroy(&forwarder);
+  resolver_destroy(&resolver);
+
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+
+  return ret;
+}
+
+size_t answer_truncated(const void* data,
+                        const uint8_t* query,
+                        size_t len,
+                        int tcp,
+                        uint8_t* response,
+                        unsigned* delay)
+{
+  unsigned nrecords;
+  unsigned i;
+  uint8_t* p;
+
+  memcpy(response, query, len);
+
+  /* UDP: the question with the TC flag. */
+  if (!tcp) {
+    /* Response, truncated, recursion desired and available. */
+    response[2] = 0x83;
+    response[3] = 0x80;
+
+    return len;
+  }
+
+  /* TCP: TRUNCATED_RECORDS addresses (HUGE_RECORDS for huge.test). */
+  response[2] = 0x81;
+  response[3] = 0x80;
+
+  nrecords = ((query[12] == 4) && (memcmp(query + 13, "huge", 4) == 0)) ?
+             HUGE_RECORDS :
+             TRUNCATED_RECORDS;
+
+  /* ANCOUNT. */
+  response[6] = (nrecords >> 8) & 0xff;
+  response[7] = nrecords & 0xff;
+
+  p = response + len;
+
+  for (i = 0; i < nrecords; i++) {
+    /* Pointer to the name of the question, A, IN, TTL 60, 10.0.x.y */
+    *p++ = 0xc0; *p++ = 12;
+    *p++ = 0; *p++ = DNS_QTYPE_A;
+    *p++ = 0; *p++ = DNS_QCLASS_IN;
+    *p++ = 0; *p++ = 0; *p++ = 0; *p++ = 60;
+    *p++ = 0; *p++ = 4;
+    *p++ = 10; *p++ = 0; *p++ = (i >> 8) & 0xff; *p++ = i & 0xff;
+  }
+
+  return p - response;
+}
+
+int test_workers(void)
+{
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  struct sockaddr_storage listen_addr;
+  socklen_t listen_addrlen;
+  workers_config_t config;
+  workers_t workers;
+  forwarder_stats_t stats;
+  uint64_t cache_hits;
+  char host[64];
+  pid_t pid;
+  unsigned i;
+  int ret;
+
+  if ((pid = start_hosts_server(SERVER_NORMAL, &addr, &addrlen)) == -1) {
+    fprintf(stderr, "Error starting DNS server.\n");
+    return -1;
+  }
+
+  workers_config_init(&config);
+  config.nworkers = NUMBER_WORKERS;
+  config.steer_by_name = 1;
+  config.nbuckets = NUMBER_BUCKETS;
+  config.resolver.deadline = FORWARDER_DEADLINE;
+
+  /* Listen on an ephemeral port of the loopback interface. */
+  if ((build_ip_address("127.0.0.1", 0, &listen_addr, &listen_addrlen) < 0) ||
+      (workers_create(&workers,
+                      &config,
+                      (const struct sockaddr*) &listen_addr,
+                      listen_addrlen) < 0)) {
+    fprintf(stderr, "Error creating workers.\n");
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    return -1;
+  }
+
+  ret = -1;
+
+  do {
+    if ((workers_add_upstream(&workers,
+                              (const struct sockaddr*) &addr,
+                              addrlen) < 0) ||
+        (workers_start(&workers) < 0)) {
+      fprintf(stderr, "Error starting workers.\n");
+      break;
+    }
+
+    /* The queries for the same name (whatever the case and the client) are
+     * handled by the same worker: the first one is forwarded, the others
+     * are answered from its DNS cache.
+     */
+    for (i = 0; i < STEERED_QUERIES; i++) {
+      if (ask_workers(&workers, i, (i & 1) ? "H7.Test" : "h7.test", 7) < 0) {
+        break;
+      }
+    }
+
+    cache_hits = 0;
+
+    for (i = 0; i < workers.nworkers; i++) {
+      workers_get_stats(&workers, i, &stats);
+      cache_hits += stats.cache_hits;
+    }
+
+    if ((i = busy_workers(&workers)) != 1) {
+      fprintf(stderr,
+              "Queries for the same name handled by %u workers.\n",
+              i);
+
+      break;
+    }
+
+    if (cache_hits != STEERED_QUERIES - 1) {
+      fprintf(stderr,
+              "Unexpected number of cache hits (%llu).\n",
+              (unsigned long long) cache_hits);
+
+      break;
+    }
+
+    /* Different names are spread among the workers. */
+    for (i = 0; i < SPREAD_QUERIES; i++) {
+      snprintf(host, sizeof(host), "h%u.test", WORKERS_FIRST_HOST + 1 + i);
+
+      if (ask_workers(&workers, i, host, WORKERS_FIRST_HOST + 1 + i) < 0) {
+        break;
+      }
+    }
+
+    if ((i = busy_workers(&workers)) < 2) {
+      fprintf(stderr, "Queries handled by %u worker(s).\n", i);
+      break;
+    }
+
+    ret = 0;
+  } while (0);
+
+  workers_destroy(&workers);
+
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+
+  return ret;
+}
+
+int ask_workers(const workers_t* workers,
+                uint16_t id,
+                const char* name,
+                uint32_t addr)
+{
+  uint8_t query[MAX_DNS_MESSAGE_SIZE];
+  uint8_t response[MAX_DNS_MESSAGE_SIZE];
+  size_t querylen;
+  rr_t answer;
+  size_t nanswers;
+  uint16_t responseid;
+  ssize_t len;
+  int ret;
+  int fd;
+
+  if ((dns_build_request(id,
+                         DNS_QTYPE_A,
+                         DNS_QCLASS_IN,
+                         name,
+                         strlen(name),
+                         query,
+                         &querylen) < 0) ||
+      ((fd = socket_create(workers->addr.ss_family, SOCK_DGRAM)) == -1)) {
+    return -1;
+  }
+
+  ret = -1;
+  nanswers = 1;
+
+  /* A new socket (source port) per query. */
+  if ((socket_sendto(fd,
+                     query,
+                     querylen,
+                     (const struct sockaddr*) &workers->addr,
+                     workers->addrlen) == (ssize_t) querylen) &&
+      ((len = socket_timed_recv(fd,
+                                response,
+                                sizeof(response),
+                                TEST_TIMEOUT)) > 0) &&
+      (dns_process_response(response,
+                            len,
+                            &responseid,
+                            NULL,
+                            NULL,
+                            &answer,
+                            &nanswers,
+                            NULL,
+                            NULL) == 0) &&
+      (responseid == id) &&
+      (nanswers == 1) &&
+      (ntohl(answer.addr4.s_addr) == (0x0a000000 | addr))) {
+    ret = 0;
+  } else {
+    fprintf(stderr, "Unexpected response for '%s'.\n", name);
+  }
+
+  close(fd);
+
+  return ret;
+}
+
+unsigned busy_workers(const workers_t* workers)
+{
+  forwarder_stats_t stats;
+  unsigned count;
+  unsigned i;
+
+  count = 0;
+
+  for (i = 0; i < workers->nworkers; i++) {
+    workers_get_stats(workers, i, &stats);
+
+    if (stats.queries > 0) {
+      count++;
+    }
+  }
+
+  return count;
+}
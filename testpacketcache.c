@@ -0,0 +1,292 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include "packetcache.h"
+#include "dns.h"
+
+#define NUMBER_BUCKETS 127
+#define MAX_ENTRIES    100
+#define NUMBER_NAMES   (2 * MAX_ENTRIES)
+#define NOW            1000
+
+typedef enum {
+  ANSWERS,     /* Two A records (TTLs 300 and 100) and an OPT record. */
+  NEGATIVE,    /* NXDOMAIN with a SOA record (TTL 3600, MINIMUM 60). */
+  NEGATIVE_NO_SOA
+} response_type_t;
+
+static size_t build_query(uint16_t id, const char* name, uint8_t* query);
+static size_t build_response(const char* name,
+                             response_type_t type,
+                             uint8_t* response);
+
+static size_t add_record(uint8_t* p,
+                         uint16_t type,
+                         uint32_t ttl,
+                         const void* rdata,
+                         uint16_t rdlength);
+
+static uint32_t get32(const uint8_t* p);
+static int test_answers(packetcache_t* cache);
+static int test_negative(packetcache_t* cache);
+static int test_evictions(packetcache_t* cache);
+
+int main()
+{
+  packetcache_t cache;
+  int ret;
+
+  if (packetcache_create(&cache, NUMBER_BUCKETS, MAX_ENTRIES) < 0) {
+    fprintf(stderr, "Error creating packet cache.\n");
+    return -1;
+  }
+
+  ret = ((test_answers(&cache) == 0) &&
+         (test_negative(&cache) == 0) &&
+         (test_evictions(&cache) == 0)) ? 0 : -1;
+
+  packetcache_destroy(&cache);
+
+  return ret;
+}
+
+int test_answers(packetcache_t* cache)
+{
+  uint8_t query[MAX_DNS_MESSAGE_SIZE];
+  uint8_t response[MAX_DNS_MESSAGE_SIZE];
+  uint8_t cached[MAX_DNS_MESSAGE_SIZE];
+  size_t querylen;
+  size_t responselen;
+  size_t len;
+
+  responselen = build_response("www.example.com", ANSWERS, response);
+
+  if (packetcache_add(cache, response, responselen, NOW) < 0) {
+    fprintf(stderr, "Error adding response to packet cache.\n");
+    return -1;
+  }
+
+  /* ID and case of the query, remaining time to live. */
+  querylen = build_query(0x4242, "WWW.Example.COM", query);
+
+  if (packetcache_get(cache, query, querylen, NOW + 30, cached, &len) < 0) {
+    fprintf(stderr, "Response not found in packet cache.\n");
+    return -1;
+  }
+
+  if ((len != responselen) ||
+      (cached[0] != 0x42) ||
+      (cached[1] != 0x42) ||
+      (memcmp(cached + 12, query + 12, querylen - 12) != 0) ||
+      (get32(cached + querylen + 6) != 270) ||
+      (get32(cached + querylen + 16 + 6) != 70) ||
+      (get32(cached + querylen + 32 + 5) != 0x8000) ||
+      (memcmp(cached + querylen + 16 + 12,
+              response + querylen + 16 + 12,
+              4) != 0)) {
+    fprintf(stderr, "Unexpected response from packet cache.\n");
+    return -1;
+  }
+
+  /* The response expires with its first record. */
+  if (packetcache_get(cache, query, querylen, NOW + 101, cached, &len) == 0) {
+    fprintf(stderr, "Expired response found in packet cache.\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+int test_negative(packetcache_t* cache)
+{
+  uint8_t query[MAX_DNS_MESSAGE_SIZE];
+  uint8_t response[MAX_DNS_MESSAGE_SIZE];
+  uint8_t cached[MAX_DNS_MESSAGE_SIZE];
+  size_t querylen;
+  size_t responselen;
+  size_t len;
+
+  /* Without SOA record, the response is not cached. */
+  responselen = build_response("nx.example.com", NEGATIVE_NO_SOA, response);
+
+  if (packetcache_add(cache, response, responselen, NOW) == 0) {
+    fprintf(stderr, "Negative response without SOA record cached.\n");
+    return -1;
+  }
+
+  /* Time to live: MINIMUM of the SOA record. */
+  responselen = build_response("nx.example.com", NEGATIVE, response);
+  querylen = build_query(1, "nx.example.com", query);
+
+  if ((packetcache_add(cache, response, responselen, NOW) < 0) ||
+      (packetcache_get(cache, query, querylen, NOW + 10, cached, &len) < 0) ||
+      ((cached[3] & 0x0f) != DNS_RCODE_NXDOMAIN) ||
+      (get32(cached + querylen + 6) != 50)) {
+    fprintf(stderr, "Unexpected negative response from packet cache.\n");
+    return -1;
+  }
+
+  if (packetcache_get(cache, query, querylen, NOW + 61, cached, &len) == 0) {
+    fprintf(stderr, "Expired negative response found in packet cache.\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+int test_evictions(packetcache_t* cache)
+{
+  uint8_t query[MAX_DNS_MESSAGE_SIZE];
+  uint8_t response[MAX_DNS_MESSAGE_SIZE];
+  uint8_t cached[MAX_DNS_MESSAGE_SIZE];
+  cache_stats_t stats;
+  char name[64];
+  size_t querylen;
+  size_t responselen;
+  size_t len;
+  unsigned i;
+
+  packetcache_remove_expired(cache, NOW + 3600);
+
+  for (i = 0; i < NUMBER_NAMES; i++) {
+    snprintf(name, sizeof(name), "www.%06u.net", i);
+
+    responselen = build_response(name, ANSWERS, response);
+
+    if (packetcache_add(cache, response, responselen, NOW) < 0) {
+      fprintf(stderr, "Error adding response for '%s'.\n", name);
+      return -1;
+    }
+  }
+
+  /* The least recently used entries have been evicted. */
+  for (i = 0; i < NUMBER_NAMES; i++) {
+    snprintf(name, sizeof(name), "www.%06u.net", i);
+    querylen = build_query(i, name, query);
+
+    if ((packetcache_get(cache, query, querylen, NOW, cached, &len) == 0) !=
+        (i >= NUMBER_NAMES - MAX_ENTRIES)) {
+      fprintf(stderr, "Unexpected lookup result for '%s'.\n", name);
+      return -1;
+    }
+  }
+
+  packetcache_get_stats(cache, &stats);
+
+  if ((stats.entries != MAX_ENTRIES) ||
+      (stats.evictions != NUMBER_NAMES - MAX_ENTRIES)) {
+    fprintf(stderr,
+            "Unexpected statistics (entries: %llu, evictions: %llu).\n",
+            (unsigned long long) stats.entries,
+            (unsigned long long) stats.evictions);
+
+    return -1;
+  }
+
+  return 0;
+}
+
+size_t build_query(uint16_t id, const char* name, uint8_t* query)
+{
+  size_t len;
+
+  dns_build_request(id,
+                    DNS_QTYPE_A,
+                    DNS_QCLASS_IN,
+                    name,
+                    strlen(name),
+                    query,
+                    &len);
+
+  return len;
+}
+
+size_t build_response(const char* name,
+                      response_type_t type,
+                      uint8_t* response)
+{
+  static const uint8_t addr1[] = {10, 0, 0, 1};
+  static const uint8_t addr2[] = {10, 0, 0, 2};
+  uint8_t soa[22];
+  uint8_t* p;
+  size_t len;
+
+  len = build_query(0x1234, name, response);
+  p = response + len;
+
+  /* Response, recursion desired and available. */
+  response[2] = 0x81;
+  response[3] = 0x80;
+
+  switch (type) {
+    case ANSWERS:
+      response[7] = 2;
+      response[11] = 1;
+
+      p += add_record(p, DNS_QTYPE_A, 300, addr1, sizeof(addr1));
+      p += add_record(p, DNS_QTYPE_A, 100, addr2, sizeof(addr2));
+
+      /* OPT: the TTL field contains the DO flag. */
+      p += add_record(p, 41, 0x8000, NULL, 0);
+
+      break;
+    case NEGATIVE:
+      response[3] = 0x80 | DNS_RCODE_NXDOMAIN;
+      response[9] = 1;
+
+      /* MNAME and RNAME (root), SERIAL, REFRESH, RETRY, EXPIRE and
+       * MINIMUM (60).
+       */
+      memset(soa, 0, sizeof(soa));
+      soa[21] = 60;
+
+      p += add_record(p, DNS_QTYPE_SOA, 3600, soa, sizeof(soa));
+
+      break;
+    case NEGATIVE_NO_SOA:
+      response[3] = 0x80 | DNS_RCODE_NXDOMAIN;
+      break;
+  }
+
+  return p - response;
+}
+
+size_t add_record(uint8_t* p,
+                  uint16_t type,
+                  uint32_t ttl,
+                  const void* rdata,
+                  uint16_t rdlength)
+{
+  /* Pointer to the name of the question (root for OPT). */
+  if (type == 41) {
+    *p++ = 0;
+
+    /* UDP payload size instead of the class. */
+    *p++ = 0; *p++ = type;
+    *p++ = 0x04; *p++ = 0xd0;
+  } else {
+    *p++ = 0xc0;
+    *p++ = 12;
+
+    *p++ = type >> 8; *p++ = type & 0xff;
+    *p++ = 0; *p++ = DNS_QCLASS_IN;
+  }
+
+  *p++ = ttl >> 24; *p++ = (ttl >> 16) & 0xff;
+  *p++ = (ttl >> 8) & 0xff; *p++ = ttl & 0xff;
+
+  *p++ = rdlength >> 8; *p++ = rdlength & 0xff;
+
+  if (rdlength > 0) {
+    memcpy(p, rdata, rdlength);
+  }
+
+  return ((type == 41) ? 11 : 12) + rdlength;
+}
+
+uint32_t get32(const uint8_t* p)
+{
+  return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
@@ -0,0 +1,1377 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include "resolver.h"
+#include "happyeyeballs.h"
+#include "zone.h"
+#include "socket.h"
+#include "testserver.h"
+#include "macros.h"
+
+#define NUMBER_BUCKETS  1021
+#define NUMBER_QUERIES  (10 * 1000)
+#define NUMBER_WAITERS  1000
+#define MAX_QUERIES     (16 * 1000)
+#define QUERY_TIMEOUT   200 /* [ms] */
+#define QUERY_ATTEMPTS  5
+#define BUFFER_SIZE     (4 * 1024 * 1024)
+#define TEST_TIMEOUT    (30 * 1000) /* [ms] */
+
+/* Upstream selection test. */
+#define NUMBER_LOOKUPS  200
+#define FIRST_HOST      100000
+#define LOOKUP_TIMEOUT  100 /* [ms] */
+
+/* Adaptive timeout test. */
+#define INITIAL_TIMEOUT 1000 /* [ms] */
+#define MIN_TIMEOUT     10 /* [ms] */
+#define MAX_LOST_DELAY  250 /* [ms] */
+#define DEADLINE        300 /* [ms] */
+
+/* Hedging test. */
+#define HEDGE_DELAY     20 /* [ms] */
+#define MAX_HEDGED_TIME 100 /* [ms] */
+
+/* Happy eyeballs test. */
+#define CONNECT_TIMEOUT 2000 /* [ms] */
+#define MAX_CONNECT_TIME 500 /* [ms] */
+
+/* Socket pool test. */
+#define NUMBER_SOCKETS  4
+#define POOL_QUERIES    2000
+#define POOL_FIRST_HOST 200000
+
+/* Iterative resolution test: root, "test" and "example.test" /
+ * "other.test" servers.
+ */
+#define NUMBER_AUTHORITATIVES 3
+
+typedef struct {
+  unsigned success;
+  unsigned nxdomain;
+  unsigned timeout;
+  unsigned errors;
+  unsigned cached;
+} counters_t;
+
+/* Zones of an authoritative server. */
+typedef struct {
+  const zone_t* zones;
+  unsigned nzones;
+} authoritative_t;
+
+/* Result of a query resolved iteratively. */
+typedef struct {
+  resolver_status_t status;
+  uint32_t addr;
+
+  /* Answers returned and answers of the response. */
+  size_t nanswers;
+  unsigned ancount;
+} answer_t;
+
+
+static void callback(const resolver_result_t* result, void* data);
+static int wait_for_queries(resolver_t* resolver);
+static int resolve_hosts(resolver_t* resolver, counters_t* counters);
+static int test_coalescing(resolver_t* resolver);
+static int test_upstreams(void);
+static int test_adaptive_timeouts(void);
+static int test_deadline(void);
+static int test_hedging(void);
+static int test_happy_eyeballs(void);
+static int test_socket_pool(int connected, int cpu_affinity);
+static int test_iterative(void);
+static int load_test_zone(zone_t* zone, const char* origin, const char* data);
+static pid_t start_authoritative(const char* ip,
+                                 in_port_t* port,
+                                 const zone_t* zones,
+                                 unsigned nzones);
+
+static size_t answer_authoritative(const void* data,
+                                   const uint8_t* query,
+                                   size_t len,
+                                   int tcp,
+                                   uint8_t* response,
+                                   unsigned* delay);
+
+static int resolve_iteratively(resolver_t* resolver,
+                               const char* name,
+                               answer_t* answer);
+
+static void answer_callback(const resolver_result_t* result, void* data);
+
+int main()
+{
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  resolver_config_t config;
+  resolver_t resolver;
+  dnscaches_t caches;
+  counters_t counters;
+  pid_t pid;
+  int ret;
+
+  if ((pid = start_hosts_server(SERVER_NORMAL, &addr, &addrlen)) == -1) {
+    fprintf(stderr, "Error starting DNS server.\n");
+    return -1;
+  }
+
+  if (dnscaches_create(&caches, NUMBER_BUCKETS) < 0) {
+    fprintf(stderr, "Error creating DNS caches.\n");
+
+    kill(pid, SIGTERM);
+    return -1;
+  }
+
+  resolver_config_init(&config);
+  config.max_queries = MAX_QUERIES;
+  config.timeout = QUERY_TIMEOUT;
+  config.max_timeout = QUERY_TIMEOUT;
+  config.attempts = QUERY_ATTEMPTS;
+  config.buffer_size = BUFFER_SIZE;
+  config.caches = &caches;
+
+  if ((resolver_create(&resolver, &config) < 0) ||
+      (resolver_add_upstream(&resolver,
+                             (const struct sockaddr*) &addr,
+                             addrlen) < 0)) {
+    fprintf(stderr, "Error creating resolver.\n");
+
+    dnscaches_destroy(&caches);
+    kill(pid, SIGTERM);
+
+    return -1;
+  }
+
+  ret = -1;
+
+  do {
+    /* Resolve all the hosts (some requests are dropped by the server the
+     * first time).
+     */
+    memset(&counters, 0, sizeof(counters_t));
+
+    if ((resolve_hosts(&resolver, &counters) < 0) ||
+        (counters.success != NUMBER_QUERIES) ||
+        (counters.cached != 0)) {
+      fprintf(stderr,
+              "Error resolving hosts (success: %u, timeout: %u, "
+              "errors: %u).\n",
+              counters.success,
+              counters.timeout,
+              counters.errors);
+
+      break;
+    }
+
+    /* Now they must be in the cache. */
+    memset(&counters, 0, sizeof(counters_t));
+
+    if ((resolve_hosts(&resolver, &counters) < 0) ||
+        (counters.cached != NUMBER_QUERIES)) {
+      fprintf(stderr,
+              "Hosts not found in the DNS cache (cached: %u).\n",
+              counters.cached);
+
+      break;
+    }
+
+    if (test_coalescing(&resolver) < 0) {
+      break;
+    }
+
+    /* Non-existent domain and server which doesn't answer. */
+    memset(&counters, 0, sizeof(counters_t));
+
+    if ((resolver_resolve(&resolver,
+                          "nx1.test",
+                          8,
+                          DNS_QTYPE_A,
+                          DNS_QCLASS_IN,
+                          callback,
+                          &counters) < 0) ||
+        (resolver_resolve(&resolver,
+                          "drop1.test",
+                          10,
+                          DNS_QTYPE_A,
+                          DNS_QCLASS_IN,
+                          callback,
+                          &counters) < 0) ||
+        (wait_for_queries(&resolver) < 0) ||
+        (counters.nxdomain != 1) ||
+        (counters.timeout != 1)) {
+      fprintf(stderr,
+              "Unexpected results (NXDOMAIN: %u, timeout: %u).\n",
+              counters.nxdomain,
+              counters.timeout);
+
+      break;
+    }
+
+    if ((test_upstreams() < 0) ||
+        (test_adaptive_timeouts() < 0) ||
+        (test_deadline() < 0) ||
+        (test_hedging() < 0) ||
+        (test_happy_eyeballs() < 0) ||
+        (test_socket_pool(1, 0) < 0) ||
+        (test_socket_pool(0, 1) < 0) ||
+        (test_iterative() < 0)) {
+      break;
+    }
+
+    ret = 0;
+  } while (0);
+
+  resolver_destroy(&resolver);
+  dnscaches_destroy(&caches);
+
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+
+  return ret;
+}
+
+void callback(const resolver_result_t* result, void* data)
+{
+  counters_t* counters;
+  unsigned n;
+
+  counters = (counters_t*) data;
+
+  switch (result->status) {
+    case RESOLVER_SUCCESS:
+      if ((result->nanswers == 1) &&
+          (result->answers[0].type == DNS_QTYPE_A) &&
+          (sscanf(result->name, "h%u.test", &n) == 1) &&
+          (ntohl(result->answers[0].addr4.s_addr) == (0x0a000000 | n))) {
+        counters->success++;
+
+        if (result->cached) {
+          counters->cached++;
+        }
+      } else {
+        counters->errors++;
+      }
+
+      break;
+    case RESOLVER_NXDOMAIN:
+      counters->nxdomain++;
+      break;
+    case RESOLVER_TIMEOUT:
+      counters->timeout++;
+      break;
+    default:
+      counters->errors++;
+  }
+}
+
+int wait_for_queries(resolver_t* resolver)
+{
+  uint64_t deadline;
+
+  deadline = timer_now() + TEST_TIMEOUT;
+
+  while (resolver_pending(resolver) > 0) {
+    if ((timer_now() > deadline) || (resolver_process(resolver, 100) < 0)) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int resolve_hosts(resolver_t* resolver, counters_t* counters)
+{
+  char host[64];
+  size_t hostlen;
+  unsigned i;
+
+  /* Start all the queries at once. */
+  for (i = 0; i < NUMBER_QUERIES; i++) {
+    hostlen = snprintf(host, sizeof(host), "h%u.test", i);
+
+    if (resolver_resolve(resolver,
+                         host,
+                         hostlen,
+                         DNS_QTYPE_A,
+                         DNS_QCLASS_IN,
+                         callback,
+                         counters) < 0) {
+      fprintf(stderr, "Error resolving '%s'.\n", host);
+      return -1;
+    }
+  }
+
+  return wait_for_queries(resolver);
+}
+
+int test_coalescing(resolver_t* resolver)
+{
+  resolver_stats_t before;
+  resolver_stats_t after;
+  counters_t counters;
+  unsigned i;
+
+  resolver_get_stats(resolver, &before);
+
+  memset(&counters, 0, sizeof(counters_t));
+
+  /* Many queries for the same question (not in the cache). */
+  for (i = 0; i < NUMBER_WAITERS; i++) {
+    if (resolver_resolve(resolver,
+                         "h20000.test",
+                         11,
+                         DNS_QTYPE_A,
+                         DNS_QCLASS_IN,
+                         callback,
+                         &counters) < 0) {
+      fprintf(stderr, "Error resolving 'h20000.test'.\n");
+      return -1;
+    }
+  }
+
+  if (resolver_pending(resolver) != 1) {
+    fprintf(stderr,
+            "Unexpected number of queries in flight (%u).\n",
+            resolver_pending(resolver));
+
+    return -1;
+  }
+
+  if (wait_for_queries(resolver) < 0) {
+    return -1;
+  }
+
+  resolver_get_stats(resolver, &after);
+
+  /* A single request must have been sent. */
+  if ((counters.success != NUMBER_WAITERS) ||
+      (after.requests - before.requests != 1) ||
+      (after.coalesced - before.coalesced != NUMBER_WAITERS - 1)) {
+    fprintf(stderr,
+            "Queries not coalesced (success: %u, requests: %llu).\n",
+            counters.success,
+            (unsigned long long) (after.requests - before.requests));
+
+    return -1;
+  }
+
+  return 0;
+}
+
+int test_upstreams(void)
+{
+  static const server_mode_t modes[] = {
+    SERVER_DEAD,
+    SERVER_SLOW,
+    SERVER_NORMAL
+  };
+
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  resolver_config_t config;
+  resolver_t resolver;
+  upstream_stats_t stats[ARRAY_SIZE(modes)];
+  counters_t counters;
+  pid_t pids[ARRAY_SIZE(modes)];
+  char host[64];
+  size_t hostlen;
+  unsigned i;
+  int ret;
+
+  resolver_config_init(&config);
+  config.timeout = LOOKUP_TIMEOUT;
+
+  if (resolver_create(&resolver, &config) < 0) {
+    fprintf(stderr, "Error creating resolver.\n");
+    return -1;
+  }
+
+  for (i = 0; i < ARRAY_SIZE(modes); i++) {
+    if ((pids[i] = start_hosts_server(modes[i], &addr, &addrlen)) == -1) {
+      fprintf(stderr, "Error starting DNS server.\n");
+      break;
+    }
+
+    if (resolver_add_upstream(&resolver,
+                              (const struct sockaddr*) &addr,
+                              addrlen) != (int) i) {
+      fprintf(stderr, "Error adding upstream server.\n");
+
+      kill(pids[i], SIGTERM);
+      waitpid(pids[i], NULL, 0);
+
+      break;
+    }
+  }
+
+  ret = -1;
+
+  if (i == ARRAY_SIZE(modes)) {
+    memset(&counters, 0, sizeof(counters_t));
+
+    /* One lookup at a time, so that each one can use the round-trip times
+     * measured by the previous ones.
+     */
+    for (i = 0; i < NUMBER_LOOKUPS; i++) {
+      hostlen = snprintf(host, sizeof(host), "h%u.test", FIRST_HOST + i);
+
+      if ((resolver_resolve(&resolver,
+                            host,
+                            hostlen,
+                            DNS_QTYPE_A,
+                            DNS_QCLASS_IN,
+                            callback,
+                            &counters) < 0) ||
+          (wait_for_queries(&resolver) < 0)) {
+        break;
+      }
+    }
+
+    for (i = 0; i < ARRAY_SIZE(modes); i++) {
+      resolver_get_upstream_stats(&resolver, i, &stats[i]);
+    }
+
+    /* All the lookups succeed (the dead server is skipped after a timeout)
+     * and most of them are answered by the fastest server.
+     */
+    if ((counters.success == NUMBER_LOOKUPS) &&
+        (stats[0].responses == 0) &&
+        (stats[0].timeouts > 0) &&
+        (stats[0].requests < NUMBER_LOOKUPS / 10) &&
+        (stats[2].responses > (NUMBER_LOOKUPS * 3) / 4)) {
+      ret = 0;
+    } else {
+      fprintf(stderr,
+              "Unexpected upstream selection (success: %u, requests: "
+              "%llu / %llu / %llu).\n",
+              counters.success,
+              (unsigned long long) stats[0].requests,
+              (unsigned long long) stats[1].requests,
+              (unsigned long long) stats[2].requests);
+    }
+
+    i = ARRAY_SIZE(modes);
+  }
+
+  while (i > 0) {
+    i--;
+
+    kill(pids[i], SIGTERM);
+    waitpid(pids[i], NULL, 0);
+  }
+
+  resolver_destroy(&resolver);
+
+  return ret;
+}
+
+int test_adaptive_timeouts(void)
+{
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  resolver_config_t config;
+  resolver_t resolver;
+  counters_t counters;
+  char host[64];
+  size_t hostlen;
+  uint64_t start;
+  uint64_t elapsed;
+  pid_t pid;
+  unsigned i;
+  int ret;
+
+  if ((pid = start_hosts_server(SERVER_NORMAL, &addr, &addrlen)) == -1) {
+    fprintf(stderr, "Error starting DNS server.\n");
+    return -1;
+  }
+
+  /* The initial timeout is much higher than the round-trip time. */
+  resolver_config_init(&config);
+  config.timeout = INITIAL_TIMEOUT;
+  config.min_timeout = MIN_TIMEOUT;
+
+  if ((resolver_create(&resolver, &config) < 0) ||
+      (resolver_add_upstream(&resolver,
+                             (const struct sockaddr*) &addr,
+                             addrlen) < 0)) {
+    fprintf(stderr, "Error creating resolver.\n");
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    return -1;
+  }
+
+  ret = 0;
+
+  memset(&counters, 0, sizeof(counters_t));
+
+  /* The server drops the first request for the hosts multiple of ten: once
+   * the round-trip time has been measured, the lost requests are
+   * retransmitted well before the initial timeout.
+   */
+  for (i = 1; (ret == 0) && (i <= 100); i++) {
+    hostlen = snprintf(host, sizeof(host), "h%u.test", i);
+
+    start = timer_now();
+
+    if ((resolver_resolve(&resolver,
+                          host,
+                          hostlen,
+                          DNS_QTYPE_A,
+                          DNS_QCLASS_IN,
+                          callback,
+                          &counters) < 0) ||
+        (wait_for_queries(&resolver) < 0)) {
+      ret = -1;
+    } else if ((i > 10) && ((i % 10) == 0)) {
+      if ((elapsed = timer_now() - start) > MAX_LOST_DELAY) {
+        fprintf(stderr,
+                "Lost request for '%s' retransmitted after %llu ms.\n",
+                host,
+                (unsigned long long) elapsed);
+
+        ret = -1;
+      }
+    }
+  }
+
+  if ((ret == 0) && (counters.success != 100)) {
+    fprintf(stderr,
+            "Error resolving hosts (success: %u, timeout: %u).\n",
+            counters.success,
+            counters.timeout);
+
+    ret = -1;
+  }
+
+  resolver_destroy(&resolver);
+
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+
+  return ret;
+}
+
+int test_deadline(void)
+{
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  resolver_config_t config;
+  resolver_t resolver;
+  counters_t counters;
+  uint64_t start;
+  uint64_t elapsed;
+  pid_t pid;
+  int ret;
+
+  if ((pid = start_hosts_server(SERVER_DEAD, &addr, &addrlen)) == -1) {
+    fprintf(stderr, "Error starting DNS server.\n");
+    return -1;
+  }
+
+  /* Many short attempts, the deadline must stop them. */
+  resolver_config_init(&config);
+  config.timeout = MIN_TIMEOUT;
+  config.min_timeout = MIN_TIMEOUT;
+  config.max_timeout = MIN_TIMEOUT;
+  config.deadline = DEADLINE;
+  config.attempts = 1000;
+
+  if ((resolver_create(&resolver, &config) < 0) ||
+      (resolver_add_upstream(&resolver,
+                             (const struct sockaddr*) &addr,
+                             addrlen) < 0)) {
+    fprintf(stderr, "Error creating resolver.\n");
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    return -1;
+  }
+
+  memset(&counters, 0, sizeof(counters_t));
+
+  start = timer_now();
+
+  if ((resolver_resolve(&resolver,
+                        "drop2.test",
+                        10,
+                        DNS_QTYPE_A,
+                        DNS_QCLASS_IN,
+                        callback,
+                        &counters) == 0) &&
+      (wait_for_queries(&resolver) == 0) &&
+      (counters.timeout == 1) &&
+      ((elapsed = timer_now() - start) >= DEADLINE) &&
+      (elapsed < 2 * DEADLINE)) {
+    ret = 0;
+  } else {
+    fprintf(stderr,
+            "Deadline not honored (timeout: %u, elapsed: %llu ms).\n",
+            counters.timeout,
+            (unsigned long long) (timer_now() - start));
+
+    ret = -1;
+  }
+
+  resolver_destroy(&resolver);
+
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+
+  return ret;
+}
+
+int test_hedging(void)
+{
+  static const server_mode_t modes[] = {
+    SERVER_SPIKY_1,
+    SERVER_SPIKY_2
+  };
+
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  resolver_config_t config;
+  resolver_t resolver;
+  resolver_stats_t stats;
+  counters_t counters;
+  pid_t pids[ARRAY_SIZE(modes)];
+  char host[64];
+  size_t hostlen;
+  uint64_t start;
+  uint64_t elapsed;
+  uint64_t max;
+  unsigned i;
+  int ret;
+
+  /* The retransmission timeout is higher than the spikes, only the hedged
+   * requests avoid waiting for the slow responses.
+   */
+  resolver_config_init(&config);
+  config.timeout = 2 * SPIKE_DELAY;
+  config.min_timeout = 2 * SPIKE_DELAY;
+  config.hedge_delay = HEDGE_DELAY;
+
+  if (resolver_create(&resolver, &config) < 0) {
+    fprintf(stderr, "Error creating resolver.\n");
+    return -1;
+  }
+
+  for (i = 0; i < ARRAY_SIZE(modes); i++) {
+    if ((pids[i] = start_hosts_server(modes[i], &addr, &addrlen)) == -1) {
+      fprintf(stderr, "Error starting DNS server.\n");
+      break;
+    }
+
+    if (resolver_add_upstream(&resolver,
+                              (const struct sockaddr*) &addr,
+                              addrlen) != (int) i) {
+      fprintf(stderr, "Error adding upstream server.\n");
+
+      kill(pids[i], SIGTERM);
+      waitpid(pids[i], NULL, 0);
+
+      break;
+    }
+  }
+
+  ret = -1;
+
+  if (i == ARRAY_SIZE(modes)) {
+    memset(&counters, 0, sizeof(counters_t));
+    max = 0;
+
+    for (i = 0; i < NUMBER_LOOKUPS; i++) {
+      hostlen = snprintf(host, sizeof(host), "h%u.test", FIRST_HOST + i);
+
+      start = timer_now();
+
+      if ((resolver_resolve(&resolver,
+                            host,
+                            hostlen,
+                            DNS_QTYPE_A,
+                            DNS_QCLASS_IN,
+                            callback,
+                            &counters) < 0) ||
+          (wait_for_queries(&resolver) < 0)) {
+        break;
+      }
+
+      if ((elapsed = timer_now() - start) > max) {
+        max = elapsed;
+      }
+    }
+
+    resolver_get_stats(&resolver, &stats);
+
+    if ((counters.success == NUMBER_LOOKUPS) &&
+        (max < MAX_HEDGED_TIME) &&
+        (stats.hedges > 0) &&
+        (stats.hedge_wins > 0)) {
+      ret = 0;
+    } else {
+      fprintf(stderr,
+              "Unexpected hedging results (success: %u, max. time: %llu ms, "
+              "hedges: %llu, wins: %llu).\n",
+              counters.success,
+              (unsigned long long) max,
+              (unsigned long long) stats.hedges,
+              (unsigned long long) stats.hedge_wins);
+    }
+
+    i = ARRAY_SIZE(modes);
+  }
+
+  while (i > 0) {
+    i--;
+
+    kill(pids[i], SIGTERM);
+    waitpid(pids[i], NULL, 0);
+  }
+
+  resolver_destroy(&resolver);
+
+  return ret;
+}
+
+int test_happy_eyeballs(void)
+{
+  static const char* const hosts[] = {"local.test", "noaaaa.test"};
+
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  resolver_config_t config;
+  resolver_t resolver;
+  uint64_t start;
+  uint64_t elapsed;
+  in_port_t port;
+  pid_t pid;
+  unsigned i;
+  int listener;
+  int fd;
+  int ret;
+
+  /* TCP server listening only on the IPv4 loopback address. */
+  if ((build_ip_address("127.0.0.1", 0, &addr, &addrlen) < 0) ||
+      ((listener = socket_listen((const struct sockaddr*) &addr,
+                                 addrlen)) == -1)) {
+    fprintf(stderr, "Error creating listener.\n");
+    return -1;
+  }
+
+  if (getsockname(listener, (struct sockaddr*) &addr, &addrlen) < 0) {
+    close(listener);
+    return -1;
+  }
+
+  port = ntohs(((const struct sockaddr_in*) &addr)->sin_port);
+
+  if ((pid = start_hosts_server(SERVER_NORMAL, &addr, &addrlen)) == -1) {
+    fprintf(stderr, "Error starting DNS server.\n");
+
+    close(listener);
+    return -1;
+  }
+
+  resolver_config_init(&config);
+  config.deadline = MAX_CONNECT_TIME;
+
+  if ((resolver_create(&resolver, &config) < 0) ||
+      (resolver_add_upstream(&resolver,
+                             (const struct sockaddr*) &addr,
+                             addrlen) < 0)) {
+    fprintf(stderr, "Error creating resolver.\n");
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    close(listener);
+
+    return -1;
+  }
+
+  ret = 0;
+
+  /* The connection to ::1 is refused, the connection to 127.0.0.1 succeeds
+   * (for 'noaaaa.test' after the resolution delay).
+   */
+  for (i = 0; (ret == 0) && (i < ARRAY_SIZE(hosts)); i++) {
+    start = timer_now();
+
+    fd = happy_eyeballs_connect(&resolver,
+                                hosts[i],
+                                strlen(hosts[i]),
+                                port,
+                                CONNECT_TIMEOUT);
+
+    elapsed = timer_now() - start;
+
+    addrlen = sizeof(struct sockaddr_storage);
+
+    if ((fd == -1) ||
+        (getpeername(fd, (struct sockaddr*) &addr, &addrlen) < 0) ||
+        (addr.ss_family != AF_INET) ||
+        (elapsed >= MAX_CONNECT_TIME)) {
+      fprintf(stderr,
+              "Error connecting to '%s' (elapsed: %llu ms).\n",
+              hosts[i],
+              (unsigned long long) elapsed);
+
+      ret = -1;
+    }
+
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+
+  /* Non-existent domain. */
+  if ((ret == 0) &&
+      (happy_eyeballs_connect(&resolver,
+                              "nx1.test",
+                              8,
+                              port,
+                              CONNECT_TIMEOUT) != -1)) {
+    fprintf(stderr, "Connected to a non-existent domain.\n");
+    ret = -1;
+  }
+
+  /* The AAAA query for 'noaaaa.test' is still in flight (its callback must
+   * not be invoked).
+   */
+  if ((ret == 0) && (wait_for_queries(&resolver) < 0)) {
+    ret = -1;
+  }
+
+  resolver_destroy(&resolver);
+
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+
+  close(listener);
+
+  return ret;
+}
+
+int test_socket_pool(int connected, int cpu_affinity)
+{
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  resolver_config_t config;
+  resolver_t resolver;
+  const upstream_t* upstream;
+  counters_t counters;
+  in_port_t ports[NUMBER_SOCKETS];
+  char host[64];
+  size_t hostlen;
+  pid_t pid;
+  unsigned nports;
+  unsigned i;
+  unsigned j;
+  int ret;
+
+  if ((pid = start_hosts_server(SERVER_NORMAL, &addr, &addrlen)) == -1) {
+    fprintf(stderr, "Error starting DNS server.\n");
+    return -1;
+  }
+
+  resolver_config_init(&config);
+  config.max_queries = MAX_QUERIES;
+  config.buffer_size = BUFFER_SIZE;
+  config.sockets = NUMBER_SOCKETS;
+  config.connected = connected;
+  config.cpu_affinity = cpu_affinity;
+
+  if ((resolver_create(&resolver, &config) < 0) ||
+      (resolver_add_upstream(&resolver,
+                             (const struct sockaddr*) &addr,
+                             addrlen) < 0)) {
+    fprintf(stderr, "Error creating resolver.\n");
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    return -1;
+  }
+
+  ret = -1;
+
+  do {
+    /* Source ports of the sockets: all different, or all the same one if
+     * the sockets are bound to CPUs.
+     */
+    upstream = &resolver.upstreams.servers[0];
+    nports = 0;
+
+    for (i = 0; i < upstream->nfds; i++) {
+      addrlen = sizeof(struct sockaddr_storage);
+
+      if (getsockname(upstream->fds[i], (struct sockaddr*) &addr, &addrlen) <
+          0) {
+        break;
+      }
+
+      ports[i] = ((const struct sockaddr_in*) &addr)->sin_port;
+
+      for (j = 0; (j < i) && (ports[j] != ports[i]); j++);
+
+      if (j == i) {
+        nports++;
+      }
+    }
+
+    if ((upstream->nfds != NUMBER_SOCKETS) ||
+        (nports != (cpu_affinity ? 1 : NUMBER_SOCKETS))) {
+      fprintf(stderr,
+              "Unexpected socket pool (sockets: %u, ports: %u).\n",
+              upstream->nfds,
+              nports);
+
+      break;
+    }
+
+    memset(&counters, 0, sizeof(counters_t));
+
+    for (i = 0; i < POOL_QUERIES; i++) {
+      hostlen = snprintf(host, sizeof(host), "h%u.test", POOL_FIRST_HOST + i);
+
+      if (resolver_resolve(&resolver,
+                           host,
+                           hostlen,
+                           DNS_QTYPE_A,
+                           DNS_QCLASS_IN,
+                           callback,
+                           &counters) < 0) {
+        break;
+      }
+    }
+
+    if ((wait_for_queries(&resolver) < 0) ||
+        (counters.success != POOL_QUERIES)) {
+      fprintf(stderr,
+              "Error resolving hosts through the socket pool (success: %u, "
+              "timeout: %u).\n",
+              counters.success,
+              counters.timeout);
+
+      break;
+    }
+
+    ret = 0;
+  } while (0);
+
+  resolver_destroy(&resolver);
+
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+
+  return ret;
+}
+
+int test_iterative(void)
+{
+  static const char* const ips[NUMBER_AUTHORITATIVES] = {
+    "127.0.0.1", "127.0.0.2", "127.0.0.3"
+  };
+
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  resolver_config_t config;
+  resolver_t resolver;
+  resolver_stats_t stats;
+  zone_t zones[4];
+  pid_t pids[NUMBER_AUTHORITATIVES];
+  answer_t answer;
+  in_port_t port;
+  unsigned nservers;
+  unsigned i;
+  int ret;
+
+  /* Root zone: delegation of "test". */
+  if (load_test_zone(&zones[0],
+                     ".",
+                     "$TTL 3600\n"
+                     "@ SOA ns.root. hostmaster.root. 1 7200 3600 1209600 "
+                     "300\n"
+                     "  NS ns.root.\n"
+                     "ns.root. A 127.0.0.1\n"
+                     "test. NS ns.test.\n"
+                     "ns.test. A 127.0.0.2\n") < 0) {
+    return -1;
+  }
+
+  /* "test": delegation of "example.test" (with glue), of "other.test"
+   * (the nameserver is in "example.test", no glue) and of "loop.test" (the
+   * nameserver is in "loop.test" itself, no glue).
+   */
+  if (load_test_zone(&zones[1],
+                     "test",
+                     "$TTL 3600\n"
+                     "@ SOA ns hostmaster 1 7200 3600 1209600 300\n"
+                     "  NS ns\n"
+                     "ns A 127.0.0.2\n"
+                     "example NS ns.example\n"
+                     "ns.example A 127.0.0.3\n"
+                     "other NS ns2.example.test.\n"
+                     "loop NS ns.loop.test.\n") < 0) {
+    zone_destroy(&zones[0]);
+    return -1;
+  }
+
+  if (load_test_zone(&zones[2],
+                     "example.test",
+                     "$TTL 3600\n"
+                     "@ SOA ns hostmaster 1 7200 3600 1209600 300\n"
+                     "  NS ns\n"
+                     "ns A 127.0.0.3\n"
+                     "ns2 A 127.0.0.3\n"
+                     "www A 10.0.0.1\n"
+                     "mail A 10.0.0.2\n"
+                     "alias CNAME www.other.test.\n"
+                     "chain CNAME alias\n") < 0) {
+    zone_destroy(&zones[1]);
+    zone_destroy(&zones[0]);
+
+    return -1;
+  }
+
+  if (load_test_zone(&zones[3],
+                     "other.test",
+                     "$TTL 3600\n"
+                     "@ SOA ns2.example.test. hostmaster 1 7200 3600 1209600 "
+                     "300\n"
+                     "  NS ns2.example.test.\n"
+                     "www A 10.0.0.3\n") < 0) {
+    zone_destroy(&zones[2]);
+    zone_destroy(&zones[1]);
+    zone_destroy(&zones[0]);
+
+    return -1;
+  }
+
+  /* The servers listen on the same port of different loopback addresses
+   * (the port of the first one).
+   */
+  port = 0;
+
+  for (nservers = 0; nservers < NUMBER_AUTHORITATIVES; nservers++) {
+    if ((pids[nservers] = start_authoritative(ips[nservers],
+                                              &port,
+                                              &zones[nservers],
+                                              (nservers < 2) ? 1 : 2)) ==
+        -1) {
+      break;
+    }
+  }
+
+  /* The servers have their own copy of the zones. */
+  for (i = 0; i < ARRAY_SIZE(zones); i++) {
+    zone_destroy(&zones[i]);
+  }
+
+  if (nservers < NUMBER_AUTHORITATIVES) {
+    fprintf(stderr, "Error starting authoritative servers.\n");
+
+    for (i = 0; i < nservers; i++) {
+      kill(pids[i], SIGTERM);
+      waitpid(pids[i], NULL, 0);
+    }
+
+    return -1;
+  }
+
+  resolver_config_init(&config);
+  config.timeout = QUERY_TIMEOUT;
+  config.iterative = 1;
+  config.nameserver_port = port;
+
+  /* Root hint. */
+  build_ip_address(ips[0], port, &addr, &addrlen);
+
+  if ((resolver_create(&resolver, &config) < 0) ||
+      (resolver_add_upstream(&resolver,
+                             (const struct sockaddr*) &addr,
+                             addrlen) < 0)) {
+    fprintf(stderr, "Error creating iterative resolver.\n");
+
+    for (i = 0; i < nservers; i++) {
+      kill(pids[i], SIGTERM);
+      waitpid(pids[i], NULL, 0);
+    }
+
+    return -1;
+  }
+
+  ret = -1;
+
+  do {
+    /* From the root: two referrals. */
+    if ((resolve_iteratively(&resolver, "www.example.test", &answer) < 0) ||
+        (answer.status != RESOLVER_SUCCESS) ||
+        (answer.addr != 0x0a000001)) {
+      fprintf(stderr,
+              "Error resolving 'www.example.test' iteratively (%s).\n",
+              resolver_status_to_string(answer.status));
+
+      break;
+    }
+
+    resolver_get_stats(&resolver, &stats);
+
+    if (stats.referrals != 2) {
+      fprintf(stderr,
+              "Unexpected number of referrals: %llu.\n",
+              (unsigned long long) stats.referrals);
+
+      break;
+    }
+
+    /* The delegation of "example.test" is in the cache. */
+    if ((resolve_iteratively(&resolver, "mail.example.test", &answer) < 0) ||
+        (answer.status != RESOLVER_SUCCESS) ||
+        (answer.addr != 0x0a000002) ||
+        (resolve_iteratively(&resolver, "nx.example.test", &answer) < 0) ||
+        (answer.status != RESOLVER_NXDOMAIN)) {
+      fprintf(stderr, "Error resolving names of 'example.test'.\n");
+      break;
+    }
+
+    resolver_get_stats(&resolver, &stats);
+
+    if (stats.referrals != 2) {
+      fprintf(stderr, "The delegation of 'example.test' was not cached.\n");
+      break;
+    }
+
+    /* No glue: the address of the nameserver is resolved first (starting
+     * from the cached delegation of "example.test").
+     */
+    if ((resolve_iteratively(&resolver, "www.other.test", &answer) < 0) ||
+        (answer.status != RESOLVER_SUCCESS) ||
+        (answer.addr != 0x0a000003)) {
+      fprintf(stderr,
+              "Error resolving 'www.other.test' iteratively (%s).\n",
+              resolver_status_to_string(answer.status));
+
+      break;
+    }
+
+    resolver_get_stats(&resolver, &stats);
+
+    if ((stats.referrals != 3) || (stats.nameserver_lookups != 1)) {
+      fprintf(stderr,
+              "Unexpected referrals / nameserver lookups: %llu / %llu.\n",
+              (unsigned long long) stats.referrals,
+              (unsigned long long) stats.nameserver_lookups);
+
+      break;
+    }
+
+    /* The delegation of "other.test" is in the cache. */
+    if ((resolve_iteratively(&resolver, "www.other.test", &answer) < 0) ||
+        (answer.status != RESOLVER_SUCCESS)) {
+      fprintf(stderr, "Error resolving 'www.other.test' again.\n");
+      break;
+    }
+
+    resolver_get_stats(&resolver, &stats);
+
+    if ((stats.referrals != 3) || (stats.nameserver_lookups != 1)) {
+      fprintf(stderr, "The delegation of 'other.test' was not cached.\n");
+      break;
+    }
+
+    /* The CNAME chain leaves the zone: the query is restarted with
+     * "www.other.test" and the response has the whole chain.
+     */
+    if ((resolve_iteratively(&resolver, "chain.example.test", &answer) < 0) ||
+        (answer.status != RESOLVER_SUCCESS) ||
+        (answer.addr != 0x0a000003) ||
+        (answer.nanswers != 3) ||
+        (answer.ancount != 3)) {
+      fprintf(stderr,
+              "Error resolving 'chain.example.test' iteratively (%s).\n",
+              resolver_status_to_string(answer.status));
+
+      break;
+    }
+
+    resolver_get_stats(&resolver, &stats);
+
+    if (stats.cnames != 1) {
+      fprintf(stderr,
+              "Unexpected number of CNAME records followed: %llu.\n",
+              (unsigned long long) stats.cnames);
+
+      break;
+    }
+
+    /* The address of the nameserver can only be found by asking it: the
+     * lookups fail instead of waiting for themselves.
+     */
+    if ((resolve_iteratively(&resolver, "www.loop.test", &answer) < 0) ||
+        (answer.status != RESOLVER_SERVFAIL) ||
+        (resolve_iteratively(&resolver, "ns.loop.test", &answer) < 0) ||
+        (answer.status != RESOLVER_SERVFAIL)) {
+      fprintf(stderr,
+              "Unexpected result of the lookups in 'loop.test' (%s).\n",
+              resolver_status_to_string(answer.status));
+
+      break;
+    }
+
+    ret = 0;
+  } while (0);
+
+  resolver_destroy(&resolver);
+
+  for (i = 0; i < nservers; i++) {
+    kill(pids[i], SIGTERM);
+    waitpid(pids[i], NULL, 0);
+  }
+
+  return ret;
+}
+
+int load_test_zone(zone_t* zone, const char* origin, const char* data)
+{
+  char filename[] = "/tmp/testresolver.XXXXXX";
+  FILE* file;
+  int ret;
+  int fd;
+
+  if ((fd = mkstemp(filename)) == -1) {
+    return -1;
+  }
+
+  if ((file = fdopen(fd, "w")) == NULL) {
+    close(fd);
+    unlink(filename);
+
+    return -1;
+  }
+
+  fputs(data, file);
+  fclose(file);
+
+  if ((ret = zone_load(zone, filename, origin, 1)) < 0) {
+    fprintf(stderr, "Error loading zone '%s' (line %u).\n", origin, zone->line);
+  }
+
+  unlink(filename);
+
+  return ret;
+}
+
+pid_t start_authoritative(const char* ip,
+                          in_port_t* port,
+                          const zone_t* zones,
+                          unsigned nzones)
+{
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  authoritative_t authoritative;
+  pid_t pid;
+
+  authoritative.zones = zones;
+  authoritative.nzones = nzones;
+
+  /* If the port is 0, the kernel chooses it. */
+  if ((build_ip_address(ip, *port, &addr, &addrlen) < 0) ||
+      ((pid = start_server(answer_authoritative,
+                           &authoritative,
+                           0,
+                           &addr,
+                           &addrlen)) == -1)) {
+    return -1;
+  }
+
+  *port = ntohs(((const struct sockaddr_in*) &addr)->sin_port);
+
+  return pid;
+}
+
+size_t answer_authoritative(const void* data,
+                            const uint8_t* query,
+                            size_t len,
+                            int tcp,
+                            uint8_t* response,
+                            unsigned* delay)
+{
+  const authoritative_t* authoritative;
+  dns_query_t parsed;
+  unsigned i;
+
+  authoritative = (const authoritative_t*) data;
+
+  if (dns_parse_query(query, len, &parsed) != DNS_RCODE_NOERROR) {
+    return 0;
+  }
+
+  /* The first zone the name belongs to answers. */
+  for (i = 0; i < authoritative->nzones; i++) {
+    if (zone_answer(&authoritative->zones[i],
+                    &parsed,
+                    query,
+                    response,
+                    tcp ? MAX_DNS_TCP_MESSAGE_SIZE : MAX_DNS_MESSAGE_SIZE,
+                    &len) == 0) {
+      return len;
+    }
+  }
+
+  return 0;
+}
+
+int resolve_iteratively(resolver_t* resolver,
+                        const char* name,
+                        answer_t* answer)
+{
+  answer->status = RESOLVER_ERROR;
+  answer->addr = 0;
+  answer->nanswers = 0;
+  answer->ancount = 0;
+
+  if (resolver_resolve(resolver,
+                       name,
+                       strlen(name),
+                       DNS_QTYPE_A,
+                       DNS_QCLASS_IN,
+                       answer_callback,
+                       answer) < 0) {
+    return -1;
+  }
+
+  return wait_for_queries(resolver);
+}
+
+void answer_callback(const resolver_result_t* result, void* data)
+{
+  const uint8_t* response;
+  answer_t* answer;
+  size_t i;
+
+  answer = (answer_t*) data;
+  answer->status = result->status;
+  answer->nanswers = result->nanswers;
+
+  if ((result->response) && (result->responselen >= 12)) {
+    response = (const uint8_t*) result->response;
+    answer->ancount = (response[6] << 8) | response[7];
+  }
+
+  for (i = 0; i < result->nanswers; i++) {
+    if (result->answers[i].type == DNS_QTYPE_A) {
+      answer->addr = ntohl(result->answers[i].addr4.s_addr);
+      break;
+    }
+  }
+}
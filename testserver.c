@@ -0,0 +1,305 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include "dns.h"
+#include "socket.h"
+#include "testserver.h"
+
+/* Receive buffer of the UDP sockets. */
+#define RECEIVE_BUFFER_SIZE (4 * 1024 * 1024)
+
+static void run_server(int udp,
+                       int tcp,
+                       server_handler_t handler,
+                       const void* data);
+
+static size_t answer_host(const void* data,
+                          const uint8_t* query,
+                          size_t len,
+                          int tcp,
+                          uint8_t* response,
+                          unsigned* delay);
+
+static size_t build_response(const uint8_t* query,
+                             size_t len,
+                             int nxdomain,
+                             dns_qtype_t qtype,
+                             const void* rdata,
+                             size_t rdlength,
+                             uint8_t* response);
+
+pid_t start_server(server_handler_t handler,
+                   const void* data,
+                   int tcp,
+                   struct sockaddr_storage* addr,
+                   socklen_t* addrlen)
+{
+  pid_t pid;
+  int size;
+  int udp;
+  int fd;
+
+  /* If the port is 0, the kernel chooses it. */
+  if ((udp = socket(addr->ss_family, SOCK_DGRAM, 0)) != -1) {
+    /* All the requests arrive at once. */
+    size = RECEIVE_BUFFER_SIZE;
+    setsockopt(udp, SOL_SOCKET, SO_RCVBUF, &size, sizeof(int));
+
+    if ((bind(udp, (const struct sockaddr*) addr, *addrlen) == 0) &&
+        (getsockname(udp, (struct sockaddr*) addr, addrlen) == 0)) {
+      fd = -1;
+
+      /* TCP on the same port. */
+      if ((!tcp) ||
+          (((fd = socket(addr->ss_family, SOCK_STREAM, 0)) != -1) &&
+           (bind(fd, (const struct sockaddr*) addr, *addrlen) == 0) &&
+           (listen(fd, SOMAXCONN) == 0))) {
+        switch (pid = fork()) {
+          case -1:
+            break;
+          case 0:
+            run_server(udp, fd, handler, data);
+            _exit(0);
+          default:
+            if (fd != -1) {
+              close(fd);
+            }
+
+            close(udp);
+            return pid;
+        }
+      }
+
+      if (fd != -1) {
+        close(fd);
+      }
+    }
+
+    close(udp);
+  }
+
+  return -1;
+}
+
+void run_server(int udp, int tcp, server_handler_t handler, const void* data)
+{
+  static uint8_t response[2 + MAX_DNS_TCP_MESSAGE_SIZE];
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  struct pollfd pfds[2];
+  uint8_t query[2 + MAX_DNS_MESSAGE_SIZE];
+  unsigned delay;
+  ssize_t len;
+  int fd;
+
+  /* Don't leave zombies behind. */
+  signal(SIGCHLD, SIG_IGN);
+
+  pfds[0].fd = udp;
+  pfds[0].events = POLLIN;
+
+  pfds[1].fd = tcp;
+  pfds[1].events = POLLIN;
+
+  do {
+    if (poll(pfds, (tcp != -1) ? 2 : 1, -1) <= 0) {
+      continue;
+    }
+
+    if (pfds[0].revents & POLLIN) {
+      addrlen = sizeof(struct sockaddr_storage);
+      delay = 0;
+
+      if (((len = recvfrom(udp,
+                           query,
+                           MAX_DNS_MESSAGE_SIZE,
+                           0,
+                           (struct sockaddr*) &addr,
+                           &addrlen)) >= 12) &&
+          ((len = handler(data, query, len, 0, response, &delay)) > 0)) {
+        if (delay == 0) {
+          sendto(udp,
+                 response,
+                 len,
+                 0,
+                 (const struct sockaddr*) &addr,
+                 addrlen);
+        } else if (fork() == 0) {
+          usleep(delay * 1000);
+
+          sendto(udp,
+                 response,
+                 len,
+                 0,
+                 (const struct sockaddr*) &addr,
+                 addrlen);
+
+          _exit(0);
+        }
+      }
+    }
+
+    /* TCP: a query per connection. */
+    if ((tcp != -1) &&
+        (pfds[1].revents & POLLIN) &&
+        ((fd = accept(tcp, NULL, NULL)) != -1)) {
+      if ((recv(fd, query, 2, MSG_WAITALL) == 2) &&
+          ((len = (query[0] << 8) | query[1]) >= 12) &&
+          (len <= MAX_DNS_MESSAGE_SIZE) &&
+          (recv(fd, query + 2, len, MSG_WAITALL) == len) &&
+          ((len = handler(data,
+                          query + 2,
+                          len,
+                          1,
+                          response + 2,
+                          &delay)) > 0)) {
+        response[0] = (len >> 8) & 0xff;
+        response[1] = len & 0xff;
+
+        send(fd, response, 2 + len, 0);
+      }
+
+      close(fd);
+    }
+  } while (1);
+}
+
+pid_t start_hosts_server(server_mode_t mode,
+                         struct sockaddr_storage* addr,
+                         socklen_t* addrlen)
+{
+  /* Ephemeral port of the loopback interface. */
+  if (build_ip_address("127.0.0.1", 0, addr, addrlen) < 0) {
+    return -1;
+  }
+
+  return start_server(answer_host, &mode, 0, addr, addrlen);
+}
+
+size_t answer_host(const void* data,
+                   const uint8_t* query,
+                   size_t len,
+                   int tcp,
+                   uint8_t* response,
+                   unsigned* delay)
+{
+  static uint8_t seen[SERVER_LOSSY_HOSTS];
+  server_mode_t mode;
+  dns_header_t header;
+  dns_question_t question;
+  uint8_t rdata[16];
+  unsigned n;
+
+  mode = *((const server_mode_t*) data);
+
+  if ((mode == SERVER_DEAD) ||
+      (dns_process_header(query, len, &header, &question) < 0)) {
+    return 0;
+  }
+
+  if (sscanf(question.name, "h%u.test", &n) == 1) {
+    /* Drop the first request for one host out of ten. */
+    if ((n < SERVER_LOSSY_HOSTS) && ((n % 10) == 0) && (!seen[n])) {
+      seen[n] = 1;
+      return 0;
+    }
+
+    /* 10.x.y.z */
+    rdata[0] = 10;
+    rdata[1] = (n >> 16) & 0xff;
+    rdata[2] = (n >> 8) & 0xff;
+    rdata[3] = n & 0xff;
+
+    len = build_response(query, len, 0, DNS_QTYPE_A, rdata, 4, response);
+  } else if (sscanf(question.name, "nx%u.test", &n) == 1) {
+    len = build_response(query, len, 1, 0, NULL, 0, response);
+  } else if ((strcmp(question.name, "local.test") == 0) ||
+             (strcmp(question.name, "noaaaa.test") == 0)) {
+    /* Loopback addresses (no answer to the AAAA query for
+     * 'noaaaa.test').
+     */
+    n = 0;
+
+    if (question.qtype == DNS_QTYPE_A) {
+      inet_pton(AF_INET, "127.0.0.1", rdata);
+      len = build_response(query, len, 0, DNS_QTYPE_A, rdata, 4, response);
+    } else if ((question.qtype == DNS_QTYPE_AAAA) &&
+               (question.name[0] == 'l')) {
+      inet_pton(AF_INET6, "::1", rdata);
+      len = build_response(query,
+                           len,
+                           0,
+                           DNS_QTYPE_AAAA,
+                           rdata,
+                           16,
+                           response);
+    } else {
+      return 0;
+    }
+  } else {
+    return 0;
+  }
+
+  switch (mode) {
+    case SERVER_SLOW:
+      usleep(SLOW_DELAY * 1000);
+      break;
+    case SERVER_SPIKY_1:
+    case SERVER_SPIKY_2:
+      /* The following requests are not delayed. */
+      if ((n % 10) == ((mode == SERVER_SPIKY_1) ? 1 : 2)) {
+        *delay = SPIKE_DELAY;
+      }
+
+      break;
+    default:
+      break;
+  }
+
+  return len;
+}
+
+size_t build_response(const uint8_t* query,
+                      size_t len,
+                      int nxdomain,
+                      dns_qtype_t qtype,
+                      const void* rdata,
+                      size_t rdlength,
+                      uint8_t* response)
+{
+  uint8_t* p;
+
+  memcpy(response, query, len);
+
+  /* Response, recursion desired and available. */
+  response[2] = 0x81;
+  response[3] = nxdomain ? 0x83 : 0x80;
+
+  if (nxdomain) {
+    return len;
+  }
+
+  /* ANCOUNT = 1. */
+  response[7] = 1;
+
+  p = response + len;
+
+  /* Pointer to the name of the question. */
+  *p++ = 0xc0;
+  *p++ = 12;
+
+  /* TYPE, CLASS IN, TTL 60, RDLENGTH. */
+  *p++ = 0; *p++ = qtype;
+  *p++ = 0; *p++ = DNS_QCLASS_IN;
+  *p++ = 0; *p++ = 0; *p++ = 0; *p++ = 60;
+  *p++ = 0; *p++ = rdlength;
+
+  memcpy(p, rdata, rdlength);
+
+  return (p + rdlength) - response;
+}
@@ -0,0 +1,63 @@
+#ifndef TESTSERVER_H
+#define TESTSERVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/* DNS servers of the tests: each one runs in a child process (stopped with
+ * kill() and waitpid()).
+ */
+
+/* The first request for one host out of ten is dropped
+ * (h<n>.test, n < SERVER_LOSSY_HOSTS).
+ */
+#define SERVER_LOSSY_HOSTS (10 * 1000)
+
+#define SLOW_DELAY      20 /* [ms] */
+#define SPIKE_DELAY     200 /* [ms] */
+
+typedef enum {
+  SERVER_NORMAL,
+  SERVER_SLOW, /* Answers after SLOW_DELAY milliseconds. */
+  SERVER_DEAD, /* Never answers. */
+
+  /* Answers the hosts whose number ends in 1 (2) after SPIKE_DELAY
+   * milliseconds.
+   */
+  SERVER_SPIKY_1,
+  SERVER_SPIKY_2
+} server_mode_t;
+
+/* Builds the response to a query received by a test server (over TCP if
+ * 'tcp' is set) and returns its length, 0 to drop the query. If 'delay' is
+ * set [ms], the response is sent by another process after the delay,
+ * without delaying the next queries.
+ */
+typedef size_t (*server_handler_t)(const void* data,
+                                   const uint8_t* query,
+                                   size_t len,
+                                   int tcp,
+                                   uint8_t* response,
+                                   unsigned* delay);
+
+/* Starts a server on 'addr' (if the port is 0, the kernel chooses it and
+ * 'addr' is updated), also on TCP if 'tcp' is set. 'data' is passed to
+ * the handler (the server has its own copy of the memory).
+ */
+pid_t start_server(server_handler_t handler,
+                   const void* data,
+                   int tcp,
+                   struct sockaddr_storage* addr,
+                   socklen_t* addrlen);
+
+/* Starts a server answering the hosts h<n>.test (10.x.y.z), nx<n>.test
+ * (NXDOMAIN), local.test and noaaaa.test (loopback addresses) on an
+ * ephemeral port of the loopback interface.
+ */
+pid_t start_hosts_server(server_mode_t mode,
+                         struct sockaddr_storage* addr,
+                         socklen_t* addrlen);
+
+#endif /* TESTSERVER_H */
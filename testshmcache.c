@@ -0,0 +1,323 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include "shmcache.h"
+
+#define NUMBER_BUCKETS     127
+#define NUMBER_ENTRIES     (32 * 1000)
+#define NUMBER_IPS         (5 * 1000)
+#define NUMBER_WORKERS     4
+#define NUMBER_REPETITIONS 3
+
+static int add_hosts(shmcaches_t* caches,
+                     unsigned worker,
+                     unsigned nworkers,
+                     time_t now);
+
+static int check_hosts(shmcaches_t* caches, time_t now);
+static int check_no_hosts(shmcaches_t* caches, time_t now);
+static int run_workers(shmcaches_t* caches, time_t now, int check);
+static int test_eviction(void);
+static int test_attach(void);
+
+int main()
+{
+  shmcaches_t caches;
+  unsigned i;
+
+  /* Create caches. */
+  if (shmcaches_create(&caches, NULL, NUMBER_BUCKETS, NUMBER_ENTRIES) < 0) {
+    fprintf(stderr, "Error creating caches.\n");
+    return -1;
+  }
+
+  for (i = 0; i < NUMBER_REPETITIONS; i++) {
+    /* Each worker adds its share of the hosts. */
+    if (run_workers(&caches, 0, 0) < 0) {
+      shmcaches_detach(&caches);
+      return -1;
+    }
+
+    /* The parent sees the hosts added by all the workers. */
+    if (check_hosts(&caches, 1) < 0) {
+      shmcaches_detach(&caches);
+      return -1;
+    }
+
+    /* Each worker adds its share again and checks all the hosts. */
+    if (run_workers(&caches, 0, 1) < 0) {
+      shmcaches_detach(&caches);
+      return -1;
+    }
+
+    shmcaches_remove_expired(&caches, 1);
+
+    if (check_hosts(&caches, 1) < 0) {
+      shmcaches_detach(&caches);
+      return -1;
+    }
+
+    /* All the entries have expired. */
+    if (check_no_hosts(&caches, 2) < 0) {
+      shmcaches_detach(&caches);
+      return -1;
+    }
+
+    shmcaches_remove_expired(&caches, 2);
+  }
+
+  shmcaches_detach(&caches);
+
+  if ((test_eviction() < 0) || (test_attach() < 0)) {
+    return -1;
+  }
+
+  return 0;
+}
+
+int add_hosts(shmcaches_t* caches,
+              unsigned worker,
+              unsigned nworkers,
+              time_t now)
+{
+  struct in_addr addr;
+  struct in6_addr addr6;
+  char host[256];
+  size_t hostlen;
+  unsigned j;
+
+  /* Add to DNS cache. */
+  for (j = worker; j < NUMBER_IPS; j += nworkers) {
+    hostlen = snprintf(host, sizeof(host), "www.%06u.net", j);
+    addr.s_addr = j + 1;
+
+    memset(&addr6, 0, sizeof(struct in6_addr));
+    memcpy(&addr6, &j, sizeof(unsigned));
+
+    if ((shmcaches_add_ipv4(caches, host, hostlen, &addr, now + 1, now) < 0) ||
+        (shmcaches_add_ipv6(caches, host, hostlen, &addr6, now + 1, now) < 0)) {
+      fprintf(stderr, "Error adding '%s' to DNS cache.\n", host);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int check_hosts(shmcaches_t* caches, time_t now)
+{
+  struct in_addr addr;
+  struct in6_addr addr6;
+  char host[256];
+  size_t hostlen;
+  unsigned j;
+
+  /* Search. */
+  for (j = 0; j < NUMBER_IPS; j++) {
+    hostlen = snprintf(host, sizeof(host), "www.%06u.net", j);
+
+    if ((shmcaches_get_ipv4(caches, host, hostlen, now, &addr) < 0) ||
+        (shmcaches_get_ipv6(caches, host, hostlen, now, &addr6) < 0)) {
+      fprintf(stderr, "Error getting '%s' from DNS cache.\n", host);
+      return -1;
+    }
+
+    if ((addr.s_addr != j + 1) || (memcmp(&addr6, &j, sizeof(unsigned)) != 0)) {
+      fprintf(stderr,
+              "IP addresses for host '%s' don't match (found: %u, "
+              "expected: %u).\n",
+              host,
+              addr.s_addr,
+              j + 1);
+
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int check_no_hosts(shmcaches_t* caches, time_t now)
+{
+  struct in_addr addr;
+  char host[256];
+  size_t hostlen;
+  unsigned j;
+
+  /* Search. */
+  for (j = NUMBER_IPS; j > 0; j--) {
+    hostlen = snprintf(host, sizeof(host), "www.%06u.net", j - 1);
+
+    if (shmcaches_get_ipv4(caches, host, hostlen, now, &addr) == 0) {
+      fprintf(stderr,
+              "Found IP address for host '%s' when not expected.\n",
+              host);
+
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int run_workers(shmcaches_t* caches, time_t now, int check)
+{
+  pid_t pids[NUMBER_WORKERS];
+  int status;
+  int ret;
+  unsigned i;
+
+  for (i = 0; i < NUMBER_WORKERS; i++) {
+    switch (pids[i] = fork()) {
+      case -1:
+        fprintf(stderr, "Error creating worker.\n");
+        return -1;
+      case 0:
+        if (add_hosts(caches, i, NUMBER_WORKERS, now) < 0) {
+          _exit(1);
+        }
+
+        if (check) {
+          /* Wait for the other workers to add their hosts. */
+          do {
+            usleep(10 * 1000);
+          } while (check_hosts(caches, now + 1) < 0);
+        }
+
+        _exit(0);
+    }
+  }
+
+  ret = 0;
+
+  for (i = 0; i < NUMBER_WORKERS; i++) {
+    if ((waitpid(pids[i], &status, 0) != pids[i]) ||
+        (!WIFEXITED(status)) ||
+        (WEXITSTATUS(status) != 0)) {
+      fprintf(stderr, "Worker %u failed.\n", i);
+      ret = -1;
+    }
+  }
+
+  return ret;
+}
+
+int test_eviction(void)
+{
+  shmcaches_t caches;
+  struct in_addr addr;
+  char host[256];
+  size_t hostlen;
+  cache_stats_t stats;
+
+  /* Create a cache with room for less entries than hosts. */
+  if (shmcaches_create(&caches, NULL, NUMBER_BUCKETS, NUMBER_IPS / 2) < 0) {
+    fprintf(stderr, "Error creating caches.\n");
+    return -1;
+  }
+
+  if (add_hosts(&caches, 0, 1, 0) < 0) {
+    shmcaches_detach(&caches);
+    return -1;
+  }
+
+  /* The last host added must be there. */
+  hostlen = snprintf(host, sizeof(host), "www.%06u.net", NUMBER_IPS - 1);
+
+  if ((shmcaches_get_ipv4(&caches, host, hostlen, 0, &addr) < 0) ||
+      (addr.s_addr != NUMBER_IPS)) {
+    fprintf(stderr, "Error getting '%s' from DNS cache.\n", host);
+
+    shmcaches_detach(&caches);
+    return -1;
+  }
+
+  /* The first one must have been evicted. */
+  hostlen = snprintf(host, sizeof(host), "www.%06u.net", 0);
+
+  if (shmcaches_get_ipv4(&caches, host, hostlen, 0, &addr) == 0) {
+    fprintf(stderr,
+            "Found IP address for host '%s' when not expected.\n",
+            host);
+
+    shmcaches_detach(&caches);
+    return -1;
+  }
+
+  shmcaches_get_stats(&caches, &stats);
+
+  if ((stats.entries != NUMBER_IPS / 2) ||
+      (stats.evictions != 2 * NUMBER_IPS - stats.entries) ||
+      (stats.hits != 1) ||
+      (stats.misses != 1)) {
+    fprintf(stderr,
+            "Unexpected statistics (entries: %llu, evictions: %llu).\n",
+            (unsigned long long) stats.entries,
+            (unsigned long long) stats.evictions);
+
+    shmcaches_detach(&caches);
+    return -1;
+  }
+
+  shmcaches_detach(&caches);
+
+  return 0;
+}
+
+int test_attach(void)
+{
+  shmcaches_t caches;
+  char name[64];
+  pid_t pid;
+  int status;
+  int ret;
+
+  snprintf(name, sizeof(name), "/testshmcache.%d", (int) getpid());
+
+  if (shmcaches_create(&caches, name, NUMBER_BUCKETS, NUMBER_ENTRIES) < 0) {
+    fprintf(stderr, "Error creating caches '%s'.\n", name);
+    return -1;
+  }
+
+  switch (pid = fork()) {
+    case -1:
+      fprintf(stderr, "Error creating process.\n");
+
+      shmcaches_detach(&caches);
+      shmcaches_unlink(name);
+
+      return -1;
+    case 0:
+      /* Attach to the cache as an unrelated process would do. */
+      shmcaches_detach(&caches);
+
+      if (shmcaches_attach(&caches, name) < 0) {
+        fprintf(stderr, "Error attaching to caches '%s'.\n", name);
+        _exit(1);
+      }
+
+      ret = add_hosts(&caches, 0, 1, 0);
+
+      shmcaches_detach(&caches);
+
+      _exit((ret == 0) ? 0 : 1);
+  }
+
+  if ((waitpid(pid, &status, 0) == pid) &&
+      (WIFEXITED(status)) &&
+      (WEXITSTATUS(status) == 0)) {
+    ret = check_hosts(&caches, 1);
+  } else {
+    fprintf(stderr, "Process failed.\n");
+    ret = -1;
+  }
+
+  shmcaches_detach(&caches);
+  shmcaches_unlink(name);
+
+  return ret;
+}
@@ -0,0 +1,403 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "zone.h"
+#include "dns.h"
+
+#define NUMBER_HOSTS   200000
+#define NUMBER_THREADS 4
+#define NUMBER_LOOKUPS 1000000
+
+/* Records of the zone file besides the generated hosts (two sets). */
+#define NUMBER_RECORDS 12
+
+typedef struct {
+  dns_header_t header;
+
+  rr_t answers[4];
+  size_t nanswers;
+
+  rr_t authorities[2];
+  size_t nauthorities;
+} answer_t;
+
+static int write_zone(const char* filename);
+static int ask(const zone_t* zone,
+               const char* name,
+               uint16_t qtype,
+               answer_t* answer);
+
+static int test_answers(const zone_t* zone);
+static int test_errors(void);
+static int test_speed(const zone_t* zone);
+static double elapsed(const struct timespec* start);
+
+int main()
+{
+  char filename[] = "/tmp/testzone.XXXXXX";
+  struct timespec start;
+  zone_t zone;
+  int ret;
+  int fd;
+
+  if ((fd = mkstemp(filename)) == -1) {
+    fprintf(stderr, "Error creating zone file.\n");
+    return -1;
+  }
+
+  close(fd);
+
+  if (write_zone(filename) < 0) {
+    fprintf(stderr, "Error writing zone file.\n");
+
+    unlink(filename);
+    return -1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if (zone_load(&zone, filename, "zone.test", NUMBER_THREADS) < 0) {
+    fprintf(stderr, "Error loading zone (line %u).\n", zone.line);
+
+    unlink(filename);
+    return -1;
+  }
+
+  printf("Zone loaded: %u records, %u names in %.1f ms.\n",
+         zone.nrecords,
+         zone.nnames,
+         elapsed(&start) / 1e6);
+
+  ret = -1;
+
+  if (zone.nrecords != (2 * NUMBER_HOSTS) + NUMBER_RECORDS) {
+    fprintf(stderr, "Unexpected number of records (%u).\n", zone.nrecords);
+  } else if ((test_answers(&zone) == 0) &&
+             (test_errors() == 0) &&
+             (test_speed(&zone) == 0)) {
+    ret = 0;
+  }
+
+  zone_destroy(&zone);
+  unlink(filename);
+
+  return ret;
+}
+
+int test_answers(const zone_t* zone)
+{
+  answer_t answer;
+
+  /* The answer keeps the case of the question. */
+  if ((ask(zone, "WWW.Zone.Test", DNS_QTYPE_A, &answer) < 0) ||
+      ((answer.header.flags & DNS_FLAG_AA) == 0) ||
+      (answer.nanswers != 1) ||
+      (strcmp(answer.answers[0].name, "WWW.Zone.Test") != 0) ||
+      (answer.answers[0].ttl != 300) ||
+      (ntohl(answer.answers[0].addr4.s_addr) != 0xc000020a)) {
+    fprintf(stderr, "Unexpected answer for www.zone.test.\n");
+    return -1;
+  }
+
+  /* Default TTL. */
+  if ((ask(zone, "www.zone.test", DNS_QTYPE_AAAA, &answer) < 0) ||
+      (answer.nanswers != 1) ||
+      (answer.answers[0].ttl != 3600)) {
+    fprintf(stderr, "Unexpected AAAA answer for www.zone.test.\n");
+    return -1;
+  }
+
+  /* Chain of CNAME records. */
+  if ((ask(zone, "alias.zone.test", DNS_QTYPE_A, &answer) < 0) ||
+      (answer.nanswers != 3) ||
+      (answer.answers[0].type != DNS_QTYPE_CNAME) ||
+      (strcmp(answer.answers[0].cname.name, "ftp.zone.test") != 0) ||
+      (answer.answers[1].type != DNS_QTYPE_CNAME) ||
+      (answer.answers[2].type != DNS_QTYPE_A)) {
+    fprintf(stderr, "Unexpected answer for alias.zone.test.\n");
+    return -1;
+  }
+
+  if ((ask(zone, "zone.test", DNS_QTYPE_MX, &answer) < 0) ||
+      (answer.nanswers != 1) ||
+      (answer.answers[0].mx.preference != 10) ||
+      (strcmp(answer.answers[0].mx.exchange, "mail.zone.test") != 0)) {
+    fprintf(stderr, "Unexpected MX answer.\n");
+    return -1;
+  }
+
+  /* No data, empty non-terminal: SOA record (negative TTL). */
+  if ((ask(zone, "www.zone.test", DNS_QTYPE_MX, &answer) < 0) ||
+      (answer.nanswers != 0) ||
+      (answer.nauthorities != 1) ||
+      (answer.authorities[0].type != DNS_QTYPE_SOA) ||
+      (answer.authorities[0].ttl != 300) ||
+      (ask(zone, "b.c.zone.test", DNS_QTYPE_A, &answer) < 0) ||
+      (DNS_RCODE(answer.header.flags) != DNS_RCODE_NOERROR) ||
+      (answer.nauthorities != 1)) {
+    fprintf(stderr, "Unexpected answer without data.\n");
+    return -1;
+  }
+
+  if ((ask(zone, "nx.zone.test", DNS_QTYPE_A, &answer) < 0) ||
+      (DNS_RCODE(answer.header.flags) != DNS_RCODE_NXDOMAIN) ||
+      (answer.header.nscount != 1)) {
+    fprintf(stderr, "Unexpected answer for nx.zone.test.\n");
+    return -1;
+  }
+
+  /* Referral: not authoritative, NS record and glue. */
+  if ((ask(zone, "www.sub.zone.test", DNS_QTYPE_A, &answer) < 0) ||
+      (answer.header.flags & DNS_FLAG_AA) ||
+      (answer.header.ancount != 0) ||
+      (answer.header.nscount != 1) ||
+      (answer.header.arcount != 1)) {
+    fprintf(stderr, "Unexpected referral.\n");
+    return -1;
+  }
+
+  /* Hosts of both $ORIGIN (every chunk starts with the right one). */
+  if ((ask(zone, "h199999.zone.test", DNS_QTYPE_A, &answer) < 0) ||
+      (answer.nanswers != 1) ||
+      (ntohl(answer.answers[0].addr4.s_addr) != 0x0a000000 + 199999) ||
+      (ask(zone, "h123456.other.zone.test", DNS_QTYPE_A, &answer) < 0) ||
+      (answer.nanswers != 1) ||
+      (ntohl(answer.answers[0].addr4.s_addr) != 0x0b000000 + 123456)) {
+    fprintf(stderr, "Unexpected answer for generated host.\n");
+    return -1;
+  }
+
+  /* Not in the zone. */
+  if (ask(zone, "www.example.com", DNS_QTYPE_A, &answer) != 1) {
+    fprintf(stderr, "Answer for a name out of the zone.\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+int test_errors(void)
+{
+  static const struct {
+    const char* zone;
+    unsigned line;
+  } tests[] = {
+    {"@ 60 SOA ns hm 1 2 3 4 5\nwww 60 TXT \"text\"\n", 2},
+    {"@ 60 SOA ns hm 1 2 3 4 5\nwww A 192.0.2.1\n", 2},
+    {"@ 60 SOA ns hm 1 2 3 4 5\nwww 60 A 192.0.2.256\n", 2},
+    {"@ 60 SOA ns hm (\n1 2 3 4 5 ))\n", 2},
+    {"$TTL 60\n@ SOA ns hm 1 2 3 4 5\nwww.example.com. A 192.0.2.1\n", 3},
+    {"$TTL 60\nwww A 192.0.2.1\n", 0}
+  };
+
+  char filename[] = "/tmp/testzone.XXXXXX";
+  zone_t zone;
+  unsigned i;
+  FILE* file;
+  int fd;
+
+  for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+    if ((fd = mkstemp(filename)) == -1) {
+      return -1;
+    }
+
+    if ((file = fdopen(fd, "w")) == NULL) {
+      close(fd);
+      unlink(filename);
+
+      return -1;
+    }
+
+    fputs(tests[i].zone, file);
+    fclose(file);
+
+    if (zone_load(&zone, filename, "zone.test", 1) == 0) {
+      fprintf(stderr, "Invalid zone #%u loaded.\n", i + 1);
+
+      zone_destroy(&zone);
+      unlink(filename);
+
+      return -1;
+    }
+
+    unlink(filename);
+    strcpy(filename + strlen(filename) - 6, "XXXXXX");
+
+    if (zone.line != tests[i].line) {
+      fprintf(stderr,
+              "Unexpected line of the error of zone #%u (%u).\n",
+              i + 1,
+              zone.line);
+
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int test_speed(const zone_t* zone)
+{
+  uint8_t queries[16][MAX_DNS_MESSAGE_SIZE];
+  size_t querylen[16];
+  uint8_t response[MAX_DNS_MESSAGE_SIZE];
+  struct timespec start;
+  dns_query_t parsed;
+  char name[64];
+  size_t total;
+  size_t len;
+  unsigned i;
+
+  for (i = 0; i < 16; i++) {
+    snprintf(name, sizeof(name), "h%u.zone.test", i * 12345);
+
+    dns_build_request(i,
+                      DNS_QTYPE_A,
+                      DNS_QCLASS_IN,
+                      name,
+                      strlen(name),
+                      queries[i],
+                      &querylen[i]);
+  }
+
+  total = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (i = 0; i < NUMBER_LOOKUPS; i++) {
+    if ((dns_parse_query(queries[i % 16],
+                         querylen[i % 16],
+                         &parsed) != DNS_RCODE_NOERROR) ||
+        (zone_answer(zone,
+                     &parsed,
+                     queries[i % 16],
+                     response,
+                     sizeof(response),
+                     &len) < 0)) {
+      fprintf(stderr, "Error answering query.\n");
+      return -1;
+    }
+
+    total += len;
+  }
+
+  printf("zone_answer(): %.1f ns per query (%zu bytes).\n",
+         elapsed(&start) / NUMBER_LOOKUPS,
+         total / NUMBER_LOOKUPS);
+
+  return 0;
+}
+
+int write_zone(const char* filename)
+{
+  FILE* file;
+  unsigned i;
+
+  if ((file = fopen(filename, "w")) == NULL) {
+    return -1;
+  }
+
+  fprintf(file,
+          "$ORIGIN zone.test.\n"
+          "$TTL 3600\n"
+          "@ IN SOA ns1 hostmaster (\n"
+          "        2024010101 ; serial\n"
+          "        7200 3600 1209600\n"
+          "        300 )\n"
+          "  IN NS ns1\n"
+          "  IN MX 10 mail\n"
+          "ns1 IN A 192.0.2.1\n"
+          "www 300 IN A 192.0.2.10\n"
+          "www IN AAAA 2001:db8::10 ; comment\n"
+          "\n"
+          "ftp IN CNAME www\n"
+          "alias CNAME ftp.zone.test.\n"
+          "out CNAME www.example.com.\n"
+          "a.b.c A 192.0.2.20\n"
+          "sub NS ns.sub\n"
+          "ns.sub A 192.0.2.53\n");
+
+  for (i = 0; i < NUMBER_HOSTS; i++) {
+    fprintf(file,
+            "h%u 60 IN A 10.%u.%u.%u\n",
+            i,
+            (i >> 16) & 0xff,
+            (i >> 8) & 0xff,
+            i & 0xff);
+  }
+
+  fprintf(file, "$ORIGIN other.zone.test.\n");
+
+  for (i = 0; i < NUMBER_HOSTS; i++) {
+    fprintf(file,
+            "h%u A 11.%u.%u.%u\n",
+            i,
+            (i >> 16) & 0xff,
+            (i >> 8) & 0xff,
+            i & 0xff);
+  }
+
+  return (fclose(file) == 0) ? 0 : -1;
+}
+
+int ask(const zone_t* zone, const char* name, uint16_t qtype, answer_t* answer)
+{
+  uint8_t query[MAX_DNS_MESSAGE_SIZE];
+  uint8_t response[MAX_DNS_MESSAGE_SIZE];
+  dns_query_t parsed;
+  size_t querylen;
+  size_t len;
+
+  if ((dns_build_request(0x4242,
+                         qtype,
+                         DNS_QCLASS_IN,
+                         name,
+                         strlen(name),
+                         query,
+                         &querylen) < 0) ||
+      (dns_parse_query(query, querylen, &parsed) != DNS_RCODE_NOERROR)) {
+    return -1;
+  }
+
+  if (zone_answer(zone, &parsed, query, response, sizeof(response), &len) < 0) {
+    return 1;
+  }
+
+  /* The records are only parsed for NOERROR responses. */
+  answer->nanswers = sizeof(answer->answers) / sizeof(answer->answers[0]);
+  answer->nauthorities = sizeof(answer->authorities) /
+                         sizeof(answer->authorities[0]);
+
+  if ((dns_process_header(response, len, &answer->header, NULL) < 0) ||
+      (answer->header.id != 0x4242) ||
+      ((answer->header.flags & DNS_FLAG_QR) == 0) ||
+      (memcmp(response + 12, query + 12, querylen - 12) != 0) ||
+      ((DNS_RCODE(answer->header.flags) == DNS_RCODE_NOERROR) &&
+       (dns_process_response(response,
+                             len,
+                             NULL,
+                             NULL,
+                             NULL,
+                             answer->answers,
+                             &answer->nanswers,
+                             answer->authorities,
+                             &answer->nauthorities) < 0))) {
+    return -1;
+  }
+
+  return 0;
+}
+
+double elapsed(const struct timespec* start)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return ((now.tv_sec - start->tv_sec) * 1e9) +
+         (now.tv_nsec - start->tv_nsec);
+}
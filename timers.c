@@ -0,0 +1,177 @@
+#include <stdlib.h>
+#include <limits.h>
+#include "timers.h"
+
+#define HEAP_ALLOC 64
+
+static void sift_up(timer_heap_t* heap, unsigned i);
+static void sift_down(timer_heap_t* heap, unsigned i);
+
+static inline void set_entry(timer_heap_t* heap,
+                             unsigned i,
+                             timer_entry_t* timer)
+{
+  heap->entries[i] = timer;
+  timer->index = i;
+}
+
+int timer_heap_create(timer_heap_t* heap, unsigned size)
+{
+  if (size == 0) {
+    size = HEAP_ALLOC;
+  }
+
+  if ((heap->entries = (timer_entry_t**) malloc(size *
+                                                sizeof(timer_entry_t*))) !=
+      NULL) {
+    heap->size = size;
+    heap->used = 0;
+
+    return 0;
+  }
+
+  return -1;
+}
+
+void timer_heap_destroy(timer_heap_t* heap)
+{
+  if (heap->entries) {
+    free(heap->entries);
+    heap->entries = NULL;
+  }
+}
+
+int timer_heap_add(timer_heap_t* heap,
+                   timer_entry_t* timer,
+                   uint64_t expiration)
+{
+  timer_entry_t** entries;
+  unsigned size;
+
+  /* If the timer is already armed... */
+  if (timer->index != TIMER_INACTIVE) {
+    if (expiration < timer->expiration) {
+      timer->expiration = expiration;
+      sift_up(heap, timer->index);
+    } else {
+      timer->expiration = expiration;
+      sift_down(heap, timer->index);
+    }
+
+    return 0;
+  }
+
+  if (heap->used == heap->size) {
+    size = heap->size * 2;
+
+    if ((entries = (timer_entry_t**) realloc(heap->entries,
+                                             size *
+                                             sizeof(timer_entry_t*))) ==
+        NULL) {
+      return -1;
+    }
+
+    heap->entries = entries;
+    heap->size = size;
+  }
+
+  timer->expiration = expiration;
+  set_entry(heap, heap->used++, timer);
+
+  sift_up(heap, timer->index);
+
+  return 0;
+}
+
+void timer_heap_remove(timer_heap_t* heap, timer_entry_t* timer)
+{
+  unsigned i;
+
+  if ((i = timer->index) != TIMER_INACTIVE) {
+    timer->index = TIMER_INACTIVE;
+
+    /* If it is not the last timer... */
+    if (i != --heap->used) {
+      set_entry(heap, i, heap->entries[heap->used]);
+
+      sift_up(heap, i);
+      sift_down(heap, i);
+    }
+  }
+}
+
+int timer_heap_timeout(const timer_heap_t* heap, uint64_t now)
+{
+  uint64_t expiration;
+
+  if (heap->used > 0) {
+    if ((expiration = heap->entries[0]->expiration) > now) {
+      return (expiration - now < INT_MAX) ? (int) (expiration - now) : INT_MAX;
+    }
+
+    return 0;
+  }
+
+  return -1;
+}
+
+timer_entry_t* timer_heap_pop_expired(timer_heap_t* heap, uint64_t now)
+{
+  timer_entry_t* timer;
+
+  if ((heap->used > 0) && (heap->entries[0]->expiration <= now)) {
+    timer = heap->entries[0];
+    timer_heap_remove(heap, timer);
+
+    return timer;
+  }
+
+  return NULL;
+}
+
+void sift_up(timer_heap_t* heap, unsigned i)
+{
+  timer_entry_t* timer;
+  unsigned parent;
+
+  timer = heap->entries[i];
+
+  while (i > 0) {
+    parent = (i - 1) / 2;
+
+    if (heap->entries[parent]->expiration <= timer->expiration) {
+      break;
+    }
+
+    set_entry(heap, i, heap->entries[parent]);
+    i = parent;
+  }
+
+  set_entry(heap, i, timer);
+}
+
+void sift_down(timer_heap_t* heap, unsigned i)
+{
+  timer_entry_t* timer;
+  unsigned child;
+
+  timer = heap->entries[i];
+
+  while ((child = (2 * i) + 1) < heap->used) {
+    /* Choose the child which expires first. */
+    if ((child + 1 < heap->used) &&
+        (heap->entries[child + 1]->expiration <
+         heap->entries[child]->expiration)) {
+      child++;
+    }
+
+    if (timer->expiration <= heap->entries[child]->expiration) {
+      break;
+    }
+
+    set_entry(heap, i, heap->entries[child]);
+    i = child;
+  }
+
+  set_entry(heap, i, timer);
+}
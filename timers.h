@@ -0,0 +1,84 @@
+#ifndef TIMERS_H
+#define TIMERS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+/* Binary min-heap of timers.
+ * The timers are embedded in the structures they belong to (see
+ * TIMER_CONTAINER()), the heap only stores pointers to them.
+ */
+
+typedef struct {
+  uint64_t expiration; /* [ms] */
+  unsigned index; /* Position in the heap (TIMER_INACTIVE if not armed). */
+} timer_entry_t;
+
+typedef struct {
+  timer_entry_t** entries;
+  unsigned size;
+  unsigned used;
+} timer_heap_t;
+
+#define TIMER_INACTIVE ((unsigned) -1)
+
+#define TIMER_CONTAINER(entry, type, member) \
+        ((type*) ((uint8_t*) (entry) - offsetof(type, member)))
+
+/* Current time of the monotonic clock in milliseconds. */
+static inline uint64_t timer_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/* Current time of the monotonic clock in microseconds. */
+static inline uint64_t timer_now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static inline void timer_init(timer_entry_t* timer)
+{
+  timer->index = TIMER_INACTIVE;
+}
+
+static inline int timer_is_active(const timer_entry_t* timer)
+{
+  return (timer->index != TIMER_INACTIVE);
+}
+
+int timer_heap_create(timer_heap_t* heap, unsigned size);
+void timer_heap_destroy(timer_heap_t* heap);
+
+/* Arms (or re-arms) the timer. */
+int timer_heap_add(timer_heap_t* heap,
+                   timer_entry_t* timer,
+                   uint64_t expiration);
+
+/* Disarms the timer (if armed). */
+void timer_heap_remove(timer_heap_t* heap, timer_entry_t* timer);
+
+/* Returns the timer which expires first (NULL if the heap is empty). */
+static inline timer_entry_t* timer_heap_top(const timer_heap_t* heap)
+{
+  return (heap->used > 0) ? heap->entries[0] : NULL;
+}
+
+/* Returns the number of milliseconds until the first timer expires, or -1
+ * if the heap is empty (suitable as timeout for poll() / epoll_wait()).
+ */
+int timer_heap_timeout(const timer_heap_t* heap, uint64_t now);
+
+/* Disarms and returns the first timer which has expired (NULL if none). */
+timer_entry_t* timer_heap_pop_expired(timer_heap_t* heap, uint64_t now);
+
+#endif /* TIMERS_H */
@@ -0,0 +1,42 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/* Statically-defined tracepoints (USDT) of the provider "dns".
+ * With <sys/sdt.h> (systemtap-sdt-dev / systemtap-sdt-devel), a tracepoint
+ * is a NOP instruction plus an ELF note describing where its arguments
+ * are; perf or bpftrace replace the NOP by a breakpoint only while they
+ * are attached, e.g.:
+ *   bpftrace -e 'usdt:./dnsforwarder:dns:cache_miss
+ *                { @[str(arg0, arg1)] = count(); }'
+ * Without <sys/sdt.h>, or if built with -DNO_TRACE, the tracepoints are
+ * compiled out (the arguments are not evaluated).
+ *
+ * Tracepoints:
+ *   process_response_entry(buf, len)
+ *   process_response_return(result, rcode, nanswers)
+ *   cache_hit(host, hostlen), cache_miss(host, hostlen),
+ *   cache_expired(host, hostlen), cache_evict(host, hostlen)
+ *   socket_send(fd, result), socket_receive(fd, result) (bytes or -1),
+ *   socket_sendmmsg(fd, result), socket_recvmmsg(fd, result) (messages),
+ *   socket_timeout(fd, timeout)
+ *   query_timeout(name, attempts)
+ */
+
+#if !defined(NO_TRACE) && defined(__has_include)
+  #if __has_include(<sys/sdt.h>)
+    #include <sys/sdt.h>
+    #define HAVE_TRACE 1
+  #endif
+#endif
+
+#ifdef HAVE_TRACE
+  #define TRACE1(name, a)       DTRACE_PROBE1(dns, name, a)
+  #define TRACE2(name, a, b)    DTRACE_PROBE2(dns, name, a, b)
+  #define TRACE3(name, a, b, c) DTRACE_PROBE3(dns, name, a, b, c)
+#else
+  #define TRACE1(name, a)       do {} while (0)
+  #define TRACE2(name, a, b)    do {} while (0)
+  #define TRACE3(name, a, b, c) do {} while (0)
+#endif
+
+#endif /* TRACE_H */
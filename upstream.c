@@ -0,0 +1,274 @@
+#include <string.h>
+#include "upstream.h"
+#include "macros.h"
+#include "counters.h"
+
+/* Each time a server is selected, the selection key of the other servers
+ * decays by 1/32, so that a server which was slow (or failed) is eventually
+ * tried again.
+ */
+#define SRTT_DECAY_SHIFT 5
+
+/* RFC 6298: alpha = 1/8, beta = 1/4, K = 4. */
+#define SRTT_ALPHA_SHIFT  3
+#define RTTVAR_BETA_SHIFT 2
+#define RTO_K             4
+
+static unsigned histogram_bucket(uint64_t rtt)
+{
+  unsigned e;
+
+  if (rtt < 4) {
+    return rtt;
+  }
+
+  /* Position of the most significant bit and the next two bits. */
+  e = 63 - __builtin_clzll(rtt);
+
+  return MIN((4 * (e - 1)) + ((rtt >> (e - 2)) & 3),
+             UPSTREAM_HISTOGRAM_SIZE - 1);
+}
+
+/* Upper limit of the bucket [us]. */
+static uint64_t histogram_limit(unsigned bucket)
+{
+  unsigned e;
+
+  if (bucket < 4) {
+    return bucket + 1;
+  }
+
+  e = (bucket / 4) + 1;
+
+  return (uint64_t) (5 + (bucket % 4)) << (e - 2);
+}
+
+static void update_rto(const upstreams_t* upstreams, upstream_t* upstream)
+{
+  uint64_t rto;
+
+  /* RTO = SRTT + max(G, K * RTTVAR) (G is negligible). */
+  rto = (upstream->srtt + (RTO_K * (uint64_t) upstream->rttvar) + 999) / 1000;
+  rto = MAX(MIN(rto, upstreams->max_rto), upstreams->min_rto);
+
+  __atomic_store_n(&upstream->rto, rto, __ATOMIC_RELAXED);
+}
+
+void upstreams_init(upstreams_t* upstreams,
+                    unsigned initial_rto,
+                    unsigned min_rto,
+                    unsigned max_rto)
+{
+  upstreams->count = 0;
+
+  upstreams->min_rto = min_rto;
+  upstreams->max_rto = MAX(max_rto, min_rto);
+  upstreams->initial_rto = MAX(MIN(initial_rto, upstreams->max_rto), min_rto);
+}
+
+int upstreams_add(upstreams_t* upstreams,
+                  const struct sockaddr* addr,
+                  socklen_t addrlen)
+{
+  upstream_t* upstream;
+
+  if ((upstreams->count < UPSTREAMS_MAX) &&
+      (addrlen <= sizeof(struct sockaddr_storage))) {
+    upstream = &upstreams->servers[upstreams->count];
+
+    memset(upstream, 0, sizeof(upstream_t));
+
+    memcpy(&upstream->addr, addr, addrlen);
+    upstream->addrlen = addrlen;
+
+    upstream->nfds = 0;
+    upstream->rto = upstreams->initial_rto;
+
+    return upstreams->count++;
+  }
+
+  return -1;
+}
+
+int upstreams_select(upstreams_t* upstreams,
+                     uint32_t exclude,
+                     uint64_t now,
+                     uint32_t random)
+{
+  upstream_t* upstream;
+  int best;
+  int fallback;
+  unsigned i;
+
+  best = -1;
+  fallback = -1;
+
+  for (i = 0; i < upstreams->count; i++) {
+    if ((exclude & ((uint32_t) 1 << i)) == 0) {
+      upstream = &upstreams->servers[i];
+
+      if (upstream->backoff_until > now) {
+        /* If all the servers are backing off, use the one whose backoff
+         * ends first.
+         */
+        if ((fallback == -1) ||
+            (upstream->backoff_until <
+             upstreams->servers[fallback].backoff_until)) {
+          fallback = i;
+        }
+      } else if ((best == -1) ||
+                 (upstream->score < upstreams->servers[best].score)) {
+        best = i;
+      } else if (upstream->score == upstreams->servers[best].score) {
+        /* Spread the requests among equivalent servers (e.g. servers not
+         * measured yet).
+         */
+        if ((random >> (i & 31)) & 1) {
+          best = i;
+        }
+      }
+    }
+  }
+
+  if (best == -1) {
+    if ((best = fallback) == -1) {
+      return -1;
+    }
+  }
+
+  for (i = 0; i < upstreams->count; i++) {
+    if ((int) i != best) {
+      upstream = &upstreams->servers[i];
+
+      __atomic_store_n(&upstream->score,
+                       upstream->score - (upstream->score >> SRTT_DECAY_SHIFT),
+                       __ATOMIC_RELAXED);
+    }
+  }
+
+  return best;
+}
+
+void upstream_response(const upstreams_t* upstreams,
+                       upstream_t* upstream,
+                       uint64_t rtt)
+{
+  uint32_t srtt;
+  uint32_t rttvar;
+  int64_t diff;
+  unsigned i;
+
+  rtt = MAX(MIN(rtt, UPSTREAM_SRTT_MAX), 1);
+
+  if (upstream->srtt == 0) {
+    /* First measurement. */
+    srtt = rtt;
+    rttvar = rtt / 2;
+  } else {
+    diff = (int64_t) rtt - (int64_t) upstream->srtt;
+
+    /* RTTVAR = (1 - beta) * RTTVAR + beta * |SRTT - R'| */
+    rttvar = upstream->rttvar - (upstream->rttvar >> RTTVAR_BETA_SHIFT) +
+             (((diff < 0) ? -diff : diff) >> RTTVAR_BETA_SHIFT);
+
+    /* SRTT = (1 - alpha) * SRTT + alpha * R' */
+    srtt = MAX((int64_t) upstream->srtt + (diff / (1 << SRTT_ALPHA_SHIFT)),
+               1);
+  }
+
+  __atomic_store_n(&upstream->srtt, srtt, __ATOMIC_RELAXED);
+  __atomic_store_n(&upstream->rttvar, rttvar, __ATOMIC_RELAXED);
+
+  update_rto(upstreams, upstream);
+
+  __atomic_store_n(&upstream->score, srtt, __ATOMIC_RELAXED);
+
+  if (++upstream->samples > UPSTREAM_HISTOGRAM_WINDOW) {
+    upstream->samples = 0;
+
+    for (i = 0; i < UPSTREAM_HISTOGRAM_SIZE; i++) {
+      upstream->histogram[i] /= 2;
+      upstream->samples += upstream->histogram[i];
+    }
+
+    upstream->samples++;
+  }
+
+  upstream->histogram[histogram_bucket(rtt)]++;
+
+  upstream->failures = 0;
+  upstream->backoff_until = 0;
+
+  counter_inc(&upstream->stats.responses);
+}
+
+void upstream_timeout(const upstreams_t* upstreams,
+                      upstream_t* upstream,
+                      uint64_t sent,
+                      uint64_t now)
+{
+  unsigned shift;
+
+  counter_inc(&upstream->stats.timeouts);
+
+  /* The requests which were already in flight when the server was backed
+   * off (e.g. a burst of requests lost at once) count as a single timeout.
+   */
+  if (sent < upstream->last_timeout) {
+    return;
+  }
+
+  upstream->last_timeout = now;
+
+  /* The server is considered at least as slow as the timeout. */
+  __atomic_store_n(&upstream->score,
+                   MIN(MAX((uint64_t) upstream->score * 2,
+                           (uint64_t) upstream->rto * 1000),
+                       UPSTREAM_SRTT_MAX),
+                   __ATOMIC_RELAXED);
+
+  /* Back off the timer (RTO = RTO * 2), until the next measurement. */
+  __atomic_store_n(&upstream->rto,
+                   MIN(upstream->rto * 2, upstreams->max_rto),
+                   __ATOMIC_RELAXED);
+
+  if (++upstream->failures >= UPSTREAM_BACKOFF_THRESHOLD) {
+    /* Exponential backoff. */
+    shift = MIN(upstream->failures - UPSTREAM_BACKOFF_THRESHOLD, 16);
+
+    upstream->backoff_until = (now / 1000) +
+                              MIN((uint64_t) UPSTREAM_BACKOFF_MIN << shift,
+                                  UPSTREAM_BACKOFF_MAX);
+  }
+}
+
+uint64_t upstream_rtt_percentile(const upstream_t* upstream,
+                                 unsigned percentile)
+{
+  uint64_t count;
+  uint64_t sum;
+  unsigned i;
+
+  if (upstream->samples >= UPSTREAM_HISTOGRAM_MIN_SAMPLES) {
+    /* Number of samples at or below the percentile. */
+    count = (((uint64_t) upstream->samples * percentile) + 99) / 100;
+    sum = 0;
+
+    for (i = 0; i < UPSTREAM_HISTOGRAM_SIZE; i++) {
+      if ((sum += upstream->histogram[i]) >= count) {
+        return histogram_limit(i);
+      }
+    }
+  }
+
+  return 0;
+}
+
+void upstream_get_stats(const upstream_t* upstream, upstream_stats_t* stats)
+{
+  counters_snapshot(&upstream->stats, stats, sizeof(upstream_stats_t));
+
+  /* Current values (not kept in the counters). */
+  stats->srtt = __atomic_load_n(&upstream->srtt, __ATOMIC_RELAXED);
+  stats->rto = __atomic_load_n(&upstream->rto, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,150 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+/* Set of upstream DNS servers.
+ * The round-trip time of each server is tracked, queries go to the fastest
+ * server which is not backing off after several consecutive timeouts.
+ * The retransmission timeout of each server is computed from the measured
+ * round-trip times as described in RFC 6298.
+ */
+
+#define UPSTREAMS_MAX              32
+
+/* Maximum number of sockets per server. */
+#define UPSTREAM_MAX_SOCKETS       16
+
+/* Consecutive timeouts before backing off. */
+#define UPSTREAM_BACKOFF_THRESHOLD 2
+#define UPSTREAM_BACKOFF_MIN       1000  /* [ms] */
+#define UPSTREAM_BACKOFF_MAX       60000 /* [ms] */
+
+/* Maximum smoothed round-trip time. */
+#define UPSTREAM_SRTT_MAX          (10 * 1000 * 1000) /* [us] */
+
+/* Histogram of round-trip times: four buckets per power of two, from 1 us
+ * up to 16 s. When the histogram reaches UPSTREAM_HISTOGRAM_WINDOW samples
+ * the counts are halved, so that it follows the recent round-trip times.
+ */
+#define UPSTREAM_HISTOGRAM_SIZE        96
+#define UPSTREAM_HISTOGRAM_WINDOW      1024
+#define UPSTREAM_HISTOGRAM_MIN_SAMPLES 32
+
+/* Default retransmission timeouts. */
+#define UPSTREAM_DEFAULT_RTO       1000 /* Before the first sample [ms]. */
+#define UPSTREAM_DEFAULT_MIN_RTO   50   /* [ms] */
+#define UPSTREAM_DEFAULT_MAX_RTO   4000 /* [ms] */
+
+typedef struct {
+  uint64_t requests;
+  uint64_t responses;
+  uint64_t timeouts;
+
+  /* Smoothed round-trip time [us] (0: not measured yet). */
+  uint64_t srtt;
+
+  /* Current retransmission timeout [ms]. */
+  uint64_t rto;
+} upstream_stats_t;
+
+typedef struct {
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+
+  /* Sockets used to send the requests to the server (pool). */
+  int fds[UPSTREAM_MAX_SOCKETS];
+  unsigned nfds;
+
+  /* Smoothed round-trip time and round-trip time variation [us] (0: not
+   * measured yet).
+   */
+  uint32_t srtt;
+  uint32_t rttvar;
+
+  /* Retransmission timeout [ms]. */
+  unsigned rto;
+
+  /* Selection key [us]: the smoothed round-trip time, which decays while
+   * the server is not used.
+   */
+  uint32_t score;
+
+  /* Histogram of round-trip times. */
+  uint32_t histogram[UPSTREAM_HISTOGRAM_SIZE];
+  uint32_t samples;
+
+  /* Number of consecutive timeouts. */
+  unsigned failures;
+
+  /* Time of the last timeout which backed off the server [us]. */
+  uint64_t last_timeout;
+
+  /* The server is not used (unless there is no other choice) until this
+   * time [ms].
+   */
+  uint64_t backoff_until;
+
+  upstream_stats_t stats;
+} upstream_t;
+
+typedef struct {
+  upstream_t servers[UPSTREAMS_MAX];
+  unsigned count;
+
+  /* Retransmission timeouts [ms]. */
+  unsigned initial_rto;
+  unsigned min_rto;
+  unsigned max_rto;
+} upstreams_t;
+
+void upstreams_init(upstreams_t* upstreams,
+                    unsigned initial_rto,
+                    unsigned min_rto,
+                    unsigned max_rto);
+
+/* Returns the index of the new server or -1. */
+int upstreams_add(upstreams_t* upstreams,
+                  const struct sockaddr* addr,
+                  socklen_t addrlen);
+
+/* Selects the server for the next request, skipping the servers whose bit
+ * is set in 'exclude'.
+ * Returns -1 if all the servers are excluded.
+ */
+int upstreams_select(upstreams_t* upstreams,
+                     uint32_t exclude,
+                     uint64_t now,
+                     uint32_t random);
+
+/* A response has been received from the server after 'rtt' microseconds.
+ * The request must not have been retransmitted with the same DNS ID (Karn's
+ * algorithm).
+ */
+void upstream_response(const upstreams_t* upstreams,
+                       upstream_t* upstream,
+                       uint64_t rtt);
+
+/* A request sent to the server at 'sent' has timed out at 'now' (both
+ * [us]).
+ */
+void upstream_timeout(const upstreams_t* upstreams,
+                      upstream_t* upstream,
+                      uint64_t sent,
+                      uint64_t now);
+
+/* Returns the given percentile (1 - 100) of the recent round-trip times
+ * [us], or 0 if there are not enough samples.
+ */
+uint64_t upstream_rtt_percentile(const upstream_t* upstream,
+                                 unsigned percentile);
+
+/* Takes a snapshot of the statistics of the server (it can be called from
+ * a thread other than the one using the servers: the counters, the
+ * round-trip times, the RTO and the score are written with relaxed atomic
+ * stores).
+ */
+void upstream_get_stats(const upstream_t* upstream, upstream_stats_t* stats);
+
+#endif /* UPSTREAM_H */
@@ -0,0 +1,371 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+#if HAVE_URING
+
+static inline int io_uring_setup(unsigned entries, struct io_uring_params* p)
+{
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int io_uring_enter(int fd,
+                                 unsigned to_submit,
+                                 unsigned min_complete,
+                                 unsigned flags,
+                                 const void* arg,
+                                 size_t argsz)
+{
+  return syscall(__NR_io_uring_enter,
+                 fd,
+                 to_submit,
+                 min_complete,
+                 flags,
+                 arg,
+                 argsz);
+}
+
+static inline int io_uring_register(int fd,
+                                    unsigned opcode,
+                                    const void* arg,
+                                    unsigned nargs)
+{
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+
+int uring_create(uring_t* uring, unsigned entries)
+{
+  struct io_uring_params params;
+  uint8_t* sq;
+  uint8_t* cq;
+
+  memset(uring, 0, sizeof(uring_t));
+
+  memset(&params, 0, sizeof(struct io_uring_params));
+
+  if ((uring->fd = io_uring_setup(entries, &params)) < 0) {
+    /* ENOSYS, EPERM (e.g. disabled by seccomp or sysctl)... */
+    uring->fd = -1;
+    return -1;
+  }
+
+  /* The timeout of io_uring_enter() requires IORING_FEAT_EXT_ARG. */
+  if ((params.features & IORING_FEAT_EXT_ARG) == 0) {
+    close(uring->fd);
+    uring->fd = -1;
+
+    return -1;
+  }
+
+  uring->sq_ring_size = params.sq_off.array +
+                        (params.sq_entries * sizeof(unsigned));
+
+  uring->cq_ring_size = params.cq_off.cqes +
+                        (params.cq_entries * sizeof(struct io_uring_cqe));
+
+  uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  if ((uring->sq_ring = mmap(NULL,
+                             uring->sq_ring_size,
+                             PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE,
+                             uring->fd,
+                             IORING_OFF_SQ_RING)) != MAP_FAILED) {
+    if ((uring->cq_ring = mmap(NULL,
+                               uring->cq_ring_size,
+                               PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE,
+                               uring->fd,
+                               IORING_OFF_CQ_RING)) != MAP_FAILED) {
+      if ((uring->sqes = (struct io_uring_sqe*)
+                         mmap(NULL,
+                              uring->sqes_size,
+                              PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE,
+                              uring->fd,
+                              IORING_OFF_SQES)) != MAP_FAILED) {
+        sq = (uint8_t*) uring->sq_ring;
+
+        uring->sq_head = (unsigned*) (sq + params.sq_off.head);
+        uring->sq_tail = (unsigned*) (sq + params.sq_off.tail);
+        uring->sq_mask = *(unsigned*) (sq + params.sq_off.ring_mask);
+        uring->sq_array = (unsigned*) (sq + params.sq_off.array);
+        uring->sq_entries = params.sq_entries;
+
+        cq = (uint8_t*) uring->cq_ring;
+
+        uring->cq_head = (unsigned*) (cq + params.cq_off.head);
+        uring->cq_tail = (unsigned*) (cq + params.cq_off.tail);
+        uring->cq_mask = *(unsigned*) (cq + params.cq_off.ring_mask);
+        uring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+
+        uring->to_submit = 0;
+
+        return 0;
+      }
+
+      munmap(uring->cq_ring, uring->cq_ring_size);
+    }
+
+    munmap(uring->sq_ring, uring->sq_ring_size);
+  }
+
+  close(uring->fd);
+  uring->fd = -1;
+
+  return -1;
+}
+
+void uring_destroy(uring_t* uring)
+{
+  if (uring->fd != -1) {
+    munmap(uring->sqes, uring->sqes_size);
+    munmap(uring->cq_ring, uring->cq_ring_size);
+    munmap(uring->sq_ring, uring->sq_ring_size);
+
+    close(uring->fd);
+    uring->fd = -1;
+  }
+}
+
+struct io_uring_sqe* uring_get_sqe(uring_t* uring)
+{
+  struct io_uring_sqe* sqe;
+  unsigned tail;
+  unsigned index;
+
+  tail = *uring->sq_tail;
+
+  /* If the submission queue is full... */
+  if (tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) ==
+      uring->sq_entries) {
+    if (uring_submit(uring) < 0) {
+      return NULL;
+    }
+
+    tail = *uring->sq_tail;
+
+    if (tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) ==
+        uring->sq_entries) {
+      return NULL;
+    }
+  }
+
+  index = tail & uring->sq_mask;
+
+  sqe = &uring->sqes[index];
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+  uring->sq_array[index] = index;
+
+  __atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  uring->to_submit++;
+
+  return sqe;
+}
+
+int uring_submit(uring_t* uring)
+{
+  int ret;
+
+  while (uring->to_submit > 0) {
+    if ((ret = io_uring_enter(uring->fd,
+                              uring->to_submit,
+                              0,
+                              0,
+                              NULL,
+                              0)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      return -1;
+    }
+
+    uring->to_submit -= ret;
+  }
+
+  return 0;
+}
+
+int uring_submit_and_wait(uring_t* uring, int timeout)
+{
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  int ret;
+
+  memset(&arg, 0, sizeof(struct io_uring_getevents_arg));
+
+  if (timeout >= 0) {
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000L;
+
+    arg.ts = (uint64_t) (uintptr_t) &ts;
+  }
+
+  if ((ret = io_uring_enter(uring->fd,
+                            uring->to_submit,
+                            1,
+                            IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                            &arg,
+                            sizeof(struct io_uring_getevents_arg))) < 0) {
+    /* Timeout or signal. */
+    if ((errno == ETIME) || (errno == EINTR)) {
+      return 0;
+    }
+
+    return -1;
+  }
+
+  uring->to_submit -= ret;
+
+  return 0;
+}
+
+int uring_buffers_create(uring_t* uring,
+                         uring_buffers_t* buffers,
+                         uint16_t bgid,
+                         unsigned nbuffers,
+                         unsigned buffer_size)
+{
+  struct io_uring_buf_reg reg;
+  struct io_uring_buf_ring* ring;
+  unsigned i;
+
+  /* The number of entries must be a power of 2. */
+  if ((nbuffers == 0) || ((nbuffers & (nbuffers - 1)) != 0)) {
+    return -1;
+  }
+
+  buffers->ring_size = nbuffers * sizeof(struct io_uring_buf);
+
+  /* The ring must be page-aligned. */
+  if ((buffers->ring = mmap(NULL,
+                            buffers->ring_size,
+                            PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS,
+                            -1,
+                            0)) == MAP_FAILED) {
+    return -1;
+  }
+
+  if ((buffers->buffers = (uint8_t*) malloc((size_t) nbuffers *
+                                            buffer_size)) != NULL) {
+    buffers->nbuffers = nbuffers;
+    buffers->buffer_size = buffer_size;
+    buffers->bgid = bgid;
+
+    memset(&reg, 0, sizeof(struct io_uring_buf_reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) buffers->ring;
+    reg.ring_entries = nbuffers;
+    reg.bgid = bgid;
+
+    if (io_uring_register(uring->fd,
+                          IORING_REGISTER_PBUF_RING,
+                          &reg,
+                          1) == 0) {
+      ring = (struct io_uring_buf_ring*) buffers->ring;
+      ring->tail = 0;
+
+      for (i = 0; i < nbuffers; i++) {
+        uring_buffers_recycle(buffers, i);
+      }
+
+      return 0;
+    }
+
+    free(buffers->buffers);
+  }
+
+  munmap(buffers->ring, buffers->ring_size);
+
+  return -1;
+}
+
+void uring_buffers_destroy(uring_t* uring, uring_buffers_t* buffers)
+{
+  struct io_uring_buf_reg reg;
+
+  if (buffers->buffers) {
+    memset(&reg, 0, sizeof(struct io_uring_buf_reg));
+    reg.bgid = buffers->bgid;
+
+    io_uring_register(uring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+
+    munmap(buffers->ring, buffers->ring_size);
+
+    free(buffers->buffers);
+    buffers->buffers = NULL;
+  }
+}
+
+void uring_buffers_recycle(uring_buffers_t* buffers, unsigned bid)
+{
+  struct io_uring_buf_ring* ring;
+  struct io_uring_buf* buf;
+  uint16_t tail;
+
+  ring = (struct io_uring_buf_ring*) buffers->ring;
+  tail = ring->tail;
+
+  buf = &ring->bufs[tail & (buffers->nbuffers - 1)];
+
+  buf->addr = (uint64_t) (uintptr_t) uring_buffer(buffers, bid);
+  buf->len = buffers->buffer_size;
+  buf->bid = bid;
+
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+#else /* !HAVE_URING */
+
+int uring_create(uring_t* uring, unsigned entries)
+{
+  uring->fd = -1;
+  return -1;
+}
+
+void uring_destroy(uring_t* uring)
+{
+}
+
+struct io_uring_sqe* uring_get_sqe(uring_t* uring)
+{
+  return NULL;
+}
+
+int uring_submit(uring_t* uring)
+{
+  return -1;
+}
+
+int uring_submit_and_wait(uring_t* uring, int timeout)
+{
+  return -1;
+}
+
+int uring_buffers_create(uring_t* uring,
+                         uring_buffers_t* buffers,
+                         uint16_t bgid,
+                         unsigned nbuffers,
+                         unsigned buffer_size)
+{
+  return -1;
+}
+
+void uring_buffers_destroy(uring_t* uring, uring_buffers_t* buffers)
+{
+}
+
+void uring_buffers_recycle(uring_buffers_t* buffers, unsigned bid)
+{
+}
+
+#endif /* HAVE_URING */
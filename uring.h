@@ -0,0 +1,117 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+/* Minimal io_uring wrapper (raw system calls, no liburing).
+ * The kernel must support provided buffer rings and multishot receives
+ * (Linux 6.0+); otherwise uring_create() fails and the callers keep using
+ * epoll.
+ */
+
+/* IORING_RECV_MULTISHOT and struct io_uring_recvmsg_out appeared in the
+ * headers of Linux 6.0, after IORING_REGISTER_PBUF_RING (an enumerator).
+ */
+#if defined(IORING_RECV_MULTISHOT)
+  #define HAVE_URING 1
+#else
+  #define HAVE_URING 0
+#endif
+
+typedef struct {
+  int fd;
+
+  /* Submission queue. */
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned sq_mask;
+  unsigned* sq_array;
+  struct io_uring_sqe* sqes;
+  unsigned sq_entries;
+
+  /* SQEs prepared but not submitted yet. */
+  unsigned to_submit;
+
+  /* Completion queue. */
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe* cqes;
+
+  void* sq_ring;
+  size_t sq_ring_size;
+
+  void* cq_ring;
+  size_t cq_ring_size;
+
+  size_t sqes_size;
+} uring_t;
+
+/* Ring of buffers provided to the kernel (buffer group 'bgid'). */
+typedef struct {
+  void* ring;
+  size_t ring_size;
+
+  uint8_t* buffers;
+  unsigned nbuffers; /* Power of 2. */
+  unsigned buffer_size;
+
+  uint16_t bgid;
+} uring_buffers_t;
+
+int uring_create(uring_t* uring, unsigned entries);
+void uring_destroy(uring_t* uring);
+
+/* Returns the next SQE (zeroed), submitting the prepared ones if the
+ * submission queue is full (NULL on error).
+ */
+struct io_uring_sqe* uring_get_sqe(uring_t* uring);
+
+/* Submits the prepared SQEs. */
+int uring_submit(uring_t* uring);
+
+/* Submits the prepared SQEs and waits up to 'timeout' milliseconds (-1: no
+ * limit) for a completion.
+ */
+int uring_submit_and_wait(uring_t* uring, int timeout);
+
+/* Next completion (NULL if none), to be released with uring_cqe_seen(). */
+static inline struct io_uring_cqe* uring_peek_cqe(uring_t* uring)
+{
+  unsigned head;
+
+  head = *uring->cq_head;
+
+  if (head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE)) {
+    return &uring->cqes[head & uring->cq_mask];
+  }
+
+  return NULL;
+}
+
+static inline void uring_cqe_seen(uring_t* uring)
+{
+  __atomic_store_n(uring->cq_head, *uring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/* Registers 'nbuffers' buffers of 'buffer_size' bytes. */
+int uring_buffers_create(uring_t* uring,
+                         uring_buffers_t* buffers,
+                         uint16_t bgid,
+                         unsigned nbuffers,
+                         unsigned buffer_size);
+
+void uring_buffers_destroy(uring_t* uring, uring_buffers_t* buffers);
+
+static inline uint8_t* uring_buffer(const uring_buffers_t* buffers,
+                                    unsigned bid)
+{
+  return buffers->buffers + ((size_t) bid * buffers->buffer_size);
+}
+
+/* Gives a buffer back to the kernel. */
+void uring_buffers_recycle(uring_buffers_t* buffers, unsigned bid);
+
+#endif /* URING_H */
@@ -0,0 +1,434 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <linux/filter.h>
+#include "workers.h"
+#include "macros.h"
+
+/* The steering program is unrolled, each step (byte of the name) is
+ * STEERING_STEP instructions long (the jumps must be shorter than 256
+ * instructions).
+ */
+#define STEERING_STEP 8
+#define STEERING_END  (1 + (WORKERS_STEERING_BYTES * STEERING_STEP))
+
+struct worker_t {
+  workers_t* workers;
+  unsigned index;
+
+  pthread_t thread;
+
+  packetcache_t packetcache;
+  dnscaches_t caches;
+  resolver_t resolver;
+  forwarder_t forwarder;
+};
+
+static int create_worker(workers_t* workers,
+                         worker_t* worker,
+                         const workers_config_t* config,
+                         const struct sockaddr* addr,
+                         socklen_t addrlen);
+
+static void destroy_worker(worker_t* worker);
+static void* run_worker(void* arg);
+static int attach_steering_program(int fd, unsigned nworkers);
+
+void workers_config_init(workers_config_t* config)
+{
+  config->nworkers = 0;
+  config->pin_threads = 0;
+  config->steer_by_name = 0;
+  config->use_uring = 0;
+  config->nbuckets = WORKERS_DEFAULT_NBUCKETS;
+  config->max_packets = WORKERS_DEFAULT_PACKETS;
+  config->max_requests = FORWARDER_DEFAULT_MAX_REQUESTS;
+  config->max_connections = FORWARDER_DEFAULT_MAX_CONNECTIONS;
+  config->idle_timeout = FORWARDER_DEFAULT_IDLE_TIMEOUT;
+  config->zone = NULL;
+
+  resolver_config_init(&config->resolver);
+}
+
+int workers_create(workers_t* workers,
+                   const workers_config_t* config,
+                   const struct sockaddr* addr,
+                   socklen_t addrlen)
+{
+  unsigned nworkers;
+  long ncpus;
+
+  if ((nworkers = config->nworkers) == 0) {
+    nworkers = ((ncpus = sysconf(_SC_NPROCESSORS_ONLN)) > 0) ? ncpus : 1;
+  }
+
+  nworkers = MIN(nworkers, WORKERS_MAX);
+
+  workers->nworkers = 0;
+  workers->pin_threads = config->pin_threads;
+  workers->running = 0;
+  workers->started = 0;
+
+  if ((workers->workers = (worker_t*) malloc(nworkers * sizeof(worker_t))) ==
+      NULL) {
+    return -1;
+  }
+
+  /* The first worker binds to 'addr', the others to the same address
+   * (the port might have been chosen by the kernel).
+   */
+  memcpy(&workers->addr, addr, addrlen);
+  workers->addrlen = addrlen;
+
+  while (workers->nworkers < nworkers) {
+    if (create_worker(workers,
+                      &workers->workers[workers->nworkers],
+                      config,
+                      (const struct sockaddr*) &workers->addr,
+                      workers->addrlen) < 0) {
+      workers_destroy(workers);
+      return -1;
+    }
+
+    if (workers->nworkers++ == 0) {
+      workers->addrlen = sizeof(struct sockaddr_storage);
+
+      if (getsockname(workers->workers[0].forwarder.fd,
+                      (struct sockaddr*) &workers->addr,
+                      &workers->addrlen) < 0) {
+        workers_destroy(workers);
+        return -1;
+      }
+
+      /* The program is attached to the group of sockets, the sockets
+       * added later are selected by it too (the index of a socket is the
+       * order in which it joined the group).
+       */
+      if ((config->steer_by_name) &&
+          (nworkers > 1) &&
+          (attach_steering_program(workers->workers[0].forwarder.fd,
+                                   nworkers) < 0)) {
+        workers_destroy(workers);
+        return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+void workers_destroy(workers_t* workers)
+{
+  unsigned i;
+
+  if (workers->workers) {
+    workers_stop(workers);
+
+    for (i = 0; i < workers->nworkers; i++) {
+      destroy_worker(&workers->workers[i]);
+    }
+
+    free(workers->workers);
+    workers->workers = NULL;
+  }
+
+  workers->nworkers = 0;
+}
+
+int workers_add_upstream(workers_t* workers,
+                         const struct sockaddr* addr,
+                         socklen_t addrlen)
+{
+  unsigned i;
+
+  if (workers->started) {
+    return -1;
+  }
+
+  for (i = 0; i < workers->nworkers; i++) {
+    if (resolver_add_upstream(&workers->workers[i].resolver,
+                              addr,
+                              addrlen) < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int workers_start(workers_t* workers)
+{
+  worker_t* worker;
+  unsigned i;
+
+  if (workers->started) {
+    return -1;
+  }
+
+  __atomic_store_n(&workers->running, 1, __ATOMIC_RELAXED);
+
+  for (i = 0; i < workers->nworkers; i++) {
+    worker = &workers->workers[i];
+
+    if (pthread_create(&worker->thread, NULL, run_worker, worker) != 0) {
+      /* Stop the threads already started. */
+      __atomic_store_n(&workers->running, 0, __ATOMIC_RELAXED);
+
+      while (i > 0) {
+        pthread_join(workers->workers[--i].thread, NULL);
+      }
+
+      return -1;
+    }
+  }
+
+  workers->started = 1;
+
+  return 0;
+}
+
+void workers_stop(workers_t* workers)
+{
+  unsigned i;
+
+  if (workers->started) {
+    __atomic_store_n(&workers->running, 0, __ATOMIC_RELAXED);
+
+    for (i = 0; i < workers->nworkers; i++) {
+      pthread_join(workers->workers[i].thread, NULL);
+    }
+
+    workers->started = 0;
+  }
+}
+
+void workers_get_stats(const workers_t* workers,
+                       unsigned index,
+                       forwarder_stats_t* stats)
+{
+  forwarder_get_stats(&workers->workers[index].forwarder, stats);
+}
+
+void workers_get_cache_stats(const workers_t* workers,
+                             unsigned index,
+                             cache_stats_t* ipv4,
+                             cache_stats_t* ipv6)
+{
+  dnscaches_get_stats(&workers->workers[index].caches, ipv4, ipv6);
+}
+
+void workers_get_packetcache_stats(const workers_t* workers,
+                                   unsigned index,
+                                   cache_stats_t* stats)
+{
+  const worker_t* worker = &workers->workers[index];
+
+  if (worker->packetcache.buckets) {
+    packetcache_get_stats(&worker->packetcache, stats);
+  } else {
+    memset(stats, 0, sizeof(cache_stats_t));
+  }
+}
+
+void workers_get_resolver_stats(const workers_t* workers,
+                                unsigned index,
+                                resolver_stats_t* stats)
+{
+  resolver_get_stats(&workers->workers[index].resolver, stats);
+}
+
+unsigned workers_upstreams(const workers_t* workers)
+{
+  return resolver_upstreams(&workers->workers[0].resolver);
+}
+
+const struct sockaddr* workers_upstream_address(const workers_t* workers,
+                                                unsigned upstream)
+{
+  const upstreams_t* upstreams = &workers->workers[0].resolver.upstreams;
+
+  return (const struct sockaddr*) &upstreams->servers[upstream].addr;
+}
+
+int workers_get_upstream_stats(const workers_t* workers,
+                               unsigned index,
+                               unsigned upstream,
+                               upstream_stats_t* stats)
+{
+  return resolver_get_upstream_stats(&workers->workers[index].resolver,
+                                     upstream,
+                                     stats);
+}
+
+int create_worker(workers_t* workers,
+                  worker_t* worker,
+                  const workers_config_t* config,
+                  const struct sockaddr* addr,
+                  socklen_t addrlen)
+{
+  resolver_config_t resolver_config;
+
+  worker->workers = workers;
+  worker->index = workers->nworkers;
+
+  worker->packetcache.buckets = NULL;
+
+  if ((config->max_packets == 0) ||
+      (packetcache_create(&worker->packetcache,
+                          config->nbuckets,
+                          config->max_packets) == 0)) {
+    if (dnscaches_create(&worker->caches, config->nbuckets) == 0) {
+      resolver_config = config->resolver;
+      resolver_config.caches = &worker->caches;
+
+      if (resolver_create(&worker->resolver, &resolver_config) == 0) {
+        if (forwarder_create(&worker->forwarder,
+                             &worker->resolver,
+                             (config->max_packets != 0) ?
+                               &worker->packetcache :
+                               NULL,
+                             addr,
+                             addrlen,
+                             config->max_requests) == 0) {
+          if ((config->max_connections == 0) ||
+              (forwarder_listen_tcp(&worker->forwarder,
+                                    config->max_connections,
+                                    config->idle_timeout) == 0)) {
+            if (config->zone) {
+              forwarder_serve_zone(&worker->forwarder, config->zone);
+            }
+
+            /* Not fatal: the forwarder keeps using epoll. */
+            if (config->use_uring) {
+              forwarder_use_uring(&worker->forwarder);
+            }
+
+            return 0;
+          }
+
+          forwarder_destroy(&worker->forwarder);
+        }
+
+        resolver_destroy(&worker->resolver);
+      }
+
+      dnscaches_destroy(&worker->caches);
+    }
+
+    packetcache_destroy(&worker->packetcache);
+  }
+
+  return -1;
+}
+
+void destroy_worker(worker_t* worker)
+{
+  forwarder_destroy(&worker->forwarder);
+  resolver_destroy(&worker->resolver);
+  dnscaches_destroy(&worker->caches);
+  packetcache_destroy(&worker->packetcache);
+}
+
+void* run_worker(void* arg)
+{
+  worker_t* worker;
+  workers_t* workers;
+  cpu_set_t cpus;
+  long ncpus;
+
+  worker = (worker_t*) arg;
+  workers = worker->workers;
+
+  if (workers->pin_threads) {
+    if ((ncpus = sysconf(_SC_NPROCESSORS_ONLN)) <= 0) {
+      ncpus = 1;
+    }
+
+    CPU_ZERO(&cpus);
+    CPU_SET(worker->index % ncpus, &cpus);
+
+    /* Not fatal (e.g. restricted CPU set). */
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+  }
+
+  while (__atomic_load_n(&workers->running, __ATOMIC_RELAXED)) {
+    if (forwarder_process(&worker->forwarder, WORKERS_POLL_INTERVAL) < 0) {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+int attach_steering_program(int fd, unsigned nworkers)
+{
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+  /* The program sees the UDP payload: the name starts after the DNS header
+   * (12 bytes).
+   */
+  struct sock_filter filter[STEERING_END + 3];
+  struct sock_fprog prog;
+  unsigned pc;
+  unsigned i;
+
+  pc = 0;
+
+  /* X = hash. */
+  filter[pc++] = (struct sock_filter) BPF_STMT(BPF_LDX | BPF_W | BPF_IMM, 0);
+
+  for (i = 0; i < WORKERS_STEERING_BYTES; i++) {
+    /* Stop at the end of the message... */
+    filter[pc] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0);
+    pc++;
+
+    filter[pc] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K,
+                                               12 + i,
+                                               0,
+                                               STEERING_END - (pc + 1));
+    pc++;
+
+    /* ... or at the end of the name. */
+    filter[pc] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_B | BPF_ABS,
+                                               12 + i);
+    pc++;
+
+    filter[pc] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                                               0,
+                                               STEERING_END - (pc + 1),
+                                               0);
+    pc++;
+
+    /* hash = (hash + (byte | 0x20)) * 31 (lowercase letters). */
+    filter[pc++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_OR | BPF_K,
+                                                 0x20);
+
+    filter[pc++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0);
+
+    filter[pc++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_MUL | BPF_K,
+                                                 31);
+
+    filter[pc++] = (struct sock_filter) BPF_STMT(BPF_MISC | BPF_TAX, 0);
+  }
+
+  /* Index of the socket = hash % number of sockets. */
+  filter[pc++] = (struct sock_filter) BPF_STMT(BPF_MISC | BPF_TXA, 0);
+
+  filter[pc++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_MOD | BPF_K,
+                                               nworkers);
+
+  filter[pc++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_A, 0);
+
+  prog.len = pc;
+  prog.filter = filter;
+
+  return setsockopt(fd,
+                    SOL_SOCKET,
+                    SO_ATTACH_REUSEPORT_CBPF,
+                    &prog,
+                    sizeof(struct sock_fprog));
+#else
+  return -1;
+#endif
+}
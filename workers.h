@@ -0,0 +1,150 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <sys/socket.h>
+#include "dnscache.h"
+#include "resolver.h"
+#include "forwarder.h"
+
+/* Multi-threaded forwarder.
+ * Each worker thread owns a forwarder socket (all of them bound to the same
+ * address with SO_REUSEPORT, the kernel spreads the queries among them), a
+ * packet cache, a DNS cache, a resolver and its upstream sockets: nothing is
+ * shared between the workers (but the zone served, which is read-only).
+ */
+
+#define WORKERS_MAX               256
+#define WORKERS_DEFAULT_NBUCKETS  65521
+#define WORKERS_DEFAULT_PACKETS   65536
+#define WORKERS_POLL_INTERVAL     100 /* [ms] */
+
+/* Number of bytes of the name hashed to steer the queries. */
+#define WORKERS_STEERING_BYTES    24
+
+typedef struct {
+  /* Number of workers (0: one per CPU). */
+  unsigned nworkers;
+
+  /* If set, worker #n runs on CPU #n. */
+  int pin_threads;
+
+  /* If set, the queries for the same name go to the same worker (a classic
+   * BPF program attached to the SO_REUSEPORT group hashes the first
+   * WORKERS_STEERING_BYTES bytes of the name, ignoring the case), so that
+   * each name is cached (and coalesced) by a single worker. Otherwise, the
+   * kernel chooses the worker by hashing the addresses of the client.
+   */
+  int steer_by_name;
+
+  /* If set, the workers use io_uring (if the kernel doesn't support it,
+   * they fall back to epoll).
+   */
+  int use_uring;
+
+  /* Number of buckets of the DNS cache and of the packet cache of each
+   * worker.
+   */
+  unsigned nbuckets;
+
+  /* Maximum number of responses in the packet cache of each worker (0: no
+   * packet cache).
+   */
+  unsigned max_packets;
+
+  /* Maximum number of queries being resolved per worker. */
+  unsigned max_requests;
+
+  /* Maximum number of TCP connections per worker (0: no TCP) and idle
+   * timeout of the connections (milliseconds).
+   */
+  unsigned max_connections;
+  int idle_timeout;
+
+  /* Zone served by every worker (NULL: none). */
+  const zone_t* zone;
+
+  /* Configuration of the resolver of each worker (the DNS cache is the
+   * worker's).
+   */
+  resolver_config_t resolver;
+} workers_config_t;
+
+typedef struct worker_t worker_t;
+
+typedef struct {
+  worker_t* workers;
+  unsigned nworkers;
+
+  /* Address the workers are listening on. */
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+
+  int pin_threads;
+
+  int running;
+  int started;
+} workers_t;
+
+void workers_config_init(workers_config_t* config);
+
+/* Creates the workers listening on 'addr' (if the port is 0, the kernel
+ * chooses it).
+ */
+int workers_create(workers_t* workers,
+                   const workers_config_t* config,
+                   const struct sockaddr* addr,
+                   socklen_t addrlen);
+
+/* Stops the workers (if they are running) and destroys them. */
+void workers_destroy(workers_t* workers);
+
+/* Adds an upstream server to all the workers (before starting them). */
+int workers_add_upstream(workers_t* workers,
+                         const struct sockaddr* addr,
+                         socklen_t addrlen);
+
+/* Starts the worker threads. */
+int workers_start(workers_t* workers);
+
+/* Stops the worker threads (within WORKERS_POLL_INTERVAL milliseconds). */
+void workers_stop(workers_t* workers);
+
+/* Takes a snapshot of the statistics of the forwarder of a worker. */
+void workers_get_stats(const workers_t* workers,
+                       unsigned index,
+                       forwarder_stats_t* stats);
+
+/* Takes a snapshot of the statistics of the DNS caches of a worker. */
+void workers_get_cache_stats(const workers_t* workers,
+                             unsigned index,
+                             cache_stats_t* ipv4,
+                             cache_stats_t* ipv6);
+
+/* Takes a snapshot of the statistics of the packet cache of a worker (all
+ * zeros if there is no packet cache).
+ */
+void workers_get_packetcache_stats(const workers_t* workers,
+                                   unsigned index,
+                                   cache_stats_t* stats);
+
+/* Takes a snapshot of the statistics of the resolver of a worker. */
+void workers_get_resolver_stats(const workers_t* workers,
+                                unsigned index,
+                                resolver_stats_t* stats);
+
+/* Number of upstream servers (the same for all the workers). */
+unsigned workers_upstreams(const workers_t* workers);
+
+/* Address of the upstream server #upstream. */
+const struct sockaddr* workers_upstream_address(const workers_t* workers,
+                                                unsigned upstream);
+
+/* Takes a snapshot of the statistics of the upstream server #upstream of a
+ * worker.
+ */
+int workers_get_upstream_stats(const workers_t* workers,
+                               unsigned index,
+                               unsigned upstream,
+                               upstream_stats_t* stats);
+
+#endif /* WORKERS_H */
@@ -0,0 +1,1456 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "zone.h"
+#include "ctype.h"
+#include "macros.h"
+
+/* No record / name. */
+#define NONE UINT32_MAX
+
+typedef enum {
+  TOKEN_WORD,
+  TOKEN_EOL,  /* End of the record (or of the chunk). */
+  TOKEN_ERROR
+} token_t;
+
+/* Growable buffer. */
+typedef struct {
+  uint8_t* data;
+  size_t len;
+  size_t size;
+} buffer_t;
+
+/* Part of the zone file parsed by a thread. */
+typedef struct {
+  const zone_t* zone;
+
+  const char* p;
+  const char* end;
+
+  /* Depth of parentheses. */
+  unsigned depth;
+
+  /* $ORIGIN and $TTL. */
+  uint8_t origin[HOSTNAME_MAX_LEN];
+  size_t originlen;
+
+  uint32_t ttl;
+  int has_ttl;
+
+  /* Owner of the last record (offset in 'names'). */
+  uint32_t owner;
+  size_t ownerlen;
+
+  buffer_t names;
+  buffer_t rdata;
+  buffer_t records;
+
+  /* Position of the first error (NULL: none). */
+  const char* error;
+
+  pthread_t thread;
+  int started;
+} chunk_t;
+
+static const char* find_boundary(const char* begin,
+                                 const char* p,
+                                 const char* end);
+
+static void* parse_chunk(void* arg);
+static int parse_directive(chunk_t* chunk);
+static int parse_record(chunk_t* chunk, const char* token, size_t len);
+static token_t next_token(chunk_t* chunk, const char** token, size_t* len);
+static int parse_name(const chunk_t* chunk,
+                      const char* token,
+                      size_t len,
+                      uint8_t* name,
+                      size_t* namelen);
+
+static int parse_number(const char* token, size_t len, uint32_t* n);
+static uint16_t parse_type(const char* token, size_t len);
+static int fail(chunk_t* chunk, const char* pos);
+static int append(buffer_t* buffer, const void* data, size_t len);
+static int merge_chunks(zone_t* zone, chunk_t* chunks, unsigned nchunks);
+static int build_index(zone_t* zone, zone_record_t* records);
+static int insert_name(zone_t* zone,
+                       uint32_t name,
+                       uint32_t hash,
+                       uint32_t* slot);
+
+static int resize_index(zone_t* zone);
+static const zone_name_t* find_name(const zone_t* zone, const uint8_t* name);
+static int in_zone(const zone_t* zone, const uint8_t* name, size_t len);
+static size_t name_length(const uint8_t* name);
+static int name_equal(const uint8_t* name1, const uint8_t* name2);
+static int has_type(const zone_t* zone,
+                    const zone_name_t* entry,
+                    uint16_t type);
+
+static int add_records(const zone_t* zone,
+                       dns_response_t* response,
+                       dns_section_t section,
+                       const zone_name_t* entry,
+                       uint16_t type,
+                       const zone_record_t** cname);
+
+static int add_record(const zone_t* zone,
+                      dns_response_t* response,
+                      dns_section_t section,
+                      const uint8_t* owner,
+                      const zone_record_t* record,
+                      uint32_t ttl);
+
+static void add_glue(const zone_t* zone,
+                     dns_response_t* response,
+                     const zone_name_t* cut);
+
+static inline uint16_t get16(const uint8_t* p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t get32(const uint8_t* p)
+{
+  return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline void put16(uint8_t* p, uint16_t n)
+{
+  p[0] = n >> 8;
+  p[1] = n & 0xff;
+}
+
+static inline void put32(uint8_t* p, uint32_t n)
+{
+  p[0] = (n >> 24) & 0xff;
+  p[1] = (n >> 16) & 0xff;
+  p[2] = (n >> 8) & 0xff;
+  p[3] = n & 0xff;
+}
+
+int zone_load(zone_t* zone,
+              const char* filename,
+              const char* origin,
+              unsigned nthreads)
+{
+  chunk_t chunks[ZONE_MAX_THREADS];
+  chunk_t scanner;
+  struct stat st;
+  const char* begin;
+  const char* end;
+  const char* boundary;
+  const char* line;
+  const char* error;
+  unsigned nchunks;
+  unsigned i;
+  long ncpus;
+  int ret;
+  int fd;
+
+  memset(zone, 0, sizeof(zone_t));
+
+  /* Apex (the names of the file are relative to it by default). */
+  memset(&scanner, 0, sizeof(chunk_t));
+  scanner.zone = zone;
+  scanner.originlen = 1;
+
+  if ((parse_name(&scanner,
+                  origin,
+                  strlen(origin),
+                  zone->origin,
+                  &zone->originlen) < 0) ||
+      ((fd = open(filename, O_RDONLY)) == -1)) {
+    return -1;
+  }
+
+  if ((fstat(fd, &st) < 0) ||
+      (st.st_size == 0) ||
+      ((begin = (const char*) mmap(NULL,
+                                   st.st_size,
+                                   PROT_READ,
+                                   MAP_PRIVATE | MAP_POPULATE,
+                                   fd,
+                                   0)) == MAP_FAILED)) {
+    close(fd);
+    return -1;
+  }
+
+  close(fd);
+
+  end = begin + st.st_size;
+
+  if (nthreads == 0) {
+    nthreads = ((ncpus = sysconf(_SC_NPROCESSORS_ONLN)) > 0) ? ncpus : 1;
+  }
+
+  nthreads = MIN(nthreads, ZONE_MAX_THREADS);
+  nthreads = MAX(MIN(nthreads, (unsigned) (st.st_size / ZONE_MIN_CHUNK)), 1);
+
+  /* Split the file and process the directives preceding each chunk, so
+   * that every chunk starts with the $ORIGIN and $TTL in effect.
+   */
+  memcpy(scanner.origin, zone->origin, zone->originlen);
+  scanner.originlen = zone->originlen;
+
+  line = begin;
+  nchunks = 0;
+
+  for (i = 0; i < nthreads; i++) {
+    boundary = (i == 0) ? begin :
+                          find_boundary(chunks[nchunks - 1].p,
+                                        MAX(begin + (st.st_size / nthreads) * i,
+                                            chunks[nchunks - 1].p),
+                                        end);
+
+    if ((boundary == end) ||
+        ((nchunks > 0) && (boundary <= chunks[nchunks - 1].p))) {
+      continue;
+    }
+
+    while (line < boundary) {
+      if (*line == '$') {
+        scanner.p = line;
+        scanner.end = end;
+        scanner.depth = 0;
+
+        parse_directive(&scanner);
+      }
+
+      line = ((line = memchr(line, '\n', end - line)) != NULL) ? line + 1 :
+                                                                 end;
+    }
+
+    memcpy(&chunks[nchunks], &scanner, sizeof(chunk_t));
+
+    chunks[nchunks].p = boundary;
+    chunks[nchunks].depth = 0;
+    chunks[nchunks].owner = NONE;
+    chunks[nchunks].error = NULL;
+    chunks[nchunks].started = 0;
+
+    if (nchunks > 0) {
+      chunks[nchunks - 1].end = boundary;
+    }
+
+    nchunks++;
+  }
+
+  chunks[nchunks - 1].end = end;
+
+  /* The first chunk is parsed by the calling thread. */
+  for (i = 1; i < nchunks; i++) {
+    chunks[i].started = (pthread_create(&chunks[i].thread,
+                                        NULL,
+                                        parse_chunk,
+                                        &chunks[i]) == 0);
+  }
+
+  parse_chunk(&chunks[0]);
+
+  error = NULL;
+
+  for (i = 0; i < nchunks; i++) {
+    if (i > 0) {
+      if (chunks[i].started) {
+        pthread_join(chunks[i].thread, NULL);
+      } else {
+        parse_chunk(&chunks[i]);
+      }
+    }
+
+    if ((chunks[i].error) && (!error)) {
+      error = chunks[i].error;
+    }
+  }
+
+  ret = -1;
+
+  if (!error) {
+    ret = merge_chunks(zone, chunks, nchunks);
+  } else {
+    /* Line of the error. */
+    zone->line = 1;
+
+    for (line = begin;
+         (line = memchr(line, '\n', error - line)) != NULL;
+         line++) {
+      zone->line++;
+    }
+  }
+
+  for (i = 0; i < nchunks; i++) {
+    free(chunks[i].names.data);
+    free(chunks[i].rdata.data);
+    free(chunks[i].records.data);
+  }
+
+  munmap((void*) begin, st.st_size);
+
+  if (ret < 0) {
+    zone_destroy(zone);
+  }
+
+  return ret;
+}
+
+void zone_destroy(zone_t* zone)
+{
+  if (zone->names) {
+    free(zone->names);
+    zone->names = NULL;
+  }
+
+  if (zone->rdata) {
+    free(zone->rdata);
+    zone->rdata = NULL;
+  }
+
+  if (zone->records) {
+    free(zone->records);
+    zone->records = NULL;
+  }
+
+  if (zone->index) {
+    free(zone->index);
+    zone->index = NULL;
+  }
+}
+
+int zone_answer(const zone_t* zone,
+                const dns_query_t* parsed,
+                const void* query,
+                void* buf,
+                size_t size,
+                size_t* len)
+{
+  dns_response_t response;
+  dns_question_t question;
+  const zone_name_t* exact;
+  const zone_name_t* entry;
+  const zone_name_t* cut;
+  const zone_record_t* cname;
+  const zone_record_t* record;
+  const uint8_t* name;
+  const uint8_t* p;
+  size_t namelen;
+  uint32_t minimum;
+  unsigned ncnames;
+  int negative;
+  int rcode;
+
+  name = parsed->key;
+  namelen = parsed->keylen - 4;
+
+  if ((parsed->qclass != DNS_QCLASS_IN) || (!in_zone(zone, name, namelen))) {
+    return -1;
+  }
+
+  exact = find_name(zone, name);
+
+  /* Highest delegation at or above the name (below the apex). */
+  cut = ((exact) && (namelen != zone->originlen) &&
+         (has_type(zone, exact, DNS_QTYPE_NS))) ? exact : NULL;
+
+  if (zone->ncuts > 0) {
+    for (p = name + *name + 1;
+         (size_t) (name + namelen - p) > zone->originlen;
+         p += *p + 1) {
+      if (((entry = find_name(zone, p)) != NULL) &&
+          (has_type(zone, entry, DNS_QTYPE_NS))) {
+        cut = entry;
+      }
+    }
+  }
+
+  /* The question keeps the case of the query. */
+  question.namelen = dns_name_to_text((const uint8_t*) query + 12,
+                                      question.name);
+
+  question.qtype = parsed->qtype;
+  question.qclass = parsed->qclass;
+
+  if (dns_response_init(&response,
+                        buf,
+                        size,
+                        parsed->id,
+                        DNS_FLAG_QR |
+                        (cut ? 0 : DNS_FLAG_AA) |
+                        (parsed->flags & DNS_FLAG_RD),
+                        &question) < 0) {
+    return -1;
+  }
+
+  rcode = DNS_RCODE_NOERROR;
+
+  if (cut) {
+    /* Referral: NS records of the delegation and glue. */
+    add_records(zone,
+                &response,
+                DNS_SECTION_AUTHORITY,
+                cut,
+                DNS_QTYPE_NS,
+                NULL);
+
+    add_glue(zone, &response, cut);
+  } else {
+    negative = 0;
+    ncnames = 0;
+
+    if ((entry = exact) != NULL) {
+      do {
+        if (add_records(zone,
+                        &response,
+                        DNS_SECTION_ANSWER,
+                        entry,
+                        parsed->qtype,
+                        &cname) > 0) {
+          break;
+        }
+
+        /* No data. */
+        if ((!cname) || (parsed->qtype == DNS_QTYPE_CNAME)) {
+          negative = 1;
+          break;
+        }
+
+        add_record(zone,
+                   &response,
+                   DNS_SECTION_ANSWER,
+                   zone->names + entry->name,
+                   cname,
+                   cname->ttl);
+
+        /* Follow the CNAME record (if the target is in the zone). */
+        p = zone->rdata + cname->rdata;
+
+        if ((++ncnames == ZONE_MAX_CNAMES) ||
+            (!in_zone(zone, p, name_length(p)))) {
+          break;
+        }
+
+        if ((entry = find_name(zone, p)) == NULL) {
+          rcode = DNS_RCODE_NXDOMAIN;
+          negative = 1;
+        }
+      } while (entry);
+    } else {
+      rcode = DNS_RCODE_NXDOMAIN;
+      negative = 1;
+    }
+
+    /* SOA record of the zone, with the negative time to live (RFC 2308). */
+    if (negative) {
+      record = zone->soa;
+
+      /* The minimum is the last field of the SOA record. */
+      minimum = get32(zone->rdata + record->rdata + record->rdlength - 4);
+
+      add_record(zone,
+                 &response,
+                 DNS_SECTION_AUTHORITY,
+                 zone->origin,
+                 record,
+                 MIN(record->ttl, minimum));
+    }
+
+    ((uint8_t*) buf)[3] |= rcode;
+  }
+
+  *len = dns_response_length(&response);
+
+  return 0;
+}
+
+const char* find_boundary(const char* begin, const char* p, const char* end)
+{
+  const char* open;
+
+  while ((p = memchr(p, '\n', end - p)) != NULL) {
+    p++;
+
+    /* A line starting with an owner name... */
+    if ((p == end) ||
+        ((!IS_WHITE_SPACE(*p)) &&
+         (*p != '\r') &&
+         (*p != '\n') &&
+         (*p != ';') &&
+         (*p != '(') &&
+         (*p != ')'))) {
+      /* ... out of parentheses (the previous boundary is). */
+      if ((p == end) ||
+          ((open = memrchr(begin, '(', p - begin)) == NULL) ||
+          (memchr(open, ')', p - open) != NULL)) {
+        return p;
+      }
+    }
+  }
+
+  return end;
+}
+
+void* parse_chunk(void* arg)
+{
+  chunk_t* chunk;
+  const char* token;
+  size_t len;
+  uint8_t name[HOSTNAME_MAX_LEN];
+  size_t namelen;
+  token_t type;
+
+  chunk = (chunk_t*) arg;
+
+  while (chunk->p < chunk->end) {
+    if (*chunk->p == '$') {
+      if (parse_directive(chunk) < 0) {
+        return NULL;
+      }
+
+      continue;
+    }
+
+    /* Owner name (if the line doesn't start with a blank). */
+    if ((IS_WHITE_SPACE(*chunk->p)) ||
+        (*chunk->p == '\r') ||
+        (*chunk->p == '\n') ||
+        (*chunk->p == ';') ||
+        (*chunk->p == '(')) {
+      if ((type = next_token(chunk, &token, &len)) == TOKEN_EOL) {
+        /* Empty line. */
+        continue;
+      }
+
+      if ((type == TOKEN_ERROR) || (chunk->owner == NONE)) {
+        fail(chunk, token);
+        return NULL;
+      }
+    } else {
+      if ((next_token(chunk, &token, &len) != TOKEN_WORD) ||
+          (parse_name(chunk, token, len, name, &namelen) < 0) ||
+          (!in_zone(chunk->zone, name, namelen))) {
+        fail(chunk, token);
+        return NULL;
+      }
+
+      /* Consecutive records of the same name share it. */
+      if ((chunk->owner == NONE) ||
+          (chunk->ownerlen != namelen) ||
+          (memcmp(chunk->names.data + chunk->owner, name, namelen) != 0)) {
+        chunk->owner = chunk->names.len;
+        chunk->ownerlen = namelen;
+
+        if (append(&chunk->names, name, namelen) < 0) {
+          fail(chunk, token);
+          return NULL;
+        }
+      }
+
+      if (next_token(chunk, &token, &len) != TOKEN_WORD) {
+        fail(chunk, token);
+        return NULL;
+      }
+    }
+
+    if (parse_record(chunk, token, len) < 0) {
+      return NULL;
+    }
+  }
+
+  return NULL;
+}
+
+int parse_directive(chunk_t* chunk)
+{
+  const char* token;
+  const char* value;
+  size_t len;
+  size_t valuelen;
+  uint8_t origin[HOSTNAME_MAX_LEN];
+  size_t originlen;
+  uint32_t ttl;
+
+  if ((next_token(chunk, &token, &len) != TOKEN_WORD) ||
+      (next_token(chunk, &value, &valuelen) != TOKEN_WORD)) {
+    return fail(chunk, token);
+  }
+
+  if ((len == 7) && (strncasecmp(token, "$ORIGIN", 7) == 0)) {
+    if (parse_name(chunk, value, valuelen, origin, &originlen) < 0) {
+      return fail(chunk, value);
+    }
+
+    memcpy(chunk->origin, origin, originlen);
+    chunk->originlen = originlen;
+  } else if ((len == 4) && (strncasecmp(token, "$TTL", 4) == 0)) {
+    if (parse_number(value, valuelen, &ttl) < 0) {
+      return fail(chunk, value);
+    }
+
+    chunk->ttl = ttl;
+    chunk->has_ttl = 1;
+  } else {
+    /* $INCLUDE... */
+    return fail(chunk, token);
+  }
+
+  if (next_token(chunk, &token, &len) != TOKEN_EOL) {
+    return fail(chunk, token);
+  }
+
+  return 0;
+}
+
+int parse_record(chunk_t* chunk, const char* token, size_t len)
+{
+  zone_record_t record;
+  char addr[INET6_ADDRSTRLEN];
+  uint8_t rdata[2 * HOSTNAME_MAX_LEN + 20];
+  uint8_t* p;
+  size_t namelen;
+  uint32_t n;
+  unsigned i;
+  int has_ttl;
+  int has_class;
+
+  record.ttl = chunk->ttl;
+  has_ttl = 0;
+  has_class = 0;
+
+  /* TTL and class (in any order), type. */
+  for (;;) {
+    if ((!has_ttl) && (IS_DIGIT(*token))) {
+      if (parse_number(token, len, &record.ttl) < 0) {
+        return fail(chunk, token);
+      }
+
+      has_ttl = 1;
+    } else if ((!has_class) &&
+               (len == 2) &&
+               (strncasecmp(token, "IN", 2) == 0)) {
+      has_class = 1;
+    } else {
+      break;
+    }
+
+    if (next_token(chunk, &token, &len) != TOKEN_WORD) {
+      return fail(chunk, token);
+    }
+  }
+
+  if (((record.type = parse_type(token, len)) == 0) ||
+      ((!has_ttl) && (!chunk->has_ttl))) {
+    return fail(chunk, token);
+  }
+
+  p = rdata;
+
+  if (next_token(chunk, &token, &len) != TOKEN_WORD) {
+    return fail(chunk, token);
+  }
+
+  switch (record.type) {
+    case DNS_QTYPE_A:
+    case DNS_QTYPE_AAAA:
+      if (len >= sizeof(addr)) {
+        return fail(chunk, token);
+      }
+
+      memcpy(addr, token, len);
+      addr[len] = 0;
+
+      if (inet_pton((record.type == DNS_QTYPE_A) ? AF_INET : AF_INET6,
+                    addr,
+                    p) != 1) {
+        return fail(chunk, token);
+      }
+
+      p += (record.type == DNS_QTYPE_A) ? 4 : 16;
+      break;
+    case DNS_QTYPE_CNAME:
+    case DNS_QTYPE_NS:
+    case DNS_QTYPE_PTR:
+      if (parse_name(chunk, token, len, p, &namelen) < 0) {
+        return fail(chunk, token);
+      }
+
+      p += namelen;
+      break;
+    case DNS_QTYPE_MX:
+      if ((parse_number(token, len, &n) < 0) ||
+          (n > 0xffff) ||
+          (next_token(chunk, &token, &len) != TOKEN_WORD) ||
+          (parse_name(chunk, token, len, p + 2, &namelen) < 0)) {
+        return fail(chunk, token);
+      }
+
+      put16(p, n);
+      p += 2 + namelen;
+
+      break;
+    case DNS_QTYPE_SOA:
+      /* MNAME, RNAME, SERIAL, REFRESH, RETRY, EXPIRE and MINIMUM. */
+      for (i = 0; i < 7; i++) {
+        if ((i > 0) && (next_token(chunk, &token, &len) != TOKEN_WORD)) {
+          return fail(chunk, token);
+        }
+
+        if (i < 2) {
+          if (parse_name(chunk, token, len, p, &namelen) < 0) {
+            return fail(chunk, token);
+          }
+
+          p += namelen;
+        } else {
+          if (parse_number(token, len, &n) < 0) {
+            return fail(chunk, token);
+          }
+
+          put32(p, n);
+          p += 4;
+        }
+      }
+
+      break;
+  }
+
+  if (next_token(chunk, &token, &len) != TOKEN_EOL) {
+    return fail(chunk, token);
+  }
+
+  record.owner = chunk->owner;
+  record.rdata = chunk->rdata.len;
+  record.rdlength = p - rdata;
+
+  if ((append(&chunk->rdata, rdata, record.rdlength) < 0) ||
+      (append(&chunk->records, &record, sizeof(zone_record_t)) < 0)) {
+    return fail(chunk, token);
+  }
+
+  return 0;
+}
+
+token_t next_token(chunk_t* chunk, const char** token, size_t* len)
+{
+  const char* p;
+
+  p = chunk->p;
+
+  for (;;) {
+    /* Blanks. */
+    while ((p < chunk->end) && ((IS_WHITE_SPACE(*p)) || (*p == '\r'))) {
+      p++;
+    }
+
+    *token = p;
+
+    if (p == chunk->end) {
+      chunk->p = p;
+      return (chunk->depth == 0) ? TOKEN_EOL : TOKEN_ERROR;
+    }
+
+    switch (*p) {
+      case ';':
+        /* Comment. */
+        if ((p = memchr(p, '\n', chunk->end - p)) == NULL) {
+          p = chunk->end;
+        }
+
+        break;
+      case '\n':
+        p++;
+
+        if (chunk->depth == 0) {
+          chunk->p = p;
+          return TOKEN_EOL;
+        }
+
+        break;
+      case '(':
+        chunk->depth++;
+        p++;
+
+        break;
+      case ')':
+        if (chunk->depth == 0) {
+          return TOKEN_ERROR;
+        }
+
+        chunk->depth--;
+        p++;
+
+        break;
+      case '"':
+      case '\\':
+        /* Not supported. */
+        return TOKEN_ERROR;
+      default:
+        while ((p < chunk->end) &&
+               (!IS_WHITE_SPACE(*p)) &&
+               (*p != '\r') &&
+               (*p != '\n') &&
+               (*p != ';') &&
+               (*p != '(') &&
+               (*p != ')')) {
+          if ((*p == '"') || (*p == '\\')) {
+            return TOKEN_ERROR;
+          }
+
+          p++;
+        }
+
+        *len = p - *token;
+        chunk->p = p;
+
+        return TOKEN_WORD;
+    }
+  }
+}
+
+int parse_name(const chunk_t* chunk,
+               const char* token,
+               size_t len,
+               uint8_t* name,
+               size_t* namelen)
+{
+  const char* end;
+  const char* dot;
+  size_t pos;
+  size_t l;
+  size_t i;
+  int absolute;
+
+  /* Origin. */
+  if ((len == 1) && (*token == '@')) {
+    memcpy(name, chunk->origin, chunk->originlen);
+    *namelen = chunk->originlen;
+
+    return 0;
+  }
+
+  /* Root. */
+  if ((len == 1) && (*token == '.')) {
+    *name = 0;
+    *namelen = 1;
+
+    return 0;
+  }
+
+  end = token + len;
+
+  if ((absolute = ((len > 0) && (end[-1] == '.')))) {
+    end--;
+  }
+
+  pos = 0;
+
+  do {
+    if ((dot = memchr(token, '.', end - token)) == NULL) {
+      dot = end;
+    }
+
+    if (((l = dot - token) == 0) ||
+        (l > DNS_LABEL_MAX_LEN) ||
+        (pos + 1 + l + 1 > HOSTNAME_MAX_LEN)) {
+      return -1;
+    }
+
+    name[pos++] = l;
+
+    for (i = 0; i < l; i++) {
+      name[pos++] = to_lower(token[i]);
+    }
+
+    token = dot + 1;
+  } while (dot < end);
+
+  if (absolute) {
+    name[pos++] = 0;
+  } else {
+    /* Relative to the origin. */
+    if (pos + chunk->originlen > HOSTNAME_MAX_LEN) {
+      return -1;
+    }
+
+    memcpy(name + pos, chunk->origin, chunk->originlen);
+    pos += chunk->originlen;
+  }
+
+  *namelen = pos;
+
+  return 0;
+}
+
+int parse_number(const char* token, size_t len, uint32_t* n)
+{
+  uint64_t value;
+  size_t i;
+
+  if ((len == 0) || (len > 10)) {
+    return -1;
+  }
+
+  value = 0;
+
+  for (i = 0; i < len; i++) {
+    if (!IS_DIGIT(token[i])) {
+      return -1;
+    }
+
+    value = (value * 10) + (token[i] - '0');
+  }
+
+  if (value > UINT32_MAX) {
+    return -1;
+  }
+
+  *n = value;
+
+  return 0;
+}
+
+uint16_t parse_type(const char* token, size_t len)
+{
+  static const struct {
+    const char* name;
+    uint16_t type;
+  } types[] = {
+    {"A",     DNS_QTYPE_A},
+    {"AAAA",  DNS_QTYPE_AAAA},
+    {"CNAME", DNS_QTYPE_CNAME},
+    {"NS",    DNS_QTYPE_NS},
+    {"PTR",   DNS_QTYPE_PTR},
+    {"MX",    DNS_QTYPE_MX},
+    {"SOA",   DNS_QTYPE_SOA}
+  };
+
+  size_t i;
+
+  for (i = 0; i < ARRAY_SIZE(types); i++) {
+    if ((strlen(types[i].name) == len) &&
+        (strncasecmp(types[i].name, token, len) == 0)) {
+      return types[i].type;
+    }
+  }
+
+  return 0;
+}
+
+int fail(chunk_t* chunk, const char* pos)
+{
+  if (!chunk->error) {
+    chunk->error = pos;
+  }
+
+  /* Stop parsing. */
+  chunk->p = chunk->end;
+
+  return -1;
+}
+
+int append(buffer_t* buffer, const void* data, size_t len)
+{
+  uint8_t* d;
+  size_t size;
+
+  if (buffer->len + len > buffer->size) {
+    size = MAX(buffer->size * 2, 4096);
+
+    while (buffer->len + len > size) {
+      size *= 2;
+    }
+
+    if ((d = (uint8_t*) realloc(buffer->data, size)) == NULL) {
+      return -1;
+    }
+
+    buffer->data = d;
+    buffer->size = size;
+  }
+
+  memcpy(buffer->data + buffer->len, data, len);
+  buffer->len += len;
+
+  return 0;
+}
+
+int merge_chunks(zone_t* zone, chunk_t* chunks, unsigned nchunks)
+{
+  zone_record_t* records;
+  const zone_record_t* r;
+  size_t nrecords;
+  size_t n;
+  unsigned i;
+  int ret;
+
+  nrecords = 0;
+
+  for (i = 0; i < nchunks; i++) {
+    zone->nameslen += chunks[i].names.len;
+    zone->rdatalen += chunks[i].rdata.len;
+    nrecords += chunks[i].records.len / sizeof(zone_record_t);
+  }
+
+  /* 32-bit offsets. */
+  if ((nrecords == 0) ||
+      (nrecords >= NONE) ||
+      (zone->nameslen >= NONE) ||
+      (zone->rdatalen >= NONE)) {
+    return -1;
+  }
+
+  if (((zone->names = (uint8_t*) malloc(zone->nameslen)) == NULL) ||
+      ((zone->rdata = (uint8_t*) malloc(MAX(zone->rdatalen, 1))) == NULL) ||
+      ((records = (zone_record_t*) malloc(nrecords *
+                                          sizeof(zone_record_t))) == NULL)) {
+    return -1;
+  }
+
+  zone->nameslen = 0;
+  zone->rdatalen = 0;
+  zone->nrecords = 0;
+
+  for (i = 0; i < nchunks; i++) {
+    memcpy(zone->names + zone->nameslen,
+           chunks[i].names.data,
+           chunks[i].names.len);
+
+    memcpy(zone->rdata + zone->rdatalen,
+           chunks[i].rdata.data,
+           chunks[i].rdata.len);
+
+    r = (const zone_record_t*) chunks[i].records.data;
+
+    for (n = chunks[i].records.len / sizeof(zone_record_t); n > 0; n--, r++) {
+      records[zone->nrecords].owner = zone->nameslen + r->owner;
+      records[zone->nrecords].rdata = zone->rdatalen + r->rdata;
+      records[zone->nrecords].ttl = r->ttl;
+      records[zone->nrecords].type = r->type;
+      records[zone->nrecords].rdlength = r->rdlength;
+
+      zone->nrecords++;
+    }
+
+    zone->nameslen += chunks[i].names.len;
+    zone->rdatalen += chunks[i].rdata.len;
+  }
+
+  ret = build_index(zone, records);
+
+  free(records);
+
+  return ret;
+}
+
+int build_index(zone_t* zone, zone_record_t* records)
+{
+  const zone_name_t* apex;
+  zone_name_t* entry;
+  uint32_t* runs;
+  uint32_t nruns;
+  uint32_t first;
+  uint32_t i;
+  uint32_t j;
+  uint32_t size;
+  const uint8_t* name;
+  uint32_t slot;
+
+  /* Runs of records of the same owner. */
+  nruns = 0;
+
+  for (i = 0; i < zone->nrecords; i++) {
+    if ((i == 0) || (records[i].owner != records[i - 1].owner)) {
+      nruns++;
+    }
+  }
+
+  /* Load factor: at most 3/4. */
+  for (size = 16; size - (size / 4) < nruns + 1; size *= 2);
+
+  if (((zone->index = (zone_name_t*) malloc(size *
+                                            sizeof(zone_name_t))) == NULL) ||
+      ((runs = (uint32_t*) malloc(nruns * sizeof(uint32_t))) == NULL)) {
+    return -1;
+  }
+
+  for (i = 0; i < size; i++) {
+    zone->index[i].name = NONE;
+  }
+
+  zone->mask = size - 1;
+  zone->nnames = 0;
+
+  /* Count the records of each name. */
+  for (i = 0, j = 0; i < zone->nrecords; i++) {
+    if ((i == 0) || (records[i].owner != records[i - 1].owner)) {
+      name = zone->names + records[i].owner;
+
+      insert_name(zone,
+                  records[i].owner,
+                  dns_key_hash(name, name_length(name)),
+                  &runs[j++]);
+    }
+
+    zone->index[runs[j - 1]].count++;
+  }
+
+  /* Group the records by name (same order as in the file). */
+  if ((zone->records = (zone_record_t*) malloc(zone->nrecords *
+                                               sizeof(zone_record_t))) ==
+      NULL) {
+    free(runs);
+    return -1;
+  }
+
+  for (i = 0, first = 0; i <= zone->mask; i++) {
+    if (zone->index[i].name != NONE) {
+      zone->index[i].first = first;
+      first += zone->index[i].count;
+    }
+  }
+
+  for (i = 0, j = 0; i < zone->nrecords; i++) {
+    if ((i > 0) && (records[i].owner != records[i - 1].owner)) {
+      j++;
+    }
+
+    entry = &zone->index[runs[j]];
+
+    /* All the records of a name point to the same copy of it. */
+    records[i].owner = entry->name;
+
+    zone->records[entry->first++] = records[i];
+  }
+
+  for (i = 0; i <= zone->mask; i++) {
+    if (zone->index[i].name != NONE) {
+      zone->index[i].first -= zone->index[i].count;
+    }
+  }
+
+  free(runs);
+
+  for (i = 0; i < zone->nrecords; i++) {
+    name = zone->names + zone->records[i].owner;
+
+    /* Delegations. */
+    if ((zone->records[i].type == DNS_QTYPE_NS) &&
+        (name_length(name) != zone->originlen)) {
+      zone->ncuts++;
+    }
+
+    if ((i > 0) && (zone->records[i].owner == zone->records[i - 1].owner)) {
+      continue;
+    }
+
+    /* Empty non-terminals (suffixes of the name, up to the apex). */
+    while (name_length(name) > zone->originlen) {
+      name += *name + 1;
+
+      if (find_name(zone, name)) {
+        break;
+      }
+
+      if (((zone->nnames + 1) * 4 > (zone->mask + 1) * 3) &&
+          (resize_index(zone) < 0)) {
+        return -1;
+      }
+
+      insert_name(zone,
+                  name - zone->names,
+                  dns_key_hash(name, name_length(name)),
+                  &slot);
+
+      zone->index[slot].first = 0;
+      zone->index[slot].count = 0;
+    }
+  }
+
+  /* SOA record of the apex. */
+  if ((apex = find_name(zone, zone->origin)) != NULL) {
+    for (i = 0; i < apex->count; i++) {
+      if (zone->records[apex->first + i].type == DNS_QTYPE_SOA) {
+        zone->soa = &zone->records[apex->first + i];
+        return 0;
+      }
+    }
+  }
+
+  return -1;
+}
+
+int insert_name(zone_t* zone, uint32_t name, uint32_t hash, uint32_t* slot)
+{
+  zone_name_t* entry;
+  uint32_t i;
+
+  for (i = hash & zone->mask; ; i = (i + 1) & zone->mask) {
+    entry = &zone->index[i];
+
+    if (entry->name == NONE) {
+      entry->hash = hash;
+      entry->name = name;
+      entry->first = 0;
+      entry->count = 0;
+
+      zone->nnames++;
+
+      *slot = i;
+      return 1;
+    }
+
+    if ((entry->hash == hash) &&
+        (name_equal(zone->names + entry->name, zone->names + name))) {
+      *slot = i;
+      return 0;
+    }
+  }
+}
+
+int resize_index(zone_t* zone)
+{
+  zone_name_t* index;
+  zone_name_t* old;
+  uint32_t mask;
+  uint32_t i;
+  uint32_t j;
+
+  mask = (zone->mask * 2) + 1;
+
+  if ((index = (zone_name_t*) malloc((mask + 1) * sizeof(zone_name_t))) ==
+      NULL) {
+    return -1;
+  }
+
+  for (i = 0; i <= mask; i++) {
+    index[i].name = NONE;
+  }
+
+  old = zone->index;
+
+  for (i = 0; i <= zone->mask; i++) {
+    if (old[i].name != NONE) {
+      for (j = old[i].hash & mask; index[j].name != NONE; j = (j + 1) & mask);
+      index[j] = old[i];
+    }
+  }
+
+  free(old);
+
+  zone->index = index;
+  zone->mask = mask;
+
+  return 0;
+}
+
+const zone_name_t* find_name(const zone_t* zone, const uint8_t* name)
+{
+  const zone_name_t* entry;
+  uint32_t hash;
+  uint32_t i;
+
+  hash = dns_key_hash(name, name_length(name));
+
+  for (i = hash & zone->mask; ; i = (i + 1) & zone->mask) {
+    entry = &zone->index[i];
+
+    if (entry->name == NONE) {
+      return NULL;
+    }
+
+    if ((entry->hash == hash) &&
+        (name_equal(zone->names + entry->name, name))) {
+      return entry;
+    }
+  }
+}
+
+int in_zone(const zone_t* zone, const uint8_t* name, size_t len)
+{
+  size_t pos;
+
+  if (len < zone->originlen) {
+    return 0;
+  }
+
+  /* The apex must start at a label. */
+  for (pos = 0; len - pos > zone->originlen; pos += name[pos] + 1);
+
+  return ((len - pos == zone->originlen) &&
+          (memcmp(name + pos, zone->origin, zone->originlen) == 0));
+}
+
+size_t name_length(const uint8_t* name)
+{
+  const uint8_t* p;
+
+  for (p = name; *p != 0; p += *p + 1);
+
+  return p - name + 1;
+}
+
+int name_equal(const uint8_t* name1, const uint8_t* name2)
+{
+  uint8_t l;
+
+  for (;;) {
+    if ((l = *name1) != *name2) {
+      return 0;
+    }
+
+    if (l == 0) {
+      return 1;
+    }
+
+    if (memcmp(name1 + 1, name2 + 1, l) != 0) {
+      return 0;
+    }
+
+    name1 += l + 1;
+    name2 += l + 1;
+  }
+}
+
+int has_type(const zone_t* zone, const zone_name_t* entry, uint16_t type)
+{
+  uint32_t i;
+
+  for (i = 0; i < entry->count; i++) {
+    if (zone->records[entry->first + i].type == type) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int add_records(const zone_t* zone,
+                dns_response_t* response,
+                dns_section_t section,
+                const zone_name_t* entry,
+                uint16_t type,
+                const zone_record_t** cname)
+{
+  const zone_record_t* record;
+  uint32_t i;
+  int n;
+
+  if (cname) {
+    *cname = NULL;
+  }
+
+  n = 0;
+
+  for (i = 0; i < entry->count; i++) {
+    record = &zone->records[entry->first + i];
+
+    if ((record->type == type) || (type == DNS_QTYPE_ALL)) {
+      add_record(zone,
+                 response,
+                 section,
+                 zone->names + entry->name,
+                 record,
+                 record->ttl);
+      n++;
+    } else if ((record->type == DNS_QTYPE_CNAME) && (cname)) {
+      *cname = record;
+    }
+  }
+
+  return n;
+}
+
+int add_record(const zone_t* zone,
+               dns_response_t* response,
+               dns_section_t section,
+               const uint8_t* owner,
+               const zone_record_t* record,
+               uint32_t ttl)
+{
+  const uint8_t* rdata;
+  rr_t rr;
+
+  rr.namelen = dns_name_to_text(owner, rr.name);
+  rr.type = record->type;
+  rr.class = DNS_QCLASS_IN;
+  rr.ttl = ttl;
+  rr.rdlength = record->rdlength;
+
+  rdata = zone->rdata + record->rdata;
+
+  switch (record->type) {
+    case DNS_QTYPE_A:
+      memcpy(&rr.addr4, rdata, 4);
+      break;
+    case DNS_QTYPE_AAAA:
+      memcpy(&rr.addr6, rdata, 16);
+      break;
+    case DNS_QTYPE_CNAME:
+    case DNS_QTYPE_NS:
+    case DNS_QTYPE_PTR:
+      rr.cname.namelen = dns_name_to_text(rdata, rr.cname.name);
+      break;
+    case DNS_QTYPE_MX:
+      rr.mx.preference = get16(rdata);
+      rr.mx.exchangelen = dns_name_to_text(rdata + 2, rr.mx.exchange);
+
+      break;
+    case DNS_QTYPE_SOA:
+      rr.soa.nameserverlen = dns_name_to_text(rdata, rr.soa.nameserver);
+      rdata += name_length(rdata);
+
+      rr.soa.mailboxlen = dns_name_to_text(rdata, rr.soa.mailbox);
+      rdata += name_length(rdata);
+
+      rr.soa.serial = get32(rdata);
+      rr.soa.refresh = get32(rdata + 4);
+      rr.soa.retry = get32(rdata + 8);
+      rr.soa.expire = get32(rdata + 12);
+      rr.soa.minimum_ttl = get32(rdata + 16);
+
+      break;
+  }
+
+  return dns_response_add(response, section, &rr);
+}
+
+void add_glue(const zone_t* zone,
+              dns_response_t* response,
+              const zone_name_t* cut)
+{
+  const zone_record_t* record;
+  const zone_record_t* glue;
+  const zone_name_t* entry;
+  const uint8_t* target;
+  uint32_t i;
+  uint32_t j;
+
+  for (i = 0; i < cut->count; i++) {
+    record = &zone->records[cut->first + i];
+
+    if (record->type == DNS_QTYPE_NS) {
+      target = zone->rdata + record->rdata;
+
+      if ((in_zone(zone, target, name_length(target))) &&
+          ((entry = find_name(zone, target)) != NULL)) {
+        for (j = 0; j < entry->count; j++) {
+          glue = &zone->records[entry->first + j];
+
+          if ((glue->type == DNS_QTYPE_A) || (glue->type == DNS_QTYPE_AAAA)) {
+            add_record(zone,
+                       response,
+                       DNS_SECTION_ADDITIONAL,
+                       target,
+                       glue,
+                       glue->ttl);
+          }
+        }
+      }
+    }
+  }
+}
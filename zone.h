@@ -0,0 +1,103 @@
+#ifndef ZONE_H
+#define ZONE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "dns.h"
+
+/* Read-only in-memory zone loaded from a master file (RFC 1035).
+ * The file is mapped in memory and split in chunks (at lines starting with
+ * an owner name) which are parsed in parallel; then the records are grouped
+ * by owner name and indexed by a hash table of the names (open addressing),
+ * including the empty non-terminals.
+ * Supported: $ORIGIN, $TTL, '@', relative names, parentheses and comments;
+ * class IN; types A, AAAA, CNAME, NS, PTR, MX and SOA. Not supported:
+ * $INCLUDE, escapes, TTL units (1h, 1d...) and wildcards.
+ */
+
+/* Maximum number of threads parsing a zone file. */
+#define ZONE_MAX_THREADS 64
+
+/* Minimum size of the chunks parsed in parallel. */
+#define ZONE_MIN_CHUNK   (64 * 1024)
+
+/* Maximum number of CNAME records followed by an answer. */
+#define ZONE_MAX_CNAMES  8
+
+typedef struct {
+  /* Offset of the owner name in 'names'. */
+  uint32_t owner;
+
+  /* Offset of the RDATA (wire format, uncompressed) in 'rdata'. */
+  uint32_t rdata;
+
+  uint32_t ttl;
+
+  uint16_t type;
+  uint16_t rdlength;
+} zone_record_t;
+
+typedef struct {
+  uint32_t hash;
+
+  /* Offset of the name in 'names' (UINT32_MAX: free slot). */
+  uint32_t name;
+
+  /* Records of the name (none for an empty non-terminal). */
+  uint32_t first;
+  uint32_t count;
+} zone_name_t;
+
+typedef struct {
+  /* Apex of the zone (wire format, lowercase). */
+  uint8_t origin[HOSTNAME_MAX_LEN];
+  size_t originlen;
+
+  /* Owner names (wire format, lowercase). */
+  uint8_t* names;
+  size_t nameslen;
+
+  uint8_t* rdata;
+  size_t rdatalen;
+
+  /* Records grouped by owner name. */
+  zone_record_t* records;
+  uint32_t nrecords;
+
+  /* Hash table of the names (size: mask + 1). */
+  zone_name_t* index;
+  uint32_t mask;
+  uint32_t nnames;
+
+  /* Number of NS records below the apex (delegations). */
+  uint32_t ncuts;
+
+  /* SOA record of the apex. */
+  const zone_record_t* soa;
+
+  /* Line of the first error (0: not a syntax error). */
+  unsigned line;
+} zone_t;
+
+/* Loads the zone 'origin' from 'filename' with up to 'nthreads' threads
+ * (0: one per CPU).
+ */
+int zone_load(zone_t* zone,
+              const char* filename,
+              const char* origin,
+              unsigned nthreads);
+
+void zone_destroy(zone_t* zone);
+
+/* Builds the authoritative response to a query parsed with
+ * dns_parse_query() in 'buf' ('size' bytes). Returns -1 if the name of
+ * the question doesn't belong to the zone.
+ */
+int zone_answer(const zone_t* zone,
+                const dns_query_t* parsed,
+                const void* query,
+                void* buf,
+                size_t size,
+                size_t* len);
+
+#endif /* ZONE_H */